@@ -0,0 +1,97 @@
+//
+// Anti-aliasing that can change while running: MSAA at several levels, or
+// an FXAA post pass
+// Anton Gerdelan
+// antongerdelan.net
+//
+// The window has no samples of its own. Frames are drawn into an offscreen
+// framebuffer instead: multisampled renderbuffers resolved into the window
+// with glBlitFramebuffer, or a plain colour texture that the FXAA shader
+// reads while drawing one triangle over the window. Switching mode frees the
+// old targets and makes new ones. Needs GL 3.0 or ARB_framebuffer_object;
+// without them only AA_OFF is available.
+//
+#ifndef _ANTIALIAS_H_
+#define _ANTIALIAS_H_
+
+#include <GL/glew.h>
+#include <stdbool.h>
+
+enum {
+	AA_OFF = 0,
+	AA_MSAA_2,
+	AA_MSAA_4,
+	AA_MSAA_8,
+	AA_MSAA_16,
+	AA_FXAA,
+	AA_MODES
+};
+
+typedef struct antialias_t {
+	int mode;
+	int width;
+	int height;
+	bool supported;
+	// GL_MAX_SAMPLES. MSAA modes above it are skipped
+	int max_samples;
+	GLuint fbo;
+	// where finished frames go. 0, the window, unless set
+	GLuint target_fbo;
+	// MSAA targets
+	GLuint colour_rb;
+	GLuint depth_rb;
+	// FXAA target and pass. the frame is read from texture unit 1
+	GLuint colour_tex;
+	GLuint fxaa_programme;
+	GLint texel_loc;
+	GLuint triangle_vbo;
+	GLuint triangle_vao;
+} antialias_t;
+
+//
+// "off", "2", "4", "8", "16" or "fxaa", as given to -aa
+const char* antialias_mode_name (int mode);
+
+//
+// mode for a name from antialias_mode_name (), or -1
+int parse_antialias_mode (const char* name);
+
+//
+// set up for a window of width x height. fxaa_programme is the linked FXAA
+// shader, with attribute 0 bound to vp, or 0 to leave FXAA out. falls back to
+// AA_OFF if mode can't be used
+void create_antialias (
+	antialias_t* aa,
+	GLuint fxaa_programme,
+	int mode,
+	int width,
+	int height
+);
+
+void free_antialias (antialias_t* aa);
+
+//
+// switch to mode, remaking the targets. false, and no change, if the mode is
+// not available
+bool set_antialias_mode (antialias_t* aa, int mode);
+
+//
+// the next mode that can be used after the current one, wrapping around
+int next_antialias_mode (const antialias_t* aa);
+
+//
+// put finished frames in framebuffer fbo instead of the window, e.g. when
+// there is no window
+void set_antialias_target (antialias_t* aa, GLuint fbo);
+
+//
+// bind the framebuffer the frame is drawn into, before clearing
+void begin_antialiased_frame (const antialias_t* aa);
+
+//
+// put the frame in the window, or the target: resolve the samples, or run FXAA. the FXAA
+// pass turns off depth testing and blending and sets GL_FILL through the
+// state cache, so set them again before drawing the next frame
+void end_antialiased_frame (const antialias_t* aa);
+
+#endif
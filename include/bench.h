@@ -0,0 +1,90 @@
+//
+// Scripted camera paths and frame time reports for --bench
+// Anton Gerdelan
+// antongerdelan.net
+//
+// A path file has one segment per line, each starting from where the last
+// one left the camera. # starts a comment.
+//   start EX EY EZ TX TY TZ    eye and target before the first segment
+//   orbit SECONDS TURNS        circle the target about the y axis
+//   zoom SECONDS DISTANCE      move the eye along its view line until it is
+//                              DISTANCE from the target
+//   fly SECONDS EX EY EZ TX TY TZ
+//                              move eye and target in straight lines
+//   hold SECONDS               stay still
+//
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+enum {
+	CAMERA_ORBIT = 0,
+	CAMERA_ZOOM,
+	CAMERA_FLY,
+	CAMERA_HOLD
+};
+
+typedef struct camera_segment_t {
+	int type;
+	float seconds;
+	// turns, distance, or eye and target to fly to
+	float args[6];
+	// camera when the segment starts
+	float eye[3];
+	float target[3];
+} camera_segment_t;
+
+typedef struct camera_path_t {
+	camera_segment_t* segments;
+	int segment_count;
+	// camera after the last segment
+	float end_eye[3];
+	float end_target[3];
+	float duration;
+} camera_path_t;
+
+//
+// read a path file. prints the line number of any line it can't parse
+bool load_camera_path (const char* file_name, camera_path_t* path);
+
+//
+// orbit once, zoom in to half the distance and back out, starting at eye
+// looking at target
+void default_camera_path (
+	const float* eye,
+	const float* target,
+	camera_path_t* path
+);
+
+void free_camera_path (camera_path_t* path);
+
+//
+// camera at t seconds. past the end the path starts over
+void sample_camera_path (
+	const camera_path_t* path,
+	float t,
+	float* eye,
+	float* target
+);
+
+//
+// what a benchmark run measured. frame_seconds has frame_count entries
+typedef struct bench_result_t {
+	const char* mesh_name;
+	const char* renderer;
+	const double* frame_seconds;
+	int frame_count;
+	// simulated time per frame
+	double timestep;
+	long long triangles;
+	double total_seconds;
+} bench_result_t;
+
+//
+// min, mean, max and percentile frame times and triangle throughput as a
+// JSON object
+void write_bench_json (FILE* fp, const bench_result_t* result);
+
+#endif
@@ -0,0 +1,80 @@
+//
+// Screenshots read back through pixel buffer objects and written on worker
+// threads, so taking one doesn't stall the frame
+// Anton Gerdelan
+// antongerdelan.net
+//
+// glReadPixels into a GL_PIXEL_PACK_BUFFER returns straight away; the copy
+// happens on the GPU's time. Once a fence after it has signalled (GL 3.2 or
+// ARB_sync), or without fences a frame later, the buffer is mapped and a
+// worker flips the rows into its own memory, hands the buffer back to be
+// unmapped, and encodes the PNG. The render thread only starts reads, maps
+// and unmaps. The buffers form a ring so several captures can be in flight.
+// When all are busy a screenshot is dropped, but a recorded frame waits for
+// a worker to hand one back, so recording slows the frame rate to what the
+// workers can write rather than using more memory: at most one frame per
+// buffer and one per worker.
+//
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include "png_writer.h"
+#include <GL/glew.h>
+#include <stdbool.h>
+
+typedef struct capture_t capture_t;
+
+typedef struct capture_stats_t {
+	int requested;
+	int written;
+	// no free buffer, or the PNG could not be written
+	int dropped;
+	// times record_capture () waited for a buffer, and how long in all
+	int waits;
+	double wait_ms_total;
+	// render thread time spent in request_capture () and update_capture ()
+	// on frames with a capture in flight
+	int busy_frames;
+	double busy_ms_total;
+	double busy_ms_max;
+	// worker time per capture
+	double encode_ms_total;
+} capture_stats_t;
+
+//
+// capture width x height frames through slot_count buffers and
+// worker_count encoder threads, each writing PNGs with png
+capture_t* create_capture (
+	int width,
+	int height,
+	int slot_count,
+	int worker_count,
+	const png_settings_t* png
+);
+
+//
+// write the captures still in flight, then free everything. the final stats
+// go to stats if not NULL. NULL cap is ignored
+void destroy_capture (capture_t* cap, capture_stats_t* stats);
+
+//
+// start reading the current read framebuffer, e.g. at the end of a frame
+// before the buffer swap. file_name NULL picks a name from the time. false
+// if every buffer is busy
+bool request_capture (capture_t* cap, const char* file_name);
+
+//
+// as request_capture (), but waits for a buffer if all are busy, so no frame
+// is lost. file names ending .raw are written as bare RGB rows, top first
+bool record_capture (capture_t* cap, const char* file_name);
+
+//
+// don't print each file name as it is written
+void set_capture_quiet (capture_t* cap, bool quiet);
+
+//
+// call once a frame: hands reads from earlier frames to the workers and
+// frees buffers the workers are done with
+void update_capture (capture_t* cap);
+
+#endif
@@ -0,0 +1,133 @@
+//
+// Spatial chunks of a triangle soup with a BVH over them for frustum culling
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _CHUNK_BVH_H_
+#define _CHUNK_BVH_H_
+
+#include "mesh_utils.h"
+#include "occlusion.h"
+#include <stdbool.h>
+
+// triangles per chunk. small enough to cull well, big enough that a draw per
+// visible range stays cheap
+#define CHUNK_BVH_TRIANGLES 2048
+
+//
+// a contiguous range of vertices in the reordered vertex arrays
+typedef struct mesh_chunk_t {
+	float bb_min[3];
+	float bb_max[3];
+	int first;
+	int count;
+} mesh_chunk_t;
+
+//
+// inner nodes have two children. leaves have chunk_count 1 and left = -1
+typedef struct bvh_node_t {
+	float bb_min[3];
+	float bb_max[3];
+	int left;
+	int right;
+	int first_chunk;
+	int chunk_count;
+} bvh_node_t;
+
+typedef struct chunk_bvh_t {
+	mesh_chunk_t* chunks;
+	int chunk_count;
+	// depth-first, root at 0, left child straight after its parent
+	bvh_node_t* nodes;
+	int node_count;
+} chunk_bvh_t;
+
+//
+// 6 planes in structure-of-arrays form, padded to 8 with planes that never
+// reject, so a box can be tested 4 planes at a time
+typedef struct frustum_t {
+	float nx[8];
+	float ny[8];
+	float nz[8];
+	float d[8];
+} frustum_t;
+
+typedef struct cull_stats_t {
+	int nodes_tested;
+	// leaves tested on their own. chunks under a node that was fully inside
+	// are accepted without a test
+	int chunks_tested;
+	int chunks_visible;
+	// in view, but behind the occluders
+	int chunks_occluded;
+	long long triangles_submitted;
+	// draw ranges after merging neighbouring visible chunks
+	int ranges;
+	double seconds;
+} cull_stats_t;
+
+//
+// sort the triangles along a Morton curve through their centroids and cut
+// them into chunks of CHUNK_BVH_TRIANGLES, then build a BVH over the chunks.
+// the vertex arrays are reordered in place so each chunk is one contiguous
+// range for glDrawArrays. the streams' tex_coords and normals may be NULL.
+// if tri_keys is not NULL, triangle t's key tri_keys[t] (>= 0) is sorted on
+// before the Morton code, so each key's triangles end up contiguous in
+// ascending key order
+bool build_chunk_bvh (
+	const vertex_streams_t* streams,
+	int point_count,
+	const int* tri_keys,
+	int thread_count,
+	chunk_bvh_t* bvh
+);
+
+//
+// the same chunks build_chunk_bvh () makes, worked out from an indexed mesh
+// before it is expanded, so the vertices can be written once in their final
+// order. corner c of triangle t is at positions[indices[t * 3 + c] * stride].
+// order receives tri_count original triangle numbers in draw order.
+// tri_keys as for build_chunk_bvh (), and may be NULL
+bool build_chunk_bvh_indexed (
+	const float* positions,
+	int stride,
+	const unsigned int* indices,
+	int tri_count,
+	const int* tri_keys,
+	int thread_count,
+	int* order,
+	chunk_bvh_t* bvh
+);
+
+void free_chunk_bvh (chunk_bvh_t* bvh);
+
+//
+// planes of the clip-space frustum of a column-major matrix. pass P * V * M
+// to get the frustum in model space
+void extract_frustum (const float* clip_matrix, frustum_t* frustum);
+
+//
+// 0 if the box is outside the frustum, 2 if it is completely inside, and 1
+// if it straddles a plane
+int test_frustum_box (
+	const frustum_t* frustum,
+	const float* bb_min,
+	const float* bb_max
+);
+
+//
+// walk the BVH and write the vertex ranges to draw, merging neighbours.
+// nodes in view are also tested against occlusion if it is not NULL; it
+// must have been rendered with the same matrix as the frustum. firsts and
+// counts need room for chunk_count entries. returns the number of ranges.
+// stats may be NULL
+int cull_chunk_bvh (
+	const chunk_bvh_t* bvh,
+	const frustum_t* frustum,
+	const occlusion_t* occlusion,
+	int* firsts,
+	int* counts,
+	cull_stats_t* stats
+);
+
+#endif
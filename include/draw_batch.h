@@ -0,0 +1,80 @@
+//
+// Vertex ranges grouped into one multi-draw per state key
+// Anton Gerdelan
+// antongerdelan.net
+//
+// Each key stands for one set of draw state (programme, texture, material
+// colour), numbered in the order the states should be drawn. The mesh's
+// triangles are sorted by key when it is chunked, so every key owns one
+// contiguous range of the vertex buffer. Each frame the visible ranges, in
+// buffer order, are cut where one key's range ends and the next begins, and
+// the pieces of a key become one glMultiDrawArrays. No sorting happens per
+// frame, so the cost is linear in ranges plus keys however many usemtl groups
+// the file had.
+//
+#ifndef _DRAW_BATCH_H_
+#define _DRAW_BATCH_H_
+
+//
+// one glMultiDrawArrays: count ranges of firsts/counts from first
+typedef struct draw_batch_t {
+	int key;
+	int first;
+	int count;
+} draw_batch_t;
+
+typedef struct draw_batch_stats_t {
+	// ranges given, and ranges drawn after cutting at key boundaries
+	long long ranges_in;
+	long long ranges;
+	// glMultiDrawArrays calls
+	long long draw_calls;
+	// texture binds and uniform changes between batches, added by the drawer
+	long long state_changes;
+} draw_batch_stats_t;
+
+typedef struct draw_batches_t {
+	// vertex range of each key in the sorted buffer. empty keys have count 0
+	int* key_firsts;
+	int* key_counts;
+	int key_count;
+	// this frame's pieces and the batches over them
+	int* firsts;
+	int* counts;
+	int range_capacity;
+	draw_batch_t* batches;
+	int batch_count;
+	// the last frame, and the sum of all frames so far
+	draw_batch_stats_t frame;
+	draw_batch_stats_t total;
+	long long frames;
+} draw_batches_t;
+
+//
+// work out each key's vertex range from the per-triangle keys, in [0,
+// key_count), that the buffer was sorted by
+void init_draw_batches (
+	draw_batches_t* db,
+	const int* tri_keys,
+	int tri_count,
+	int key_count
+);
+
+void free_draw_batches (draw_batches_t* db);
+
+//
+// cut range_count vertex ranges, ascending and not overlapping, at key
+// boundaries and group the pieces into db->batches in key order. starts a
+// new frame of stats. returns the number of batches
+int batch_draw_ranges (
+	draw_batches_t* db,
+	const int* firsts,
+	const int* counts,
+	int range_count
+);
+
+//
+// count state changes made between this frame's batches
+void add_batch_state_changes (draw_batches_t* db, int changes);
+
+#endif
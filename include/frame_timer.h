@@ -0,0 +1,82 @@
+//
+// CPU and GPU time per frame, with rolling percentiles
+// Anton Gerdelan
+// antongerdelan.net
+//
+// GPU time comes from GL_TIME_ELAPSED queries kept in a small ring. Results
+// are collected a few frames later, once the GPU has them, so the CPU never
+// waits on a query; if every query in the ring is still in flight the frame
+// goes without a GPU time. The last window_frames samples of each are kept
+// in a histogram of FRAME_TIMER_BUCKET_MS wide buckets for the percentiles.
+//
+#ifndef _FRAME_TIMER_H_
+#define _FRAME_TIMER_H_
+
+#include <stdbool.h>
+
+// queries in flight. results usually arrive 1-3 frames late
+#define FRAME_TIMER_QUERIES 8
+// histogram resolution and range. longer frames go in the last bucket
+#define FRAME_TIMER_BUCKET_MS 0.01
+#define FRAME_TIMER_BUCKETS 10000
+
+typedef struct frame_time_stats_t {
+	// over the rolling window, in milliseconds
+	double cpu_p50;
+	double cpu_p95;
+	double cpu_p99;
+	double gpu_p50;
+	double gpu_p95;
+	double gpu_p99;
+	// samples in the window. gpu is 0 without timer queries
+	int cpu_samples;
+	int gpu_samples;
+	// frames timed so far
+	int frame_count;
+} frame_time_stats_t;
+
+//
+// mean times of the frames with one tag
+typedef struct tagged_frame_times_t {
+	int frames;
+	double cpu_mean;
+	// frames whose GPU time has arrived
+	int gpu_frames;
+	double gpu_mean;
+} tagged_frame_times_t;
+
+typedef struct frame_timer_t frame_timer_t;
+
+//
+// needs a current GL context. GPU times are left out if the context has no
+// timer queries
+frame_timer_t* create_frame_timer (int window_frames);
+
+void destroy_frame_timer (frame_timer_t* ft);
+
+//
+// bracket the CPU work and GL commands of a frame, not including the buffer
+// swap, which can wait on vsync
+void begin_frame_timing (frame_timer_t* ft);
+void end_frame_timing (frame_timer_t* ft);
+
+void get_frame_time_stats (const frame_timer_t* ft, frame_time_stats_t* stats);
+
+//
+// label the frames begun from now on, e.g. with a render mode, to compare
+// modes afterwards. frames are tagged 0 until this is called
+void set_frame_timing_tag (frame_timer_t* ft, int tag);
+
+void get_tagged_frame_times (
+	const frame_timer_t* ft,
+	int tag,
+	tagged_frame_times_t* times
+);
+
+//
+// write every frame timed as frame,cpu_ms,gpu_ms,tag. gpu_ms is empty for
+// frames without a GPU time. waits for the queries still in flight, so call it once
+// rendering is done
+bool write_frame_times_csv (frame_timer_t* ft, const char* file_name);
+
+#endif
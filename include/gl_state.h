@@ -0,0 +1,63 @@
+//
+// Shadow copy of the GL state the viewer changes, skipping redundant calls
+// Anton Gerdelan
+// antongerdelan.net
+//
+// Every bind and toggle in the viewer goes through these functions, which
+// only call GL when the value differs from the last one set. That only
+// holds if nothing calls the GL functions directly, so objects must be
+// deleted with the wrappers here too: GL unbinds a deleted name, and a new
+// object may reuse it. Call reset_gl_state_cache () after any code that
+// changes state behind the cache's back. GL thread only.
+//
+#ifndef _GL_STATE_H_
+#define _GL_STATE_H_
+
+#include <GL/glew.h>
+#include <stdbool.h>
+
+enum {
+	GL_STATE_PROGRAM = 0,
+	GL_STATE_VERTEX_ARRAY,
+	GL_STATE_ARRAY_BUFFER,
+	GL_STATE_TEXTURE,
+	GL_STATE_CAPABILITY,
+	GL_STATE_VIEWPORT,
+	GL_STATE_POLYGON_MODE,
+	GL_STATE_KINDS
+};
+
+typedef struct gl_state_stats_t {
+	// calls asked for, and calls that reached GL, per kind
+	long long requested[GL_STATE_KINDS];
+	long long issued[GL_STATE_KINDS];
+} gl_state_stats_t;
+
+//
+// forget everything, so the next call of each kind goes through
+void reset_gl_state_cache ();
+
+void use_program (GLuint program);
+void bind_vertex_array (GLuint vao);
+void bind_array_buffer (GLuint vbo);
+//
+// GL_TEXTURE_2D on the given unit, 0 for GL_TEXTURE0
+void bind_texture_2d (int unit, GLuint texture);
+//
+// glEnable or glDisable. GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND and
+// GL_MULTISAMPLE are cached; anything else goes straight through
+void set_capability (GLenum cap, bool enabled);
+void set_viewport (int x, int y, int width, int height);
+void set_polygon_mode (GLenum mode);
+
+void delete_vertex_arrays (int count, const GLuint* vaos);
+void delete_buffers (int count, const GLuint* vbos);
+void delete_textures (int count, const GLuint* textures);
+
+void get_gl_state_stats (gl_state_stats_t* stats);
+//
+// the calls avoided since a get_gl_state_stats () snapshot, e.g. taken when
+// the render loop starts, in total and per frame over frames
+void print_gl_state_stats (const gl_state_stats_t* since, int frames);
+
+#endif
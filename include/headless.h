@@ -0,0 +1,41 @@
+//
+// An OpenGL context with no window, drawing into a framebuffer object
+// Anton Gerdelan
+// antongerdelan.net
+//
+// For machines with no display, and often no GPU. The context comes from
+// EGL's surfaceless platform (EGL_MESA_platform_surfaceless), which Mesa
+// provides even without a GPU through its llvmpipe software renderer; set
+// LIBGL_ALWAYS_SOFTWARE=1 to make sure of that. There is no default
+// framebuffer, so frames are drawn into a colour and depth renderbuffer of
+// the requested size and read back from there. Linux only; elsewhere
+// create_headless () fails.
+//
+#ifndef _HEADLESS_H_
+#define _HEADLESS_H_
+
+#include <GL/glew.h>
+#include <stdbool.h>
+
+typedef struct headless_t {
+	// EGLDisplay and EGLContext
+	void* display;
+	void* context;
+	int width;
+	int height;
+	// the framebuffer that stands in for the window
+	GLuint fbo;
+	GLuint colour_rb;
+	GLuint depth_rb;
+	// time taken to make the context, including glewInit ()
+	double context_seconds;
+} headless_t;
+
+//
+// make the context current on this thread, start GLEW and make a width x
+// height framebuffer, left bound. false, with an error printed, on failure
+bool create_headless (headless_t* hl, int width, int height);
+
+void free_headless (headless_t* hl);
+
+#endif
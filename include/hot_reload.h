@@ -0,0 +1,71 @@
+//
+// Re-load the viewed mesh when its file changes and re-upload what changed
+// Anton Gerdelan
+// antongerdelan.net
+//
+// A watcher thread waits on inotify for the file to be written or replaced,
+// then re-parses it, chunks it exactly like the first load, and hashes the
+// new vertex arrays in 64kB blocks. The render thread compares those hashes
+// with the ones for what is on the GPU and sends only differing blocks with
+// glBufferSubData, a few per frame under a time budget, so big edits spread
+// over several frames instead of stalling one. Blocks go into a second set of
+// buffers, which holds the mesh from before the previous reload, and the two
+// sets are swapped together with the point count and BVH when the upload is
+// complete, so a frame never shows a mix of old and new blocks. That costs
+// twice the vertex memory once the first reload has happened. Linux only;
+// elsewhere start_hot_reload () fails.
+//
+#ifndef _HOT_RELOAD_H_
+#define _HOT_RELOAD_H_
+
+#include "chunk_bvh.h"
+#include "mesh_batch.h"
+#include <GL/glew.h>
+
+#define HOT_RELOAD_BLOCK_BYTES (64 * 1024)
+// wait for writes to settle before re-parsing, in seconds
+#define HOT_RELOAD_SETTLE_SECONDS 0.1
+
+//
+// a finished reload, handed back once its upload is complete. the caller
+// owns the arrays, the bvh and the occluders, which were picked on the
+// watcher thread for set_occluders ()
+typedef struct reloaded_mesh_t {
+	float* points;
+	float* tex_coords;
+	float* normals;
+	int point_count;
+	chunk_bvh_t bvh;
+	float* occluders;
+	int occluder_count;
+} reloaded_mesh_t;
+
+typedef struct hot_reload_t hot_reload_t;
+
+//
+// watch file_name. vbos are the points, tex coords and normals buffers that
+// vao draws from, currently holding the given arrays
+hot_reload_t* start_hot_reload (
+	const char* file_name,
+	GLuint vao,
+	const GLuint* vbos,
+	const float* points,
+	const float* tex_coords,
+	const float* normals,
+	int point_count,
+	int thread_count,
+	mesh_process_fn process
+);
+
+//
+// call once a frame on the GL thread. uploads changed blocks until budget_ms
+// is spent. returns true on the frame an update finishes, filling finished
+bool update_hot_reload (
+	hot_reload_t* hr,
+	double budget_ms,
+	reloaded_mesh_t* finished
+);
+
+void stop_hot_reload (hot_reload_t* hr);
+
+#endif
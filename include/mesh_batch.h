@@ -0,0 +1,98 @@
+//
+// Loading several mesh files at once on a pool of threads
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _MESH_BATCH_H_
+#define _MESH_BATCH_H_
+
+#include "obj_parser.h"
+
+typedef struct loaded_mesh_t {
+	char file_name[256];
+	// position in the list given to start_mesh_batch
+	int index;
+	bool ok;
+	float* points;
+	float* tex_coords;
+	float* normals;
+	int point_count;
+	double parse_seconds;
+} loaded_mesh_t;
+
+typedef struct mesh_batch_t mesh_batch_t;
+
+//
+// optional step run on each indexed .obj mesh before it is expanded, e.g.
+// welding. runs on a loader thread
+typedef void (*mesh_process_fn) (obj_mesh_t* mesh);
+
+//
+// parse one .obj or .cmsh file into non-indexed arrays, as the viewer draws
+// them. process may be NULL
+bool load_mesh_file (
+	const char* file_name,
+	int thread_count,
+	mesh_process_fn process,
+	float** points,
+	float** tex_coords,
+	float** normals,
+	int* point_count
+);
+
+//
+// as load_mesh_file (), but expanding straight into one array of
+// INTERLEAVED_VERTEX_FLOATS floats per vertex, with no separate arrays made
+// on the way
+bool load_mesh_file_interleaved (
+	const char* file_name,
+	int thread_count,
+	mesh_process_fn process,
+	float** vertices,
+	int* point_count
+);
+
+//
+// start parsing .obj or .cmsh files on up to thread_count threads (<= 0 is
+// all cores), one file per thread at a time
+mesh_batch_t* start_mesh_batch (
+	const char** file_names,
+	int file_count,
+	int thread_count,
+	mesh_process_fn process
+);
+
+//
+// wait for the next file to finish, in completion order. the caller owns the
+// result and frees it with free_loaded_mesh (). NULL once every file has been
+// handed out
+loaded_mesh_t* next_loaded_mesh (mesh_batch_t* batch);
+
+void free_loaded_mesh (loaded_mesh_t* mesh);
+
+//
+// join the loader threads. call after next_loaded_mesh () returns NULL
+void finish_mesh_batch (mesh_batch_t* batch);
+
+//
+// read a list of mesh files, one per line. blank lines and lines starting
+// with # are skipped. returns the number of names, or -1 if the file can't be
+// opened. free the names and the array with free_file_list ()
+int read_file_list (const char* list_file_name, char*** file_names);
+
+void free_file_list (char** file_names, int count);
+
+//
+// as read_file_list (), but for the .obj and .cmsh files in a
+// directory, sorted by name. returns -1 if it can't be opened
+int read_mesh_directory (const char* dir_name, char*** file_names);
+
+//
+// true if path names a directory
+bool is_directory (const char* path);
+
+//
+// make directory path unless it exists. false, with an error, if it can't
+bool make_directory (const char* path);
+
+#endif
@@ -0,0 +1,37 @@
+//
+// Degenerate and duplicate triangle removal
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _MESH_CLEAN_H_
+#define _MESH_CLEAN_H_
+
+#include "mesh_utils.h"
+
+typedef struct mesh_clean_report_t {
+	int tris_before;
+	int tris_after;
+	// two or more corners share a position index
+	int removed_index_collapse;
+	// distinct indices but area below the epsilon
+	int removed_zero_area;
+	// same three positions as an earlier, kept triangle
+	int removed_duplicate;
+	double seconds;
+} mesh_clean_report_t;
+
+//
+// remove degenerate and duplicate triangles from mesh in place. the first of
+// each set of duplicates is kept so draw order is otherwise unchanged.
+// area_epsilon is relative to the squared bounding box diagonal; pass
+// MESH_AREA_EPSILON for the default. report may be NULL
+void clean_obj_mesh (
+	obj_mesh_t* mesh,
+	float area_epsilon,
+	int thread_count,
+	mesh_clean_report_t* report
+);
+
+void print_mesh_clean_report (const mesh_clean_report_t* report);
+
+#endif
@@ -0,0 +1,95 @@
+//
+// Compressed binary mesh format (.cmsh)
+// Anton Gerdelan
+// antongerdelan.net
+//
+// File layout, all integers little-endian:
+//   header    "CMSH" u32 version, u32 vertex_count, u32 index_count,
+//             u32 block_count, u32 flags
+//   directory block_count x { u32 vertex_count, u32 index_count,
+//             u64 byte offset from start of file, u32 byte size }
+//   blocks    independent of each other, so they decode in parallel
+//
+// Each block holds up to CMSH_BLOCK_TRIANGLES triangles with its own vertex
+// list in first-use order. Indices are coded as the distance back from the
+// next new vertex (0 = new vertex) in LEB128 varints. Vertices are 8 floats
+// (pos, uv, normal); each float component is XOR-delta'd against the previous
+// vertex and split into 4 byte planes. Each plane is coded in groups of 16
+// bytes as a 16-bit mask of non-zero bytes followed by those bytes.
+//
+#ifndef _MESH_CODEC_H_
+#define _MESH_CODEC_H_
+
+#include "mesh_utils.h"
+#include "obj_parser.h"
+
+#define CMSH_VERSION 1
+#define CMSH_BLOCK_TRIANGLES 16384
+// floats per vertex: position, texture coordinate, normal
+#define CMSH_VERTEX_FLOATS 8
+
+// flags
+#define CMSH_HAS_TEX_COORDS 1
+#define CMSH_HAS_NORMALS 2
+
+//
+// decoded indexed mesh. vertices are CMSH_VERTEX_FLOATS floats each
+typedef struct cmsh_mesh_t {
+	float* vertices;
+	unsigned int* indices;
+	int vertex_count;
+	int index_count;
+	unsigned int flags;
+} cmsh_mesh_t;
+
+//
+// encode an indexed mesh to a .cmsh file, compressing blocks in parallel
+bool write_cmsh_file (
+	const char* file_name,
+	const obj_mesh_t* mesh,
+	int thread_count
+);
+
+//
+// decode a .cmsh file, one block per task. decode_seconds (optional) receives
+// the time spent decoding, excluding file reading
+bool load_cmsh_mesh (
+	const char* file_name,
+	cmsh_mesh_t* mesh,
+	int thread_count,
+	double* decode_seconds
+);
+
+void free_cmsh_mesh (cmsh_mesh_t* mesh);
+
+//
+// put the triangles in a new order. order[t] is the original number of the
+// triangle that goes t-th
+void reorder_cmsh_triangles (cmsh_mesh_t* mesh, const int* order);
+
+//
+// write index_count non-indexed vertices into streams. missing normals become
+// the face normal
+void expand_cmsh_mesh_into (
+	const cmsh_mesh_t* mesh,
+	const vertex_streams_t* streams,
+	int thread_count
+);
+
+//
+// same output as load_obj_file () so the viewer can use either. missing
+// normals become the face normal
+bool load_cmsh_file (
+	const char* file_name,
+	float** points,
+	float** tex_coords,
+	float** normals,
+	int* point_count,
+	int thread_count
+);
+
+//
+// true if the file name ends in .cmsh
+bool is_cmsh_file_name (const char* file_name);
+
+#endif
@@ -0,0 +1,49 @@
+//
+// Headless mesh analysis for --stats
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _MESH_STATS_H_
+#define _MESH_STATS_H_
+
+#include "obj_parser.h"
+
+// post-transform vertex caches simulated for ACMR/ATVR
+#define MESH_STATS_CACHE_CONFIGS 3
+
+typedef struct mesh_stats_t {
+	int vp_count;
+	int vt_count;
+	int vn_count;
+	int tri_count;
+	// unique vp/vt/vn combinations, i.e. vertices after index dedup
+	int unique_vertex_count;
+	// two or more corners share a position index
+	int degenerate_index_count;
+	// distinct position indices but area below MESH_AREA_EPSILON
+	// * (bounding box diagonal)^2
+	int degenerate_area_count;
+	// same set of position indices as an earlier triangle, in any order
+	int duplicate_count;
+	float bb_min[3];
+	float bb_max[3];
+	// average cache miss ratio (misses per triangle) and average transform to
+	// vertex ratio (misses per unique vertex), one per simulated cache
+	const char* cache_names[MESH_STATS_CACHE_CONFIGS];
+	float acmr[MESH_STATS_CACHE_CONFIGS];
+	float atvr[MESH_STATS_CACHE_CONFIGS];
+} mesh_stats_t;
+
+//
+// analyse a loaded mesh using thread_count threads (<= 0 for all cores)
+void compute_mesh_stats (
+	const obj_mesh_t* mesh,
+	mesh_stats_t* stats,
+	int thread_count
+);
+
+//
+// print stats and the memory cost of the mesh in several vertex formats
+void print_mesh_stats (const mesh_stats_t* stats);
+
+#endif
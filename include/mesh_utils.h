@@ -0,0 +1,149 @@
+//
+// Operations on indexed obj_mesh_t meshes
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _MESH_UTILS_H_
+#define _MESH_UTILS_H_
+
+#include "obj_parser.h"
+
+//
+// callbacks for dedup_items. items are identified by their index
+typedef unsigned int (*item_hash_fn) (int item, const void* user);
+typedef bool (*item_equal_fn) (int a, int b, const void* user);
+
+//
+// give every item an id so that equal items share the same id. ids are dense
+// in [0, returned count). each thread owns a slice of the hash space so no
+// locking is needed. first_item (optional, sized count) receives the first
+// item seen for each id
+int dedup_items (
+	int count,
+	item_hash_fn hash,
+	item_equal_fn equal,
+	const void* user,
+	int* ids,
+	int* first_item,
+	int thread_count
+);
+
+//
+// build an index buffer of unique vp/vt/vn corner combinations.
+// indices must hold 3 * tri_count entries. first_corner (optional, sized
+// 3 * tri_count) receives the corner that each unique vertex came from.
+// returns the number of unique vertices
+int index_obj_mesh (
+	const obj_mesh_t* mesh,
+	unsigned int* indices,
+	int* first_corner,
+	int thread_count
+);
+
+//
+// group triangles that use the same three positions in any order, so
+// opposite windings and differing vt/vn still match. ids as dedup_items
+int dedup_triangles (
+	const obj_mesh_t* mesh,
+	int* ids,
+	int* first_tri,
+	int thread_count
+);
+
+//
+// default area below which a triangle is degenerate, relative to
+// (bounding box diagonal)^2
+#define MESH_AREA_EPSILON 1e-12f
+
+// what classify_triangle () finds
+enum {
+	TRI_OK = 0,
+	// two or more corners share a position index
+	TRI_INDEX_COLLAPSE,
+	// distinct indices but area below the threshold
+	TRI_ZERO_AREA
+};
+
+//
+// bounding box of the positions. all 0 if there are none
+void obj_mesh_bounds (
+	const obj_mesh_t* mesh,
+	float* bb_min,
+	float* bb_max,
+	int thread_count
+);
+
+//
+// turn an area epsilon relative to the squared bounding box diagonal into
+// the threshold classify_triangle () compares against
+float zero_area_threshold (
+	const float* bb_min,
+	const float* bb_max,
+	float area_epsilon
+);
+
+//
+// TRI_OK, or why triangle tri is degenerate
+int classify_triangle (const obj_mesh_t* mesh, int tri, float threshold);
+
+// floats per vertex in the interleaved layout: position, tex coord, normal
+#define INTERLEAVED_VERTEX_FLOATS 8
+
+//
+// where expanded vertices are written. each attribute has its own pointer and
+// a stride in floats, so the same code fills separate arrays or one
+// interleaved array. tex_coords and normals may be NULL
+typedef struct vertex_streams_t {
+	float* points;
+	float* tex_coords;
+	float* normals;
+	int points_stride;
+	int tex_coords_stride;
+	int normals_stride;
+} vertex_streams_t;
+
+void separate_vertex_streams (
+	float* points,
+	float* tex_coords,
+	float* normals,
+	vertex_streams_t* streams
+);
+
+void interleaved_vertex_streams (float* vertices, vertex_streams_t* streams);
+
+//
+// put the triangles of a mesh in a new order. order[t] is the original
+// number of the triangle that goes t-th, e.g. from build_chunk_bvh_indexed ()
+void reorder_obj_mesh_triangles (obj_mesh_t* mesh, const int* order);
+
+//
+// copy point_count vertices from one layout to another. attributes that
+// either side lacks are skipped
+void copy_vertex_streams (
+	const vertex_streams_t* from,
+	const vertex_streams_t* to,
+	int point_count
+);
+
+//
+// write 3 * tri_count non-indexed vertices into streams. missing texture
+// coordinates become 0 and missing normals are replaced by the face normal
+void expand_obj_mesh_into (
+	const obj_mesh_t* mesh,
+	const vertex_streams_t* streams,
+	int thread_count
+);
+
+//
+// expand an indexed mesh into the separate non-indexed float arrays that
+// load_obj_file () produces. free the arrays with free ()
+bool expand_obj_mesh (
+	const obj_mesh_t* mesh,
+	float** points,
+	float** tex_coords,
+	float** normals,
+	int* point_count,
+	int thread_count
+);
+
+#endif
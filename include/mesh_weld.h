@@ -0,0 +1,37 @@
+//
+// Epsilon welding of near-duplicate vertex positions
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _MESH_WELD_H_
+#define _MESH_WELD_H_
+
+#include "obj_parser.h"
+
+typedef struct mesh_weld_report_t {
+	int positions_before;
+	int positions_after;
+	// unique vp/vt/vn combinations, i.e. what an index buffer would hold
+	int vertices_before;
+	int vertices_after;
+	int grid_cells;
+	double seconds;
+} mesh_weld_report_t;
+
+//
+// merge positions closer than tolerance (in mesh units) and renumber the
+// position indices. positions are bucketed into a uniform grid with cell size
+// tolerance, so only the 27 surrounding cells are searched. each position is
+// redirected to the lowest-numbered position in reach, then chains are
+// collapsed, so the result does not depend on thread count. report may be
+// NULL
+void weld_obj_mesh (
+	obj_mesh_t* mesh,
+	float tolerance,
+	int thread_count,
+	mesh_weld_report_t* report
+);
+
+void print_mesh_weld_report (const mesh_weld_report_t* report);
+
+#endif
@@ -8,6 +8,10 @@
 
 #include <stdbool.h>
 
+//
+// the original one-line-at-a-time parser. takes only triangles with v/vt/vn
+// on every corner. the viewer loads with load_obj_mesh (); this is kept as
+// the reference tests/test_obj_parser.c checks that against
 bool load_obj_file (
 	const char* file_name,
 	float** points,
@@ -16,4 +20,56 @@ bool load_obj_file (
 	int* point_count
 );
 
+//
+// indexed mesh as it appears in the .obj - unique attribute arrays plus one
+// set of indices per triangle corner. polygons are fan-triangulated
+typedef struct obj_mesh_t {
+	float* vp; // 3 floats per position
+	float* vt; // 2 floats per texture coordinate
+	float* vn; // 3 floats per normal
+	int vp_count;
+	int vt_count;
+	int vn_count;
+	// 3 entries per triangle, 0-based. -1 where the face omits the attribute
+	int* ivp;
+	int* ivt;
+	int* ivn;
+	int tri_count;
+	// usemtl names in order of first use, and the number of the material of
+	// each triangle. tri_material is NULL if the file has no usemtl, and -1
+	// for triangles before the first one
+	char** material_names;
+	int material_count;
+	int* tri_material;
+	// the first mtllib named, or empty
+	char mtllib[256];
+} obj_mesh_t;
+
+//
+// parse an .obj into an indexed mesh, splitting the file into line-aligned
+// chunks parsed on thread_count threads (<= 0 for all cores). does not need a
+// GL context. free with free_obj_mesh ()
+bool load_obj_mesh (const char* file_name, obj_mesh_t* mesh, int thread_count);
+
+void free_obj_mesh (obj_mesh_t* mesh);
+
+//
+// the parts of a .mtl material the viewer draws with
+typedef struct obj_material_t {
+	char name[128];
+	// diffuse colour, white if not given
+	float kd[3];
+	// diffuse texture as written in the file, or empty
+	char map_kd[256];
+} obj_material_t;
+
+//
+// read the newmtl, Kd and map_Kd lines of a .mtl file. anything else is
+// ignored. free materials with free ()
+bool load_mtl_file (
+	const char* file_name,
+	obj_material_t** materials,
+	int* material_count
+);
+
 #endif
@@ -0,0 +1,113 @@
+//
+// Software hierarchical-Z occlusion culling against a few large occluders
+// Anton Gerdelan
+// antongerdelan.net
+//
+// Each frame the occluder triangles are rasterised on the CPU into a small
+// depth buffer, and a max-depth mip pyramid is built over it. A box is hidden
+// if its nearest point is further away than the farthest depth in every
+// pyramid texel its screen rectangle touches. Rows of the depth buffer are
+// split between threads and no pixel is written by two threads, so the
+// result does not depend on thread count. Nothing here touches GL.
+//
+#ifndef _OCCLUSION_H_
+#define _OCCLUSION_H_
+
+#include <stdbool.h>
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 256
+// the largest triangles in the mesh are used as occluders
+#define OCCLUSION_OCCLUDER_TRIANGLES 4096
+#define OCCLUSION_MAX_LEVELS 16
+
+typedef struct occlusion_t {
+	int width;
+	int height;
+	// level 0 is the depth buffer. depths are 0 near to 1 far
+	float* levels[OCCLUSION_MAX_LEVELS];
+	int level_width[OCCLUSION_MAX_LEVELS];
+	int level_height[OCCLUSION_MAX_LEVELS];
+	int level_count;
+	// 9 floats per occluder triangle
+	float* occluders;
+	int occluder_count;
+	// occluder vertices after transformation to window x, y and depth
+	float* screen;
+	// vertices behind the eye or the near plane are flagged here
+	unsigned char* clipped;
+	float clip_matrix[16];
+	int thread_count;
+	// last render_occluders ()
+	int triangles_drawn;
+	double raster_seconds;
+} occlusion_t;
+
+bool create_occlusion (
+	occlusion_t* occ,
+	int width,
+	int height,
+	int thread_count
+);
+
+void free_occlusion (occlusion_t* occ);
+
+//
+// copy the max_triangles largest-area triangles of a triangle soup out as
+// occluders. positions are stride floats apart. ties go to the lower
+// triangle index so the pick is repeatable
+void select_occluders (
+	occlusion_t* occ,
+	const float* points,
+	int stride,
+	int point_count,
+	int max_triangles
+);
+
+//
+// as select_occluders () for an indexed mesh: corner c of triangle t is at
+// points[indices[t * 3 + c] * stride]. indices may be NULL for a soup
+void select_occluders_indexed (
+	occlusion_t* occ,
+	const float* points,
+	int stride,
+	const unsigned int* indices,
+	int tri_count,
+	int max_triangles
+);
+
+//
+// the selection of select_occluders_indexed () on its own, for picking on
+// another thread while occ is in use. returns a malloc'd array of 9 floats per
+// triangle and sets count
+float* pick_occluders (
+	const float* points,
+	int stride,
+	const unsigned int* indices,
+	int tri_count,
+	int max_triangles,
+	int thread_count,
+	int* count
+);
+
+//
+// replace occ's occluders with an array from pick_occluders (), which occ
+// then owns
+void set_occluders (occlusion_t* occ, float* occluders, int count);
+
+//
+// clear the depth buffer, rasterise the occluders with clip_matrix
+// (column-major P * V * M) and rebuild the pyramid
+void render_occluders (occlusion_t* occ, const float* clip_matrix);
+
+//
+// true if a model-space box is completely hidden behind the occluders drawn
+// by the last render_occluders (). boxes that cross the near plane are never
+// hidden
+bool test_occlusion_box (
+	const occlusion_t* occ,
+	const float* bb_min,
+	const float* bb_max
+);
+
+#endif
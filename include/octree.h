@@ -0,0 +1,72 @@
+//
+// Octree of mesh chunks with per-node LODs for out-of-core viewing (.oct)
+// Anton Gerdelan
+// antongerdelan.net
+//
+// File layout, all integers and floats little-endian:
+//   header "OCTM" u32 version, u32 node_count, u32 reserved
+//   nodes  node_count x 56 bytes, breadth-first so siblings are contiguous:
+//          f32 bb_min[3], f32 bb_max[3], f32 error, i32 first_child,
+//          i32 child_count, u32 vertex_count, u64 offset, u32 byte size,
+//          u32 reserved
+//   data   per node, vertex_count x 8 f32 interleaved (pos, uv, normal),
+//          non-indexed triangles ready for glDrawArrays
+//
+// Leaves hold the original triangles. Inner nodes hold a vertex-clustered
+// simplification of everything below them; error is the cluster cell size in
+// mesh units, so the viewer can compare it against a pixel tolerance.
+//
+#ifndef _OCTREE_H_
+#define _OCTREE_H_
+
+#include "obj_parser.h"
+#include <stdio.h>
+
+#define OCTREE_VERSION 1
+#define OCTREE_LEAF_TRIANGLES 32768
+#define OCTREE_MAX_DEPTH 12
+// clustering grid resolution along each axis of an inner node
+#define OCTREE_LOD_GRID 48
+#define OCTREE_VERTEX_FLOATS 8
+
+typedef struct octree_node_t {
+	float bb_min[3];
+	float bb_max[3];
+	float error;
+	int first_child;
+	int child_count;
+	unsigned int vertex_count;
+	unsigned long long offset;
+	unsigned int size;
+} octree_node_t;
+
+//
+// build the octree and its LODs and write everything into one file
+bool write_octree_file (
+	const char* file_name,
+	const obj_mesh_t* mesh,
+	int thread_count
+);
+
+//
+// read only the node table. payloads are read on demand with
+// read_octree_node_data ()
+bool load_octree_nodes (
+	const char* file_name,
+	octree_node_t** nodes,
+	int* node_count
+);
+
+//
+// read one node's vertices from an open file into a malloc'd buffer
+bool read_octree_node_data (
+	FILE* fp,
+	const octree_node_t* node,
+	float** vertices
+);
+
+//
+// true if the file name ends in .oct
+bool is_octree_file_name (const char* file_name);
+
+#endif
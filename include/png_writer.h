@@ -0,0 +1,102 @@
+//
+// PNG writer that filters and deflates bands of rows on several threads
+// Anton Gerdelan
+// antongerdelan.net
+//
+// stb_image_write compresses a whole image on one thread, which takes seconds
+// at 8K. Here the rows are cut into bands of about PNG_BAND_BYTES. Each band
+// is filtered, then deflated on its own thread with the 32kB before it as
+// its dictionary, so matches reach back across band edges as they would in
+// one stream. Every band but the last ends with an empty stored block (a
+// sync flush) so its bytes end on a byte boundary and the bands just follow
+// one another in the zlib stream. Each band goes in its own IDAT chunk, its
+// CRC worked out on the band's thread, and the Adler-32 of the whole stream
+// is combined from the bands'. Blocks use dynamic Huffman codes, fixed codes
+// or no compression, whichever is smallest.
+//
+// Rows can be given a few at a time, so a caller that makes the image in
+// strips, e.g. a tiled render, never needs all of it in memory.
+//
+#ifndef _PNG_WRITER_H_
+#define _PNG_WRITER_H_
+
+#include <stdbool.h>
+
+#define PNG_BAND_BYTES (256 * 1024)
+
+//
+// the row filters. PNG_FILTER_ADAPTIVE tries all five on each row and keeps
+// the one whose bytes sum smallest as signed values, as libpng and stb do
+enum {
+	PNG_FILTER_NONE = 0,
+	PNG_FILTER_SUB,
+	PNG_FILTER_UP,
+	PNG_FILTER_AVERAGE,
+	PNG_FILTER_PAETH,
+	PNG_FILTER_ADAPTIVE,
+	PNG_FILTERS
+};
+
+typedef struct png_settings_t {
+	int filter;
+	// 0 stores the data uncompressed. 1 is quickest, 9 smallest
+	int level;
+	// <= 0 means all cores
+	int thread_count;
+} png_settings_t;
+
+typedef struct png_writer_t png_writer_t;
+
+//
+// adaptive filtering, level 6, all cores
+void default_png_settings (png_settings_t* settings);
+
+//
+// "none", "sub", "up", "average", "paeth" or "adaptive", as given to
+// -png-filter
+const char* png_filter_name (int filter);
+
+//
+// filter for a name from png_filter_name (), or -1
+int parse_png_filter (const char* name);
+
+//
+// start a width x height PNG of channels 8-bit channels: 1 grey, 2 grey and
+// alpha, 3 RGB or 4 RGBA. NULL if the file can't be opened
+png_writer_t* open_png_writer (
+	const char* file_name,
+	int width,
+	int height,
+	int channels,
+	const png_settings_t* settings
+);
+
+//
+// add the next row_count rows, top first. rows is the first of them and
+// stride the bytes from one row to the next, which may be negative to read a
+// bottom-up image upwards. false if writing failed
+bool write_png_rows (
+	png_writer_t* pw,
+	const unsigned char* rows,
+	int row_count,
+	int stride
+);
+
+//
+// finish the file and free the writer. false if anything failed to write or
+// fewer rows than height were given
+bool close_png_writer (png_writer_t* pw);
+
+//
+// write a whole image at once. as the functions above
+bool write_png (
+	const char* file_name,
+	int width,
+	int height,
+	int channels,
+	const unsigned char* rows,
+	int stride,
+	const png_settings_t* settings
+);
+
+#endif
@@ -0,0 +1,69 @@
+//
+// Images much larger than the framebuffer, drawn a tile at a time
+// Anton Gerdelan
+// antongerdelan.net
+//
+// The poster's projection, from perspective () with the poster's aspect, is
+// cut into a grid of tiles the size of the framebuffer. Each tile is drawn
+// with a matrix in front of the projection that scales and shifts its part
+// of clip space to fill the whole of it, so the tiles join with no seam and
+// draw exactly what one huge frame would. Tiles go left to right, top row
+// first, and are read back into a buffer one tile row high. When a row of
+// tiles is finished it streams into the PNG writer, so memory stays at one
+// tile row however big the poster is: e.g. 32768 x 1024 x 3 = 96 MB for a
+// 32k poster in 1024 tiles.
+//
+#ifndef _POSTER_H_
+#define _POSTER_H_
+
+#include "png_writer.h"
+#include <GL/glew.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct poster_t poster_t;
+
+typedef struct poster_stats_t {
+	int tiles;
+	// reading tiles back, and filtering and compressing tile rows
+	double read_seconds;
+	double write_seconds;
+	// the one tile row held in memory
+	size_t row_buffer_bytes;
+} poster_stats_t;
+
+//
+// start a width x height PNG drawn in tile_width x tile_height tiles.
+// NULL if the file can't be opened
+poster_t* open_poster (
+	const char* file_name,
+	int width,
+	int height,
+	int tile_width,
+	int tile_height,
+	const png_settings_t* png
+);
+
+int poster_tile_count (const poster_t* poster);
+
+//
+// projection for tile number tile, from proj, the poster's whole
+// projection. both are column-major 4x4 matrices
+void poster_tile_projection (
+	const poster_t* poster,
+	int tile,
+	const float* proj,
+	float* tile_proj
+);
+
+//
+// read tile number tile from the bottom-left of the current read
+// framebuffer. tiles must be read in order. false if writing a row failed
+bool read_poster_tile (poster_t* poster, int tile);
+
+//
+// finish the file and free the poster. false if any of it failed to write
+// or not every tile was read
+bool close_poster (poster_t* poster, poster_stats_t* stats);
+
+#endif
@@ -0,0 +1,99 @@
+//
+// Multi-threaded software rasteriser drawing what basic.vert and basic.frag
+// draw, for machines with no GPU
+// Anton Gerdelan
+// antongerdelan.net
+//
+// Triangles go through in two passes, each split over threads. The first
+// transforms each triangle's corners with the MVP, MV and normal matrices of
+// a transforms_t, as basic.vert does, clips it against the near and far
+// planes and a guard band around the screen, culls back faces, works out its
+// edge functions and interpolation deltas, and adds it to the bin of every
+// SOFT_RASTER_TILE square tile its bounding box touches. Each thread keeps
+// its own triangles and bins, so nothing is locked. The second pass gives
+// each thread whole tiles; a tile's bins are walked in thread order, which
+// is submission order, so the depth test breaks ties as GL does. Inside a
+// tile the edge functions, depth and the perspective-correct attributes are
+// evaluated four pixels at a time with SSE, or in a plain loop without it.
+// A fragment's colour is the bilinear, clamped texel times Kd times the
+// cosine between the normal and the direction to the eye, as in basic.frag.
+//
+#ifndef _SOFT_RASTER_H_
+#define _SOFT_RASTER_H_
+
+#include "uniforms.h"
+#include <stdbool.h>
+
+#define SOFT_RASTER_TILE 64
+
+typedef struct soft_raster_t soft_raster_t;
+
+typedef struct soft_texture_t {
+	// RGBA, top row first as stbi_load () gives them
+	const unsigned char* rgba;
+	int width;
+	int height;
+} soft_texture_t;
+
+typedef struct soft_raster_stats_t {
+	long long draws;
+	long long triangles_in;
+	// back-facing, or outside the frustum or the screen. each piece of a
+	// clipped triangle counts on its own
+	long long triangles_culled;
+	// cut by a clip plane; the pieces are drawn
+	long long triangles_clipped;
+	// triangles and pieces set up and binned, and the tiles they were binned
+	// into
+	long long triangles_binned;
+	long long bin_entries;
+	long long pixels_shaded;
+	// transform, clip, set-up and binning, and tile rasterisation
+	double setup_seconds;
+	double raster_seconds;
+} soft_raster_stats_t;
+
+//
+// a width x height colour and depth buffer drawn on thread_count threads.
+// <= 0 means all cores
+soft_raster_t* create_soft_raster (int width, int height, int thread_count);
+
+void free_soft_raster (soft_raster_t* sr);
+
+//
+// as glClear () of colour and depth, with depth cleared to 1
+void clear_soft_raster (soft_raster_t* sr, float r, float g, float b);
+
+//
+// cull back faces, counter-clockwise being the front, as GL_CULL_FACE. on
+// by default
+void set_soft_raster_culling (soft_raster_t* sr, bool cull_back);
+
+//
+// draw point_count / 3 triangles, as glDrawArrays (GL_TRIANGLES) with
+// basic.vert and basic.frag. tex_coords and normals may be NULL for zeros.
+// texture NULL samples white. kd is the material colour
+void draw_soft_triangles (
+	soft_raster_t* sr,
+	transforms_t* transforms,
+	const float* points,
+	const float* tex_coords,
+	const float* normals,
+	int point_count,
+	const soft_texture_t* texture,
+	const float* kd
+);
+
+//
+// copy the colour buffer out as RGB bytes, bottom row first, as
+// glReadPixels () with GL_PACK_ALIGNMENT 1 gives them
+void read_soft_raster_rgb (const soft_raster_t* sr, unsigned char* rgb);
+
+int soft_raster_thread_count (const soft_raster_t* sr);
+
+//
+// totals since the raster was made
+void get_soft_raster_stats (const soft_raster_t* sr,
+	soft_raster_stats_t* stats);
+
+#endif
@@ -0,0 +1,55 @@
+//
+// Out-of-core paging of .oct octree chunks into GL buffers
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _STREAMER_H_
+#define _STREAMER_H_
+
+#include <stdbool.h>
+
+typedef struct streamer_stats_t {
+	long long resident_bytes;
+	long long budget_bytes;
+	int resident_nodes;
+	int node_count;
+	// in the last frame
+	int drawn_nodes;
+	long long drawn_vertices;
+	// averaged over the last second
+	double streamed_mb_per_s;
+	// fraction of nodes the traversal wanted that were already resident
+	double hit_rate;
+	int pending_loads;
+} streamer_stats_t;
+
+typedef struct streamer_t streamer_t;
+
+//
+// open an .oct file and start io_threads background readers. GPU memory for
+// chunk buffers is kept under budget_bytes by evicting least-recently-drawn
+// chunks. needs a current GL context
+streamer_t* create_streamer (
+	const char* file_name,
+	long long budget_bytes,
+	int io_threads
+);
+
+void destroy_streamer (streamer_t* s);
+
+//
+// upload finished loads, pick the chunks to draw for this camera, request
+// missing ones and draw what is resident. cam_pos is in model space.
+// proj_scale is viewport height / (2 tan (fovy / 2)); nodes whose LOD error
+// projects to more than error_px pixels are refined. the caller binds the
+// shader programme first
+void draw_streamed (
+	streamer_t* s,
+	const float* cam_pos,
+	float proj_scale,
+	float error_px
+);
+
+void get_streamer_stats (streamer_t* s, streamer_stats_t* stats);
+
+#endif
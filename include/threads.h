@@ -0,0 +1,82 @@
+//
+// Small threading helpers for the viewer's offline/CPU-side work
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _THREADS_H_
+#define _THREADS_H_
+
+#include <stdbool.h>
+
+//
+// callback for parallel_for. processes items [begin, end). thread_idx is in
+// [0, thread_count) so it can be used to index per-thread scratch memory
+typedef void (*parallel_fn) (int begin, int end, int thread_idx, void* user);
+
+//
+// number of hardware threads available. always at least 1
+int get_cpu_count ();
+
+//
+// split count items into thread_count contiguous ranges and run fn on each
+// range in its own thread. the calling thread runs the first range itself.
+// returns when all ranges are done. thread_count <= 0 means use all cores
+void parallel_for (int count, int thread_count, parallel_fn fn, void* user);
+
+//
+// resolve a thread count request. <= 0 means "all cores"
+int resolve_thread_count (int thread_count);
+
+//
+// fixed-capacity thread-safe FIFO of pointers. pushing blocks while full and
+// popping blocks while empty, which gives producers back-pressure
+typedef struct work_queue_t work_queue_t;
+
+work_queue_t* create_work_queue (int capacity);
+
+//
+// free the queue. items still in it are not freed
+void destroy_work_queue (work_queue_t* q);
+
+//
+// returns false if the queue was closed
+bool work_queue_push (work_queue_t* q, void* item);
+
+//
+// non-blocking push. returns false if full or closed
+bool work_queue_try_push (work_queue_t* q, void* item);
+
+//
+// waits for an item. returns false once the queue is closed and empty
+bool work_queue_pop (work_queue_t* q, void** item);
+
+//
+// non-blocking pop. returns false if empty
+bool work_queue_try_pop (work_queue_t* q, void** item);
+
+//
+// wake all waiters. pops drain what is left, then fail. pushes fail
+void work_queue_close (work_queue_t* q);
+
+int work_queue_size (work_queue_t* q);
+
+//
+// long-running threads that all run fn (worker_idx, user) until it returns
+typedef void (*worker_fn) (int worker_idx, void* user);
+typedef struct worker_group_t worker_group_t;
+
+worker_group_t* start_workers (int count, worker_fn fn, void* user);
+
+//
+// wait for every worker's fn to return, then free the group
+void join_workers (worker_group_t* group);
+
+//
+// monotonic wall-clock time in seconds. use for measuring CPU-side work
+double get_wall_time ();
+
+//
+// peak resident memory of the process so far in bytes, or -1 if unknown
+long long get_peak_memory_bytes ();
+
+#endif
@@ -0,0 +1,73 @@
+//
+// Thumbnail images for many mesh files, in a three-stage pipeline
+// Anton Gerdelan
+// antongerdelan.net
+//
+// A pool of parser threads loads meshes and works out their bounds. The
+// calling thread, which owns the GL context, draws each one and reads it
+// back. A pool of encoder threads writes the PNGs. The stages are joined by
+// bounded queues, so a stage that runs ahead waits instead of filling memory
+// with meshes or images: at most THUMBNAIL_QUEUE_DEPTH items per thread of
+// the stage after are in flight. Each stage's busy time, not counting waits
+// on the queues, gives its utilisation and shows which one limits the rate.
+//
+#ifndef _THUMBNAILS_H_
+#define _THUMBNAILS_H_
+
+#include "mesh_batch.h"
+
+#define THUMBNAIL_QUEUE_DEPTH 2
+
+//
+// draw mesh, whose bounding sphere is centre and radius, and read it into
+// rgb: size x size pixels of 3 bytes, bottom row first as glReadPixels gives
+// them. runs on the thread that called make_thumbnails (). false skips it
+typedef bool (*thumbnail_render_fn) (
+	const loaded_mesh_t* mesh,
+	const float* centre,
+	float radius,
+	unsigned char* rgb,
+	void* user
+);
+
+typedef struct thumbnail_stage_t {
+	int threads;
+	// time spent working, summed over the stage's threads
+	double busy_seconds;
+	// busy_seconds / (threads * wall time)
+	double utilisation;
+} thumbnail_stage_t;
+
+typedef struct thumbnail_stats_t {
+	int assets;
+	int written;
+	int failed;
+	double seconds;
+	double assets_per_second;
+	thumbnail_stage_t parse;
+	thumbnail_stage_t render;
+	thumbnail_stage_t encode;
+	// the most items seen waiting in each queue
+	int parsed_queue_peak;
+	int image_queue_peak;
+} thumbnail_stats_t;
+
+//
+// write a size x size PNG of each file to out_dir, named after the file.
+// thread counts <= 0 mean all cores. process may be NULL
+bool make_thumbnails (
+	const char** file_names,
+	int file_count,
+	const char* out_dir,
+	int size,
+	int parse_threads,
+	int encode_threads,
+	mesh_process_fn process,
+	thumbnail_render_fn render,
+	void* user,
+	thumbnail_stats_t* stats
+);
+
+void print_thumbnail_stats (const thumbnail_stats_t* stats);
+
+#endif
@@ -0,0 +1,83 @@
+//
+// Transform matrices for the shaders, derived on the CPU and sent only when
+// they change
+// Anton Gerdelan
+// antongerdelan.net
+//
+// The model, view and projection matrices are set here instead of straight
+// on the programs. MV, MVP and the normal matrix are worked out once when
+// an input changes, rather than per vertex in the shader, and each program
+// remembers which versions of the inputs it has so that apply_transforms ()
+// only calls glUniform for what is stale. Uniform locations are looked up
+// once per program; shaders that lack a uniform simply don't get it, so
+// older shaders using M, V and P still work.
+//
+#ifndef _UNIFORMS_H_
+#define _UNIFORMS_H_
+
+#include <GL/glew.h>
+#include <stdbool.h>
+
+enum {
+	TRANSFORM_MODEL = 0,
+	TRANSFORM_VIEW,
+	TRANSFORM_PROJECTION,
+	TRANSFORM_INPUTS
+};
+
+typedef struct transforms_t {
+	// column-major, like the rest of the viewer
+	float M[16];
+	float V[16];
+	float P[16];
+	// derived from the above when stale
+	float MV[16];
+	float MVP[16];
+	// inverse transpose of the upper 3x3 of MV
+	float normal_matrix[9];
+	bool derived_stale;
+	// bumped when the matching input changes
+	unsigned int versions[TRANSFORM_INPUTS];
+	// counters for reporting
+	long long derived_updates;
+	long long uniform_uploads;
+	long long uniform_skips;
+} transforms_t;
+
+typedef struct program_uniforms_t {
+	GLuint program;
+	GLint M_loc;
+	GLint V_loc;
+	GLint P_loc;
+	GLint MV_loc;
+	GLint MVP_loc;
+	GLint normal_matrix_loc;
+	// versions of the inputs the program was last sent. 0 is never sent
+	unsigned int sent[TRANSFORM_INPUTS];
+} program_uniforms_t;
+
+//
+// identity matrices
+void init_transforms (transforms_t* t);
+
+//
+// setting a matrix equal to the current one changes nothing
+void set_model_matrix (transforms_t* t, const float* m);
+void set_view_matrix (transforms_t* t, const float* m);
+void set_projection_matrix (transforms_t* t, const float* m);
+
+//
+// work out MV, MVP and the normal matrix if an input has changed. done by
+// apply_transforms () too; for drawing without GL
+void update_derived_transforms (transforms_t* t);
+
+//
+// look up and cache the transform uniform locations of a linked program
+void init_program_uniforms (program_uniforms_t* u, GLuint program);
+
+//
+// bring the program's transform uniforms up to date. the program must be in
+// use (glUseProgram)
+void apply_transforms (transforms_t* t, program_uniforms_t* u);
+
+#endif
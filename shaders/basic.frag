@@ -3,6 +3,8 @@
 varying vec2 st;
 varying vec3 n, p;
 uniform sampler2D dm;
+// material colour, white without one
+uniform vec3 Kd;
 
 void main () {
 	//
@@ -13,5 +15,5 @@ void main () {
 	
 	vec4 texel = texture2D (dm, st);
 	
-	gl_FragColor = vec4 (texel.rgb * dp, 1.0);
+	gl_FragColor = vec4 (texel.rgb * Kd * dp, 1.0);
 }
@@ -3,15 +3,22 @@
 attribute vec3 vp; // points
 attribute vec2 vt; // tex coords
 attribute vec3 vn; // normals
+attribute mat4 im; // per-instance transform. identity when not instancing
 
-uniform mat4 M, V, P;
+// worked out on the CPU when the model, view or projection changes
+uniform mat4 MV, MVP;
+uniform mat3 normal_matrix;
 
 varying vec2 st;
 varying vec3 n, p;
 
 void main () {
 	st = vt;
-	n = vec3 (V * M * vec4 (vn, 0.0));
-	p = vec3 (V * M * vec4 (vp, 1.0));
-	gl_Position = P * V * M * vec4 (vp, 1.0);
+	// matrix times vector all the way; a mat4 x mat4 here would cost four
+	// times as much per vertex
+	vec4 instance_p = im * vec4 (vp, 1.0);
+	// fine for instance transforms without non-uniform scale
+	n = normal_matrix * (mat3 (im) * vn);
+	p = vec3 (MV * instance_p);
+	gl_Position = MVP * instance_p;
 }
@@ -0,0 +1,51 @@
+#version 120
+
+// FXAA after Timothy Lottes' console version: blur along the edge direction
+// found from the luma of the 4 diagonal neighbours, and fall back to a
+// narrower blur if the wide one strays outside the local luma range
+
+varying vec2 st;
+uniform sampler2D frame;
+uniform vec2 texel; // 1 / size of frame in pixels
+
+#define FXAA_REDUCE_MIN (1.0 / 128.0)
+#define FXAA_REDUCE_MUL (1.0 / 8.0)
+#define FXAA_SPAN_MAX 8.0
+
+void main () {
+	vec3 luma = vec3 (0.299, 0.587, 0.114);
+	vec3 rgb_nw = texture2D (frame, st + vec2 (-1.0, -1.0) * texel).rgb;
+	vec3 rgb_ne = texture2D (frame, st + vec2 (1.0, -1.0) * texel).rgb;
+	vec3 rgb_sw = texture2D (frame, st + vec2 (-1.0, 1.0) * texel).rgb;
+	vec3 rgb_se = texture2D (frame, st + vec2 (1.0, 1.0) * texel).rgb;
+	vec3 rgb_m = texture2D (frame, st).rgb;
+	float luma_nw = dot (rgb_nw, luma);
+	float luma_ne = dot (rgb_ne, luma);
+	float luma_sw = dot (rgb_sw, luma);
+	float luma_se = dot (rgb_se, luma);
+	float luma_m = dot (rgb_m, luma);
+	float luma_min = min (luma_m, min (min (luma_nw, luma_ne), min (luma_sw,
+		luma_se)));
+	float luma_max = max (luma_m, max (max (luma_nw, luma_ne), max (luma_sw,
+		luma_se)));
+
+	vec2 dir = vec2 (-((luma_nw + luma_ne) - (luma_sw + luma_se)),
+		(luma_nw + luma_sw) - (luma_ne + luma_se));
+	float dir_reduce = max ((luma_nw + luma_ne + luma_sw + luma_se) *
+		(0.25 * FXAA_REDUCE_MUL), FXAA_REDUCE_MIN);
+	float rcp_dir_min = 1.0 / (min (abs (dir.x), abs (dir.y)) + dir_reduce);
+	dir = clamp (dir * rcp_dir_min, vec2 (-FXAA_SPAN_MAX),
+		vec2 (FXAA_SPAN_MAX)) * texel;
+
+	vec3 rgb_a = 0.5 * (texture2D (frame, st + dir * (1.0 / 3.0 - 0.5)).rgb +
+		texture2D (frame, st + dir * (2.0 / 3.0 - 0.5)).rgb);
+	vec3 rgb_b = rgb_a * 0.5 + 0.25 * (texture2D (frame, st - dir * 0.5).rgb +
+		texture2D (frame, st + dir * 0.5).rgb);
+	float luma_b = dot (rgb_b, luma);
+
+	if (luma_b < luma_min || luma_b > luma_max) {
+		gl_FragColor = vec4 (rgb_a, 1.0);
+	} else {
+		gl_FragColor = vec4 (rgb_b, 1.0);
+	}
+}
@@ -0,0 +1,10 @@
+#version 120
+
+attribute vec2 vp; // clip-space corners of one triangle covering the screen
+
+varying vec2 st;
+
+void main () {
+	st = vp * 0.5 + 0.5;
+	gl_Position = vec4 (vp, 0.0, 1.0);
+}
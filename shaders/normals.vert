@@ -3,12 +3,13 @@
 attribute vec3 vp; // points
 attribute vec2 vt; // tex coords
 attribute vec3 vn; // normals
+attribute mat4 im; // per-instance transform. identity when not instancing
 
-uniform mat4 M, V, P;
+uniform mat4 MVP;
 
 varying vec3 n;
 
 void main () {
 	n = abs (vn);
-	gl_Position = P * V * M * vec4 (vp, 1.0);
+	gl_Position = MVP * (im * vec4 (vp, 1.0));
 }
@@ -0,0 +1,215 @@
+//
+// Anti-aliasing that can change while running: MSAA at several levels, or
+// an FXAA post pass
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "antialias.h"
+#include "gl_state.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* mode_names[AA_MODES] = {
+	"off", "2", "4", "8", "16", "fxaa"
+};
+static const int mode_samples[AA_MODES] = { 0, 2, 4, 8, 16, 0 };
+
+const char* antialias_mode_name (int mode) {
+	return mode >= 0 && mode < AA_MODES ? mode_names[mode] : "?";
+}
+
+int parse_antialias_mode (const char* name) {
+	int m;
+	for (m = 0; m < AA_MODES; m++) {
+		if (0 == strcmp (name, mode_names[m])) {
+			return m;
+		}
+	}
+	return -1;
+}
+
+static bool mode_available (const antialias_t* aa, int mode) {
+	if (AA_OFF == mode) {
+		return true;
+	}
+	if (!aa->supported) {
+		return false;
+	}
+	if (AA_FXAA == mode) {
+		return aa->fxaa_programme != 0;
+	}
+	return mode_samples[mode] <= aa->max_samples;
+}
+
+static void free_targets (antialias_t* aa) {
+	if (aa->fbo) {
+		glDeleteFramebuffers (1, &aa->fbo);
+	}
+	if (aa->colour_rb) {
+		glDeleteRenderbuffers (1, &aa->colour_rb);
+	}
+	if (aa->depth_rb) {
+		glDeleteRenderbuffers (1, &aa->depth_rb);
+	}
+	if (aa->colour_tex) {
+		delete_textures (1, &aa->colour_tex);
+	}
+	aa->fbo = aa->colour_rb = aa->depth_rb = aa->colour_tex = 0;
+}
+
+//
+// make the framebuffer for a mode. false if the driver rejects it
+static bool make_targets (antialias_t* aa, int mode) {
+	int samples = mode_samples[mode];
+	GLenum status;
+
+	if (AA_OFF == mode) {
+		return true;
+	}
+	glGenFramebuffers (1, &aa->fbo);
+	glBindFramebuffer (GL_FRAMEBUFFER, aa->fbo);
+	glGenRenderbuffers (1, &aa->depth_rb);
+	glBindRenderbuffer (GL_RENDERBUFFER, aa->depth_rb);
+	glRenderbufferStorageMultisample (GL_RENDERBUFFER, samples,
+		GL_DEPTH_COMPONENT24, aa->width, aa->height);
+	glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, aa->depth_rb);
+	if (AA_FXAA == mode) {
+		glGenTextures (1, &aa->colour_tex);
+		bind_texture_2d (1, aa->colour_tex);
+		glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, aa->width, aa->height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		// FXAA relies on bilinear taps between pixels
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, aa->colour_tex, 0);
+	} else {
+		glGenRenderbuffers (1, &aa->colour_rb);
+		glBindRenderbuffer (GL_RENDERBUFFER, aa->colour_rb);
+		glRenderbufferStorageMultisample (GL_RENDERBUFFER, samples, GL_RGBA8,
+			aa->width, aa->height);
+		glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_RENDERBUFFER, aa->colour_rb);
+	}
+	status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+	glBindFramebuffer (GL_FRAMEBUFFER, 0);
+	if (GL_FRAMEBUFFER_COMPLETE != status) {
+		fprintf (stderr, "ERROR: anti-aliasing framebuffer for %s incomplete \
+(0x%x)\n", mode_names[mode], status);
+		free_targets (aa);
+		return false;
+	}
+	return true;
+}
+
+void create_antialias (
+	antialias_t* aa,
+	GLuint fxaa_programme,
+	int mode,
+	int width,
+	int height
+) {
+	// a triangle big enough that the screen is cut out of it
+	const float corners[6] = { -1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f };
+
+	memset (aa, 0, sizeof (antialias_t));
+	aa->width = width;
+	aa->height = height;
+	aa->supported = GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+	if (!aa->supported) {
+		fprintf (stderr, "WARNING: no framebuffer objects. anti-aliasing off\n");
+		return;
+	}
+	glGetIntegerv (GL_MAX_SAMPLES, &aa->max_samples);
+	if (fxaa_programme) {
+		GLint frame_loc = glGetUniformLocation (fxaa_programme, "frame");
+		aa->fxaa_programme = fxaa_programme;
+		aa->texel_loc = glGetUniformLocation (fxaa_programme, "texel");
+		use_program (fxaa_programme);
+		glUniform1i (frame_loc, 1);
+		glUniform2f (aa->texel_loc, 1.0f / width, 1.0f / height);
+		glGenBuffers (1, &aa->triangle_vbo);
+		bind_array_buffer (aa->triangle_vbo);
+		glBufferData (GL_ARRAY_BUFFER, sizeof (corners), corners,
+			GL_STATIC_DRAW);
+		glGenVertexArrays (1, &aa->triangle_vao);
+		bind_vertex_array (aa->triangle_vao);
+		glEnableVertexAttribArray (0);
+		glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+		bind_vertex_array (0);
+	}
+	if (!set_antialias_mode (aa, mode)) {
+		fprintf (stderr, "WARNING: anti-aliasing %s not available. using off\n",
+			antialias_mode_name (mode));
+	}
+}
+
+void free_antialias (antialias_t* aa) {
+	free_targets (aa);
+	if (aa->triangle_vao) {
+		delete_vertex_arrays (1, &aa->triangle_vao);
+		delete_buffers (1, &aa->triangle_vbo);
+	}
+	memset (aa, 0, sizeof (antialias_t));
+}
+
+bool set_antialias_mode (antialias_t* aa, int mode) {
+	if (mode < 0 || mode >= AA_MODES || !mode_available (aa, mode)) {
+		return false;
+	}
+	free_targets (aa);
+	aa->mode = AA_OFF;
+	if (!make_targets (aa, mode)) {
+		return false;
+	}
+	aa->mode = mode;
+	return true;
+}
+
+int next_antialias_mode (const antialias_t* aa) {
+	int m = aa->mode, i;
+	for (i = 1; i < AA_MODES; i++) {
+		int next = (aa->mode + i) % AA_MODES;
+		if (mode_available (aa, next)) {
+			m = next;
+			break;
+		}
+	}
+	return m;
+}
+
+void set_antialias_target (antialias_t* aa, GLuint fbo) {
+	aa->target_fbo = fbo;
+}
+
+void begin_antialiased_frame (const antialias_t* aa) {
+	if (aa->fbo || aa->target_fbo) {
+		glBindFramebuffer (GL_FRAMEBUFFER, aa->fbo ? aa->fbo : aa->target_fbo);
+	}
+}
+
+void end_antialiased_frame (const antialias_t* aa) {
+	if (!aa->fbo) {
+		return;
+	}
+	if (AA_FXAA != aa->mode) {
+		// the resolve averages each pixel's samples
+		glBindFramebuffer (GL_READ_FRAMEBUFFER, aa->fbo);
+		glBindFramebuffer (GL_DRAW_FRAMEBUFFER, aa->target_fbo);
+		glBlitFramebuffer (0, 0, aa->width, aa->height, 0, 0, aa->width,
+			aa->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer (GL_FRAMEBUFFER, aa->target_fbo);
+		return;
+	}
+	glBindFramebuffer (GL_FRAMEBUFFER, aa->target_fbo);
+	set_capability (GL_DEPTH_TEST, false);
+	set_capability (GL_BLEND, false);
+	set_polygon_mode (GL_FILL);
+	use_program (aa->fxaa_programme);
+	bind_texture_2d (1, aa->colour_tex);
+	bind_vertex_array (aa->triangle_vao);
+	glDrawArrays (GL_TRIANGLES, 0, 3);
+}
@@ -0,0 +1,267 @@
+//
+// Scripted camera paths and frame time reports for --bench
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "bench.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_TWO_PI 6.283185307f
+
+//
+// camera at fraction u of the way through a segment
+static void eval_segment (
+	const camera_segment_t* seg,
+	float u,
+	float* eye,
+	float* target
+) {
+	float offset[3];
+	int k;
+
+	for (k = 0; k < 3; k++) {
+		eye[k] = seg->eye[k];
+		target[k] = seg->target[k];
+		offset[k] = seg->eye[k] - seg->target[k];
+	}
+	switch (seg->type) {
+		case CAMERA_ORBIT: {
+			float angle = seg->args[0] * BENCH_TWO_PI * u;
+			float c = cosf (angle), s = sinf (angle);
+			eye[0] = target[0] + offset[0] * c + offset[2] * s;
+			eye[2] = target[2] - offset[0] * s + offset[2] * c;
+		} break;
+		case CAMERA_ZOOM: {
+			float d0 = sqrtf (offset[0] * offset[0] + offset[1] * offset[1] +
+				offset[2] * offset[2]);
+			float d = d0 + (seg->args[0] - d0) * u;
+			if (d0 > 0.0f) {
+				for (k = 0; k < 3; k++) {
+					eye[k] = target[k] + offset[k] / d0 * d;
+				}
+			}
+		} break;
+		case CAMERA_FLY:
+			for (k = 0; k < 3; k++) {
+				const float* to_eye = seg->args;
+				const float* to_target = seg->args + 3;
+				eye[k] = seg->eye[k] + (to_eye[k] - seg->eye[k]) * u;
+				target[k] = seg->target[k] + (to_target[k] - seg->target[k]) * u;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static void add_segment (
+	camera_path_t* path,
+	int* capacity,
+	int type,
+	float seconds,
+	const float* args
+) {
+	camera_segment_t* seg;
+
+	if (path->segment_count == *capacity) {
+		*capacity = *capacity > 0 ? *capacity * 2 : 8;
+		path->segments = (camera_segment_t*)realloc (path->segments, *capacity *
+			sizeof (camera_segment_t));
+	}
+	seg = &path->segments[path->segment_count++];
+	memset (seg, 0, sizeof (camera_segment_t));
+	seg->type = type;
+	seg->seconds = seconds > 0.0f ? seconds : 0.0f;
+	memcpy (seg->args, args, sizeof (seg->args));
+	memcpy (seg->eye, path->end_eye, sizeof (seg->eye));
+	memcpy (seg->target, path->end_target, sizeof (seg->target));
+	eval_segment (seg, 1.0f, path->end_eye, path->end_target);
+	path->duration += seg->seconds;
+}
+
+bool load_camera_path (const char* file_name, camera_path_t* path) {
+	FILE* fp = fopen (file_name, "r");
+	char line[1024];
+	int capacity = 0, line_number = 0;
+
+	memset (path, 0, sizeof (camera_path_t));
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open camera path %s\n", file_name);
+		return false;
+	}
+	path->end_eye[2] = 5.0f;
+	while (fgets (line, sizeof (line), fp)) {
+		char word[32];
+		float seconds = 0.0f, args[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		char* comment = strchr (line, '#');
+		bool ok = false;
+
+		line_number++;
+		if (comment) {
+			*comment = '\0';
+		}
+		if (1 != sscanf (line, "%31s", word)) {
+			continue;
+		}
+		if (0 == strcmp (word, "start")) {
+			ok = 6 == sscanf (line, "%*s %f %f %f %f %f %f", &path->end_eye[0],
+				&path->end_eye[1], &path->end_eye[2], &path->end_target[0],
+				&path->end_target[1], &path->end_target[2]);
+			ok = ok && 0 == path->segment_count;
+		} else if (0 == strcmp (word, "orbit")) {
+			ok = 2 == sscanf (line, "%*s %f %f", &seconds, &args[0]);
+			if (ok) {
+				add_segment (path, &capacity, CAMERA_ORBIT, seconds, args);
+			}
+		} else if (0 == strcmp (word, "zoom")) {
+			ok = 2 == sscanf (line, "%*s %f %f", &seconds, &args[0]);
+			if (ok) {
+				add_segment (path, &capacity, CAMERA_ZOOM, seconds, args);
+			}
+		} else if (0 == strcmp (word, "fly")) {
+			ok = 7 == sscanf (line, "%*s %f %f %f %f %f %f %f", &seconds,
+				&args[0], &args[1], &args[2], &args[3], &args[4], &args[5]);
+			if (ok) {
+				add_segment (path, &capacity, CAMERA_FLY, seconds, args);
+			}
+		} else if (0 == strcmp (word, "hold")) {
+			ok = 1 == sscanf (line, "%*s %f", &seconds);
+			if (ok) {
+				add_segment (path, &capacity, CAMERA_HOLD, seconds, args);
+			}
+		}
+		if (!ok) {
+			fprintf (stderr, "ERROR: %s:%i: can't parse camera path line\n",
+				file_name, line_number);
+			fclose (fp);
+			free_camera_path (path);
+			return false;
+		}
+	}
+	fclose (fp);
+	printf ("camera path %s: %i segments, %.1fs\n", file_name,
+		path->segment_count, path->duration);
+	return true;
+}
+
+void default_camera_path (
+	const float* eye,
+	const float* target,
+	camera_path_t* path
+) {
+	float args[6] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	float distance = 0.0f;
+	int capacity = 0, k;
+
+	memset (path, 0, sizeof (camera_path_t));
+	for (k = 0; k < 3; k++) {
+		path->end_eye[k] = eye[k];
+		path->end_target[k] = target[k];
+		distance += (eye[k] - target[k]) * (eye[k] - target[k]);
+	}
+	distance = sqrtf (distance);
+	add_segment (path, &capacity, CAMERA_ORBIT, 4.0f, args);
+	args[0] = distance * 0.5f;
+	add_segment (path, &capacity, CAMERA_ZOOM, 2.0f, args);
+	args[0] = distance;
+	add_segment (path, &capacity, CAMERA_ZOOM, 2.0f, args);
+}
+
+void free_camera_path (camera_path_t* path) {
+	free (path->segments);
+	memset (path, 0, sizeof (camera_path_t));
+}
+
+void sample_camera_path (
+	const camera_path_t* path,
+	float t,
+	float* eye,
+	float* target
+) {
+	int i;
+
+	if (path->segment_count < 1 || path->duration <= 0.0f) {
+		memcpy (eye, path->end_eye, 3 * sizeof (float));
+		memcpy (target, path->end_target, 3 * sizeof (float));
+		return;
+	}
+	t = fmodf (t, path->duration);
+	for (i = 0; i < path->segment_count; i++) {
+		const camera_segment_t* seg = &path->segments[i];
+		if (t < seg->seconds || i == path->segment_count - 1) {
+			float u = seg->seconds > 0.0f ? t / seg->seconds : 1.0f;
+			eval_segment (seg, u < 1.0f ? u : 1.0f, eye, target);
+			return;
+		}
+		t -= seg->seconds;
+	}
+}
+
+static int compare_doubles (const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+//
+// nearest-rank percentile of sorted values
+static double sorted_percentile (const double* sorted, int count, double p) {
+	int rank = (int)ceil (p * count) - 1;
+	rank = rank < 0 ? 0 : (rank < count ? rank : count - 1);
+	return sorted[rank];
+}
+
+static void write_json_string (FILE* fp, const char* s) {
+	fputc ('"', fp);
+	for (; s && *s; s++) {
+		if ('"' == *s || '\\' == *s) {
+			fprintf (fp, "\\%c", *s);
+		} else if ((unsigned char)*s < 0x20) {
+			fprintf (fp, "\\u%04x", (unsigned char)*s);
+		} else {
+			fputc (*s, fp);
+		}
+	}
+	fputc ('"', fp);
+}
+
+void write_bench_json (FILE* fp, const bench_result_t* result) {
+	int n = result->frame_count, i;
+	double* sorted = (double*)malloc ((n + 1) * sizeof (double));
+	double sum = 0.0, ms = 1000.0;
+
+	memcpy (sorted, result->frame_seconds, n * sizeof (double));
+	qsort (sorted, n, sizeof (double), compare_doubles);
+	for (i = 0; i < n; i++) {
+		sum += sorted[i];
+	}
+	fprintf (fp, "{\n  \"mesh\": ");
+	write_json_string (fp, result->mesh_name);
+	fprintf (fp, ",\n  \"renderer\": ");
+	write_json_string (fp, result->renderer);
+	fprintf (fp, ",\n  \"frames\": %i,\n", n);
+	fprintf (fp, "  \"timestep_s\": %.6f,\n", result->timestep);
+	fprintf (fp, "  \"total_s\": %.6f,\n", result->total_seconds);
+	if (n > 0) {
+		fprintf (fp, "  \"frame_ms\": {\n");
+		fprintf (fp, "    \"min\": %.4f,\n", sorted[0] * ms);
+		fprintf (fp, "    \"mean\": %.4f,\n", sum / n * ms);
+		fprintf (fp, "    \"p50\": %.4f,\n", sorted_percentile (sorted, n, 0.50) *
+			ms);
+		fprintf (fp, "    \"p90\": %.4f,\n", sorted_percentile (sorted, n, 0.90) *
+			ms);
+		fprintf (fp, "    \"p95\": %.4f,\n", sorted_percentile (sorted, n, 0.95) *
+			ms);
+		fprintf (fp, "    \"p99\": %.4f,\n", sorted_percentile (sorted, n, 0.99) *
+			ms);
+		fprintf (fp, "    \"max\": %.4f\n", sorted[n - 1] * ms);
+		fprintf (fp, "  },\n");
+	}
+	fprintf (fp, "  \"triangles\": %lld,\n", result->triangles);
+	fprintf (fp, "  \"triangles_per_frame\": %.1f,\n", n > 0 ?
+		(double)result->triangles / n : 0.0);
+	fprintf (fp, "  \"triangles_per_s\": %.1f\n}\n", sum > 0.0 ?
+		(double)result->triangles / sum : 0.0);
+	free (sorted);
+}
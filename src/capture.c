@@ -0,0 +1,359 @@
+//
+// Screenshots read back through pixel buffer objects and written on worker
+// threads, so taking one doesn't stall the frame
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "capture.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum {
+	SLOT_FREE = 0,
+	// glReadPixels issued into the buffer
+	SLOT_READING,
+	// mapped, with a worker copying out of it
+	SLOT_MAPPED
+};
+
+typedef struct capture_slot_t {
+	GLuint pbo;
+	int state;
+	long long frame;
+	// signalled when the read has finished, if there are fences
+	GLsync fence;
+	char file_name[256];
+	const unsigned char* mapped;
+} capture_slot_t;
+
+//
+// per worker, so no locking
+typedef struct capture_worker_stats_t {
+	int written;
+	int failed;
+	double encode_ms;
+} capture_worker_stats_t;
+
+struct capture_t {
+	int width;
+	int height;
+	capture_slot_t* slots;
+	int slot_count;
+	long long frame;
+	int sequence;
+	// mapped slots for the workers, and slots they have finished reading
+	work_queue_t* jobs;
+	work_queue_t* done;
+	worker_group_t* workers;
+	capture_worker_stats_t* worker_stats;
+	int worker_count;
+	png_settings_t png;
+	capture_stats_t stats;
+	// don't print every file written
+	bool quiet;
+	// render thread time this frame
+	double frame_ms;
+	bool fences;
+};
+
+//
+// frames whose name ends in .raw are written as bare rows of RGB bytes, top
+// row first, which is much quicker than deflating them
+static bool write_raw (const char* file_name, const unsigned char* rgb,
+	size_t bytes) {
+	FILE* fp = fopen (file_name, "wb");
+	bool ok;
+	if (!fp) {
+		return false;
+	}
+	ok = 1 == fwrite (rgb, bytes, 1, fp);
+	return 0 == fclose (fp) && ok;
+}
+
+static bool is_raw_file_name (const char* file_name) {
+	const char* dot = strrchr (file_name, '.');
+	return dot && 0 == strcmp (dot, ".raw");
+}
+
+static void worker_main (int worker_idx, void* user) {
+	capture_t* cap = (capture_t*)user;
+	capture_worker_stats_t* ws = &cap->worker_stats[worker_idx];
+	int row_bytes = cap->width * 3;
+	// one frame per worker, kept for every capture it writes
+	unsigned char* rgb = (unsigned char*)malloc ((size_t)row_bytes *
+		cap->height);
+	void* item = NULL;
+
+	while (work_queue_pop (cap->jobs, &item)) {
+		capture_slot_t* slot = (capture_slot_t*)item;
+		double t0 = get_wall_time ();
+		char file_name[256];
+		int x, y;
+
+		// GL's rows go bottom-up; drop alpha on the way
+		for (y = 0; y < cap->height; y++) {
+			const unsigned char* src = slot->mapped + (size_t)(cap->height - 1 -
+				y) * cap->width * 4;
+			unsigned char* dst = rgb + (size_t)y * row_bytes;
+			for (x = 0; x < cap->width; x++) {
+				dst[x * 3] = src[x * 4];
+				dst[x * 3 + 1] = src[x * 4 + 1];
+				dst[x * 3 + 2] = src[x * 4 + 2];
+			}
+		}
+		strcpy (file_name, slot->file_name);
+		// the render thread can unmap and re-use it now
+		work_queue_push (cap->done, slot);
+		if (is_raw_file_name (file_name) ? write_raw (file_name, rgb,
+			(size_t)row_bytes * cap->height) : write_png (file_name, cap->width,
+			cap->height, 3, rgb, row_bytes, &cap->png)) {
+			ws->written++;
+			if (!cap->quiet) {
+				printf ("screenshot: wrote %s\n", file_name);
+			}
+		} else {
+			ws->failed++;
+			fprintf (stderr, "ERROR: could not write screenshot file %s\n",
+				file_name);
+		}
+		ws->encode_ms += (get_wall_time () - t0) * 1000.0;
+	}
+	free (rgb);
+}
+
+capture_t* create_capture (
+	int width,
+	int height,
+	int slot_count,
+	int worker_count,
+	const png_settings_t* png
+) {
+	capture_t* cap = (capture_t*)calloc (1, sizeof (capture_t));
+	int i;
+
+	cap->width = width;
+	cap->height = height;
+	cap->slot_count = slot_count;
+	cap->png = *png;
+	cap->slots = (capture_slot_t*)calloc (slot_count, sizeof (capture_slot_t));
+	cap->fences = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+	for (i = 0; i < slot_count; i++) {
+		glGenBuffers (1, &cap->slots[i].pbo);
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, cap->slots[i].pbo);
+		glBufferData (GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL,
+			GL_STREAM_READ);
+	}
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+	// every slot fits, so nobody waits on a push
+	cap->jobs = create_work_queue (slot_count);
+	cap->done = create_work_queue (slot_count);
+	cap->worker_count = worker_count > 0 ? worker_count : 1;
+	cap->worker_stats = (capture_worker_stats_t*)calloc (cap->worker_count,
+		sizeof (capture_worker_stats_t));
+	cap->workers = start_workers (cap->worker_count, worker_main, cap);
+	return cap;
+}
+
+static bool in_flight (const capture_t* cap) {
+	int i;
+	for (i = 0; i < cap->slot_count; i++) {
+		if (SLOT_FREE != cap->slots[i].state) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//
+// unmap the slots the workers have finished with
+static void collect_done (capture_t* cap) {
+	void* item = NULL;
+	while (work_queue_try_pop (cap->done, &item)) {
+		capture_slot_t* slot = (capture_slot_t*)item;
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->pbo);
+		glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+		slot->mapped = NULL;
+		slot->state = SLOT_FREE;
+	}
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+}
+
+//
+// true once slot's read has finished. with wait, blocks until then
+static bool read_finished (capture_slot_t* slot, long long before_frame,
+	bool wait) {
+	GLenum result;
+
+	if (!slot->fence) {
+		// without fences, a frame later is when the copy has usually finished
+		return wait || slot->frame < before_frame;
+	}
+	result = glClientWaitSync (slot->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT :
+		0, wait ? ~0ULL : 0);
+	return GL_ALREADY_SIGNALED == result || GL_CONDITION_SATISFIED == result;
+}
+
+//
+// map finished reads and give them to the workers. with wait, every read
+// is finished first
+static void dispatch_reads (capture_t* cap, long long before_frame,
+	bool wait) {
+	int i;
+	for (i = 0; i < cap->slot_count; i++) {
+		capture_slot_t* slot = &cap->slots[i];
+		if (SLOT_READING != slot->state || !read_finished (slot, before_frame,
+			wait)) {
+			continue;
+		}
+		if (slot->fence) {
+			glDeleteSync (slot->fence);
+			slot->fence = NULL;
+		}
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->pbo);
+		slot->mapped = (const unsigned char*)glMapBuffer (GL_PIXEL_PACK_BUFFER,
+			GL_READ_ONLY);
+		if (!slot->mapped) {
+			fprintf (stderr, "ERROR: could not map screenshot buffer\n");
+			cap->stats.dropped++;
+			slot->state = SLOT_FREE;
+			continue;
+		}
+		slot->state = SLOT_MAPPED;
+		work_queue_push (cap->jobs, slot);
+	}
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static void add_busy_time (capture_t* cap, double t0) {
+	cap->frame_ms += (get_wall_time () - t0) * 1000.0;
+}
+
+static capture_slot_t* free_slot (capture_t* cap) {
+	int i;
+	for (i = 0; i < cap->slot_count; i++) {
+		if (SLOT_FREE == cap->slots[i].state) {
+			return &cap->slots[i];
+		}
+	}
+	return NULL;
+}
+
+//
+// block until a worker hands a slot back
+static capture_slot_t* wait_for_slot (capture_t* cap) {
+	double t0 = get_wall_time ();
+	capture_slot_t* slot = NULL;
+	void* item = NULL;
+
+	cap->stats.waits++;
+	// reads that are still on the GPU have to finish to be written
+	dispatch_reads (cap, cap->frame + 1, true);
+	if (work_queue_pop (cap->done, &item)) {
+		slot = (capture_slot_t*)item;
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->pbo);
+		glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+		slot->mapped = NULL;
+		slot->state = SLOT_FREE;
+	}
+	cap->stats.wait_ms_total += (get_wall_time () - t0) * 1000.0;
+	return slot;
+}
+
+static bool start_read (capture_t* cap, const char* file_name, bool wait) {
+	double t0 = get_wall_time ();
+	capture_slot_t* slot = NULL;
+
+	cap->stats.requested++;
+	slot = free_slot (cap);
+	if (!slot && wait) {
+		slot = wait_for_slot (cap);
+	}
+	if (!slot) {
+		fprintf (stderr, "WARNING: screenshots still being written. skipped\n");
+		cap->stats.dropped++;
+		return false;
+	}
+	if (file_name) {
+		strncpy (slot->file_name, file_name, sizeof (slot->file_name) - 1);
+		slot->file_name[sizeof (slot->file_name) - 1] = '\0';
+	} else {
+		long int t = time (NULL);
+		sprintf (slot->file_name, "screenshot_%ld_%i.png", t, cap->sequence++);
+	}
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->pbo);
+	// RGBA is the format drivers copy without converting on the CPU
+	glPixelStorei (GL_PACK_ALIGNMENT, 4);
+	glReadPixels (0, 0, cap->width, cap->height, GL_RGBA, GL_UNSIGNED_BYTE,
+		NULL);
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+	if (cap->fences) {
+		slot->fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	slot->state = SLOT_READING;
+	slot->frame = cap->frame;
+	add_busy_time (cap, t0);
+	return true;
+}
+
+bool request_capture (capture_t* cap, const char* file_name) {
+	return start_read (cap, file_name, false);
+}
+
+bool record_capture (capture_t* cap, const char* file_name) {
+	return start_read (cap, file_name, true);
+}
+
+void set_capture_quiet (capture_t* cap, bool quiet) {
+	cap->quiet = quiet;
+}
+
+void update_capture (capture_t* cap) {
+	double t0 = get_wall_time ();
+	bool busy = in_flight (cap);
+
+	collect_done (cap);
+	dispatch_reads (cap, cap->frame, false);
+	add_busy_time (cap, t0);
+	if (busy) {
+		cap->stats.busy_frames++;
+		cap->stats.busy_ms_total += cap->frame_ms;
+		if (cap->frame_ms > cap->stats.busy_ms_max) {
+			cap->stats.busy_ms_max = cap->frame_ms;
+		}
+	}
+	cap->frame_ms = 0.0;
+	cap->frame++;
+}
+
+void destroy_capture (capture_t* cap, capture_stats_t* stats) {
+	int i;
+
+	if (!cap) {
+		return;
+	}
+	// whatever is still reading goes to the workers now
+	dispatch_reads (cap, cap->frame + 1, true);
+	work_queue_close (cap->jobs);
+	join_workers (cap->workers);
+	collect_done (cap);
+	for (i = 0; i < cap->worker_count; i++) {
+		cap->stats.written += cap->worker_stats[i].written;
+		cap->stats.dropped += cap->worker_stats[i].failed;
+		cap->stats.encode_ms_total += cap->worker_stats[i].encode_ms;
+	}
+	if (stats) {
+		*stats = cap->stats;
+	}
+	for (i = 0; i < cap->slot_count; i++) {
+		glDeleteBuffers (1, &cap->slots[i].pbo);
+	}
+	destroy_work_queue (cap->jobs);
+	destroy_work_queue (cap->done);
+	free (cap->worker_stats);
+	free (cap->slots);
+	free (cap);
+}
@@ -0,0 +1,532 @@
+//
+// Spatial chunks of a triangle soup with a BVH over them for frustum culling
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "chunk_bvh.h"
+#include "threads.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined (__SSE__) || defined (_M_X64)
+#include <xmmintrin.h>
+#define CHUNK_BVH_SSE
+#endif
+
+typedef struct chunk_job_t {
+	// corner c of triangle t is position indices[t * 3 + c], or t * 3 + c if
+	// indices is NULL. positions are stride floats apart
+	const float* positions;
+	int stride;
+	const unsigned int* indices;
+	// optional key per triangle. triangles are grouped by key before Morton
+	const int* tri_keys;
+	vertex_streams_t streams;
+	// tightly packed, reordered copies of each stream
+	float* dst_vp;
+	float* dst_vt;
+	float* dst_vn;
+	float bb_min[3];
+	float inv_extent[3];
+	// (morton code << 32) | triangle
+	unsigned long long* keys;
+	int tri_count;
+	mesh_chunk_t* chunks;
+} chunk_job_t;
+
+//
+// spread the low 10 bits of v out to every third bit
+static unsigned int spread_bits (unsigned int v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static const float* corner_position (const chunk_job_t* job, int t, int c) {
+	size_t v = job->indices ? job->indices[t * 3 + c] : (size_t)t * 3 + c;
+	return &job->positions[v * job->stride];
+}
+
+static void morton_range (int begin, int end, int thread_idx, void* user) {
+	chunk_job_t* job = (chunk_job_t*)user;
+	int t, k;
+	for (t = begin; t < end; t++) {
+		const float* p[3];
+		unsigned int q[3];
+		for (k = 0; k < 3; k++) {
+			p[k] = corner_position (job, t, k);
+		}
+		for (k = 0; k < 3; k++) {
+			float c = (p[0][k] + p[1][k] + p[2][k]) * (1.0f / 3.0f);
+			float u = (c - job->bb_min[k]) * job->inv_extent[k];
+			u = u < 0.0f ? 0.0f : (u > 1.0f ? 1.0f : u);
+			q[k] = (unsigned int)(u * 1023.0f);
+		}
+		job->keys[t] = (unsigned long long)(spread_bits (q[0]) |
+			(spread_bits (q[1]) << 1) | (spread_bits (q[2]) << 2)) << 32 |
+			(unsigned int)t;
+	}
+	(void)thread_idx;
+}
+
+static int compare_keys (const void* a, const void* b) {
+	unsigned long long x = *(const unsigned long long*)a;
+	unsigned long long y = *(const unsigned long long*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+//
+// stable counting sort of the Morton-sorted keys by triangle key, so each
+// key's triangles are contiguous and still in Morton order among themselves
+static void group_by_tri_key (chunk_job_t* job) {
+	unsigned long long* grouped;
+	int* offsets;
+	int key_count = 0, t, k, sum = 0;
+
+	for (t = 0; t < job->tri_count; t++) {
+		key_count = job->tri_keys[t] + 1 > key_count ? job->tri_keys[t] + 1 :
+			key_count;
+	}
+	offsets = (int*)calloc (key_count + 1, sizeof (int));
+	for (t = 0; t < job->tri_count; t++) {
+		offsets[job->tri_keys[t]]++;
+	}
+	for (k = 0; k < key_count; k++) {
+		int n = offsets[k];
+		offsets[k] = sum;
+		sum += n;
+	}
+	grouped = (unsigned long long*)malloc (job->tri_count *
+		sizeof (unsigned long long));
+	for (t = 0; t < job->tri_count; t++) {
+		int src = (int)(job->keys[t] & 0xffffffffull);
+		grouped[offsets[job->tri_keys[src]]++] = job->keys[t];
+	}
+	free (job->keys);
+	free (offsets);
+	job->keys = grouped;
+}
+
+//
+// copy the components of vertex src from a strided stream to packed dst
+static void gather_vertex (float* dst, const float* stream, int stride,
+	int components, int src) {
+	memcpy (dst, &stream[(size_t)src * stride], components * sizeof (float));
+}
+
+static void permute_range (int begin, int end, int thread_idx, void* user) {
+	chunk_job_t* job = (chunk_job_t*)user;
+	const vertex_streams_t* in = &job->streams;
+	int t, i;
+	for (t = begin; t < end; t++) {
+		int src = (int)(job->keys[t] & 0xffffffffull);
+		for (i = 0; i < 3; i++) {
+			size_t v = (size_t)t * 3 + i;
+			gather_vertex (&job->dst_vp[v * 3], in->points, in->points_stride, 3,
+				src * 3 + i);
+			if (job->dst_vt) {
+				gather_vertex (&job->dst_vt[v * 2], in->tex_coords,
+					in->tex_coords_stride, 2, src * 3 + i);
+			}
+			if (job->dst_vn) {
+				gather_vertex (&job->dst_vn[v * 3], in->normals, in->normals_stride,
+					3, src * 3 + i);
+			}
+		}
+	}
+	(void)thread_idx;
+}
+
+//
+// copy the reordered vertices back into the caller's streams
+static void scatter_range (int begin, int end, int thread_idx, void* user) {
+	chunk_job_t* job = (chunk_job_t*)user;
+	const vertex_streams_t* out = &job->streams;
+	int v;
+	for (v = begin; v < end; v++) {
+		memcpy (&out->points[(size_t)v * out->points_stride],
+			&job->dst_vp[(size_t)v * 3], 3 * sizeof (float));
+		if (job->dst_vt) {
+			memcpy (&out->tex_coords[(size_t)v * out->tex_coords_stride],
+				&job->dst_vt[(size_t)v * 2], 2 * sizeof (float));
+		}
+		if (job->dst_vn) {
+			memcpy (&out->normals[(size_t)v * out->normals_stride],
+				&job->dst_vn[(size_t)v * 3], 3 * sizeof (float));
+		}
+	}
+	(void)thread_idx;
+}
+
+static void chunk_bounds_range (int begin, int end, int thread_idx,
+	void* user) {
+	chunk_job_t* job = (chunk_job_t*)user;
+	int c, t, v, k;
+	for (c = begin; c < end; c++) {
+		mesh_chunk_t* chunk = &job->chunks[c];
+		int first_tri = c * CHUNK_BVH_TRIANGLES;
+		int tris = job->tri_count - first_tri;
+		tris = tris < CHUNK_BVH_TRIANGLES ? tris : CHUNK_BVH_TRIANGLES;
+		chunk->first = first_tri * 3;
+		chunk->count = tris * 3;
+		for (k = 0; k < 3; k++) {
+			chunk->bb_min[k] = FLT_MAX;
+			chunk->bb_max[k] = -FLT_MAX;
+		}
+		// read through the sorted keys, so this works before the vertices move
+		for (t = first_tri; t < first_tri + tris; t++) {
+			int src = (int)(job->keys[t] & 0xffffffffull);
+			for (v = 0; v < 3; v++) {
+				const float* p = corner_position (job, src, v);
+				for (k = 0; k < 3; k++) {
+					float* lo = &chunk->bb_min[k];
+					float* hi = &chunk->bb_max[k];
+					*lo = p[k] < *lo ? p[k] : *lo;
+					*hi = p[k] > *hi ? p[k] : *hi;
+				}
+			}
+		}
+	}
+	(void)thread_idx;
+}
+
+//
+// chunks are already in Morton order, so halving the range gives a
+// reasonable split without any sorting. with triangle keys the order is only
+// Morton within each key, so nodes that span keys are looser
+static int build_node (chunk_bvh_t* bvh, int first_chunk, int chunk_count) {
+	int n = bvh->node_count++;
+	bvh_node_t* node = &bvh->nodes[n];
+	int c, k;
+
+	node->first_chunk = first_chunk;
+	node->chunk_count = chunk_count;
+	for (k = 0; k < 3; k++) {
+		node->bb_min[k] = FLT_MAX;
+		node->bb_max[k] = -FLT_MAX;
+	}
+	for (c = first_chunk; c < first_chunk + chunk_count; c++) {
+		for (k = 0; k < 3; k++) {
+			float lo = bvh->chunks[c].bb_min[k], hi = bvh->chunks[c].bb_max[k];
+			node->bb_min[k] = lo < node->bb_min[k] ? lo : node->bb_min[k];
+			node->bb_max[k] = hi > node->bb_max[k] ? hi : node->bb_max[k];
+		}
+	}
+	if (1 == chunk_count) {
+		node->left = node->right = -1;
+	} else {
+		int half = chunk_count / 2;
+		node->left = build_node (bvh, first_chunk, half);
+		node->right = build_node (bvh, first_chunk + half, chunk_count - half);
+	}
+	return n;
+}
+
+//
+// sort job's triangles into Morton order in job->keys and build the chunks
+// and nodes. the vertices themselves are not touched
+static bool build_from_positions (
+	chunk_job_t* job,
+	int thread_count,
+	chunk_bvh_t* bvh
+) {
+	float bb_max[3];
+	int t, c, k;
+
+	memset (bvh, 0, sizeof (chunk_bvh_t));
+	if (job->tri_count < 1) {
+		return false;
+	}
+	for (k = 0; k < 3; k++) {
+		job->bb_min[k] = FLT_MAX;
+		bb_max[k] = -FLT_MAX;
+	}
+	for (t = 0; t < job->tri_count; t++) {
+		for (c = 0; c < 3; c++) {
+			const float* p = corner_position (job, t, c);
+			for (k = 0; k < 3; k++) {
+				job->bb_min[k] = p[k] < job->bb_min[k] ? p[k] : job->bb_min[k];
+				bb_max[k] = p[k] > bb_max[k] ? p[k] : bb_max[k];
+			}
+		}
+	}
+	for (k = 0; k < 3; k++) {
+		float extent = bb_max[k] - job->bb_min[k];
+		job->inv_extent[k] = extent > 0.0f ? 1.0f / extent : 0.0f;
+	}
+
+	job->keys = (unsigned long long*)malloc (job->tri_count *
+		sizeof (unsigned long long));
+	parallel_for (job->tri_count, thread_count, morton_range, job);
+	qsort (job->keys, job->tri_count, sizeof (unsigned long long),
+		compare_keys);
+	if (job->tri_keys) {
+		group_by_tri_key (job);
+	}
+
+	bvh->chunk_count = (job->tri_count + CHUNK_BVH_TRIANGLES - 1) /
+		CHUNK_BVH_TRIANGLES;
+	bvh->chunks = (mesh_chunk_t*)malloc (bvh->chunk_count *
+		sizeof (mesh_chunk_t));
+	job->chunks = bvh->chunks;
+	parallel_for (bvh->chunk_count, thread_count, chunk_bounds_range, job);
+
+	bvh->nodes = (bvh_node_t*)malloc ((2 * bvh->chunk_count - 1) *
+		sizeof (bvh_node_t));
+	build_node (bvh, 0, bvh->chunk_count);
+	return true;
+}
+
+bool build_chunk_bvh (
+	const vertex_streams_t* streams,
+	int point_count,
+	const int* tri_keys,
+	int thread_count,
+	chunk_bvh_t* bvh
+) {
+	chunk_job_t job;
+	double t0 = get_wall_time ();
+
+	memset (&job, 0, sizeof (chunk_job_t));
+	job.tri_count = point_count / 3;
+	job.positions = streams->points;
+	job.stride = streams->points_stride;
+	job.tri_keys = tri_keys;
+	job.streams = *streams;
+	if (!build_from_positions (&job, thread_count, bvh)) {
+		return false;
+	}
+
+	// gather into copies, then copy back so the caller's pointers stay valid
+	job.dst_vp = (float*)malloc (job.tri_count * 9 * sizeof (float));
+	job.dst_vt = streams->tex_coords ? (float*)malloc (job.tri_count * 6 *
+		sizeof (float)) : NULL;
+	job.dst_vn = streams->normals ? (float*)malloc (job.tri_count * 9 *
+		sizeof (float)) : NULL;
+	parallel_for (job.tri_count, thread_count, permute_range, &job);
+	parallel_for (job.tri_count * 3, thread_count, scatter_range, &job);
+
+	free (job.keys);
+	free (job.dst_vp);
+	free (job.dst_vt);
+	free (job.dst_vn);
+	printf ("chunked %i triangles into %i chunks, %i BVH nodes in %.3fs\n",
+		job.tri_count, bvh->chunk_count, bvh->node_count,
+		get_wall_time () - t0);
+	return true;
+}
+
+bool build_chunk_bvh_indexed (
+	const float* positions,
+	int stride,
+	const unsigned int* indices,
+	int tri_count,
+	const int* tri_keys,
+	int thread_count,
+	int* order,
+	chunk_bvh_t* bvh
+) {
+	chunk_job_t job;
+	double t0 = get_wall_time ();
+	int t;
+
+	memset (&job, 0, sizeof (chunk_job_t));
+	job.tri_count = tri_count;
+	job.positions = positions;
+	job.stride = stride;
+	job.indices = indices;
+	job.tri_keys = tri_keys;
+	if (!build_from_positions (&job, thread_count, bvh)) {
+		return false;
+	}
+	for (t = 0; t < tri_count; t++) {
+		order[t] = (int)(job.keys[t] & 0xffffffffull);
+	}
+	free (job.keys);
+	printf ("chunked %i indexed triangles into %i chunks, %i BVH nodes in \
+%.3fs\n", tri_count, bvh->chunk_count, bvh->node_count,
+		get_wall_time () - t0);
+	return true;
+}
+
+void free_chunk_bvh (chunk_bvh_t* bvh) {
+	free (bvh->chunks);
+	free (bvh->nodes);
+	memset (bvh, 0, sizeof (chunk_bvh_t));
+}
+
+void extract_frustum (const float* m, frustum_t* frustum) {
+	int i;
+	// row r of a column-major matrix is m[r], m[4 + r], m[8 + r], m[12 + r].
+	// planes are row 3 +/- rows 0, 1, 2: left, right, bottom, top, near, far
+	for (i = 0; i < 6; i++) {
+		int r = i / 2;
+		float s = (i % 2) ? -1.0f : 1.0f;
+		float a = m[3] + s * m[r];
+		float b = m[7] + s * m[4 + r];
+		float c = m[11] + s * m[8 + r];
+		float d = m[15] + s * m[12 + r];
+		float len = sqrtf (a * a + b * b + c * c);
+		float inv = len > 0.0f ? 1.0f / len : 0.0f;
+		frustum->nx[i] = a * inv;
+		frustum->ny[i] = b * inv;
+		frustum->nz[i] = c * inv;
+		frustum->d[i] = d * inv;
+	}
+	// padding planes: zero normal and positive distance, always inside
+	for (i = 6; i < 8; i++) {
+		frustum->nx[i] = frustum->ny[i] = frustum->nz[i] = 0.0f;
+		frustum->d[i] = 1.0f;
+	}
+}
+
+int test_frustum_box (
+	const frustum_t* frustum,
+	const float* bb_min,
+	const float* bb_max
+) {
+	float cx = (bb_min[0] + bb_max[0]) * 0.5f;
+	float cy = (bb_min[1] + bb_max[1]) * 0.5f;
+	float cz = (bb_min[2] + bb_max[2]) * 0.5f;
+	float ex = (bb_max[0] - bb_min[0]) * 0.5f;
+	float ey = (bb_max[1] - bb_min[1]) * 0.5f;
+	float ez = (bb_max[2] - bb_min[2]) * 0.5f;
+#ifdef CHUNK_BVH_SSE
+	// signed distance of the centre and the box's projected radius, for 4
+	// planes at once. outside any plane rejects; inside all accepts outright
+	const __m128 sign = _mm_set1_ps (-0.0f);
+	__m128 vcx = _mm_set1_ps (cx), vcy = _mm_set1_ps (cy);
+	__m128 vcz = _mm_set1_ps (cz), vex = _mm_set1_ps (ex);
+	__m128 vey = _mm_set1_ps (ey), vez = _mm_set1_ps (ez);
+	int outside = 0, straddle = 0, i;
+	for (i = 0; i < 8; i += 4) {
+		__m128 nx = _mm_loadu_ps (&frustum->nx[i]);
+		__m128 ny = _mm_loadu_ps (&frustum->ny[i]);
+		__m128 nz = _mm_loadu_ps (&frustum->nz[i]);
+		__m128 dist = _mm_add_ps (_mm_add_ps (_mm_mul_ps (nx, vcx),
+			_mm_mul_ps (ny, vcy)), _mm_add_ps (_mm_mul_ps (nz, vcz),
+			_mm_loadu_ps (&frustum->d[i])));
+		__m128 radius = _mm_add_ps (_mm_add_ps (
+			_mm_mul_ps (_mm_andnot_ps (sign, nx), vex),
+			_mm_mul_ps (_mm_andnot_ps (sign, ny), vey)),
+			_mm_mul_ps (_mm_andnot_ps (sign, nz), vez));
+		outside |= _mm_movemask_ps (_mm_cmplt_ps (_mm_add_ps (dist, radius),
+			_mm_setzero_ps ()));
+		straddle |= _mm_movemask_ps (_mm_cmplt_ps (_mm_sub_ps (dist, radius),
+			_mm_setzero_ps ()));
+	}
+	if (outside) {
+		return 0;
+	}
+	return straddle ? 1 : 2;
+#else
+	int result = 2, i;
+	for (i = 0; i < 6; i++) {
+		float dist = frustum->nx[i] * cx + frustum->ny[i] * cy +
+			frustum->nz[i] * cz + frustum->d[i];
+		float radius = fabsf (frustum->nx[i]) * ex + fabsf (frustum->ny[i]) * ey +
+			fabsf (frustum->nz[i]) * ez;
+		if (dist + radius < 0.0f) {
+			return 0;
+		}
+		if (dist - radius < 0.0f) {
+			result = 1;
+		}
+	}
+	return result;
+#endif
+}
+
+typedef struct cull_walk_t {
+	const chunk_bvh_t* bvh;
+	const frustum_t* frustum;
+	const occlusion_t* occlusion;
+	int* firsts;
+	int* counts;
+	int range_count;
+	cull_stats_t stats;
+} cull_walk_t;
+
+static void emit_chunks (cull_walk_t* w, int first_chunk, int chunk_count) {
+	int c;
+	for (c = first_chunk; c < first_chunk + chunk_count; c++) {
+		const mesh_chunk_t* chunk = &w->bvh->chunks[c];
+		// the walk is in chunk order, so neighbours in the array are
+		// neighbours in the vertex buffer
+		if (w->range_count > 0 && w->firsts[w->range_count - 1] +
+			w->counts[w->range_count - 1] == chunk->first) {
+			w->counts[w->range_count - 1] += chunk->count;
+		} else {
+			w->firsts[w->range_count] = chunk->first;
+			w->counts[w->range_count] = chunk->count;
+			w->range_count++;
+		}
+		w->stats.chunks_visible++;
+		w->stats.triangles_submitted += chunk->count / 3;
+	}
+}
+
+//
+// inside means an ancestor was found to be completely in the frustum, so
+// only the occlusion test is left to do
+static void cull_node (cull_walk_t* w, int n, bool inside) {
+	const bvh_node_t* node = &w->bvh->nodes[n];
+	int result = 2;
+
+	if (!inside || w->occlusion) {
+		w->stats.nodes_tested++;
+		if (node->left < 0) {
+			w->stats.chunks_tested++;
+		}
+	}
+	if (!inside) {
+		result = test_frustum_box (w->frustum, node->bb_min, node->bb_max);
+		if (0 == result) {
+			return;
+		}
+	}
+	if (w->occlusion && test_occlusion_box (w->occlusion, node->bb_min,
+		node->bb_max)) {
+		w->stats.chunks_occluded += node->chunk_count;
+		return;
+	}
+	if (node->left < 0 || (2 == result && !w->occlusion)) {
+		emit_chunks (w, node->first_chunk, node->chunk_count);
+		return;
+	}
+	cull_node (w, node->left, 2 == result);
+	cull_node (w, node->right, 2 == result);
+}
+
+int cull_chunk_bvh (
+	const chunk_bvh_t* bvh,
+	const frustum_t* frustum,
+	const occlusion_t* occlusion,
+	int* firsts,
+	int* counts,
+	cull_stats_t* stats
+) {
+	cull_walk_t w;
+	double t0 = get_wall_time ();
+
+	memset (&w, 0, sizeof (cull_walk_t));
+	w.bvh = bvh;
+	w.frustum = frustum;
+	w.occlusion = occlusion;
+	w.firsts = firsts;
+	w.counts = counts;
+	if (bvh->node_count > 0) {
+		cull_node (&w, 0, false);
+	}
+	w.stats.ranges = w.range_count;
+	w.stats.seconds = get_wall_time () - t0;
+	if (stats) {
+		*stats = w.stats;
+	}
+	return w.range_count;
+}
@@ -0,0 +1,99 @@
+//
+// Vertex ranges grouped into one multi-draw per state key
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "draw_batch.h"
+#include <stdlib.h>
+#include <string.h>
+
+void init_draw_batches (
+	draw_batches_t* db,
+	const int* tri_keys,
+	int tri_count,
+	int key_count
+) {
+	int t, k, first = 0;
+
+	memset (db, 0, sizeof (draw_batches_t));
+	db->key_count = key_count;
+	db->key_firsts = (int*)malloc ((key_count + 1) * sizeof (int));
+	db->key_counts = (int*)calloc (key_count + 1, sizeof (int));
+	for (t = 0; t < tri_count; t++) {
+		db->key_counts[tri_keys[t]] += 3;
+	}
+	for (k = 0; k < key_count; k++) {
+		db->key_firsts[k] = first;
+		first += db->key_counts[k];
+	}
+}
+
+void free_draw_batches (draw_batches_t* db) {
+	free (db->key_firsts);
+	free (db->key_counts);
+	free (db->firsts);
+	free (db->counts);
+	free (db->batches);
+	memset (db, 0, sizeof (draw_batches_t));
+}
+
+int batch_draw_ranges (
+	draw_batches_t* db,
+	const int* firsts,
+	const int* counts,
+	int range_count
+) {
+	int pieces = 0, key = 0, r;
+
+	// each key boundary can cut at most one range in two
+	if (range_count + db->key_count > db->range_capacity) {
+		db->range_capacity = range_count + db->key_count;
+		db->firsts = (int*)realloc (db->firsts, db->range_capacity *
+			sizeof (int));
+		db->counts = (int*)realloc (db->counts, db->range_capacity *
+			sizeof (int));
+		db->batches = (draw_batch_t*)realloc (db->batches, (db->key_count + 1) *
+			sizeof (draw_batch_t));
+	}
+	db->batch_count = 0;
+	for (r = 0; r < range_count; r++) {
+		int first = firsts[r], end = firsts[r] + counts[r];
+
+		while (first < end && key < db->key_count) {
+			int key_end = db->key_firsts[key] + db->key_counts[key];
+			int piece_end;
+
+			if (first >= key_end) {
+				key++;
+				continue;
+			}
+			piece_end = end < key_end ? end : key_end;
+			if (0 == db->batch_count || db->batches[db->batch_count - 1].key !=
+				key) {
+				draw_batch_t* b = &db->batches[db->batch_count++];
+				b->key = key;
+				b->first = pieces;
+				b->count = 0;
+			}
+			db->firsts[pieces] = first;
+			db->counts[pieces] = piece_end - first;
+			db->batches[db->batch_count - 1].count++;
+			pieces++;
+			first = piece_end;
+		}
+	}
+	memset (&db->frame, 0, sizeof (draw_batch_stats_t));
+	db->frame.ranges_in = range_count;
+	db->frame.ranges = pieces;
+	db->frame.draw_calls = db->batch_count;
+	db->total.ranges_in += range_count;
+	db->total.ranges += pieces;
+	db->total.draw_calls += db->batch_count;
+	db->frames++;
+	return db->batch_count;
+}
+
+void add_batch_state_changes (draw_batches_t* db, int changes) {
+	db->frame.state_changes += changes;
+	db->total.state_changes += changes;
+}
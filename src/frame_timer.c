@@ -0,0 +1,253 @@
+//
+// CPU and GPU time per frame, with rolling percentiles
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "frame_timer.h"
+#include "threads.h"
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// counts per bucket for the last ring_size samples
+typedef struct rolling_histogram_t {
+	int buckets[FRAME_TIMER_BUCKETS];
+	int* ring;
+	int ring_size;
+	int head;
+	int count;
+} rolling_histogram_t;
+
+struct frame_timer_t {
+	bool gpu_timing;
+	GLuint queries[FRAME_TIMER_QUERIES];
+	// frame each query is timing, -1 if it is free, and when it began
+	int query_frames[FRAME_TIMER_QUERIES];
+	double query_starts[FRAME_TIMER_QUERIES];
+	int next_query;
+	// the query running for this frame, -1 if none
+	int current_query;
+	double frame_start;
+	// every frame so far. gpu_ms is -1 until its result arrives
+	float* cpu_ms;
+	float* gpu_ms;
+	int* tags;
+	int tag;
+	int frame_count;
+	int frame_capacity;
+	rolling_histogram_t cpu;
+	rolling_histogram_t gpu;
+};
+
+static void init_histogram (rolling_histogram_t* h, int window) {
+	memset (h->buckets, 0, sizeof (h->buckets));
+	h->ring_size = window > 0 ? window : 1;
+	h->ring = (int*)malloc (h->ring_size * sizeof (int));
+	h->head = 0;
+	h->count = 0;
+}
+
+static void add_sample (rolling_histogram_t* h, double ms) {
+	int bucket = (int)(ms / FRAME_TIMER_BUCKET_MS);
+	bucket = bucket < 0 ? 0 : bucket;
+	bucket = bucket < FRAME_TIMER_BUCKETS ? bucket : FRAME_TIMER_BUCKETS - 1;
+	if (h->count == h->ring_size) {
+		// the oldest sample leaves the window
+		h->buckets[h->ring[h->head]]--;
+	} else {
+		h->count++;
+	}
+	h->ring[h->head] = bucket;
+	h->buckets[bucket]++;
+	h->head = (h->head + 1) % h->ring_size;
+}
+
+//
+// upper edge of the bucket holding the p-th fraction of samples
+static double percentile (const rolling_histogram_t* h, double p) {
+	int target = (int)(p * h->count + 0.5), seen = 0, b;
+	target = target > 0 ? target : 1;
+	if (0 == h->count) {
+		return 0.0;
+	}
+	for (b = 0; b < FRAME_TIMER_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen >= target) {
+			break;
+		}
+	}
+	b = b < FRAME_TIMER_BUCKETS ? b : FRAME_TIMER_BUCKETS - 1;
+	return (b + 1) * FRAME_TIMER_BUCKET_MS;
+}
+
+//
+// collect query results. with wait set, block until each is ready
+static void collect_queries (frame_timer_t* ft, bool wait) {
+	int q;
+	for (q = 0; q < FRAME_TIMER_QUERIES; q++) {
+		GLint available = 0;
+		GLuint64 ns = 0;
+		if (ft->query_frames[q] < 0 || q == ft->current_query) {
+			continue;
+		}
+		if (!wait) {
+			glGetQueryObjectiv (ft->queries[q], GL_QUERY_RESULT_AVAILABLE,
+				&available);
+			if (!available) {
+				continue;
+			}
+		}
+		glGetQueryObjectui64v (ft->queries[q], GL_QUERY_RESULT, &ns);
+		// the GPU can't have taken longer than the wall time since the query
+		// began. some drivers, e.g. llvmpipe, give the first query of a
+		// context a start time of 0; that frame goes without a GPU time
+		if (ns * 1e-9 <= get_wall_time () - ft->query_starts[q]) {
+			ft->gpu_ms[ft->query_frames[q]] = (float)(ns * 1e-6);
+			add_sample (&ft->gpu, ns * 1e-6);
+		}
+		ft->query_frames[q] = -1;
+	}
+}
+
+frame_timer_t* create_frame_timer (int window_frames) {
+	frame_timer_t* ft = (frame_timer_t*)calloc (1, sizeof (frame_timer_t));
+	int q;
+
+	ft->gpu_timing = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (ft->gpu_timing) {
+		glGenQueries (FRAME_TIMER_QUERIES, ft->queries);
+	} else {
+		fprintf (stderr, "WARNING: no timer queries. timing CPU only\n");
+	}
+	for (q = 0; q < FRAME_TIMER_QUERIES; q++) {
+		ft->query_frames[q] = -1;
+	}
+	ft->current_query = -1;
+	ft->frame_capacity = 1024;
+	ft->cpu_ms = (float*)malloc (ft->frame_capacity * sizeof (float));
+	ft->gpu_ms = (float*)malloc (ft->frame_capacity * sizeof (float));
+	ft->tags = (int*)malloc (ft->frame_capacity * sizeof (int));
+	init_histogram (&ft->cpu, window_frames);
+	init_histogram (&ft->gpu, window_frames);
+	return ft;
+}
+
+void destroy_frame_timer (frame_timer_t* ft) {
+	if (!ft) {
+		return;
+	}
+	if (ft->gpu_timing) {
+		glDeleteQueries (FRAME_TIMER_QUERIES, ft->queries);
+	}
+	free (ft->cpu_ms);
+	free (ft->gpu_ms);
+	free (ft->tags);
+	free (ft->cpu.ring);
+	free (ft->gpu.ring);
+	free (ft);
+}
+
+void begin_frame_timing (frame_timer_t* ft) {
+	if (ft->frame_count == ft->frame_capacity) {
+		ft->frame_capacity *= 2;
+		ft->cpu_ms = (float*)realloc (ft->cpu_ms, ft->frame_capacity *
+			sizeof (float));
+		ft->gpu_ms = (float*)realloc (ft->gpu_ms, ft->frame_capacity *
+			sizeof (float));
+		ft->tags = (int*)realloc (ft->tags, ft->frame_capacity * sizeof (int));
+	}
+	ft->gpu_ms[ft->frame_count] = -1.0f;
+	ft->tags[ft->frame_count] = ft->tag;
+	ft->current_query = -1;
+	// only start a query if the next one in the ring has been read back
+	if (ft->gpu_timing && ft->query_frames[ft->next_query] < 0) {
+		ft->current_query = ft->next_query;
+		ft->query_frames[ft->current_query] = ft->frame_count;
+		ft->query_starts[ft->current_query] = get_wall_time ();
+		ft->next_query = (ft->next_query + 1) % FRAME_TIMER_QUERIES;
+		glBeginQuery (GL_TIME_ELAPSED, ft->queries[ft->current_query]);
+	}
+	ft->frame_start = get_wall_time ();
+}
+
+void end_frame_timing (frame_timer_t* ft) {
+	double ms = (get_wall_time () - ft->frame_start) * 1000.0;
+	ft->cpu_ms[ft->frame_count] = (float)ms;
+	add_sample (&ft->cpu, ms);
+	if (ft->current_query >= 0) {
+		glEndQuery (GL_TIME_ELAPSED);
+		ft->current_query = -1;
+	}
+	ft->frame_count++;
+	if (ft->gpu_timing) {
+		collect_queries (ft, false);
+	}
+}
+
+void get_frame_time_stats (const frame_timer_t* ft, frame_time_stats_t* stats) {
+	stats->cpu_p50 = percentile (&ft->cpu, 0.50);
+	stats->cpu_p95 = percentile (&ft->cpu, 0.95);
+	stats->cpu_p99 = percentile (&ft->cpu, 0.99);
+	stats->gpu_p50 = percentile (&ft->gpu, 0.50);
+	stats->gpu_p95 = percentile (&ft->gpu, 0.95);
+	stats->gpu_p99 = percentile (&ft->gpu, 0.99);
+	stats->cpu_samples = ft->cpu.count;
+	stats->gpu_samples = ft->gpu.count;
+	stats->frame_count = ft->frame_count;
+}
+
+void set_frame_timing_tag (frame_timer_t* ft, int tag) {
+	ft->tag = tag;
+}
+
+void get_tagged_frame_times (
+	const frame_timer_t* ft,
+	int tag,
+	tagged_frame_times_t* times
+) {
+	double cpu_sum = 0.0, gpu_sum = 0.0;
+	int i;
+
+	memset (times, 0, sizeof (tagged_frame_times_t));
+	for (i = 0; i < ft->frame_count; i++) {
+		if (ft->tags[i] != tag) {
+			continue;
+		}
+		times->frames++;
+		cpu_sum += ft->cpu_ms[i];
+		if (ft->gpu_ms[i] >= 0.0f) {
+			times->gpu_frames++;
+			gpu_sum += ft->gpu_ms[i];
+		}
+	}
+	times->cpu_mean = times->frames > 0 ? cpu_sum / times->frames : 0.0;
+	times->gpu_mean = times->gpu_frames > 0 ? gpu_sum / times->gpu_frames : 0.0;
+}
+
+bool write_frame_times_csv (frame_timer_t* ft, const char* file_name) {
+	FILE* fp = NULL;
+	int i;
+
+	if (ft->gpu_timing) {
+		collect_queries (ft, true);
+	}
+	fp = fopen (file_name, "w");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open %s for writing\n", file_name);
+		return false;
+	}
+	fprintf (fp, "frame,cpu_ms,gpu_ms,tag\n");
+	for (i = 0; i < ft->frame_count; i++) {
+		if (ft->gpu_ms[i] < 0.0f) {
+			fprintf (fp, "%i,%.4f,,%i\n", i, ft->cpu_ms[i], ft->tags[i]);
+		} else {
+			fprintf (fp, "%i,%.4f,%.4f,%i\n", i, ft->cpu_ms[i], ft->gpu_ms[i],
+				ft->tags[i]);
+		}
+	}
+	fclose (fp);
+	printf ("wrote %i frame times to %s\n", ft->frame_count, file_name);
+	return true;
+}
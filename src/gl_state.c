@@ -0,0 +1,208 @@
+//
+// Shadow copy of the GL state the viewer changes, skipping redundant calls
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "gl_state.h"
+#include <stdio.h>
+#include <string.h>
+
+#define GL_STATE_TEXTURE_UNITS 16
+#define GL_STATE_CAPABILITIES 4
+
+static const GLenum cached_caps[GL_STATE_CAPABILITIES] = {
+	GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_MULTISAMPLE
+};
+
+static const char* kind_names[GL_STATE_KINDS] = {
+	"program", "vertex array", "array buffer", "texture", "enable/disable",
+	"viewport", "polygon mode"
+};
+
+// the values last set. the matching known flag is false until one is
+typedef struct gl_shadow_t {
+	GLuint program;
+	GLuint vertex_array;
+	GLuint array_buffer;
+	GLuint textures[GL_STATE_TEXTURE_UNITS];
+	int active_unit;
+	bool caps[GL_STATE_CAPABILITIES];
+	int viewport[4];
+	GLenum polygon_mode;
+	bool program_known;
+	bool vertex_array_known;
+	bool array_buffer_known;
+	bool textures_known[GL_STATE_TEXTURE_UNITS];
+	bool active_unit_known;
+	bool caps_known[GL_STATE_CAPABILITIES];
+	bool viewport_known;
+	bool polygon_mode_known;
+} gl_shadow_t;
+
+static gl_shadow_t g_shadow;
+static gl_state_stats_t g_stats;
+
+//
+// count a request. returns true if it must reach GL
+static bool request (int kind, bool known, bool same) {
+	g_stats.requested[kind]++;
+	if (known && same) {
+		return false;
+	}
+	g_stats.issued[kind]++;
+	return true;
+}
+
+void reset_gl_state_cache () {
+	memset (&g_shadow, 0, sizeof (gl_shadow_t));
+}
+
+void use_program (GLuint program) {
+	if (request (GL_STATE_PROGRAM, g_shadow.program_known,
+		g_shadow.program == program)) {
+		glUseProgram (program);
+		g_shadow.program = program;
+		g_shadow.program_known = true;
+	}
+}
+
+void bind_vertex_array (GLuint vao) {
+	if (request (GL_STATE_VERTEX_ARRAY, g_shadow.vertex_array_known,
+		g_shadow.vertex_array == vao)) {
+		glBindVertexArray (vao);
+		g_shadow.vertex_array = vao;
+		g_shadow.vertex_array_known = true;
+	}
+}
+
+void bind_array_buffer (GLuint vbo) {
+	if (request (GL_STATE_ARRAY_BUFFER, g_shadow.array_buffer_known,
+		g_shadow.array_buffer == vbo)) {
+		glBindBuffer (GL_ARRAY_BUFFER, vbo);
+		g_shadow.array_buffer = vbo;
+		g_shadow.array_buffer_known = true;
+	}
+}
+
+void bind_texture_2d (int unit, GLuint texture) {
+	if (unit < 0 || unit >= GL_STATE_TEXTURE_UNITS) {
+		glActiveTexture (GL_TEXTURE0 + unit);
+		glBindTexture (GL_TEXTURE_2D, texture);
+		g_shadow.active_unit_known = false;
+		return;
+	}
+	if (!request (GL_STATE_TEXTURE, g_shadow.textures_known[unit],
+		g_shadow.textures[unit] == texture)) {
+		return;
+	}
+	if (!g_shadow.active_unit_known || g_shadow.active_unit != unit) {
+		glActiveTexture (GL_TEXTURE0 + unit);
+		g_shadow.active_unit = unit;
+		g_shadow.active_unit_known = true;
+	}
+	glBindTexture (GL_TEXTURE_2D, texture);
+	g_shadow.textures[unit] = texture;
+	g_shadow.textures_known[unit] = true;
+}
+
+void set_capability (GLenum cap, bool enabled) {
+	int i;
+	for (i = 0; i < GL_STATE_CAPABILITIES; i++) {
+		if (cached_caps[i] == cap) {
+			break;
+		}
+	}
+	if (i == GL_STATE_CAPABILITIES || request (GL_STATE_CAPABILITY,
+		g_shadow.caps_known[i], g_shadow.caps[i] == enabled)) {
+		if (enabled) {
+			glEnable (cap);
+		} else {
+			glDisable (cap);
+		}
+	}
+	if (i < GL_STATE_CAPABILITIES) {
+		g_shadow.caps[i] = enabled;
+		g_shadow.caps_known[i] = true;
+	}
+}
+
+void set_viewport (int x, int y, int width, int height) {
+	int v[4] = { x, y, width, height };
+	if (request (GL_STATE_VIEWPORT, g_shadow.viewport_known,
+		0 == memcmp (v, g_shadow.viewport, sizeof (v)))) {
+		glViewport (x, y, width, height);
+		memcpy (g_shadow.viewport, v, sizeof (v));
+		g_shadow.viewport_known = true;
+	}
+}
+
+void set_polygon_mode (GLenum mode) {
+	if (request (GL_STATE_POLYGON_MODE, g_shadow.polygon_mode_known,
+		g_shadow.polygon_mode == mode)) {
+		glPolygonMode (GL_FRONT_AND_BACK, mode);
+		g_shadow.polygon_mode = mode;
+		g_shadow.polygon_mode_known = true;
+	}
+}
+
+void delete_vertex_arrays (int count, const GLuint* vaos) {
+	int i;
+	for (i = 0; i < count; i++) {
+		// GL reverts to 0 when the bound one is deleted
+		if (g_shadow.vertex_array == vaos[i]) {
+			g_shadow.vertex_array = 0;
+		}
+	}
+	glDeleteVertexArrays (count, vaos);
+}
+
+void delete_buffers (int count, const GLuint* vbos) {
+	int i;
+	for (i = 0; i < count; i++) {
+		if (g_shadow.array_buffer == vbos[i]) {
+			g_shadow.array_buffer = 0;
+		}
+	}
+	glDeleteBuffers (count, vbos);
+}
+
+void delete_textures (int count, const GLuint* textures) {
+	int i, unit;
+	for (i = 0; i < count; i++) {
+		for (unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++) {
+			if (g_shadow.textures[unit] == textures[i]) {
+				g_shadow.textures[unit] = 0;
+			}
+		}
+	}
+	glDeleteTextures (count, textures);
+}
+
+void get_gl_state_stats (gl_state_stats_t* stats) {
+	*stats = g_stats;
+}
+
+void print_gl_state_stats (const gl_state_stats_t* since, int frames) {
+	long long requested[GL_STATE_KINDS], issued[GL_STATE_KINDS];
+	long long total_requested = 0, total_issued = 0;
+	double per_frame = frames > 0 ? 1.0 / frames : 0.0;
+	int k;
+
+	for (k = 0; k < GL_STATE_KINDS; k++) {
+		requested[k] = g_stats.requested[k] - since->requested[k];
+		issued[k] = g_stats.issued[k] - since->issued[k];
+		total_requested += requested[k];
+		total_issued += issued[k];
+	}
+	printf ("GL state cache: %lld of %lld calls avoided (%.1f%%) over %i frames, \
+%.2f of %.2f per frame\n", total_requested - total_issued, total_requested,
+		total_requested > 0 ? 100.0 * (total_requested - total_issued) /
+		total_requested : 0.0, frames, (total_requested - total_issued) *
+		per_frame, total_requested * per_frame);
+	for (k = 0; k < GL_STATE_KINDS; k++) {
+		if (requested[k] > 0) {
+			printf ("  %-15s %.2f of %.2f avoided per frame\n", kind_names[k],
+				(requested[k] - issued[k]) * per_frame, requested[k] * per_frame);
+		}
+	}
+}
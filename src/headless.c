@@ -0,0 +1,155 @@
+//
+// An OpenGL context with no window, drawing into a framebuffer object
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "headless.h"
+#include "threads.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef __linux__
+
+//
+// the surfaceless platform needs no display server. older EGLs without
+// eglGetPlatformDisplayEXT get the default display, which may want one
+static EGLDisplay get_display () {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress (
+		"eglGetPlatformDisplayEXT");
+
+	if (get_platform_display) {
+		EGLDisplay display = get_platform_display (EGL_PLATFORM_SURFACELESS_MESA,
+			EGL_DEFAULT_DISPLAY, NULL);
+		if (EGL_NO_DISPLAY != display) {
+			return display;
+		}
+	}
+	return eglGetDisplay (EGL_DEFAULT_DISPLAY);
+}
+
+static bool make_context (headless_t* hl) {
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLDisplay display = get_display ();
+	EGLConfig config;
+	EGLContext context;
+	EGLint major, minor, config_count = 0;
+
+	if (EGL_NO_DISPLAY == display || !eglInitialize (display, &major, &minor)) {
+		fprintf (stderr, "ERROR: could not start EGL (0x%x)\n", eglGetError ());
+		return false;
+	}
+	hl->display = display;
+	if (!eglBindAPI (EGL_OPENGL_API)) {
+		fprintf (stderr, "ERROR: EGL %i.%i has no desktop OpenGL\n", major,
+			minor);
+		return false;
+	}
+	if (!eglChooseConfig (display, config_attribs, &config, 1, &config_count) ||
+		config_count < 1) {
+		fprintf (stderr, "ERROR: no EGL config for OpenGL\n");
+		return false;
+	}
+	context = eglCreateContext (display, config, EGL_NO_CONTEXT, NULL);
+	if (EGL_NO_CONTEXT == context) {
+		fprintf (stderr, "ERROR: could not create EGL context (0x%x)\n",
+			eglGetError ());
+		return false;
+	}
+	hl->context = context;
+	// no surface: everything is drawn into the framebuffer object
+	if (!eglMakeCurrent (display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf (stderr, "ERROR: could not make the EGL context current \
+(0x%x)\n", eglGetError ());
+		return false;
+	}
+	return true;
+}
+
+static void free_context (headless_t* hl) {
+	if (!hl->display) {
+		return;
+	}
+	eglMakeCurrent (hl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		EGL_NO_CONTEXT);
+	if (hl->context) {
+		eglDestroyContext (hl->display, hl->context);
+	}
+	eglTerminate (hl->display);
+}
+
+#else
+
+static bool make_context (headless_t* hl) {
+	(void)hl;
+	fprintf (stderr, "ERROR: headless rendering needs EGL, which is only used \
+on Linux\n");
+	return false;
+}
+
+static void free_context (headless_t* hl) {
+	(void)hl;
+}
+
+#endif
+
+bool create_headless (headless_t* hl, int width, int height) {
+	double t0 = get_wall_time ();
+	GLenum status;
+
+	memset (hl, 0, sizeof (headless_t));
+	hl->width = width;
+	hl->height = height;
+	if (!make_context (hl)) {
+		free_headless (hl);
+		return false;
+	}
+	glewExperimental = GL_TRUE;
+	glewInit ();
+	hl->context_seconds = get_wall_time () - t0;
+	if (!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object) {
+		fprintf (stderr, "ERROR: headless rendering needs framebuffer objects\n");
+		free_headless (hl);
+		return false;
+	}
+	glGenFramebuffers (1, &hl->fbo);
+	glBindFramebuffer (GL_FRAMEBUFFER, hl->fbo);
+	glGenRenderbuffers (1, &hl->colour_rb);
+	glBindRenderbuffer (GL_RENDERBUFFER, hl->colour_rb);
+	glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, hl->colour_rb);
+	glGenRenderbuffers (1, &hl->depth_rb);
+	glBindRenderbuffer (GL_RENDERBUFFER, hl->depth_rb);
+	glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+		height);
+	glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, hl->depth_rb);
+	status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+	if (GL_FRAMEBUFFER_COMPLETE != status) {
+		fprintf (stderr, "ERROR: headless framebuffer %ix%i incomplete (0x%x)\n",
+			width, height, status);
+		free_headless (hl);
+		return false;
+	}
+	return true;
+}
+
+void free_headless (headless_t* hl) {
+	if (hl->fbo) {
+		glBindFramebuffer (GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers (1, &hl->fbo);
+		glDeleteRenderbuffers (1, &hl->colour_rb);
+		glDeleteRenderbuffers (1, &hl->depth_rb);
+	}
+	free_context (hl);
+	memset (hl, 0, sizeof (headless_t));
+}
@@ -0,0 +1,488 @@
+//
+// Re-load the viewed mesh when its file changes and re-upload what changed
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "hot_reload.h"
+#include "gl_state.h"
+#include "occlusion.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// points, tex coords, normals
+#define RELOAD_ARRAYS 3
+static const int array_components[RELOAD_ARRAYS] = { 3, 2, 3 };
+
+//
+// a re-parsed mesh on its way from the watcher to the GL thread
+typedef struct reload_job_t {
+	float* arrays[RELOAD_ARRAYS];
+	int point_count;
+	chunk_bvh_t bvh;
+	float* occluders;
+	int occluder_count;
+	unsigned long long* hashes[RELOAD_ARRAYS];
+	int hash_count[RELOAD_ARRAYS];
+	double parse_seconds;
+} reload_job_t;
+
+typedef struct block_ref_t {
+	int array;
+	int block;
+} block_ref_t;
+
+struct hot_reload_t {
+	char file_name[256];
+	int thread_count;
+	mesh_process_fn process;
+	GLuint vao;
+	// the buffers vao draws from, and how many points they hold
+	GLuint vbos[RELOAD_ARRAYS];
+	long long capacity[RELOAD_ARRAYS];
+	int point_count;
+	// hashes of what is in vbos now
+	unsigned long long* hashes[RELOAD_ARRAYS];
+	int hash_count[RELOAD_ARRAYS];
+	// the set updates are uploaded into, swapped with vbos when complete.
+	// holds the mesh from before the last swap, so only blocks that differ
+	// from that are sent
+	GLuint back_vbos[RELOAD_ARRAYS];
+	long long back_capacity[RELOAD_ARRAYS];
+	unsigned long long* back_hashes[RELOAD_ARRAYS];
+	int back_hash_count[RELOAD_ARRAYS];
+	int inotify_fd;
+	// written to wake the watcher up when stopping
+	int stop_pipe[2];
+	worker_group_t* watcher;
+	work_queue_t* results;
+	// the update being uploaded, if any
+	reload_job_t* active;
+	block_ref_t* pending;
+	int pending_count;
+	int cursor;
+	int frames;
+	double longest_slice_ms;
+	long long uploaded_bytes;
+	int total_blocks;
+};
+
+static long long array_bytes (int array, int point_count) {
+	return (long long)point_count * array_components[array] * sizeof (float);
+}
+
+#ifdef __linux__
+
+typedef struct hash_job_t {
+	const unsigned char* data;
+	long long bytes;
+	unsigned long long* hashes;
+} hash_job_t;
+
+static int block_count (long long bytes) {
+	return (int)((bytes + HOT_RELOAD_BLOCK_BYTES - 1) / HOT_RELOAD_BLOCK_BYTES);
+}
+
+static void hash_range (int begin, int end, int thread_idx, void* user) {
+	hash_job_t* job = (hash_job_t*)user;
+	int b;
+	for (b = begin; b < end; b++) {
+		long long offset = (long long)b * HOT_RELOAD_BLOCK_BYTES;
+		long long size = job->bytes - offset;
+		unsigned long long h = 0x9e3779b97f4a7c15ull ^ (unsigned long long)size;
+		long long i;
+		size = size < HOT_RELOAD_BLOCK_BYTES ? size : HOT_RELOAD_BLOCK_BYTES;
+		// floats come in 4-byte units, so hash 4 bytes at a time
+		for (i = 0; i + 4 <= size; i += 4) {
+			unsigned int w;
+			memcpy (&w, &job->data[offset + i], 4);
+			h = (h ^ w) * 0x100000001b3ull;
+			h ^= h >> 29;
+		}
+		job->hashes[b] = h;
+	}
+	(void)thread_idx;
+}
+
+static unsigned long long* hash_blocks (const float* data, long long bytes,
+	int thread_count, int* count) {
+	hash_job_t job;
+	*count = block_count (bytes);
+	job.data = (const unsigned char*)data;
+	job.bytes = bytes;
+	job.hashes = (unsigned long long*)malloc (*count *
+		sizeof (unsigned long long) + 1);
+	parallel_for (*count, thread_count, hash_range, &job);
+	return job.hashes;
+}
+
+static void free_reload_job (reload_job_t* job) {
+	int k;
+	if (!job) {
+		return;
+	}
+	for (k = 0; k < RELOAD_ARRAYS; k++) {
+		free (job->arrays[k]);
+		free (job->hashes[k]);
+	}
+	free_chunk_bvh (&job->bvh);
+	free (job->occluders);
+	free (job);
+}
+
+//
+// parse, chunk, pick occluders and hash the file on the watcher thread, so
+// the render thread only has to upload and swap
+static reload_job_t* reparse (hot_reload_t* hr) {
+	reload_job_t* job = (reload_job_t*)calloc (1, sizeof (reload_job_t));
+	vertex_streams_t streams;
+	double t0 = get_wall_time ();
+	bool ok;
+	int k;
+
+	ok = load_mesh_file (hr->file_name, hr->thread_count, hr->process,
+		&job->arrays[0], &job->arrays[1], &job->arrays[2], &job->point_count);
+	if (ok) {
+		separate_vertex_streams (job->arrays[0], job->arrays[1], job->arrays[2],
+			&streams);
+		ok = build_chunk_bvh (&streams, job->point_count, NULL,
+			hr->thread_count, &job->bvh);
+	}
+	if (!ok) {
+		fprintf (stderr, "ERROR: reloading %s failed. keeping the old mesh\n",
+			hr->file_name);
+		free_reload_job (job);
+		return NULL;
+	}
+	// after chunking, as that reorders the triangles
+	job->occluders = pick_occluders (job->arrays[0], 3, NULL,
+		job->point_count / 3, OCCLUSION_OCCLUDER_TRIANGLES, hr->thread_count,
+		&job->occluder_count);
+	for (k = 0; k < RELOAD_ARRAYS; k++) {
+		job->hashes[k] = hash_blocks (job->arrays[k], array_bytes (k,
+			job->point_count), hr->thread_count, &job->hash_count[k]);
+	}
+	job->parse_seconds = get_wall_time () - t0;
+	return job;
+}
+
+static void watcher_main (int worker_idx, void* user) {
+	hot_reload_t* hr = (hot_reload_t*)user;
+	const char* base = strrchr (hr->file_name, '/');
+	char events[4096];
+	bool dirty = false;
+
+	base = base ? base + 1 : hr->file_name;
+	for (;;) {
+		struct pollfd fds[2];
+		int ready;
+
+		fds[0].fd = hr->inotify_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = hr->stop_pipe[0];
+		fds[1].events = POLLIN;
+		// editors often write a file in several steps, so once something has
+		// changed wait until it has been quiet for a moment
+		ready = poll (fds, 2, dirty ? (int)(HOT_RELOAD_SETTLE_SECONDS * 1000.0) :
+			-1);
+		if (ready < 0 || (fds[1].revents & POLLIN)) {
+			break;
+		}
+		if (0 == ready && dirty) {
+			reload_job_t* job = reparse (hr);
+			dirty = false;
+			if (job && !work_queue_push (hr->results, job)) {
+				free_reload_job (job);
+				break;
+			}
+			continue;
+		}
+		if (fds[0].revents & POLLIN) {
+			ssize_t len = read (hr->inotify_fd, events, sizeof (events));
+			ssize_t i = 0;
+			while (len > 0 && i < len) {
+				const struct inotify_event* ev = (const struct inotify_event*)
+					&events[i];
+				// the directory is watched so that save-by-rename is seen too
+				if (ev->len > 0 && 0 == strcmp (ev->name, base)) {
+					dirty = true;
+				}
+				i += sizeof (struct inotify_event) + ev->len;
+			}
+		}
+	}
+	(void)worker_idx;
+}
+
+hot_reload_t* start_hot_reload (
+	const char* file_name,
+	GLuint vao,
+	const GLuint* vbos,
+	const float* points,
+	const float* tex_coords,
+	const float* normals,
+	int point_count,
+	int thread_count,
+	mesh_process_fn process
+) {
+	hot_reload_t* hr = (hot_reload_t*)calloc (1, sizeof (hot_reload_t));
+	const float* arrays[RELOAD_ARRAYS] = { points, tex_coords, normals };
+	char dir[256];
+	const char* slash = strrchr (file_name, '/');
+	int k;
+
+	strncpy (hr->file_name, file_name, sizeof (hr->file_name) - 1);
+	if (slash) {
+		size_t len = (size_t)(slash - file_name);
+		len = len < sizeof (dir) - 1 ? len : sizeof (dir) - 1;
+		memcpy (dir, file_name, len);
+		dir[len] = '\0';
+	} else {
+		strcpy (dir, ".");
+	}
+	hr->inotify_fd = inotify_init ();
+	if (hr->inotify_fd < 0 || inotify_add_watch (hr->inotify_fd, dir,
+		IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0 ||
+		0 != pipe (hr->stop_pipe)) {
+		fprintf (stderr, "ERROR: could not watch %s for changes\n", file_name);
+		if (hr->inotify_fd >= 0) {
+			close (hr->inotify_fd);
+		}
+		free (hr);
+		return NULL;
+	}
+	hr->thread_count = thread_count;
+	hr->process = process;
+	hr->vao = vao;
+	hr->point_count = point_count;
+	for (k = 0; k < RELOAD_ARRAYS; k++) {
+		hr->vbos[k] = vbos[k];
+		hr->capacity[k] = array_bytes (k, point_count);
+		hr->hashes[k] = hash_blocks (arrays[k], hr->capacity[k], thread_count,
+			&hr->hash_count[k]);
+	}
+	hr->results = create_work_queue (1);
+	hr->watcher = start_workers (1, watcher_main, hr);
+	printf ("watching %s for changes\n", file_name);
+	return hr;
+}
+
+void stop_hot_reload (hot_reload_t* hr) {
+	void* item = NULL;
+	char c = 0;
+	int k;
+
+	if (!hr) {
+		return;
+	}
+	if (1 != write (hr->stop_pipe[1], &c, 1)) {
+		fprintf (stderr, "WARNING: could not signal the file watcher\n");
+	}
+	// unblocks the watcher if it is waiting to hand over a result
+	work_queue_close (hr->results);
+	join_workers (hr->watcher);
+	while (work_queue_try_pop (hr->results, &item)) {
+		free_reload_job ((reload_job_t*)item);
+	}
+	free_reload_job (hr->active);
+	// 0s, if no update has happened yet, are ignored
+	delete_buffers (RELOAD_ARRAYS, hr->back_vbos);
+	destroy_work_queue (hr->results);
+	close (hr->inotify_fd);
+	close (hr->stop_pipe[0]);
+	close (hr->stop_pipe[1]);
+	for (k = 0; k < RELOAD_ARRAYS; k++) {
+		free (hr->hashes[k]);
+		free (hr->back_hashes[k]);
+	}
+	free (hr->pending);
+	free (hr);
+}
+
+#else
+
+hot_reload_t* start_hot_reload (
+	const char* file_name,
+	GLuint vao,
+	const GLuint* vbos,
+	const float* points,
+	const float* tex_coords,
+	const float* normals,
+	int point_count,
+	int thread_count,
+	mesh_process_fn process
+) {
+	fprintf (stderr, "ERROR: watching %s needs inotify, which is Linux only\n",
+		file_name);
+	(void)vao; (void)vbos; (void)points; (void)tex_coords; (void)normals;
+	(void)point_count; (void)thread_count; (void)process;
+	return NULL;
+}
+
+void stop_hot_reload (hot_reload_t* hr) {
+	(void)hr;
+}
+
+#endif
+
+//
+// make sure the back buffers can hold the new mesh. a buffer that is missing
+// or too small is replaced by a copy of the front one, so that blocks which
+// did not change still need not be sent. without buffer-to-buffer copies the
+// new buffer starts empty and every block is sent from the re-parsed arrays
+static void prepare_back_buffers (hot_reload_t* hr, int point_count) {
+	bool can_copy = GLEW_VERSION_3_1 || GLEW_ARB_copy_buffer;
+	int k;
+
+	for (k = 0; k < RELOAD_ARRAYS; k++) {
+		long long need = array_bytes (k, point_count);
+		long long copy = array_bytes (k, hr->point_count);
+		if (hr->back_vbos[k] && hr->back_capacity[k] >= need) {
+			continue;
+		}
+		delete_buffers (1, &hr->back_vbos[k]);
+		glGenBuffers (1, &hr->back_vbos[k]);
+		bind_array_buffer (hr->back_vbos[k]);
+		glBufferData (GL_ARRAY_BUFFER, need, NULL, GL_STATIC_DRAW);
+		hr->back_capacity[k] = need;
+		free (hr->back_hashes[k]);
+		hr->back_hashes[k] = NULL;
+		hr->back_hash_count[k] = 0;
+		if (!can_copy) {
+			continue;
+		}
+		copy = copy < need ? copy : need;
+		if (copy > 0) {
+			glBindBuffer (GL_COPY_READ_BUFFER, hr->vbos[k]);
+			glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, 0, copy);
+			glBindBuffer (GL_COPY_READ_BUFFER, 0);
+		}
+		hr->back_hash_count[k] = hr->hash_count[k];
+		hr->back_hashes[k] = (unsigned long long*)malloc (hr->hash_count[k] *
+			sizeof (unsigned long long) + 1);
+		memcpy (hr->back_hashes[k], hr->hashes[k], hr->hash_count[k] *
+			sizeof (unsigned long long));
+	}
+}
+
+//
+// decide which blocks to send. they all go into the back buffers, which vao
+// does not draw from, so frames keep showing the old mesh intact until the
+// swap in finish_update ()
+static void begin_update (hot_reload_t* hr, reload_job_t* job) {
+	int k, b;
+
+	hr->active = job;
+	prepare_back_buffers (hr, job->point_count);
+	hr->total_blocks = job->hash_count[0] + job->hash_count[1] +
+		job->hash_count[2];
+	hr->pending = (block_ref_t*)realloc (hr->pending, hr->total_blocks *
+		sizeof (block_ref_t) + 1);
+	hr->pending_count = 0;
+	for (k = 0; k < RELOAD_ARRAYS; k++) {
+		for (b = 0; b < job->hash_count[k]; b++) {
+			// a copied partial last block hashes differently from a full one
+			if (b >= hr->back_hash_count[k] ||
+				job->hashes[k][b] != hr->back_hashes[k][b]) {
+				hr->pending[hr->pending_count].array = k;
+				hr->pending[hr->pending_count].block = b;
+				hr->pending_count++;
+			}
+		}
+	}
+	hr->cursor = 0;
+	hr->frames = 0;
+	hr->longest_slice_ms = 0.0;
+	hr->uploaded_bytes = 0;
+}
+
+static void finish_update (hot_reload_t* hr, reloaded_mesh_t* finished) {
+	reload_job_t* job = hr->active;
+	int k;
+
+	// the old front set becomes the back set for the next update
+	bind_vertex_array (hr->vao);
+	for (k = 0; k < RELOAD_ARRAYS; k++) {
+		GLuint vbo = hr->vbos[k];
+		long long capacity = hr->capacity[k];
+		hr->vbos[k] = hr->back_vbos[k];
+		hr->capacity[k] = hr->back_capacity[k];
+		hr->back_vbos[k] = vbo;
+		hr->back_capacity[k] = capacity;
+		bind_array_buffer (hr->vbos[k]);
+		glVertexAttribPointer (k, array_components[k], GL_FLOAT, GL_FALSE, 0,
+			NULL);
+		free (hr->back_hashes[k]);
+		hr->back_hashes[k] = hr->hashes[k];
+		hr->back_hash_count[k] = hr->hash_count[k];
+		hr->hashes[k] = job->hashes[k];
+		hr->hash_count[k] = job->hash_count[k];
+		job->hashes[k] = NULL;
+	}
+	hr->point_count = job->point_count;
+	printf ("reloaded %s: %i triangles, %i/%i blocks changed (%.2f MB) over %i \
+frames, longest slice %.2fms, parse %.3fs\n", hr->file_name,
+		job->point_count / 3, hr->pending_count, hr->total_blocks,
+		hr->uploaded_bytes / (1024.0 * 1024.0), hr->frames, hr->longest_slice_ms,
+		job->parse_seconds);
+	finished->points = job->arrays[0];
+	finished->tex_coords = job->arrays[1];
+	finished->normals = job->arrays[2];
+	finished->point_count = job->point_count;
+	finished->bvh = job->bvh;
+	finished->occluders = job->occluders;
+	finished->occluder_count = job->occluder_count;
+	free (job);
+	hr->active = NULL;
+}
+
+bool update_hot_reload (
+	hot_reload_t* hr,
+	double budget_ms,
+	reloaded_mesh_t* finished
+) {
+	double t0 = get_wall_time (), slice_ms;
+
+	if (!hr) {
+		return false;
+	}
+	if (!hr->active) {
+		void* item = NULL;
+		if (!work_queue_try_pop (hr->results, &item)) {
+			return false;
+		}
+		begin_update (hr, (reload_job_t*)item);
+	}
+	// always make some progress, even on a tiny budget
+	do {
+		if (hr->cursor >= hr->pending_count) {
+			break;
+		}
+		{
+			const block_ref_t* ref = &hr->pending[hr->cursor++];
+			long long bytes = array_bytes (ref->array, hr->active->point_count);
+			long long offset = (long long)ref->block * HOT_RELOAD_BLOCK_BYTES;
+			long long size = bytes - offset;
+			size = size < HOT_RELOAD_BLOCK_BYTES ? size : HOT_RELOAD_BLOCK_BYTES;
+			bind_array_buffer (hr->back_vbos[ref->array]);
+			glBufferSubData (GL_ARRAY_BUFFER, offset, size,
+				(const unsigned char*)hr->active->arrays[ref->array] + offset);
+			hr->uploaded_bytes += size;
+		}
+	} while ((get_wall_time () - t0) * 1000.0 < budget_ms);
+	slice_ms = (get_wall_time () - t0) * 1000.0;
+	hr->longest_slice_ms = slice_ms > hr->longest_slice_ms ? slice_ms :
+		hr->longest_slice_ms;
+	hr->frames++;
+	if (hr->cursor < hr->pending_count) {
+		return false;
+	}
+	finish_update (hr, finished);
+	return true;
+}
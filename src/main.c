@@ -5,6 +5,30 @@
 //
 #include "maths_funcs.hpp"
 #include "obj_parser.h"
+#include "antialias.h"
+#include "bench.h"
+#include "capture.h"
+#include "chunk_bvh.h"
+#include "draw_batch.h"
+#include "frame_timer.h"
+#include "gl_state.h"
+#include "headless.h"
+#include "hot_reload.h"
+#include "mesh_batch.h"
+#include "mesh_clean.h"
+#include "mesh_codec.h"
+#include "mesh_stats.h"
+#include "mesh_utils.h"
+#include "mesh_weld.h"
+#include "occlusion.h"
+#include "octree.h"
+#include "png_writer.h"
+#include "poster.h"
+#include "soft_raster.h"
+#include "streamer.h"
+#include "thumbnails.h"
+#include "threads.h"
+#include "uniforms.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h" // https://github.com/nothings/stb/
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -34,21 +58,146 @@ char fs_file_name[256];
 // obj to load
 char obj_file_name[256];
 
+// every mesh given with -o or -list. more than one are loaded concurrently
+const char** mesh_file_names;
+int mesh_file_count = 0;
+
+// a VAO per mesh when several are loaded
+typedef struct scene_mesh_t {
+	GLuint vao;
+	int point_count;
+} scene_mesh_t;
+scene_mesh_t* scene_meshes = NULL;
+int scene_mesh_count = 0;
+
 // texture file
 char texture_file_name[256];
 
-// built-in anti-aliasing to smooth jagged diagonal edges of polygons
-int msaa_samples = 16;
-// NOTE: if too high grainy crap appears on polygon edges
+// worker threads for CPU-side mesh processing. 0 means all cores
+int thread_count = 0;
+
+// remove degenerate and duplicate triangles after loading
+bool clean_mesh = false;
+float clean_area_epsilon = MESH_AREA_EPSILON;
+
+// merge vertex positions closer than this. 0 means off
+float weld_tolerance = 0.0f;
+
+// GPU memory budget and LOD pixel tolerance when streaming an .oct file
+long long vram_budget_mb = 512;
+float lod_error_px = 2.0f;
+
+// draw only the chunks of the mesh inside the view frustum. toggle with C
+bool frustum_cull = true;
+
+// also skip chunks hidden behind the mesh's largest triangles. toggle with O
+bool occlusion_cull = false;
+
+// -instances NxMxK draws a grid of copies of the mesh. I switches between one
+// instanced draw and a draw per copy to compare frame times
+int instance_grid[3] = { 0, 0, 0 };
+int instance_count = 0;
+// a 64-byte matrix each, so 64MB of them
+#define MAX_INSTANCES (1024 * 1024)
+bool instanced_draws = true;
+// instanced arrays are GL 3.3 or ARB_instanced_arrays. without them only the
+// per-copy draws are used
+bool can_instance = true;
+
+// re-load the mesh when its file changes, uploading what changed a few
+// blocks a frame within this many milliseconds
+bool watch_file = false;
+double reload_budget_ms = 2.0;
+
+// keep each vertex's position, tex coord and normal together in one buffer,
+// INTERLEAVED_VERTEX_FLOATS apart, instead of one buffer per attribute
+bool interleaved_vertices = false;
+
+// expand the mesh straight into mapped vertex buffers instead of CPU arrays
+bool mapped_upload = false;
+
+// --layout-bench FRAMES draws the mesh this many frames from each layout
+int layout_bench_frames = 0;
+
+// -timings FILE measures CPU and GPU time per frame, shows percentiles in the
+// window title and writes every frame to FILE on exit
+frame_timer_t* frame_timer = NULL;
+char timings_file_name[256];
+
+// --bench FRAMES draws FRAMES frames along a camera path, -path FILE or a
+// built-in orbit and zoom, at a fixed timestep with vsync off, then prints
+// frame time statistics as JSON, also to -bench-out FILE if given
+#define BENCH_TIMESTEP (1.0 / 60.0)
+int bench_frames = 0;
+char camera_path_file_name[256];
+char bench_out_file_name[256];
+
+// --headless WxH draws into a framebuffer of that size with no window, then
+// writes it to -headless-out FILE and exits. one frame, or the --bench ones
+bool headless = false;
+char headless_out_file_name[256];
+
+// --poster WxH draws an image of that size, e.g. 32768x32768, to -poster-out
+// FILE without a window, in tiles the size of --headless or POSTER_TILE
+#define POSTER_TILE 1024
+int poster_width = 0;
+int poster_height = 0;
+char poster_out_file_name[256];
+
+// -renderer soft draws the --headless frames on the CPU with soft_raster, on
+// -threads threads, for machines with no GPU. no GL context is made
+bool soft_renderer = false;
+
+// --thumbnails DIR|LIST draws a -thumb-size square PNG of every mesh into
+// -thumb-out DIR without a window. meshes are parsed on -threads threads and
+// PNGs encoded on -encode-threads threads while this thread draws
+int thumbnail_size = 256;
+char thumbnail_dir_name[256];
+int encode_thread_count = 0;
+
+// -record DIR writes every frame to DIR/frame_000000.png, or .raw frames with
+// -record-raw, through a ring of RECORD_SLOTS read-back buffers and
+// -encode-threads writers
+#define RECORD_SLOTS 4
+char record_dir_name[256];
+bool record_raw = false;
+
+// how screenshots, --headless images and recorded frames are compressed:
+// -png-filter NAME and -png-level 0-9. --png-bench with --headless also
+// writes the image with stb_image_write and compares the times
+png_settings_t png_settings;
+bool png_bench = false;
+
+// window title without the frame timings
+char title_base[256];
+
+// draw state of a usemtl material. meshes with materials are sorted by these
+// and drawn a key at a time; key_states is indexed by key
+typedef struct material_state_t {
+	// 0 for the -tex texture
+	GLuint texture;
+	float kd[3];
+} material_state_t;
+material_state_t* key_states = NULL;
+draw_batches_t draw_batches;
+// the texture and colour set by the last batch drawn
+material_state_t current_state = { 0, { 1.0f, 1.0f, 1.0f } };
+GLint kd_loc = -1;
+
+// anti-aliasing to smooth jagged diagonal edges of polygons. -aa picks the
+// mode to start in and A cycles through them. 16x MSAA costs a lot of
+// bandwidth on integrated GPUs, so the default is 4x
+int aa_start_mode = AA_MSAA_4;
 
 //
-// check CL params for string. if found return argc value
-// returns 0 if not present
+// check CL params for string after argv[after]. if found return argc value
+// returns 0 if not present. repeated params can be walked with
+// param = check_next_param (s, param)
 // i stole this code from DOOM
-int check_param (const char* s) {
+int check_next_param (const char* s, int after) {
 	int i;
 
-	for (i = 1; i < my_argc; i++) {
+	for (i = after + 1; i < my_argc; i++) {
 		if (!strcasecmp (s, my_argv[i])) {
 			return i;
 		}
@@ -57,6 +206,13 @@ int check_param (const char* s) {
 	return 0;
 }
 
+//
+// check CL params for string. if found return argc value
+// returns 0 if not present
+int check_param (const char* s) {
+	return check_next_param (s, 0);
+}
+
 //
 // copy a shader from a plain text file into a character array
 bool parse_file_into_str (const char* file_name, char** shader_str) {
@@ -91,40 +247,1121 @@ bool parse_file_into_str (const char* file_name, char** shader_str) {
 }
 
 //
-// take screenshot with F11
-bool screencapture () {
+// compile and link a shader programme from two files, with attributes bound
+// as for basic.vert. returns 0 on failure
+GLuint create_programme_from_files (const char* vs_file, const char* fs_file) {
+	char* vertex_shader_str = NULL;
+	char* fragment_shader_str = NULL;
+	GLuint vs, fs, sp;
+	GLint linked = GL_FALSE;
+
+	if (!parse_file_into_str (vs_file, &vertex_shader_str)) {
+		return 0;
+	}
+	if (!parse_file_into_str (fs_file, &fragment_shader_str)) {
+		free (vertex_shader_str);
+		return 0;
+	}
+	vs = glCreateShader (GL_VERTEX_SHADER);
+	fs = glCreateShader (GL_FRAGMENT_SHADER);
+	glShaderSource (vs, 1, (const char**)&vertex_shader_str, NULL);
+	glShaderSource (fs, 1, (const char**)&fragment_shader_str, NULL);
+	free (vertex_shader_str);
+	free (fragment_shader_str);
+	glCompileShader (vs);
+	glCompileShader (fs);
+	sp = glCreateProgram ();
+	glAttachShader (sp, fs);
+	glAttachShader (sp, vs);
+	glBindAttribLocation (sp, 0, "vp");
+	glBindAttribLocation (sp, 1, "vt");
+	glBindAttribLocation (sp, 2, "vn");
+	glBindAttribLocation (sp, 3, "im");
+	glLinkProgram (sp);
+	glGetProgramiv (sp, GL_LINK_STATUS, &linked);
+	if (GL_TRUE != linked) {
+		fprintf (stderr, "ERROR: could not link %s and %s\n", vs_file, fs_file);
+		glDeleteProgram (sp);
+		return 0;
+	}
+	return sp;
+}
+
+//
+// run the requested -weld and -clean passes on an indexed mesh. welding goes
+// first since it can collapse triangles that -clean then removes
+void process_mesh (obj_mesh_t* mesh) {
+	if (weld_tolerance > 0.0f) {
+		mesh_weld_report_t report;
+		weld_obj_mesh (mesh, weld_tolerance, thread_count, &report);
+		print_mesh_weld_report (&report);
+	}
+	if (clean_mesh) {
+		mesh_clean_report_t report;
+		clean_obj_mesh (mesh, clean_area_epsilon, thread_count, &report);
+		print_mesh_clean_report (&report);
+	}
+}
+
+//
+// load an image into a new texture, bound to unit 0. returns 0 on failure
+GLuint load_texture (const char* file_name) {
+	int x,y,n;
+	unsigned char* data;
+	GLuint tex;
+	
+	data = stbi_load (file_name, &x, &y, &n, 4);
+	if (!data) {
+		fprintf (stderr, "ERROR: could not load image %s\n", file_name);
+		return 0;
+	}
+	printf ("loaded image with %ix%ipx and %i chans\n", x, y, n);
+	
+	// NPOT check
+	if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
+		fprintf (stderr, "WARNING: texture is not power-of-two dimensions %s\n",
+			file_name);
+	}
+
+	// FLIP UP-SIDE DIDDLY-DOWN
+	// make upside-down copy for GL
+	{
+		unsigned char *imagePtr = &data[0];
+		int halfTheHeightInPixels = y / 2;
+		int heightInPixels = y;
+
+		// Assuming RGBA for 4 components per pixel.
+		int numColorComponents = 4;
+		// Assuming each color component is an unsigned char.
+		int widthInChars = x * numColorComponents;
+		unsigned char *top = NULL;
+		unsigned char *bottom = NULL;
+		unsigned char temp = 0;
+		for (int h = 0; h < halfTheHeightInPixels; h++) {
+			top = imagePtr + h * widthInChars;
+			bottom = imagePtr + (heightInPixels - h - 1) * widthInChars;
+			for (int w = 0; w < widthInChars; w++) {
+				// Swap the chars around.
+				temp = *top;
+				*top = *bottom;
+				*bottom = temp;
+				++top;
+				++bottom;
+			}
+		}
+	}
+	
+	glGenTextures (1, &tex);
+	bind_texture_2d (0, tex);
+	glTexImage2D (
+		GL_TEXTURE_2D,
+		0,
+		GL_RGBA,
+		x,
+		y,
+		0,
+		GL_RGBA,
+		GL_UNSIGNED_BYTE,
+		data
+	);
+	stbi_image_free(data);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	return tex;
+}
+
+//
+// a file named relative to another one, e.g. an .mtl beside its .obj
+void path_beside (const char* file_name, const char* relative, char* out,
+	int out_size) {
+	const char* slash = strrchr (file_name, '/');
+	int dir_len = slash ? (int)(slash - file_name) + 1 : 0;
+
+	if ('/' == relative[0] || dir_len + (int)strlen (relative) >= out_size) {
+		dir_len = 0;
+	}
+	memcpy (out, file_name, dir_len);
+	strncpy (out + dir_len, relative, out_size - dir_len - 1);
+	out[out_size - 1] = '\0';
+}
+
+typedef struct material_sort_t {
+	material_state_t state;
+	int material;
+} material_sort_t;
+
+static int compare_material_states (const void* a, const void* b) {
+	const material_state_t* x = &((const material_sort_t*)a)->state;
+	const material_state_t* y = &((const material_sort_t*)b)->state;
+	int k;
+
+	// textures first, since binding one costs the most
+	if (x->texture != y->texture) {
+		return x->texture < y->texture ? -1 : 1;
+	}
+	for (k = 0; k < 3; k++) {
+		if (x->kd[k] != y->kd[k]) {
+			return x->kd[k] < y->kd[k] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static int compare_material_names (const void* a, const void* b) {
+	return strcmp (((const obj_material_t*)a)->name,
+		((const obj_material_t*)b)->name);
+}
+
+//
+// load the .mtl and textures of a mesh with usemtl groups and number the
+// distinct draw states in the order they should be drawn, filling key_states
+// and draw_batches. materials with the same texture and colour share a key.
+// returns each triangle's key, for sorting the triangles, or NULL if the mesh
+// has no materials. free with free ()
+int* prepare_materials (const obj_mesh_t* mesh) {
+	obj_material_t* library = NULL;
+	material_sort_t* sorted = NULL;
+	int* material_keys = NULL;
+	int* tri_keys = NULL;
+	char mtl_path[512], path[512];
+	char (*texture_names)[512] = NULL;
+	GLuint* textures = NULL;
+	int library_count = 0, texture_count = 0, key_count = 0, i, j;
+
+	mtl_path[0] = '\0';
+	if (!mesh->tri_material) {
+		return NULL;
+	}
+	if (mesh->mtllib[0]) {
+		path_beside (obj_file_name, mesh->mtllib, mtl_path, sizeof (mtl_path));
+		if (load_mtl_file (mtl_path, &library, &library_count)) {
+			qsort (library, library_count, sizeof (obj_material_t),
+				compare_material_names);
+		}
+	}
+	// entry 0 is for triangles before the first usemtl
+	sorted = (material_sort_t*)calloc (mesh->material_count + 1,
+		sizeof (material_sort_t));
+	textures = (GLuint*)malloc ((mesh->material_count + 1) * sizeof (GLuint));
+	texture_names = (char (*)[512])malloc ((mesh->material_count + 1) * 512);
+	for (i = 0; i <= mesh->material_count; i++) {
+		material_state_t* state = &sorted[i].state;
+		const obj_material_t* found = NULL;
+
+		sorted[i].material = i;
+		state->kd[0] = state->kd[1] = state->kd[2] = 1.0f;
+		if (i > 0 && library) {
+			obj_material_t key;
+			strncpy (key.name, mesh->material_names[i - 1], sizeof (key.name) - 1);
+			key.name[sizeof (key.name) - 1] = '\0';
+			found = (const obj_material_t*)bsearch (&key, library, library_count,
+				sizeof (obj_material_t), compare_material_names);
+		}
+		if (!found) {
+			continue;
+		}
+		memcpy (state->kd, found->kd, sizeof (state->kd));
+		if (!found->map_kd[0]) {
+			continue;
+		}
+		// materials often share textures. only load each file once
+		path_beside (mtl_path, found->map_kd, path, sizeof (path));
+		for (j = 0; j < texture_count; j++) {
+			if (0 == strcmp (texture_names[j], path)) {
+				break;
+			}
+		}
+		if (j == texture_count) {
+			strcpy (texture_names[texture_count], path);
+			textures[texture_count++] = load_texture (path);
+		}
+		state->texture = textures[j];
+	}
+	qsort (sorted, mesh->material_count + 1, sizeof (material_sort_t),
+		compare_material_states);
+	key_states = (material_state_t*)malloc ((mesh->material_count + 1) *
+		sizeof (material_state_t));
+	material_keys = (int*)malloc ((mesh->material_count + 1) * sizeof (int));
+	for (i = 0; i <= mesh->material_count; i++) {
+		if (0 == key_count || 0 != compare_material_states (&sorted[i],
+			&sorted[i - 1])) {
+			key_states[key_count++] = sorted[i].state;
+		}
+		material_keys[sorted[i].material] = key_count - 1;
+	}
+	tri_keys = (int*)malloc ((mesh->tri_count + 1) * sizeof (int));
+	for (i = 0; i < mesh->tri_count; i++) {
+		tri_keys[i] = material_keys[mesh->tri_material[i] + 1];
+	}
+	init_draw_batches (&draw_batches, tri_keys, mesh->tri_count, key_count);
+	printf ("materials: %i used, %i in library, %i textures, %i draw states\n",
+		mesh->material_count, library_count, texture_count, key_count);
+	free (library);
+	free (sorted);
+	free (textures);
+	free (texture_names);
+	free (material_keys);
+	return tri_keys;
+}
+
+//
+// draw vertex ranges, ascending, with one glMultiDrawArrays per material key.
+// a key's texture and colour are only set if the last batch's differ
+void draw_material_batches (const int* firsts, const int* counts,
+	int range_count, GLuint default_texture) {
+	int changes = 0, b;
+
+	batch_draw_ranges (&draw_batches, firsts, counts, range_count);
+	for (b = 0; b < draw_batches.batch_count; b++) {
+		const draw_batch_t* batch = &draw_batches.batches[b];
+		material_state_t state = key_states[batch->key];
+
+		if (!state.texture) {
+			state.texture = default_texture;
+		}
+		if (state.texture != current_state.texture) {
+			bind_texture_2d (0, state.texture);
+			current_state.texture = state.texture;
+			changes++;
+		}
+		if (kd_loc >= 0 && 0 != memcmp (state.kd, current_state.kd,
+			sizeof (state.kd))) {
+			glUniform3fv (kd_loc, 1, state.kd);
+			memcpy (current_state.kd, state.kd, sizeof (state.kd));
+			changes++;
+		}
+		glMultiDrawArrays (GL_TRIANGLES, &draw_batches.firsts[batch->first],
+			&draw_batches.counts[batch->first], batch->count);
+	}
+	add_batch_state_changes (&draw_batches, changes);
+}
+
+//
+// point attributes 0, 1, 2 (vp, vt, vn) of the bound VAO at the mesh's
+// buffers: vbos[0..2] for separate arrays, or vbos[0] alone if interleaved
+void set_vertex_attribs (const GLuint* vbos, bool interleaved) {
+	GLsizei stride = INTERLEAVED_VERTEX_FLOATS * sizeof (float);
+
+	glEnableVertexAttribArray (0);
+	glEnableVertexAttribArray (1);
+	glEnableVertexAttribArray (2);
+	if (interleaved) {
+		bind_array_buffer (vbos[0]);
+		glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, stride, NULL);
+		glVertexAttribPointer (1, 2, GL_FLOAT, GL_FALSE, stride,
+			(GLvoid*)(3 * sizeof (float)));
+		glVertexAttribPointer (2, 3, GL_FLOAT, GL_FALSE, stride,
+			(GLvoid*)(5 * sizeof (float)));
+		return;
+	}
+	bind_array_buffer (vbos[0]);
+	glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+	bind_array_buffer (vbos[1]);
+	glVertexAttribPointer (1, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+	bind_array_buffer (vbos[2]);
+	glVertexAttribPointer (2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+}
+
+//
+// copy a mesh into VBOs and return a VAO with vp, vt, vn at locations 0, 1, 2.
+// the VAO is left bound. vbos gets the 3 buffers if not NULL
+GLuint create_mesh_vao (const float* vp, const float* vt, const float* vn,
+	int point_count, GLuint* vbos) {
+	GLuint buffers[3], vao;
+
+	glGenBuffers (3, buffers);
+	bind_array_buffer (buffers[0]);
+	// copy our points from the header file into our VBO on graphics hardware
+	glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 3 * point_count, vp,
+		GL_STATIC_DRAW);
+	bind_array_buffer (buffers[1]);
+	glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 2 * point_count, vt,
+		GL_STATIC_DRAW);
+	bind_array_buffer (buffers[2]);
+	glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 3 * point_count, vn,
+		GL_STATIC_DRAW);
+
+	glGenVertexArrays (1, &vao);
+	bind_vertex_array (vao);
+	set_vertex_attribs (buffers, false);
+	if (vbos) {
+		memcpy (vbos, buffers, sizeof (buffers));
+	}
+	return vao;
+}
+
+//
+// copy an interleaved mesh into one VBO and return a VAO reading vp, vt, vn
+// at locations 0, 1, 2 from it. the VAO is left bound. vbo gets the buffer if
+// not NULL
+GLuint create_interleaved_vao (const float* vertices, int point_count,
+	GLuint* vbo) {
+	GLuint vertices_vbo, vao;
+
+	glGenBuffers (1, &vertices_vbo);
+	bind_array_buffer (vertices_vbo);
+	glBufferData (GL_ARRAY_BUFFER, sizeof (float) * INTERLEAVED_VERTEX_FLOATS *
+		point_count, vertices, GL_STATIC_DRAW);
+
+	glGenVertexArrays (1, &vao);
+	bind_vertex_array (vao);
+	set_vertex_attribs (&vertices_vbo, true);
+	if (vbo) {
+		*vbo = vertices_vbo;
+	}
+	return vao;
+}
+
+//
+// parse the mesh and expand it straight into mapped GL buffers, already in
+// chunked draw order, so there is never a CPU copy of the expanded vertices.
+// the chunks are worked out on the indexed mesh first. fills bvh and the
+// occluders and returns the VAO, left bound, or 0 on failure. upload_seconds
+// gets the time from creating the buffers until they are unmapped
+GLuint load_mesh_mapped (
+	const char* file_name,
+	int* point_count,
+	chunk_bvh_t* bvh,
+	occlusion_t* occlusion,
+	double* upload_seconds
+) {
+	obj_mesh_t mesh;
+	cmsh_mesh_t packed;
+	vertex_streams_t streams;
+	bool is_cmsh = is_cmsh_file_name (file_name);
+	const float* positions = NULL;
+	const unsigned int* indices = NULL;
+	float* mapped[3] = { NULL, NULL, NULL };
+	int buffer_floats[3] = { 3, 2, 3 };
+	int buffer_count = interleaved_vertices ? 1 : 3;
+	int stride = 3, tri_count = 0, k;
+	int* order = NULL;
+	int* tri_keys = NULL;
+	GLuint vbos[3], vao;
+	double t0;
+	bool ok = true;
+
+	if (is_cmsh) {
+		if (!load_cmsh_mesh (file_name, &packed, thread_count, NULL)) {
+			return 0;
+		}
+		positions = packed.vertices;
+		stride = CMSH_VERTEX_FLOATS;
+		indices = packed.indices;
+		tri_count = packed.index_count / 3;
+	} else {
+		if (!load_obj_mesh (file_name, &mesh, thread_count)) {
+			return 0;
+		}
+		process_mesh (&mesh);
+		tri_keys = prepare_materials (&mesh);
+		positions = mesh.vp;
+		// positions are never negative once parsed
+		indices = (const unsigned int*)mesh.ivp;
+		tri_count = mesh.tri_count;
+	}
+	*point_count = tri_count * 3;
+
+	order = (int*)malloc (tri_count * sizeof (int) + 1);
+	if (build_chunk_bvh_indexed (positions, stride, indices, tri_count,
+		tri_keys, thread_count, order, bvh)) {
+		if (is_cmsh) {
+			reorder_cmsh_triangles (&packed, order);
+		} else {
+			reorder_obj_mesh_triangles (&mesh, order);
+		}
+	}
+	free (order);
+	free (tri_keys);
+	select_occluders_indexed (occlusion, positions, stride, indices, tri_count,
+		OCCLUSION_OCCLUDER_TRIANGLES);
+
+	if (interleaved_vertices) {
+		buffer_floats[0] = INTERLEAVED_VERTEX_FLOATS;
+	}
+	t0 = get_wall_time ();
+	glGenBuffers (buffer_count, vbos);
+	for (k = 0; k < buffer_count; k++) {
+		GLsizeiptr bytes = sizeof (float) * buffer_floats[k] * (*point_count);
+		bind_array_buffer (vbos[k]);
+		glBufferData (GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+		mapped[k] = (float*)glMapBufferRange (GL_ARRAY_BUFFER, 0, bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		ok = ok && mapped[k];
+	}
+	if (ok) {
+		if (interleaved_vertices) {
+			interleaved_vertex_streams (mapped[0], &streams);
+		} else {
+			separate_vertex_streams (mapped[0], mapped[1], mapped[2], &streams);
+		}
+		// the worker threads write into the mapping. only this thread calls GL
+		if (is_cmsh) {
+			expand_cmsh_mesh_into (&packed, &streams, thread_count);
+		} else {
+			expand_obj_mesh_into (&mesh, &streams, thread_count);
+		}
+	} else {
+		fprintf (stderr, "ERROR: could not map vertex buffers\n");
+	}
+	for (k = 0; k < buffer_count; k++) {
+		bind_array_buffer (vbos[k]);
+		// false if the contents were lost while mapped, e.g. a mode change
+		if (mapped[k] && GL_FALSE == glUnmapBuffer (GL_ARRAY_BUFFER)) {
+			fprintf (stderr, "ERROR: vertex buffer corrupted while mapped\n");
+			ok = false;
+		}
+	}
+	glFinish ();
+	*upload_seconds = get_wall_time () - t0;
+	if (is_cmsh) {
+		free_cmsh_mesh (&packed);
+	} else {
+		free_obj_mesh (&mesh);
+	}
+	if (!ok) {
+		delete_buffers (buffer_count, vbos);
+		return 0;
+	}
+
+	glGenVertexArrays (1, &vao);
+	bind_vertex_array (vao);
+	set_vertex_attribs (vbos, interleaved_vertices);
+	return vao;
+}
+
+//
+// draw the same fixed view frames times from each VAO with vsync off and
+// report vertex throughput. vaos are the separate and interleaved layouts
+void run_layout_bench (GLFWwindow* window, const GLuint* vaos,
+	int point_count, int frames) {
+	const char* names[2] = { "separate", "interleaved" };
+	double ms[2];
+	int layout, i;
+
+	if (window) {
+		glfwSwapInterval (0);
+	}
+	for (layout = 0; layout < 2; layout++) {
+		double t0;
+		bind_vertex_array (vaos[layout]);
+		// warm up so buffer placement and shader compiles aren't timed
+		for (i = 0; i < 10; i++) {
+			glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glDrawArrays (GL_TRIANGLES, 0, point_count);
+			if (window) {
+				glfwSwapBuffers (window);
+			}
+		}
+		glFinish ();
+		t0 = get_wall_time ();
+		for (i = 0; i < frames; i++) {
+			glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glDrawArrays (GL_TRIANGLES, 0, point_count);
+			if (window) {
+				glfwSwapBuffers (window);
+				glfwPollEvents ();
+			}
+		}
+		glFinish ();
+		ms[layout] = (get_wall_time () - t0) * 1000.0 / frames;
+		printf ("%-12s %i frames %.3f ms/frame %.1f Mverts/s\n", names[layout],
+			frames, ms[layout], ms[layout] > 0.0 ? point_count / (ms[layout] *
+			1000.0) : 0.0);
+	}
+	printf ("%i vertices of %i bytes. interleaved/separate throughput %.3fx\n",
+		point_count, (int)(INTERLEAVED_VERTEX_FLOATS * sizeof (float)),
+		ms[1] > 0.0 ? ms[0] / ms[1] : 0.0);
+}
+
+//
+// parse every -o/-list file on the thread pool and upload each one on this
+// thread as soon as it is ready, while the rest are still parsing
+void load_scene_meshes () {
+	mesh_batch_t* batch = NULL;
+	loaded_mesh_t* mesh = NULL;
+	double t0 = get_wall_time (), parse_sum = 0.0, total;
+
+	scene_meshes = (scene_mesh_t*)calloc (mesh_file_count,
+		sizeof (scene_mesh_t));
+	batch = start_mesh_batch (mesh_file_names, mesh_file_count, thread_count,
+		process_mesh);
+	while ((mesh = next_loaded_mesh (batch))) {
+		double t1 = get_wall_time ();
+		if (!mesh->ok) {
+			fprintf (stderr, "ERROR: could not load %s\n", mesh->file_name);
+			free_loaded_mesh (mesh);
+			continue;
+		}
+		scene_meshes[scene_mesh_count].vao = create_mesh_vao (mesh->points,
+			mesh->tex_coords, mesh->normals, mesh->point_count, NULL);
+		scene_meshes[scene_mesh_count].point_count = mesh->point_count;
+		scene_mesh_count++;
+		parse_sum += mesh->parse_seconds;
+		printf ("  %s: %i triangles, parse %.3fs upload %.3fs\n",
+			mesh->file_name, mesh->point_count / 3, mesh->parse_seconds,
+			get_wall_time () - t1);
+		free_loaded_mesh (mesh);
+	}
+	finish_mesh_batch (batch);
+	total = get_wall_time () - t0;
+	// parse time summed over files vs. wall time is the parallel speedup
+	printf ("loaded %i/%i meshes in %.3fs on %i threads (%.3fs of parsing, \
+%.2fx)\n", scene_mesh_count, mesh_file_count, total,
+		resolve_thread_count (thread_count), parse_sum, total > 0.0 ? parse_sum /
+		total : 0.0);
+}
+
+//
+// column-major translations spreading copies of a mesh over a grid centred on
+// the origin, a little over one bounding box apart
+float* build_instance_grid (const float* bb_min, const float* bb_max) {
+	float* matrices = (float*)malloc (instance_count * 16 * sizeof (float));
+	float step[3];
+	int x, y, z, k, i = 0;
+
+	for (k = 0; k < 3; k++) {
+		step[k] = (bb_max[k] - bb_min[k]) * 1.25f;
+		step[k] = step[k] > 0.0f ? step[k] : 1.0f;
+	}
+	for (z = 0; z < instance_grid[2]; z++) {
+		for (y = 0; y < instance_grid[1]; y++) {
+			for (x = 0; x < instance_grid[0]; x++) {
+				float* m = &matrices[i * 16];
+				memset (m, 0, 16 * sizeof (float));
+				m[0] = m[5] = m[10] = m[15] = 1.0f;
+				m[12] = ((float)x - (instance_grid[0] - 1) * 0.5f) * step[0];
+				m[13] = ((float)y - (instance_grid[1] - 1) * 0.5f) * step[1];
+				m[14] = ((float)z - (instance_grid[2] - 1) * 0.5f) * step[2];
+				i++;
+			}
+		}
+	}
+	return matrices;
+}
+
+//
+// the per-instance matrix im takes attribute locations 3 to 6. when those
+// arrays are off, shaders see these current values, i.e. identity
+void set_identity_instance_attribs () {
+	glVertexAttrib4f (3, 1.0f, 0.0f, 0.0f, 0.0f);
+	glVertexAttrib4f (4, 0.0f, 1.0f, 0.0f, 0.0f);
+	glVertexAttrib4f (5, 0.0f, 0.0f, 1.0f, 0.0f);
+	glVertexAttrib4f (6, 0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+//
+// set the window title. with -timings the frame time percentiles follow it
+void set_window_title (GLFWwindow* window, const char* title) {
+	char full[512];
+
+	if (title != title_base) {
+		strncpy (title_base, title, sizeof (title_base) - 1);
+	}
+	if (!window) {
+		return;
+	}
+	if (!frame_timer || !timings_file_name[0]) {
+		glfwSetWindowTitle (window, title_base);
+		return;
+	}
+	{
+		frame_time_stats_t stats;
+		get_frame_time_stats (frame_timer, &stats);
+		sprintf (full, "%s | p50/95/99 cpu %.2f/%.2f/%.2f ms", title_base,
+			stats.cpu_p50, stats.cpu_p95, stats.cpu_p99);
+		if (stats.gpu_samples > 0) {
+			sprintf (full + strlen (full), " gpu %.2f/%.2f/%.2f ms", stats.gpu_p50,
+				stats.gpu_p95, stats.gpu_p99);
+		}
+	}
+	glfwSetWindowTitle (window, full);
+}
+
+//
+// take screenshot with F11. file_name NULL picks a name from the time
+bool screencapture (const char* file_name) {
 	unsigned char* buffer = (unsigned char*)malloc (gl_width * gl_height * 3);
+	// rows of odd widths aren't a multiple of 4 bytes
+	glPixelStorei (GL_PACK_ALIGNMENT, 1);
 	glReadPixels (0, 0, gl_width, gl_height, GL_RGB, GL_UNSIGNED_BYTE, buffer);
 	char name[1024];
-	long int t = time (NULL);
-	sprintf (name, "screenshot_%ld.png", t);
+	if (file_name) {
+		strncpy (name, file_name, sizeof (name) - 1);
+		name[sizeof (name) - 1] = '\0';
+	} else {
+		long int t = time (NULL);
+		sprintf (name, "screenshot_%ld.png", t);
+	}
 	unsigned char* last_row = buffer + (gl_width * 3 * (gl_height - 1));
-	if (!stbi_write_png (name, gl_width, gl_height, 3, last_row, -3 * gl_width)) {
+	if (!write_png (name, gl_width, gl_height, 3, last_row, -3 * gl_width,
+		&png_settings)) {
 		fprintf (stderr, "ERROR: could not write screenshot file %s\n", name);
+		free (buffer);
+		return false;
+	}
+	free (buffer);
+	return true;
+}
+
+long file_bytes (const char* file_name) {
+	FILE* fp = fopen (file_name, "rb");
+	long bytes = 0;
+	if (fp) {
+		fseek (fp, 0, SEEK_END);
+		bytes = ftell (fp);
+		fclose (fp);
+	}
+	return bytes;
+}
+
+//
+// write the framebuffer to file_name with stb_image_write, then with
+// png_writer on one thread and on -threads threads, and print how long each
+// took
+void run_png_bench (const char* file_name) {
+	unsigned char* buffer = (unsigned char*)malloc (gl_width * gl_height * 3);
+	unsigned char* last_row = buffer + (gl_width * 3 * (gl_height - 1));
+	png_settings_t settings = png_settings;
+	double t0, stb_ms, ms[2];
+	long stb_bytes, bytes[2];
+	int threads[2], passes, pass;
+
+	glPixelStorei (GL_PACK_ALIGNMENT, 1);
+	glReadPixels (0, 0, gl_width, gl_height, GL_RGB, GL_UNSIGNED_BYTE, buffer);
+	t0 = get_wall_time ();
+	stbi_write_png (file_name, gl_width, gl_height, 3, last_row, -3 * gl_width);
+	stb_ms = (get_wall_time () - t0) * 1000.0;
+	stb_bytes = file_bytes (file_name);
+	threads[0] = 1;
+	threads[1] = resolve_thread_count (png_settings.thread_count);
+	passes = threads[1] > 1 ? 2 : 1;
+	for (pass = 0; pass < passes; pass++) {
+		settings.thread_count = threads[pass];
+		t0 = get_wall_time ();
+		write_png (file_name, gl_width, gl_height, 3, last_row, -3 * gl_width,
+			&settings);
+		ms[pass] = (get_wall_time () - t0) * 1000.0;
+		bytes[pass] = file_bytes (file_name);
+	}
+	printf ("png bench %ix%i, %s filter, level %i:\n", gl_width, gl_height,
+		png_filter_name (settings.filter), settings.level);
+	printf ("  stb_image_write      %8.1f ms %10li bytes\n", stb_ms, stb_bytes);
+	for (pass = 0; pass < passes; pass++) {
+		printf ("  png_writer %2i thread%s %8.1f ms %10li bytes %5.2fx faster\n",
+			threads[pass], 1 == threads[pass] ? " " : "s", ms[pass], bytes[pass],
+			ms[pass] > 0.0 ? stb_ms / ms[pass] : 0.0);
 	}
 	free (buffer);
+}
+
+//
+// what each thumbnail is drawn with, made once for the whole batch
+typedef struct thumbnail_gl_t {
+	headless_t hl;
+	antialias_t aa;
+	GLuint programme;
+	program_uniforms_t uniforms;
+	transforms_t transforms;
+	GLuint vbos[3];
+	GLuint vao;
+} thumbnail_gl_t;
+
+//
+// fit the mesh's bounding sphere to the view, looking down on it from the
+// front right, and read the frame back. runs on the GL thread
+bool render_thumbnail (
+	const loaded_mesh_t* mesh,
+	const float* centre,
+	float radius,
+	unsigned char* rgb,
+	void* user
+) {
+	thumbnail_gl_t* gl = (thumbnail_gl_t*)user;
+	float s = 1.0f / radius;
+	mat4 M = scale (translate (identity_mat4 (), vec3 (-centre[0], -centre[1],
+		-centre[2])), vec3 (s, s, s));
+
+	// the same buffers every time; the driver can recycle the storage
+	bind_array_buffer (gl->vbos[0]);
+	glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 3 * mesh->point_count,
+		mesh->points, GL_STREAM_DRAW);
+	bind_array_buffer (gl->vbos[1]);
+	glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 2 * mesh->point_count,
+		mesh->tex_coords, GL_STREAM_DRAW);
+	bind_array_buffer (gl->vbos[2]);
+	glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 3 * mesh->point_count,
+		mesh->normals, GL_STREAM_DRAW);
+	set_model_matrix (&gl->transforms, M.m);
+	use_program (gl->programme);
+	apply_transforms (&gl->transforms, &gl->uniforms);
+	begin_antialiased_frame (&gl->aa);
+	set_capability (GL_DEPTH_TEST, true);
+	set_capability (GL_BLEND, false);
+	set_polygon_mode (GL_FILL);
+	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	bind_vertex_array (gl->vao);
+	glDrawArrays (GL_TRIANGLES, 0, mesh->point_count);
+	end_antialiased_frame (&gl->aa);
+	glPixelStorei (GL_PACK_ALIGNMENT, 1);
+	glReadPixels (0, 0, gl->hl.width, gl->hl.height, GL_RGB, GL_UNSIGNED_BYTE,
+		rgb);
 	return true;
 }
 
+//
+// --thumbnails: a PNG for every mesh in a directory or list file
+int run_thumbnails (const char* source) {
+	thumbnail_gl_t gl;
+	thumbnail_stats_t stats;
+	char** names = NULL;
+	int count;
+	GLuint texture;
+	mat4 V, P;
+	vec3 cam_dir = normalise (vec3 (1.0f, 0.6f, 1.6f));
+	const float white[3] = { 1.0f, 1.0f, 1.0f };
+
+	if (is_directory (source)) {
+		count = read_mesh_directory (source, &names);
+	} else {
+		count = read_file_list (source, &names);
+	}
+	if (count < 0) {
+		return 1;
+	}
+	if (!create_headless (&gl.hl, thumbnail_size, thumbnail_size)) {
+		free_file_list (names, count);
+		return 1;
+	}
+	printf ("Renderer: %s\n", glGetString (GL_RENDERER));
+	gl.programme = create_programme_from_files (vs_file_name, fs_file_name);
+	texture = load_texture (texture_file_name);
+	if (!gl.programme || !texture) {
+		free_headless (&gl.hl);
+		free_file_list (names, count);
+		return 1;
+	}
+	init_program_uniforms (&gl.uniforms, gl.programme);
+	kd_loc = glGetUniformLocation (gl.programme, "Kd");
+	use_program (gl.programme);
+	if (kd_loc >= 0) {
+		glUniform3fv (kd_loc, 1, white);
+	}
+	bind_texture_2d (0, texture);
+	// a sphere of radius 1 just fits the 67 degree view from 1.8 away
+	V = look_at (cam_dir * 1.9f, vec3 (0.0f, 0.0f, 0.0f), vec3 (0.0f, 1.0f,
+		0.0f));
+	P = perspective (67.0f, 1.0f, 0.1f, 10.0f);
+	init_transforms (&gl.transforms);
+	set_view_matrix (&gl.transforms, V.m);
+	set_projection_matrix (&gl.transforms, P.m);
+	glGenBuffers (3, gl.vbos);
+	glGenVertexArrays (1, &gl.vao);
+	bind_vertex_array (gl.vao);
+	set_vertex_attribs (gl.vbos, false);
+	set_identity_instance_attribs ();
+	create_antialias (&gl.aa, 0, aa_start_mode, thumbnail_size,
+		thumbnail_size);
+	set_antialias_target (&gl.aa, gl.hl.fbo);
+	set_viewport (0, 0, thumbnail_size, thumbnail_size);
+	// meshes from anywhere wind their triangles either way; show both sides
+	set_capability (GL_CULL_FACE, false);
+	glClearColor (0.5, 0.5, 0.8, 1.0);
+
+	make_thumbnails ((const char**)names, count, thumbnail_dir_name,
+		thumbnail_size, thread_count, encode_thread_count, process_mesh,
+		render_thumbnail, &gl, &stats);
+	print_thumbnail_stats (&stats);
+
+	free_antialias (&gl.aa);
+	delete_vertex_arrays (1, &gl.vao);
+	delete_buffers (3, gl.vbos);
+	delete_textures (1, &texture);
+	glDeleteProgram (gl.programme);
+	free_headless (&gl.hl);
+	free_file_list (names, count);
+	return stats.written == count ? 0 : 1;
+}
+
+//
+// --bench JSON to stdout, and to -bench-out FILE if given
+void write_bench_results (const bench_result_t* result) {
+	write_bench_json (stdout, result);
+	if (bench_out_file_name[0]) {
+		FILE* fp = fopen (bench_out_file_name, "w");
+		if (fp) {
+			write_bench_json (fp, result);
+			fclose (fp);
+		} else {
+			fprintf (stderr, "ERROR: could not open %s for writing\n",
+				bench_out_file_name);
+		}
+	}
+}
+
+//
+// the model's spin and the camera. both renderers step this the same way every
+// frame, so GL and -renderer soft draw the same frames, e.g. under --bench
+typedef struct frame_view_t {
+	mat4 T, S, M, V;
+	vec3 cam_pos, targ_pos, up;
+	// followed under --bench, otherwise NULL
+	const camera_path_t* camera_path;
+	float spin_deg;
+	double prev_clock;
+	// seconds on the frame's timeline, and since the previous frame
+	double time;
+	double elapsed;
+} frame_view_t;
+
+void init_frame_view (frame_view_t* view, float scalef, vec3 vtra) {
+	view->T = translate (identity_mat4 (), vtra);
+	view->S = scale (identity_mat4 (), vec3 (scalef, scalef, scalef));
+	view->M = view->T * view->S;
+	view->cam_pos = vec3 (0.0, 0.0, 5.0);
+	view->targ_pos = vec3 (0.0, 0.0, 0.0);
+	view->up = vec3 (0.0, 1.0, 0.0);
+	view->V = look_at (view->cam_pos, view->targ_pos, view->up);
+	view->camera_path = NULL;
+	view->spin_deg = 0.0f;
+	view->prev_clock = view->time = view->elapsed = 0.0;
+}
+
+//
+// step to frame number frame at clock seconds. the model spins by the time
+// since the last frame, except that without a window it holds still so every
+// run draws the same. under --bench time goes up by BENCH_TIMESTEP a frame
+// and the camera follows the path. sets M and V in transforms
+void advance_frame_view (
+	frame_view_t* view,
+	int frame,
+	double clock,
+	bool moving,
+	transforms_t* transforms
+) {
+	view->time = clock;
+	view->elapsed = moving ? clock - view->prev_clock : 0.0;
+	view->prev_clock = clock;
+	if (view->camera_path) {
+		// a fixed timestep so every run draws exactly the same frames
+		view->time = frame * BENCH_TIMESTEP;
+		view->elapsed = BENCH_TIMESTEP;
+		sample_camera_path (view->camera_path, (float)view->time,
+			view->cam_pos.v, view->targ_pos.v);
+		view->V = look_at (view->cam_pos, view->targ_pos, view->up);
+		set_view_matrix (transforms, view->V.m);
+	}
+	view->spin_deg += sinf (view->elapsed * 50.0f);
+	view->M = view->T * rotate_y_deg (view->S, view->spin_deg);
+	set_model_matrix (transforms, view->M.m);
+}
+
+//
+// -renderer soft: the --headless frame, or the --bench ones, drawn by
+// soft_raster with what the GL path would use, then written to -headless-out
+int run_soft_render (float scalef, vec3 vtra) {
+	soft_raster_t* sr = NULL;
+	soft_raster_stats_t stats;
+	soft_texture_t texture;
+	transforms_t transforms;
+	camera_path_t camera_path;
+	frame_view_t view;
+	char renderer_name[64];
+	double* frame_seconds = NULL;
+	float* vp = NULL;
+	float* vt = NULL;
+	float* vn = NULL;
+	unsigned char* rgba = NULL;
+	unsigned char* rgb = NULL;
+	const float white[3] = { 1.0f, 1.0f, 1.0f };
+	int point_count = 0, frames = bench_frames > 0 ? bench_frames : 1;
+	int frame, n;
+	double start_time = get_wall_time (), loop_start, loop_end, t0;
+	double write_seconds;
+	mat4 P;
+	bool ok;
+
+	if (mesh_file_count > 1 || is_octree_file_name (obj_file_name)) {
+		fprintf (stderr, "ERROR: -renderer soft draws one .obj or .cmsh mesh\n");
+		return 1;
+	}
+	if (!load_mesh_file (obj_file_name, thread_count, process_mesh, &vp, &vt,
+		&vn, &point_count)) {
+		return 1;
+	}
+	// soft_texture_t wants the rows as stbi_load () gives them
+	rgba = stbi_load (texture_file_name, &texture.width, &texture.height, &n,
+		4);
+	if (!rgba) {
+		fprintf (stderr, "ERROR: could not load image %s\n", texture_file_name);
+		free (vp);
+		free (vt);
+		free (vn);
+		return 1;
+	}
+	texture.rgba = rgba;
+	sr = create_soft_raster (gl_width, gl_height, thread_count);
+	if (!sr) {
+		stbi_image_free (rgba);
+		free (vp);
+		free (vt);
+		free (vn);
+		return 1;
+	}
+	sprintf (renderer_name, "software rasteriser, %i thread%s",
+		soft_raster_thread_count (sr), 1 == soft_raster_thread_count (sr) ? "" :
+		"s");
+	printf ("Renderer: %s\n", renderer_name);
+
+	// as main () sets them up for a window-less frame
+	init_frame_view (&view, scalef, vtra);
+	P = perspective (67.0f, (float)gl_width / (float)gl_height, 0.1, 1000.0);
+	init_transforms (&transforms);
+	set_model_matrix (&transforms, view.M.m);
+	set_view_matrix (&transforms, view.V.m);
+	set_projection_matrix (&transforms, P.m);
+	if (bench_frames > 0) {
+		if (camera_path_file_name[0]) {
+			if (!load_camera_path (camera_path_file_name, &camera_path)) {
+				free_soft_raster (sr);
+				stbi_image_free (rgba);
+				free (vp);
+				free (vt);
+				free (vn);
+				return 1;
+			}
+		} else {
+			default_camera_path (view.cam_pos.v, view.targ_pos.v, &camera_path);
+		}
+		view.camera_path = &camera_path;
+		frame_seconds = (double*)malloc (bench_frames * sizeof (double));
+	}
+
+	loop_start = get_wall_time ();
+	for (frame = 0; frame < frames; frame++) {
+		t0 = get_wall_time ();
+		advance_frame_view (&view, frame, t0 - loop_start, false, &transforms);
+		clear_soft_raster (sr, 0.5f, 0.5f, 0.8f);
+		draw_soft_triangles (sr, &transforms, vp, vt, vn, point_count, &texture,
+			white);
+		if (frame_seconds) {
+			frame_seconds[frame] = get_wall_time () - t0;
+		}
+	}
+	loop_end = get_wall_time ();
+
+	t0 = get_wall_time ();
+	rgb = (unsigned char*)malloc ((size_t)gl_width * gl_height * 3);
+	read_soft_raster_rgb (sr, rgb);
+	ok = write_png (headless_out_file_name, gl_width, gl_height, 3, rgb +
+		(size_t)gl_width * 3 * (gl_height - 1), -3 * gl_width, &png_settings);
+	write_seconds = get_wall_time () - t0;
+	if (!ok) {
+		fprintf (stderr, "ERROR: could not write %s\n", headless_out_file_name);
+	}
+
+	get_soft_raster_stats (sr, &stats);
+	printf ("soft: %i frames, mean %.2f ms (transform and bin %.2f, raster \
+%.2f), write %.1f ms\n", frames, (loop_end - loop_start) * 1000.0 / frames,
+		stats.setup_seconds * 1000.0 / frames, stats.raster_seconds * 1000.0 /
+		frames, write_seconds * 1000.0);
+	printf ("soft: %.1f Mtri/s, %.1f Mpixel/s shaded. per frame %lli \
+triangles, %lli culled, %lli clipped, %.2f tiles each\n",
+		loop_end > loop_start ? stats.triangles_in / (loop_end - loop_start) *
+		1e-6 : 0.0, loop_end > loop_start ? stats.pixels_shaded / (loop_end -
+		loop_start) * 1e-6 : 0.0, stats.triangles_in / frames,
+		stats.triangles_culled / frames, stats.triangles_clipped / frames,
+		stats.triangles_binned > 0 ? (double)stats.bin_entries /
+		stats.triangles_binned : 0.0);
+	printf ("soft: start to image %.3fs\n", get_wall_time () - start_time);
+	if (bench_frames > 0) {
+		bench_result_t result;
+		result.mesh_name = obj_file_name;
+		result.renderer = renderer_name;
+		result.frame_seconds = frame_seconds;
+		result.frame_count = frames;
+		result.timestep = BENCH_TIMESTEP;
+		result.triangles = stats.triangles_in;
+		result.total_seconds = loop_end - loop_start;
+		write_bench_results (&result);
+		free_camera_path (&camera_path);
+		free (frame_seconds);
+	}
+
+	free (rgb);
+	free_soft_raster (sr);
+	stbi_image_free (rgba);
+	free (vp);
+	free (vt);
+	free (vn);
+	return ok ? 0 : 1;
+}
+
 int main (int argc, char** argv) {
+	double start_time = get_wall_time ();
 	GLFWwindow* window = NULL;
+	headless_t hl;
+	// frames drawn without a window, and the times the report needs
+	int headless_frame = 0, headless_frames = 1;
+	double loop_start = 0.0, loop_end = 0.0, first_frame_seconds = 0.0;
 	const GLubyte* renderer;
 	const GLubyte* version;
-	GLuint shader_programme, normals_sp;
-	int M_loc, V_loc, P_loc, time_loc;
-	int normals_M_loc, normals_V_loc, normals_P_loc;
-	GLuint vao;
+	GLuint shader_programme, normals_sp, fxaa_sp;
+	antialias_t aa;
+	// F11 screenshots, read back and written without stalling the frame
+	capture_t* capture = NULL;
+	// --poster draws a tile a frame, each with its part of poster_P
+	poster_t* poster = NULL;
+	bool screenshot_requested = false;
+	int record_frame = 0;
+	double record_start = 0.0;
+	const GLenum poly_modes[3] = { GL_FILL, GL_LINE, GL_POINT };
+	int time_loc;
+	transforms_t transforms;
+	program_uniforms_t basic_uniforms, normals_uniforms;
+	// the uniforms of whichever programme is drawing this frame
+	program_uniforms_t* frame_uniforms = &basic_uniforms;
+	GLuint vao = 0;
+	// the -tex texture, for meshes and materials without their own
+	GLuint default_texture = 0;
+	// separate and interleaved layouts of the mesh for --layout-bench
+	GLuint bench_vaos[2] = { 0, 0 };
 	int point_count = 0;
+	streamer_t* streamer = NULL;
+	double title_time = 0.0;
+	double timings_title_time = 0.0;
+	camera_path_t camera_path;
+	double* bench_frame_seconds = NULL;
+	double bench_start = 0.0, bench_last = 0.0;
+	long long bench_triangles = 0, frame_triangles = 0;
+	int bench_frame = 0;
+	// every frame drawn, and the GL state calls before the first
+	int frames_drawn = 0;
+	gl_state_stats_t loop_gl_stats;
+	chunk_bvh_t bvh;
+	int* cull_firsts = NULL;
+	int* cull_counts = NULL;
+	occlusion_t occlusion;
+	float* instance_matrices = NULL;
+	hot_reload_t* hot_reload = NULL;
+	double frame_seconds[2] = { 0.0, 0.0 };
+	int frame_counts[2] = { 0, 0 };
+	double window_seconds = 0.0;
+	int window_frames = 0;
 	int param = 0;
-	float a = 0.0f;
 	float scalef = 1.0f;
-	double prev;
 	vec3 vtra = vec3 (0.0f, 0.0f, 0.0f);
 	char win_title[256];
 	bool normals_mode = false;
 	bool npressed = false;
 	bool f11pressed = false;
 	bool ppressed = false;
+	bool cpressed = false;
+	bool opressed = false;
+	bool ipressed = false;
+	bool apressed = false;
 	int poly_mode = 0;
 	
 	my_argc = argc;
@@ -135,63 +1372,434 @@ int main (int argc, char** argv) {
 		printf ("\nOpenGL .obj Viewer.\nAnton Gerdelan 21 Dec 2014 @capnramses\n\n");
 		printf ("usage: ./viewer [-o FILE] [-t FILE] [-vs FILE] [-fs FILE]\n\n");
 		printf ("--help\t\t\tthis text\n");
-		printf ("-o FILE\t\t\t.obj to load\n");
+		printf ("-o FILE\t\t\t.obj, .cmsh or .oct to load. repeat for more\n");
+		printf ("-list FILE\t\ttext file naming meshes to load, one a line\n");
 		printf ("-sca FLOAT\t\tscale mesh uniformly by this factor\n");
 		printf ("-tra FLOAT FLOAT FLOAT\ttranslate mesh by X Y Z\n");
 		printf ("-tex FILE\t\timage to use as texture\n");
 		printf ("-vs FILE\t\tvertex shader to use\n");
 		printf ("-fs FILE\t\tfragment shader to use\n");
+		printf ("-threads INT\t\tthreads for mesh processing (default all)\n");
+		printf ("--stats\t\t\tprint mesh analysis and exit. no window\n");
+		printf ("-clean\t\t\tremove degenerate and duplicate triangles\n");
+		printf ("-eps FLOAT\t\tzero-area threshold for -clean (relative)\n");
+		printf ("-weld FLOAT\t\tmerge positions closer than this distance\n");
+		printf ("--pack FILE\t\twrite the mesh as compressed .cmsh and exit\n");
+		printf ("--chunk FILE\t\twrite the mesh as an .oct octree and exit\n");
+		printf ("-vram MB\t\tGPU budget when streaming an .oct (512)\n");
+		printf ("-lod-px FLOAT\t\tLOD error tolerance in pixels (2)\n");
+		printf ("-nocull\t\t\tstart with frustum culling off\n");
+		printf ("-occlude\t\tstart with occlusion culling on\n");
+		printf ("-instances NxMxK\tdraw a grid of copies of the mesh\n");
+		printf ("-watch\t\t\treload the mesh when its file changes\n");
+		printf ("-interleaved\t\tone VBO with all attributes of a vertex together\n");
+		printf ("--layout-bench INT\tdraw INT frames from each layout and exit\n");
+		printf ("-mapped\t\t\texpand the mesh straight into mapped buffers\n");
+		printf ("-timings FILE\t\tframe time percentiles, all frames to CSV\n");
+		printf ("--bench INT\t\tdraw INT frames on a camera path, print JSON\n");
+		printf ("-path FILE\t\tcamera path for --bench\n");
+		printf ("-bench-out FILE\t\talso write the --bench JSON to a file\n");
+		printf ("-aa MODE\t\tanti-aliasing off, 2, 4, 8, 16 (MSAA) or fxaa\n");
+		printf ("--headless WxH\t\tdraw with no window into a WxH image and exit\n");
+		printf ("-headless-out FILE\tPNG for --headless (headless.png)\n");
+		printf ("--poster WxH\t\tdraw a WxH PNG in tiles of the --headless size\n");
+		printf ("-poster-out FILE\tPNG for --poster (poster.png)\n");
+		printf ("-renderer NAME\t\tgl, or soft to draw --headless on the CPU\n");
+		printf ("--thumbnails DIR|FILE\tPNG of each mesh in a directory or list\n");
+		printf ("-thumb-size INT\t\tthumbnail width and height (256)\n");
+		printf ("-thumb-out DIR\t\tdirectory for --thumbnails (thumbnails)\n");
+		printf ("-encode-threads INT\tthreads writing PNGs (default all)\n");
+		printf ("-record DIR\t\twrite every frame to DIR as numbered PNGs\n");
+		printf ("-record-raw\t\twith -record, write raw RGB frames instead\n");
+		printf ("-png-filter NAME\tnone, sub, up, average, paeth or adaptive\n");
+		printf ("-png-level INT\t\tPNG compression 0 (none) to 9 (smallest), 6\n");
+		printf ("--png-bench\t\twith --headless, time PNG writing against stb\n");
 		printf ("\n");
 		printf ("F11\t\t\tscreenshot\n");
 		printf ("n\t\t\ttoggle normals visualisation\n");
+		printf ("c\t\t\ttoggle frustum culling\n");
+		printf ("o\t\t\ttoggle occlusion culling\n");
+		printf ("i\t\t\tinstanced or per-copy draws with -instances\n");
+		printf ("a\t\t\tcycle anti-aliasing modes\n");
 		printf ("\n");
 		return 0;
 	}
-	
-	param = check_param ("-o");
+	
+	mesh_file_names = (const char**)malloc (my_argc * sizeof (const char*));
+	for (param = check_param ("-o"); param && my_argc > param + 1;
+		param = check_next_param ("-o", param)) {
+		mesh_file_names[mesh_file_count++] = argv[param + 1];
+	}
+	param = check_param ("-list");
+	if (param && my_argc > param + 1) {
+		char** list_names = NULL;
+		int list_count = read_file_list (argv[param + 1], &list_names), i;
+		if (list_count < 0) {
+			return 1;
+		}
+		mesh_file_names = (const char**)realloc (mesh_file_names, (my_argc +
+			list_count) * sizeof (const char*));
+		// the names live for the whole run
+		for (i = 0; i < list_count; i++) {
+			mesh_file_names[mesh_file_count++] = list_names[i];
+		}
+		free (list_names);
+	}
+	if (mesh_file_count > 0) {
+		strcpy (obj_file_name, mesh_file_names[0]);
+	} else {
+		strcpy (obj_file_name, "cube.obj");
+	}
+	
+	param = check_param ("-vs");
+	if (param && my_argc > param + 1) {
+		strcpy (vs_file_name, argv[param + 1]);
+	} else {
+		strcpy (vs_file_name, "shaders/basic.vert");
+	}
+	
+	param = check_param ("-fs");
+	if (param && my_argc > param + 1) {
+		strcpy (fs_file_name, argv[param + 1]);
+	} else {
+		strcpy (fs_file_name, "shaders/basic.frag");
+	}
+	
+	param = check_param ("-sca");
+	if (param && my_argc > param + 1) {
+		scalef = atof (argv[param + 1]);
+	}
+	
+	param = check_param ("-tra");
+	if (param && my_argc > param + 3) {
+		vtra.v[0] = atof (argv[param + 1]);
+		vtra.v[1] = atof (argv[param + 2]);
+		vtra.v[2] = atof (argv[param + 3]);
+	}
+	
+	param = check_param ("-tex");
+	if (param && my_argc > param + 1) {
+		strcpy (texture_file_name, argv[param + 1]);
+	} else {
+		strcpy (texture_file_name, "textures/checkerboard.png");
+	}
+
+	param = check_param ("-threads");
+	if (param && my_argc > param + 1) {
+		thread_count = atoi (argv[param + 1]);
+	}
+
+	clean_mesh = check_param ("-clean") > 0;
+	param = check_param ("-eps");
+	if (param && my_argc > param + 1) {
+		clean_area_epsilon = atof (argv[param + 1]);
+	}
+
+	param = check_param ("-weld");
+	if (param && my_argc > param + 1) {
+		weld_tolerance = atof (argv[param + 1]);
+	}
+
+	param = check_param ("-vram");
+	if (param && my_argc > param + 1) {
+		vram_budget_mb = atoll (argv[param + 1]);
+	}
+
+	param = check_param ("-lod-px");
+	if (param && my_argc > param + 1) {
+		lod_error_px = atof (argv[param + 1]);
+	}
+
+	if (check_param ("-nocull")) {
+		frustum_cull = false;
+	}
+	occlusion_cull = check_param ("-occlude") > 0;
+
+	param = check_param ("-instances");
+	if (param && my_argc > param + 1) {
+		if (3 != sscanf (argv[param + 1], "%ix%ix%i", &instance_grid[0],
+			&instance_grid[1], &instance_grid[2]) || instance_grid[0] < 1 ||
+			instance_grid[1] < 1 || instance_grid[2] < 1) {
+			fprintf (stderr, "ERROR: -instances wants NxMxK, e.g. 10x10x10\n");
+			return 1;
+		}
+		// two ints can't overflow a long long, and once they are under the cap
+		// the third can't either
+		if ((long long)instance_grid[0] * instance_grid[1] > MAX_INSTANCES ||
+			(long long)instance_grid[0] * instance_grid[1] * instance_grid[2] >
+			MAX_INSTANCES) {
+			fprintf (stderr, "ERROR: -instances %s is more than %i copies\n",
+				argv[param + 1], MAX_INSTANCES);
+			return 1;
+		}
+		instance_count = instance_grid[0] * instance_grid[1] * instance_grid[2];
+	}
+
+	watch_file = check_param ("-watch") > 0;
+
+	interleaved_vertices = check_param ("-interleaved") > 0;
+	param = check_param ("--layout-bench");
+	if (param && my_argc > param + 1) {
+		layout_bench_frames = atoi (argv[param + 1]);
+	}
+	if (interleaved_vertices && watch_file) {
+		// hot reload patches the three separate buffers
+		fprintf (stderr, "WARNING: -watch needs separate buffers. ignoring \
+-interleaved\n");
+		interleaved_vertices = false;
+	}
+	mapped_upload = check_param ("-mapped") > 0;
+
+	param = check_param ("-timings");
+	if (param && my_argc > param + 1) {
+		strcpy (timings_file_name, argv[param + 1]);
+	}
+
+	param = check_param ("--bench");
+	if (param && my_argc > param + 1) {
+		bench_frames = atoi (argv[param + 1]);
+	}
+	param = check_param ("-path");
+	if (param && my_argc > param + 1) {
+		strcpy (camera_path_file_name, argv[param + 1]);
+	}
+	param = check_param ("-bench-out");
+	if (param && my_argc > param + 1) {
+		strcpy (bench_out_file_name, argv[param + 1]);
+	}
+	param = check_param ("-aa");
+	if (param && my_argc > param + 1) {
+		aa_start_mode = parse_antialias_mode (argv[param + 1]);
+		if (aa_start_mode < 0) {
+			fprintf (stderr, "ERROR: -aa wants off, 2, 4, 8, 16 or fxaa\n");
+			return 1;
+		}
+	}
+	param = check_param ("--headless");
+	if (param && my_argc > param + 1) {
+		if (2 != sscanf (argv[param + 1], "%ix%i", &gl_width, &gl_height) ||
+			gl_width < 1 || gl_height < 1) {
+			fprintf (stderr, "ERROR: --headless wants WxH, e.g. 1920x1080\n");
+			return 1;
+		}
+		headless = true;
+		if (bench_frames > 0) {
+			headless_frames = bench_frames;
+		}
+	}
+	param = check_param ("--poster");
+	if (param && my_argc > param + 1) {
+		if (2 != sscanf (argv[param + 1], "%ix%i", &poster_width,
+			&poster_height) || poster_width < 1 || poster_height < 1) {
+			fprintf (stderr, "ERROR: --poster wants WxH, e.g. 32768x32768\n");
+			return 1;
+		}
+		if (!headless) {
+			headless = true;
+			gl_width = gl_height = POSTER_TILE;
+		}
+		if (bench_frames > 0) {
+			fprintf (stderr, "WARNING: --bench does nothing with --poster. \
+ignoring it\n");
+			bench_frames = 0;
+			headless_frames = 1;
+		}
+	}
+	param = check_param ("-renderer");
+	if (param && my_argc > param + 1) {
+		if (0 == strcmp (argv[param + 1], "soft")) {
+			soft_renderer = true;
+		} else if (0 != strcmp (argv[param + 1], "gl")) {
+			fprintf (stderr, "ERROR: -renderer wants gl or soft\n");
+			return 1;
+		}
+		if (soft_renderer && (!headless || poster_width > 0)) {
+			fprintf (stderr, "ERROR: -renderer soft draws --headless frames \
+only\n");
+			return 1;
+		}
+	}
+	param = check_param ("-poster-out");
 	if (param && my_argc > param + 1) {
-		strcpy (obj_file_name, argv[param + 1]);
+		strcpy (poster_out_file_name, argv[param + 1]);
 	} else {
-		strcpy (obj_file_name, "cube.obj");
+		strcpy (poster_out_file_name, "poster.png");
 	}
-	
-	param = check_param ("-vs");
+	param = check_param ("-headless-out");
 	if (param && my_argc > param + 1) {
-		strcpy (vs_file_name, argv[param + 1]);
+		strcpy (headless_out_file_name, argv[param + 1]);
 	} else {
-		strcpy (vs_file_name, "shaders/basic.vert");
+		strcpy (headless_out_file_name, "headless.png");
 	}
-	
-	param = check_param ("-fs");
+	param = check_param ("-thumb-size");
 	if (param && my_argc > param + 1) {
-		strcpy (fs_file_name, argv[param + 1]);
+		thumbnail_size = atoi (argv[param + 1]);
+		if (thumbnail_size < 1) {
+			fprintf (stderr, "ERROR: -thumb-size wants a positive size\n");
+			return 1;
+		}
+	}
+	param = check_param ("-thumb-out");
+	if (param && my_argc > param + 1) {
+		strcpy (thumbnail_dir_name, argv[param + 1]);
 	} else {
-		strcpy (fs_file_name, "shaders/basic.frag");
+		strcpy (thumbnail_dir_name, "thumbnails");
 	}
-	
-	param = check_param ("-sca");
+	param = check_param ("-encode-threads");
 	if (param && my_argc > param + 1) {
-		scalef = atof (argv[param + 1]);
+		encode_thread_count = atoi (argv[param + 1]);
 	}
-	
-	param = check_param ("-tra");
-	if (param && my_argc > param + 3) {
-		vtra.v[0] = atof (argv[param + 1]);
-		vtra.v[1] = atof (argv[param + 2]);
-		vtra.v[2] = atof (argv[param + 3]);
+	param = check_param ("-record");
+	if (param && my_argc > param + 1) {
+		strcpy (record_dir_name, argv[param + 1]);
+		if (!make_directory (record_dir_name)) {
+			return 1;
+		}
 	}
-	
-	param = check_param ("-tex");
+	record_raw = check_param ("-record-raw") > 0;
+	default_png_settings (&png_settings);
+	png_settings.thread_count = thread_count;
+	param = check_param ("-png-filter");
 	if (param && my_argc > param + 1) {
-		strcpy (texture_file_name, argv[param + 1]);
-	} else {
-		strcpy (texture_file_name, "textures/checkerboard.png");
+		png_settings.filter = parse_png_filter (argv[param + 1]);
+		if (png_settings.filter < 0) {
+			fprintf (stderr, "ERROR: -png-filter wants none, sub, up, average, \
+paeth or adaptive\n");
+			return 1;
+		}
+	}
+	param = check_param ("-png-level");
+	if (param && my_argc > param + 1) {
+		png_settings.level = atoi (argv[param + 1]);
+		if (png_settings.level < 0 || png_settings.level > 9) {
+			fprintf (stderr, "ERROR: -png-level wants 0 to 9\n");
+			return 1;
+		}
+	}
+	png_bench = check_param ("--png-bench") > 0;
+	if (headless && watch_file) {
+		// nothing would be drawn after the reload
+		fprintf (stderr, "WARNING: -watch does nothing with --headless. \
+ignoring it\n");
+		watch_file = false;
+	}
+	if (mapped_upload && (watch_file || layout_bench_frames > 0)) {
+		// both need the vertices in CPU memory after upload
+		fprintf (stderr, "WARNING: -mapped does not work with -watch or \
+--layout-bench. ignoring it\n");
+		mapped_upload = false;
+	}
+
+	//
+	// headless analysis - runs without a window or GL context
+	// --------------------------------------------------------------------------
+	param = check_param ("--stats");
+	if (param) {
+		obj_mesh_t mesh;
+		mesh_stats_t stats;
+		double t0, t1, t2;
+
+		t0 = get_wall_time ();
+		if (!load_obj_mesh (obj_file_name, &mesh, thread_count)) {
+			return 1;
+		}
+		t1 = get_wall_time ();
+		compute_mesh_stats (&mesh, &stats, thread_count);
+		t2 = get_wall_time ();
+		printf ("mesh: %s\n", obj_file_name);
+		print_mesh_stats (&stats);
+		printf ("threads: %i load %.3fs analysis %.3fs\n",
+			resolve_thread_count (thread_count), t1 - t0, t2 - t1);
+		if (weld_tolerance > 0.0f || clean_mesh) {
+			process_mesh (&mesh);
+			compute_mesh_stats (&mesh, &stats, thread_count);
+			printf ("after processing:\n");
+			print_mesh_stats (&stats);
+		}
+		free_obj_mesh (&mesh);
+		return 0;
+	}
+
+	param = check_param ("--pack");
+	if (param && my_argc > param + 1) {
+		obj_mesh_t mesh;
+		cmsh_mesh_t packed;
+		double t0, encode_s, decode_1_s = 0.0, decode_n_s = 0.0, raw_bytes;
+		long packed_bytes = 0;
+		FILE* fp = NULL;
+
+		if (!load_obj_mesh (obj_file_name, &mesh, thread_count)) {
+			return 1;
+		}
+		process_mesh (&mesh);
+		t0 = get_wall_time ();
+		if (!write_cmsh_file (argv[param + 1], &mesh, thread_count)) {
+			return 1;
+		}
+		encode_s = get_wall_time () - t0;
+		free_obj_mesh (&mesh);
+		fp = fopen (argv[param + 1], "rb");
+		if (fp) {
+			fseek (fp, 0, SEEK_END);
+			packed_bytes = ftell (fp);
+			fclose (fp);
+		}
+		// decode it back on one core and on all of them
+		assert (load_cmsh_mesh (argv[param + 1], &packed, 1, &decode_1_s));
+		free_cmsh_mesh (&packed);
+		assert (load_cmsh_mesh (argv[param + 1], &packed, thread_count,
+			&decode_n_s));
+		raw_bytes = (double)packed.vertex_count * CMSH_VERTEX_FLOATS *
+			sizeof (float) + (double)packed.index_count * sizeof (unsigned int);
+		printf ("packed %s -> %s: %i vertices %i indices\n", obj_file_name,
+			argv[param + 1], packed.vertex_count, packed.index_count);
+		printf ("raw %.2f MB packed %.2f MB (%.1f%%) encode %.3fs\n",
+			raw_bytes / (1024.0 * 1024.0), packed_bytes / (1024.0 * 1024.0),
+			raw_bytes > 0.0 ? 100.0 * packed_bytes / raw_bytes : 0.0, encode_s);
+		printf ("decode 1 thread %.3fs (%.2f GB/s), %i threads %.3fs \
+(%.2f GB/s)\n", decode_1_s, decode_1_s > 0.0 ? raw_bytes / decode_1_s * 1e-9 :
+			0.0, resolve_thread_count (thread_count), decode_n_s, decode_n_s > 0.0 ?
+			raw_bytes / decode_n_s * 1e-9 : 0.0);
+		free_cmsh_mesh (&packed);
+		return 0;
+	}
+
+	param = check_param ("--thumbnails");
+	if (param && my_argc > param + 1) {
+		return run_thumbnails (argv[param + 1]);
+	}
+
+	param = check_param ("--chunk");
+	if (param && my_argc > param + 1) {
+		obj_mesh_t mesh;
+		double t0;
+
+		if (!load_obj_mesh (obj_file_name, &mesh, thread_count)) {
+			return 1;
+		}
+		process_mesh (&mesh);
+		t0 = get_wall_time ();
+		if (!write_octree_file (argv[param + 1], &mesh, thread_count)) {
+			return 1;
+		}
+		printf ("octree build %.3fs\n", get_wall_time () - t0);
+		free_obj_mesh (&mesh);
+		return 0;
+	}
+
+	if (soft_renderer) {
+		return run_soft_render (scalef, vtra);
 	}
 
 	//
 	// Start OpenGL using helper libraries
 	// --------------------------------------------------------------------------
-	if (!glfwInit ()) {
+	sprintf (win_title, "obj viewer: %s", obj_file_name);
+	if (headless) {
+		if (!create_headless (&hl, gl_width, gl_height)) {
+			return 1;
+		}
+	} else if (!glfwInit ()) {
 		fprintf (stderr, "ERROR: could not start GLFW3\n");
 		return 1;
 	} 
@@ -202,23 +1810,36 @@ int main (int argc, char** argv) {
 	glfwWindowHint (GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint (GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); */
 
-	glfwWindowHint (GLFW_SAMPLES, msaa_samples);
+	if (!headless) {
+		// anti-aliasing is done in an offscreen framebuffer instead
+		glfwWindowHint (GLFW_SAMPLES, 0);
 
-	sprintf (win_title, "obj viewer: %s", obj_file_name);
-	window = glfwCreateWindow (gl_width, gl_height, win_title, NULL, NULL);
-	if (!window) {
-		fprintf (stderr, "ERROR: opening OS window\n");
-		return 1;
-	}
-	glfwMakeContextCurrent (window);
+		window = glfwCreateWindow (gl_width, gl_height, win_title, NULL, NULL);
+		if (!window) {
+			fprintf (stderr, "ERROR: opening OS window\n");
+			return 1;
+		}
+		glfwMakeContextCurrent (window);
 
-	glewExperimental = GL_TRUE;
-	glewInit ();
+		glewExperimental = GL_TRUE;
+		glewInit ();
+	}
 
 	renderer = glGetString (GL_RENDERER);
 	version = glGetString (GL_VERSION);
 	printf ("Renderer: %s\n", renderer);
 	printf ("OpenGL version supported %s\n", version);
+	if (mapped_upload && !GLEW_VERSION_3_0 && !GLEW_ARB_map_buffer_range) {
+		fprintf (stderr, "WARNING: no glMapBufferRange. ignoring -mapped\n");
+		mapped_upload = false;
+	}
+	if (instance_count > 0 && !GLEW_VERSION_3_3 &&
+		!GLEW_ARB_instanced_arrays) {
+		fprintf (stderr,
+			"WARNING: no instanced arrays. -instances draws one copy at a time\n");
+		can_instance = false;
+		instanced_draws = false;
+	}
 
 	//
 	// Set up vertex buffers and vertex array object
@@ -227,241 +1848,519 @@ int main (int argc, char** argv) {
 		GLfloat* vp = NULL; // array of vertex points
 		GLfloat* vn = NULL; // array of vertex normals (we haven't used these yet)
 		GLfloat* vt = NULL; // array of texture coordinates (or these)
-		GLuint points_vbo, texcoord_vbo, normals_vbo;
+		// with -interleaved, all three in one array instead
+		GLfloat* vertices = NULL;
+		vertex_streams_t streams;
+		GLuint vbos[3];
+		// material key of each triangle if the mesh has usemtl groups
+		int* tri_keys = NULL;
+		double load_time = get_wall_time (), upload_time = 0.0;
+		long long peak_bytes;
 
-		assert (load_obj_file (obj_file_name, &vp, &vt, &vn, &point_count));
-	
-		glGenBuffers (1, &points_vbo);
-		glBindBuffer (GL_ARRAY_BUFFER, points_vbo);
-		// copy our points from the header file into our VBO on graphics hardware
-		glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 3 * point_count, vp,
-			GL_STATIC_DRAW);
-		glGenBuffers (1, &texcoord_vbo);
-		glBindBuffer (GL_ARRAY_BUFFER, texcoord_vbo);
-		glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 2 * point_count, vt,
-			GL_STATIC_DRAW);
-		glGenBuffers (1, &normals_vbo);
-		glBindBuffer (GL_ARRAY_BUFFER, normals_vbo);
-		glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 3 * point_count, vn,
-			GL_STATIC_DRAW);
-	
-		glGenVertexArrays (1, &vao);
-		glBindVertexArray (vao);
-		glEnableVertexAttribArray (0);
-		glBindBuffer (GL_ARRAY_BUFFER, points_vbo);
-		glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-		glEnableVertexAttribArray (1);
-		glBindBuffer (GL_ARRAY_BUFFER, texcoord_vbo);
-		glVertexAttribPointer (1, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-		glEnableVertexAttribArray (2);
-		glBindBuffer (GL_ARRAY_BUFFER, normals_vbo);
-		glVertexAttribPointer (2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+		create_occlusion (&occlusion, OCCLUSION_WIDTH, OCCLUSION_HEIGHT,
+			thread_count);
+		memset (&bvh, 0, sizeof (chunk_bvh_t));
+		if (mesh_file_count > 1) {
+			// each mesh gets its own VAO. the buffers below are left empty
+			load_scene_meshes ();
+		} else if (is_octree_file_name (obj_file_name)) {
+			// chunks are paged in by the streamer as the camera needs them. the
+			// buffers below are left empty
+			streamer = create_streamer (obj_file_name,
+				vram_budget_mb * 1024 * 1024, resolve_thread_count (thread_count));
+			assert (streamer);
+		} else if (mapped_upload) {
+			// also chunks the mesh, picks the occluders and makes the VAO
+			vao = load_mesh_mapped (obj_file_name, &point_count, &bvh, &occlusion,
+				&upload_time);
+			assert (vao);
+		} else if (interleaved_vertices) {
+			assert (load_mesh_file_interleaved (obj_file_name, thread_count,
+				process_mesh, &vertices, &point_count));
+		} else if (is_cmsh_file_name (obj_file_name)) {
+			assert (load_cmsh_file (obj_file_name, &vp, &vt, &vn, &point_count,
+				thread_count));
+		} else {
+			// the indexed loader also reads the usemtl groups
+			obj_mesh_t mesh;
+			assert (load_obj_mesh (obj_file_name, &mesh, thread_count));
+			process_mesh (&mesh);
+			// hot reload rebuilds the chunks without materials
+			if (!watch_file) {
+				tri_keys = prepare_materials (&mesh);
+			}
+			assert (expand_obj_mesh (&mesh, &vp, &vt, &vn, &point_count,
+				thread_count));
+			free_obj_mesh (&mesh);
+		}
+
+		// a mapped load has made its VAO already
+		if (!vao) {
+			if (vertices) {
+				interleaved_vertex_streams (vertices, &streams);
+			} else {
+				separate_vertex_streams (vp, vt, vn, &streams);
+			}
+			// reorders the vertices so each chunk is one range in the buffers,
+			// and each material key's triangles are together
+			build_chunk_bvh (&streams, point_count, tri_keys, thread_count, &bvh);
+			free (tri_keys);
+			select_occluders (&occlusion, streams.points, streams.points_stride,
+				point_count, OCCLUSION_OCCLUDER_TRIANGLES);
+
+			upload_time = get_wall_time ();
+			if (vertices) {
+				vao = create_interleaved_vao (vertices, point_count, NULL);
+			} else {
+				vao = create_mesh_vao (vp, vt, vn, point_count, vbos);
+			}
+			// glFinish so the driver's copy is counted, as with unmapping
+			glFinish ();
+			upload_time = get_wall_time () - upload_time;
+		}
+		if (bvh.chunk_count > 0) {
+			cull_firsts = (int*)malloc (bvh.chunk_count * sizeof (int));
+			cull_counts = (int*)malloc (bvh.chunk_count * sizeof (int));
+		}
+		load_time = get_wall_time () - load_time;
+		peak_bytes = get_peak_memory_bytes ();
+		if (point_count > 0) {
+			printf ("vertices %s: load %.3fs, upload %.1f ms, peak memory %.1f \
+MB\n", mapped_upload ? "expanded into mapped buffers" : "copied from arrays",
+				load_time, upload_time * 1000.0, peak_bytes / (1024.0 * 1024.0));
+		}
+		if (layout_bench_frames > 0 && point_count > 0) {
+			// the same reordered vertices in the other layout
+			vertex_streams_t other;
+			float* copy = (float*)malloc ((size_t)point_count *
+				INTERLEAVED_VERTEX_FLOATS * sizeof (float));
+			if (vertices) {
+				separate_vertex_streams (copy, copy + point_count * 3, copy +
+					point_count * 5, &other);
+				copy_vertex_streams (&streams, &other, point_count);
+				bench_vaos[0] = create_mesh_vao (other.points, other.tex_coords,
+					other.normals, point_count, NULL);
+				bench_vaos[1] = vao;
+			} else {
+				interleaved_vertex_streams (copy, &other);
+				copy_vertex_streams (&streams, &other, point_count);
+				bench_vaos[0] = vao;
+				bench_vaos[1] = create_interleaved_vao (copy, point_count, NULL);
+			}
+			free (copy);
+		}
+		if (watch_file && point_count > 0) {
+			hot_reload = start_hot_reload (obj_file_name, vao, vbos, vp, vt, vn,
+				point_count, thread_count, process_mesh);
+		}
+		if (instance_count > 0 && bvh.node_count > 0) {
+			GLuint instance_vbo;
+			int col;
+
+			instance_matrices = build_instance_grid (bvh.nodes[0].bb_min,
+				bvh.nodes[0].bb_max);
+			glGenBuffers (1, &instance_vbo);
+			bind_array_buffer (instance_vbo);
+			glBufferData (GL_ARRAY_BUFFER, sizeof (float) * 16 * instance_count,
+				instance_matrices, GL_STATIC_DRAW);
+			// a mat4 attribute is 4 vec4 columns, advancing once per instance.
+			// the arrays are enabled only while drawing instanced
+			for (col = 0; col < 4; col++) {
+				glVertexAttribPointer (3 + col, 4, GL_FLOAT, GL_FALSE,
+					16 * sizeof (float), (GLvoid*)(col * 4 * sizeof (float)));
+				if (GLEW_VERSION_3_3) {
+					glVertexAttribDivisor (3 + col, 1);
+				} else if (can_instance) {
+					glVertexAttribDivisorARB (3 + col, 1);
+				}
+			}
+			// many copies will be sub-millisecond; don't let vsync hide that
+			if (window) {
+				glfwSwapInterval (0);
+			}
+			printf ("%i instances, %lld triangles per frame\n", instance_count,
+				(long long)instance_count * (point_count / 3));
+		}
+		set_identity_instance_attribs ();
 		free (vp);
 		free (vn);
 		free (vt);
+		free (vertices);
 	}
 	
 	//
 	// Load shaders from files
 	// --------------------------------------------------------------------------
-	{
-		char* vertex_shader_str = NULL;
-		char* fragment_shader_str = NULL;
-		GLuint vs, fs;
-		
-		// load shader strings from text files
-		assert (parse_file_into_str (vs_file_name, &vertex_shader_str));
-		assert (parse_file_into_str (fs_file_name, &fragment_shader_str));
-		vs = glCreateShader (GL_VERTEX_SHADER);
-		fs = glCreateShader (GL_FRAGMENT_SHADER);
-		glShaderSource (vs, 1, (const char**)&vertex_shader_str, NULL);
-		glShaderSource (fs, 1, (const char**)&fragment_shader_str, NULL);
-		// free memory
-		free (vertex_shader_str);
-		free (fragment_shader_str);
-		glCompileShader (vs);
-		glCompileShader (fs);
-		shader_programme = glCreateProgram ();
-		glAttachShader (shader_programme, fs);
-		glAttachShader (shader_programme, vs);
-		glBindAttribLocation (shader_programme, 0, "vp");
-		glBindAttribLocation (shader_programme, 1, "vt");
-		glBindAttribLocation (shader_programme, 2, "vn");
-		glLinkProgram (shader_programme);
-		M_loc = glGetUniformLocation (shader_programme, "M");
-		V_loc = glGetUniformLocation (shader_programme, "V");
-		P_loc = glGetUniformLocation (shader_programme, "P");
-		// attempt this. won't use if < 0
-		time_loc = glGetUniformLocation (shader_programme, "time");
+	shader_programme = create_programme_from_files (vs_file_name,
+		fs_file_name);
+	normals_sp = create_programme_from_files ("shaders/normals.vert",
+		"shaders/normals.frag");
+	if (!shader_programme || !normals_sp) {
+		return 1;
 	}
-	{
-		char* vertex_shader_str = NULL;
-		char* fragment_shader_str = NULL;
-		GLuint vs, fs;
-		
-		// load shader strings from text files
-		assert (parse_file_into_str ("shaders/normals.vert", &vertex_shader_str));
-		assert (parse_file_into_str ("shaders/normals.frag",
-			&fragment_shader_str));
-		vs = glCreateShader (GL_VERTEX_SHADER);
-		fs = glCreateShader (GL_FRAGMENT_SHADER);
-		glShaderSource (vs, 1, (const char**)&vertex_shader_str, NULL);
-		glShaderSource (fs, 1, (const char**)&fragment_shader_str, NULL);
-		// free memory
-		free (vertex_shader_str);
-		free (fragment_shader_str);
-		glCompileShader (vs);
-		glCompileShader (fs);
-		normals_sp = glCreateProgram ();
-		glAttachShader (normals_sp, fs);
-		glAttachShader (normals_sp, vs);
-		glBindAttribLocation (normals_sp, 0, "vp");
-		glBindAttribLocation (normals_sp, 1, "vt");
-		glBindAttribLocation (normals_sp, 2, "vn");
-		glLinkProgram (normals_sp);
-		normals_M_loc = glGetUniformLocation (normals_sp, "M");
-		normals_V_loc = glGetUniformLocation (normals_sp, "V");
-		normals_P_loc = glGetUniformLocation (normals_sp, "P");
+	init_program_uniforms (&basic_uniforms, shader_programme);
+	init_program_uniforms (&normals_uniforms, normals_sp);
+	// attempt this. won't use if < 0
+	time_loc = glGetUniformLocation (shader_programme, "time");
+	// material colour. white unless a material sets it
+	kd_loc = glGetUniformLocation (shader_programme, "Kd");
+	// without it the fxaa mode is left out
+	fxaa_sp = create_programme_from_files ("shaders/fxaa.vert",
+		"shaders/fxaa.frag");
+	create_antialias (&aa, fxaa_sp, aa_start_mode, gl_width, gl_height);
+	if (headless) {
+		set_antialias_target (&aa, hl.fbo);
+	}
+	if (record_dir_name[0]) {
+		png_settings_t record_png = png_settings;
+		if (!GLEW_VERSION_2_1 && !GLEW_ARB_pixel_buffer_object) {
+			fprintf (stderr, "ERROR: -record needs pixel buffer objects\n");
+			return 1;
+		}
+		// each writer has a frame to itself, so they share the cores that way
+		record_png.thread_count = 1;
+		capture = create_capture (gl_width, gl_height, RECORD_SLOTS,
+			resolve_thread_count (encode_thread_count), &record_png);
+		set_capture_quiet (capture, true);
+	} else if (window && (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object)) {
+		// two in flight at once; F11 can't be pressed faster than they write.
+		// one writer, compressing each screenshot on every core
+		capture = create_capture (gl_width, gl_height, 2, 1, &png_settings);
 	}
 	
 	//
 	// Create some matrices
 	// --------------------------------------------------------------------------
-	mat4 M, V, P, S, T;
-	vec3 cam_pos (0.0, 0.0, 5.0);
-	vec3 targ_pos (0.0, 0.0, 0.0);
-	vec3 up (0.0, 1.0, 0.0);
+	mat4 M, V, P, poster_P;
+	frame_view_t view;
 	
-	T = translate (identity_mat4 (), vtra);
-	S = scale (identity_mat4 (), vec3 (scalef, scalef, scalef));
-	M = T * S;
-	V = look_at (cam_pos, targ_pos, up);
-	P = perspective (67.0f, (float)gl_width / (float)gl_height, 0.1, 1000.0);
+	init_frame_view (&view, scalef, vtra);
+	M = view.M;
+	V = view.V;
+	if (poster_width > 0) {
+		P = perspective (67.0f, (float)poster_width / (float)poster_height, 0.1,
+			1000.0);
+	} else {
+		P = perspective (67.0f, (float)gl_width / (float)gl_height, 0.1, 1000.0);
+	}
+	poster_P = P;
 	
 	// send matrix values to shader immediately
-	glUseProgram (shader_programme);
-	glUniformMatrix4fv (M_loc, 1, GL_FALSE, M.m);
-	glUniformMatrix4fv (V_loc, 1, GL_FALSE, V.m);
-	glUniformMatrix4fv (P_loc, 1, GL_FALSE, P.m);
-	glUseProgram (normals_sp);
-	glUniformMatrix4fv (normals_M_loc, 1, GL_FALSE, M.m);
-	glUniformMatrix4fv (normals_V_loc, 1, GL_FALSE, V.m);
-	glUniformMatrix4fv (normals_P_loc, 1, GL_FALSE, P.m);
+	init_transforms (&transforms);
+	set_model_matrix (&transforms, M.m);
+	set_view_matrix (&transforms, V.m);
+	set_projection_matrix (&transforms, P.m);
+	use_program (shader_programme);
+	apply_transforms (&transforms, &basic_uniforms);
+	if (kd_loc >= 0) {
+		glUniform3fv (kd_loc, 1, current_state.kd);
+	}
+	use_program (normals_sp);
+	apply_transforms (&transforms, &normals_uniforms);
 	
 	//
 	// Create texture
 	// --------------------------------------------------------------------------
-	{
-		int x,y,n;
-		unsigned char* data;
-		GLuint tex;
-		
-		data = stbi_load (texture_file_name, &x, &y, &n, 4);
-		if (!data) {
-			fprintf (stderr, "ERROR: could not load image %s\n", texture_file_name);
-			return 1;
-		}
-		printf ("loaded image with %ix%ipx and %i chans\n", x, y, n);
-		
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf (stderr, "WARNING: texture is not power-of-two dimensions %s\n",
-				texture_file_name);
-		}
-	
-		// FLIP UP-SIDE DIDDLY-DOWN
-		// make upside-down copy for GL
-		{
-			unsigned char *imagePtr = &data[0];
-			int halfTheHeightInPixels = y / 2;
-			int heightInPixels = y;
-	
-			// Assuming RGBA for 4 components per pixel.
-			int numColorComponents = 4;
-			// Assuming each color component is an unsigned char.
-			int widthInChars = x * numColorComponents;
-			unsigned char *top = NULL;
-			unsigned char *bottom = NULL;
-			unsigned char temp = 0;
-			for (int h = 0; h < halfTheHeightInPixels; h++) {
-				top = imagePtr + h * widthInChars;
-				bottom = imagePtr + (heightInPixels - h - 1) * widthInChars;
-				for (int w = 0; w < widthInChars; w++) {
-					// Swap the chars around.
-					temp = *top;
-					*top = *bottom;
-					*bottom = temp;
-					++top;
-					++bottom;
-				}
-			}
-		}
-		
-		glGenTextures (1, &tex);
-		glActiveTexture (GL_TEXTURE0);
-		glBindTexture (GL_TEXTURE_2D, tex);
-		glTexImage2D (
-			GL_TEXTURE_2D,
-			0,
-			GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			data
-		);
-		stbi_image_free(data);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	default_texture = load_texture (texture_file_name);
+	if (!default_texture) {
+		return 1;
 	}
+	current_state.texture = default_texture;
 	
 	//
 	// Start rendering
 	// --------------------------------------------------------------------------
-	glEnable (GL_DEPTH_TEST);
+	set_capability (GL_DEPTH_TEST, true);
 	glDepthFunc (GL_LESS);
 	glClearColor (0.5, 0.5, 0.8, 1.0);
 	
-	glEnable (GL_CULL_FACE); // enable culling of faces
+	set_capability (GL_CULL_FACE, true); // enable culling of faces
 	glCullFace (GL_BACK);
 	glFrontFace (GL_CCW);
 	
-	glEnable (GL_BLEND);
+	set_capability (GL_BLEND, true);
 	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	//glDepthMask (GL_FALSE);
 
-	a = 0.0f;
-	prev = glfwGetTime ();
-	while (!glfwWindowShouldClose (window)) {
+	if (bench_vaos[0] && bench_vaos[1]) {
+		run_layout_bench (window, bench_vaos, point_count, layout_bench_frames);
+		if (headless) {
+			free_headless (&hl);
+		} else {
+			glfwTerminate ();
+		}
+		return 0;
+	}
+
+	// always timed, tagged with the anti-aliasing mode, so the modes can be
+	// compared on exit. percentiles are over roughly the last 10 seconds at
+	// 60Hz
+	frame_timer = create_frame_timer (600);
+	set_frame_timing_tag (frame_timer, aa.mode);
+	strcpy (title_base, win_title);
+
+	if (bench_frames > 0) {
+		if (camera_path_file_name[0]) {
+			if (!load_camera_path (camera_path_file_name, &camera_path)) {
+				return 1;
+			}
+		} else {
+			default_camera_path (view.cam_pos.v, view.targ_pos.v, &camera_path);
+		}
+		view.camera_path = &camera_path;
+		bench_frame_seconds = (double*)malloc (bench_frames * sizeof (double));
+		if (window) {
+			glfwSwapInterval (0);
+		}
+		bench_start = bench_last = get_wall_time ();
+	}
+
+	if (poster_width > 0) {
+		poster = open_poster (poster_out_file_name, poster_width, poster_height,
+			gl_width, gl_height, &png_settings);
+		if (!poster) {
+			return 1;
+		}
+		headless_frames = poster_tile_count (poster);
+	}
+
+	loop_start = get_wall_time ();
+	view.prev_clock = window ? glfwGetTime () : 0.0;
+	get_gl_state_stats (&loop_gl_stats);
+	while (window ? !glfwWindowShouldClose (window) :
+		headless_frame < headless_frames) {
 		double curr, elapsed;
 	
+		if (frame_timer) {
+			begin_frame_timing (frame_timer);
+		}
+		begin_antialiased_frame (&aa);
 		glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glViewport (0, 0, gl_width, gl_height);
+		set_viewport (0, 0, gl_width, gl_height);
+		// the FXAA pass changes these. through the cache this costs nothing
+		// when they are already set
+		set_capability (GL_DEPTH_TEST, true);
+		set_capability (GL_BLEND, true);
+		set_polygon_mode (poly_modes[poly_mode]);
+		if (poster) {
+			poster_tile_projection (poster, headless_frame, poster_P.m, P.m);
+			set_projection_matrix (&transforms, P.m);
+		}
 	
-		curr = glfwGetTime ();
-		elapsed = curr - prev;
-		prev = curr;
+		advance_frame_view (&view, bench_frame, window ? glfwGetTime () :
+			get_wall_time () - loop_start, window != NULL, &transforms);
+		curr = view.time;
+		elapsed = view.elapsed;
+		M = view.M;
+		V = view.V;
 
-		a += sinf (elapsed * 50.0f);
-		M = T * rotate_y_deg (S, a);
+		if (hot_reload) {
+			reloaded_mesh_t reloaded;
+			if (update_hot_reload (hot_reload, reload_budget_ms, &reloaded)) {
+				point_count = reloaded.point_count;
+				free_chunk_bvh (&bvh);
+				bvh = reloaded.bvh;
+				cull_firsts = (int*)realloc (cull_firsts, bvh.chunk_count *
+					sizeof (int));
+				cull_counts = (int*)realloc (cull_counts, bvh.chunk_count *
+					sizeof (int));
+				set_occluders (&occlusion, reloaded.occluders,
+					reloaded.occluder_count);
+				free (reloaded.points);
+				free (reloaded.tex_coords);
+				free (reloaded.normals);
+			}
+		}
 
 		if (normals_mode) {
-			glUseProgram (normals_sp);
-			glUniformMatrix4fv (normals_M_loc, 1, GL_FALSE, M.m);
+			use_program (normals_sp);
+			frame_uniforms = &normals_uniforms;
 		} else {
-			glUseProgram (shader_programme);
-			glUniformMatrix4fv (M_loc, 1, GL_FALSE, M.m);
+			use_program (shader_programme);
+			frame_uniforms = &basic_uniforms;
 			if (time_loc > 0) {
 				glUniform1f (time_loc, (float)curr);
 			}
 		}
-		glBindVertexArray (vao);
-		glDrawArrays (GL_TRIANGLES, 0, point_count);
-		glfwPollEvents ();
-		glfwSwapBuffers (window);
+		apply_transforms (&transforms, frame_uniforms);
+		if (streamer) {
+			// the LOD test happens in model space, so bring the camera there
+			vec4 cam_model = inverse (M) * vec4 (view.cam_pos, 1.0f);
+			float proj_scale = (float)(poster ? poster_height : gl_height) /
+				(2.0f * tanf (67.0f * 0.5f * ONE_DEG_IN_RAD));
+			draw_streamed (streamer, cam_model.v, proj_scale, lod_error_px);
+			if (bench_frames > 0) {
+				streamer_stats_t stats;
+				get_streamer_stats (streamer, &stats);
+				frame_triangles = stats.drawn_vertices / 3;
+			}
+			if (curr - title_time > 1.0) {
+				streamer_stats_t stats;
+				get_streamer_stats (streamer, &stats);
+				sprintf (win_title, "obj viewer: %s %.0f/%.0f MB %.1f MB/s hit %.0f%% \
+%i nodes", obj_file_name, stats.resident_bytes / (1024.0 * 1024.0),
+					stats.budget_bytes / (1024.0 * 1024.0), stats.streamed_mb_per_s,
+					stats.hit_rate * 100.0, stats.drawn_nodes);
+				set_window_title (window, win_title);
+				title_time = curr;
+			}
+		} else if (scene_mesh_count > 0) {
+			int i;
+			frame_triangles = 0;
+			for (i = 0; i < scene_mesh_count; i++) {
+				bind_vertex_array (scene_meshes[i].vao);
+				glDrawArrays (GL_TRIANGLES, 0, scene_meshes[i].point_count);
+				frame_triangles += scene_meshes[i].point_count / 3;
+			}
+		} else if (instance_matrices) {
+			int mode = instanced_draws ? 0 : 1;
+			int col;
+
+			bind_vertex_array (vao);
+			if (instanced_draws) {
+				for (col = 0; col < 4; col++) {
+					glEnableVertexAttribArray (3 + col);
+				}
+				if (GLEW_VERSION_3_3) {
+					glDrawArraysInstanced (GL_TRIANGLES, 0, point_count, instance_count);
+				} else {
+					glDrawArraysInstancedARB (GL_TRIANGLES, 0, point_count,
+						instance_count);
+				}
+				for (col = 0; col < 4; col++) {
+					glDisableVertexAttribArray (3 + col);
+				}
+			} else {
+				int i;
+				set_identity_instance_attribs ();
+				for (i = 0; i < instance_count; i++) {
+					mat4 IM;
+					memcpy (IM.m, &instance_matrices[i * 16], 16 * sizeof (float));
+					IM = M * IM;
+					set_model_matrix (&transforms, IM.m);
+					apply_transforms (&transforms, frame_uniforms);
+					glDrawArrays (GL_TRIANGLES, 0, point_count);
+				}
+			}
+			frame_triangles = (long long)instance_count * (point_count / 3);
+			frame_seconds[mode] += elapsed;
+			frame_counts[mode]++;
+			window_seconds += elapsed;
+			window_frames++;
+			if (curr - title_time > 1.0) {
+				sprintf (win_title, "obj viewer: %s %i copies, %s: %.2f ms/frame",
+					obj_file_name, instance_count, instanced_draws ? "instanced" :
+					"per-copy draws", window_seconds * 1000.0 / window_frames);
+				set_window_title (window, win_title);
+				title_time = curr;
+				window_seconds = 0.0;
+				window_frames = 0;
+			}
+		} else if (frustum_cull && bvh.chunk_count > 0) {
+			// planes of P * V * M are in model space, where the chunk bounds are
+			mat4 PVM = P * V * M;
+			frustum_t frustum;
+			cull_stats_t cull_stats;
+			int range_count;
+
+			extract_frustum (PVM.m, &frustum);
+			if (occlusion_cull) {
+				render_occluders (&occlusion, PVM.m);
+			}
+			range_count = cull_chunk_bvh (&bvh, &frustum, occlusion_cull ?
+				&occlusion : NULL, cull_firsts, cull_counts, &cull_stats);
+			bind_vertex_array (vao);
+			if (draw_batches.key_count > 0 && !normals_mode) {
+				draw_material_batches (cull_firsts, cull_counts, range_count,
+					default_texture);
+			} else {
+				glMultiDrawArrays (GL_TRIANGLES, cull_firsts, cull_counts,
+					range_count);
+			}
+			frame_triangles = cull_stats.triangles_submitted;
+			if (curr - title_time > 1.0) {
+				sprintf (win_title, "obj viewer: %s tested %i/%i chunks, %i visible, \
+%lld tris", obj_file_name, cull_stats.chunks_tested, bvh.chunk_count,
+					cull_stats.chunks_visible, cull_stats.triangles_submitted);
+				if (occlusion_cull) {
+					sprintf (win_title + strlen (win_title), ", %i occluded \
+(raster %.2fms)", cull_stats.chunks_occluded,
+						occlusion.raster_seconds * 1000.0);
+				}
+				if (draw_batches.key_count > 0 && !normals_mode) {
+					sprintf (win_title + strlen (win_title), ", %lld draws %lld state \
+changes", draw_batches.frame.draw_calls, draw_batches.frame.state_changes);
+				}
+				set_window_title (window, win_title);
+				title_time = curr;
+			}
+		} else {
+			bind_vertex_array (vao);
+			if (draw_batches.key_count > 0 && !normals_mode) {
+				int first = 0;
+				draw_material_batches (&first, &point_count, 1, default_texture);
+			} else {
+				glDrawArrays (GL_TRIANGLES, 0, point_count);
+			}
+			frame_triangles = point_count / 3;
+		}
+		end_antialiased_frame (&aa);
+		if (poster) {
+			read_poster_tile (poster, headless_frame);
+		}
+		// read the finished frame before the swap leaves the back buffer undefined
+		if (screenshot_requested) {
+			if (capture) {
+				request_capture (capture, NULL);
+			} else {
+				screencapture (NULL);
+			}
+			screenshot_requested = false;
+		}
+		if (record_dir_name[0]) {
+			char name[512];
+			if (0 == record_frame) {
+				record_start = get_wall_time ();
+			}
+			snprintf (name, sizeof (name), "%s/frame_%06i.%s", record_dir_name,
+				record_frame++, record_raw ? "raw" : "png");
+			// waits here if the writers are behind
+			record_capture (capture, name);
+		}
+		if (capture) {
+			update_capture (capture);
+		}
+		if (frame_timer) {
+			end_frame_timing (frame_timer);
+			if (timings_file_name[0] && curr - timings_title_time > 1.0) {
+				set_window_title (window, title_base);
+				timings_title_time = curr;
+			}
+		}
+		if (window) {
+			glfwPollEvents ();
+			glfwSwapBuffers (window);
+		} else {
+			// nothing swaps, so wait for the frame to be drawn to time it
+			glFinish ();
+			if (0 == headless_frame) {
+				first_frame_seconds = get_wall_time () - loop_start;
+			}
+		}
+		frames_drawn++;
+		if (bench_frames > 0) {
+			double now = get_wall_time ();
+			bench_frame_seconds[bench_frame] = now - bench_last;
+			bench_last = now;
+			bench_triangles += frame_triangles;
+			if (++bench_frame >= bench_frames && window) {
+				glfwSetWindowShouldClose (window, 1);
+			}
+		}
+		if (!window) {
+			headless_frame++;
+			continue;
+		}
 		
 		if (GLFW_PRESS == glfwGetKey (window, GLFW_KEY_N)) {
 			if (!npressed) {
@@ -472,28 +2371,65 @@ int main (int argc, char** argv) {
 			npressed = false;
 		}
 		
+		if (GLFW_PRESS == glfwGetKey (window, GLFW_KEY_C)) {
+			if (!cpressed) {
+				cpressed = true;
+				frustum_cull = !frustum_cull;
+				sprintf (win_title, "obj viewer: %s", obj_file_name);
+				set_window_title (window, win_title);
+			}
+		} else {
+			cpressed = false;
+		}
+		
+		if (GLFW_PRESS == glfwGetKey (window, GLFW_KEY_I)) {
+			if (!ipressed) {
+				ipressed = true;
+				instanced_draws = can_instance && !instanced_draws;
+				window_seconds = 0.0;
+				window_frames = 0;
+			}
+		} else {
+			ipressed = false;
+		}
+		
+		if (GLFW_PRESS == glfwGetKey (window, GLFW_KEY_O)) {
+			if (!opressed) {
+				opressed = true;
+				occlusion_cull = !occlusion_cull;
+			}
+		} else {
+			opressed = false;
+		}
+		
 		if (GLFW_PRESS == glfwGetKey (window, GLFW_KEY_P)) {
 			if (!ppressed) {
 				ppressed = true;
 				poly_mode++;
 				poly_mode = poly_mode % 3;
-				
-				if (0 == poly_mode) {
-					glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
-				} else if (1 == poly_mode) {
-					glPolygonMode (GL_FRONT_AND_BACK, GL_LINE);
-				} else {
-					glPolygonMode (GL_FRONT_AND_BACK, GL_POINT);
-				}
+				// set at the start of each frame
 			}
 		} else {
 			ppressed = false;
 		}
 		
+		if (GLFW_PRESS == glfwGetKey (window, GLFW_KEY_A)) {
+			if (!apressed) {
+				apressed = true;
+				set_antialias_mode (&aa, next_antialias_mode (&aa));
+				if (frame_timer) {
+					set_frame_timing_tag (frame_timer, aa.mode);
+				}
+				printf ("anti-aliasing: %s\n", antialias_mode_name (aa.mode));
+			}
+		} else {
+			apressed = false;
+		}
+		
 		if (GLFW_PRESS == glfwGetKey (window, GLFW_KEY_F11)) {
 			if (!f11pressed) {
 				f11pressed = true;
-				screencapture ();
+				screenshot_requested = true;
 			}
 		} else {
 			f11pressed = false;
@@ -503,6 +2439,159 @@ int main (int argc, char** argv) {
 			glfwSetWindowShouldClose (window, 1);
 		}
 	}
+	loop_end = get_wall_time ();
+	if (capture) {
+		capture_stats_t stats;
+		destroy_capture (capture, &stats);
+		if (record_frame > 0) {
+			// the last frames are written by now
+			double seconds = get_wall_time () - record_start;
+			printf ("recorded %i frames of %ix%i to %s in %.2fs: %.1f fps \
+sustained. %.1f ms to write each on %i threads, waited for a buffer %i times \
+(%.1f ms)\n", stats.written, gl_width, gl_height, record_dir_name, seconds,
+				seconds > 0.0 ? stats.written / seconds : 0.0, stats.written > 0 ?
+				stats.encode_ms_total / stats.written : 0.0,
+				resolve_thread_count (encode_thread_count), stats.waits,
+				stats.wait_ms_total);
+		} else if (stats.requested > 0) {
+			printf ("screenshots: %i of %i written, %.1f ms to encode each. render \
+thread %.3f ms mean, %.3f ms max a frame over %i frames in flight\n",
+				stats.written, stats.requested, stats.written > 0 ?
+				stats.encode_ms_total / stats.written : 0.0, stats.busy_frames > 0 ?
+				stats.busy_ms_total / stats.busy_frames : 0.0, stats.busy_ms_max,
+				stats.busy_frames);
+		}
+	}
+	if (poster) {
+		poster_stats_t stats;
+		double seconds = get_wall_time () - loop_start;
+		bool ok = close_poster (poster, &stats);
+		long long peak_bytes = get_peak_memory_bytes ();
+
+		if (ok) {
+			printf ("wrote %ix%i to %s\n", poster_width, poster_height,
+				poster_out_file_name);
+		} else {
+			fprintf (stderr, "ERROR: could not write %s\n", poster_out_file_name);
+		}
+		printf ("poster: %i tiles of %ix%i in %.2fs: draw %.2fs, read back %.2fs, \
+compress and write %.2fs. tile row buffer %.1f MB, peak memory %.1f MB\n",
+			stats.tiles, gl_width, gl_height, seconds, seconds - stats.read_seconds -
+			stats.write_seconds, stats.read_seconds, stats.write_seconds,
+			stats.row_buffer_bytes / (1024.0 * 1024.0), peak_bytes > 0 ? peak_bytes /
+			(1024.0 * 1024.0) : 0.0);
+	} else if (headless) {
+		double t0 = get_wall_time (), write_seconds;
+		bool ok;
+
+		// the last frame is in the framebuffer, already drawn
+		if (png_bench) {
+			run_png_bench (headless_out_file_name);
+			t0 = get_wall_time ();
+		}
+		ok = screencapture (headless_out_file_name);
+		write_seconds = get_wall_time () - t0;
+		if (ok) {
+			printf ("wrote %ix%i to %s\n", gl_width, gl_height,
+				headless_out_file_name);
+		}
+		printf ("headless: context %.3fs, load and set-up %.3fs, first frame \
+%.1f ms, read back and write PNG %.1f ms\n", hl.context_seconds, loop_start -
+			start_time - hl.context_seconds, first_frame_seconds * 1000.0,
+			write_seconds * 1000.0);
+		if (headless_frames > 1) {
+			printf ("headless: %i frames, mean %.2f ms\n", headless_frames,
+				(loop_end - loop_start) * 1000.0 / headless_frames);
+		}
+		printf ("headless: start to first frame %.3fs, start to image %.3fs\n",
+			loop_start + first_frame_seconds - start_time, get_wall_time () -
+			start_time);
+	}
+
+	if (streamer) {
+		streamer_stats_t stats;
+		get_streamer_stats (streamer, &stats);
+		printf ("streamed: %i/%i nodes resident %.1f MB, last second %.1f MB/s \
+hit rate %.1f%%\n", stats.resident_nodes, stats.node_count,
+			stats.resident_bytes / (1024.0 * 1024.0), stats.streamed_mb_per_s,
+			stats.hit_rate * 100.0);
+		destroy_streamer (streamer);
+	}
+	if (instance_matrices) {
+		printf ("%i copies, mean frame time: instanced %.3f ms (%i frames), \
+per-copy draws %.3f ms (%i frames)\n", instance_count, frame_counts[0] > 0 ?
+			frame_seconds[0] * 1000.0 / frame_counts[0] : 0.0, frame_counts[0],
+			frame_counts[1] > 0 ? frame_seconds[1] * 1000.0 / frame_counts[1] : 0.0,
+			frame_counts[1]);
+		free (instance_matrices);
+	}
+	if (bench_frames > 0) {
+		bench_result_t result;
+		result.mesh_name = obj_file_name;
+		result.renderer = (const char*)renderer;
+		result.frame_seconds = bench_frame_seconds;
+		result.frame_count = bench_frame;
+		result.timestep = BENCH_TIMESTEP;
+		result.triangles = bench_triangles;
+		result.total_seconds = bench_last - bench_start;
+		write_bench_results (&result);
+		free_camera_path (&camera_path);
+		free (bench_frame_seconds);
+	}
+	if (frame_timer && timings_file_name[0]) {
+		frame_time_stats_t stats;
+		write_frame_times_csv (frame_timer, timings_file_name);
+		get_frame_time_stats (frame_timer, &stats);
+		printf ("last %i of %i frames, p50/p95/p99: cpu %.2f/%.2f/%.2f ms, \
+gpu %.2f/%.2f/%.2f ms (%i samples)\n", stats.cpu_samples, stats.frame_count,
+			stats.cpu_p50, stats.cpu_p95, stats.cpu_p99, stats.gpu_p50,
+			stats.gpu_p95, stats.gpu_p99, stats.gpu_samples);
+	}
+	if (draw_batches.frames > 0) {
+		double frames = (double)draw_batches.frames;
+		printf ("material batches: %i keys. per frame %.1f ranges cut into %.1f, \
+%.1f multi-draws, %.1f state changes\n", draw_batches.key_count,
+			draw_batches.total.ranges_in / frames, draw_batches.total.ranges /
+			frames, draw_batches.total.draw_calls / frames,
+			draw_batches.total.state_changes / frames);
+	}
+	free_draw_batches (&draw_batches);
+	free (key_states);
+	if (frame_timer) {
+		int m;
+		// from the frame timer, as the time between frames is fixed under
+		// --bench, 0 with --headless and held to vsync in a window
+		printf ("anti-aliasing mode   frames   cpu ms   gpu ms\n");
+		for (m = 0; m < AA_MODES; m++) {
+			tagged_frame_times_t times;
+			get_tagged_frame_times (frame_timer, m, &times);
+			if (0 == times.frames) {
+				continue;
+			}
+			printf ("%-18s %8i %8.3f", antialias_mode_name (m), times.frames,
+				times.cpu_mean);
+			if (times.gpu_frames > 0) {
+				printf (" %8.3f\n", times.gpu_mean);
+			} else {
+				printf ("        -\n");
+			}
+		}
+	}
+	destroy_frame_timer (frame_timer);
+	free_antialias (&aa);
+	print_gl_state_stats (&loop_gl_stats, frames_drawn);
+	printf ("transforms: %lld matrix updates, %lld uniform uploads, %lld \
+skipped as unchanged\n", transforms.derived_updates, transforms.uniform_uploads,
+		transforms.uniform_skips);
+	stop_hot_reload (hot_reload);
+	free (scene_meshes);
+	free_chunk_bvh (&bvh);
+	free_occlusion (&occlusion);
+	free (cull_firsts);
+	free (cull_counts);
+	if (headless) {
+		free_headless (&hl);
+	}
 
 	return 0;
 }
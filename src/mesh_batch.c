@@ -0,0 +1,308 @@
+//
+// Loading several mesh files at once on a pool of threads
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "mesh_batch.h"
+#include "mesh_codec.h"
+#include "mesh_utils.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+struct mesh_batch_t {
+	const char** file_names;
+	int file_count;
+	mesh_process_fn process;
+	// file indices waiting to be parsed, and finished loaded_mesh_t's
+	work_queue_t* todo;
+	work_queue_t* done;
+	worker_group_t* loaders;
+	int handed_out;
+};
+
+bool load_mesh_file (
+	const char* file_name,
+	int thread_count,
+	mesh_process_fn process,
+	float** points,
+	float** tex_coords,
+	float** normals,
+	int* point_count
+) {
+	obj_mesh_t mesh;
+	bool ok;
+
+	if (is_cmsh_file_name (file_name)) {
+		return load_cmsh_file (file_name, points, tex_coords, normals, point_count,
+			thread_count);
+	}
+	if (!load_obj_mesh (file_name, &mesh, thread_count)) {
+		return false;
+	}
+	if (process) {
+		process (&mesh);
+	}
+	ok = expand_obj_mesh (&mesh, points, tex_coords, normals, point_count,
+		thread_count);
+	free_obj_mesh (&mesh);
+	return ok;
+}
+
+bool load_mesh_file_interleaved (
+	const char* file_name,
+	int thread_count,
+	mesh_process_fn process,
+	float** vertices,
+	int* point_count
+) {
+	vertex_streams_t streams;
+	obj_mesh_t mesh;
+
+	if (is_cmsh_file_name (file_name)) {
+		cmsh_mesh_t packed;
+		if (!load_cmsh_mesh (file_name, &packed, thread_count, NULL)) {
+			return false;
+		}
+		*point_count = packed.index_count;
+		*vertices = (float*)malloc (((size_t)packed.index_count *
+			INTERLEAVED_VERTEX_FLOATS + 1) * sizeof (float));
+		interleaved_vertex_streams (*vertices, &streams);
+		expand_cmsh_mesh_into (&packed, &streams, thread_count);
+		free_cmsh_mesh (&packed);
+		return true;
+	}
+	if (!load_obj_mesh (file_name, &mesh, thread_count)) {
+		return false;
+	}
+	if (process) {
+		process (&mesh);
+	}
+	*point_count = mesh.tri_count * 3;
+	*vertices = (float*)malloc (((size_t)*point_count *
+		INTERLEAVED_VERTEX_FLOATS + 1) * sizeof (float));
+	interleaved_vertex_streams (*vertices, &streams);
+	expand_obj_mesh_into (&mesh, &streams, thread_count);
+	free_obj_mesh (&mesh);
+	return true;
+}
+
+static void loader_main (int worker_idx, void* user) {
+	mesh_batch_t* batch = (mesh_batch_t*)user;
+	void* item = NULL;
+
+	while (work_queue_pop (batch->todo, &item)) {
+		// indices are stored +1 so that file 0 isn't a NULL item
+		int index = (int)((size_t)item - 1);
+		loaded_mesh_t* out = (loaded_mesh_t*)calloc (1, sizeof (loaded_mesh_t));
+		out->index = index;
+		strncpy (out->file_name, batch->file_names[index],
+			sizeof (out->file_name) - 1);
+		// files are spread over threads, so each file is parsed on one
+		out->parse_seconds = get_wall_time ();
+		out->ok = load_mesh_file (out->file_name, 1, batch->process, &out->points,
+			&out->tex_coords, &out->normals, &out->point_count);
+		out->parse_seconds = get_wall_time () - out->parse_seconds;
+		work_queue_push (batch->done, out);
+	}
+	(void)worker_idx;
+}
+
+mesh_batch_t* start_mesh_batch (
+	const char** file_names,
+	int file_count,
+	int thread_count,
+	mesh_process_fn process
+) {
+	mesh_batch_t* batch = (mesh_batch_t*)calloc (1, sizeof (mesh_batch_t));
+	int threads = resolve_thread_count (thread_count), i;
+
+	threads = threads < file_count ? threads : file_count;
+	threads = threads > 0 ? threads : 1;
+	batch->file_names = file_names;
+	batch->file_count = file_count;
+	batch->process = process;
+	batch->todo = create_work_queue (file_count + 1);
+	// every result fits, so loaders never wait on the main thread
+	batch->done = create_work_queue (file_count + 1);
+	for (i = 0; i < file_count; i++) {
+		work_queue_push (batch->todo, (void*)(size_t)(i + 1));
+	}
+	work_queue_close (batch->todo);
+	batch->loaders = start_workers (threads, loader_main, batch);
+	return batch;
+}
+
+loaded_mesh_t* next_loaded_mesh (mesh_batch_t* batch) {
+	void* item = NULL;
+	if (batch->handed_out >= batch->file_count) {
+		return NULL;
+	}
+	if (!work_queue_pop (batch->done, &item)) {
+		return NULL;
+	}
+	batch->handed_out++;
+	return (loaded_mesh_t*)item;
+}
+
+void free_loaded_mesh (loaded_mesh_t* mesh) {
+	if (!mesh) {
+		return;
+	}
+	free (mesh->points);
+	free (mesh->tex_coords);
+	free (mesh->normals);
+	free (mesh);
+}
+
+void finish_mesh_batch (mesh_batch_t* batch) {
+	void* item = NULL;
+	join_workers (batch->loaders);
+	while (work_queue_try_pop (batch->done, &item)) {
+		free_loaded_mesh ((loaded_mesh_t*)item);
+	}
+	destroy_work_queue (batch->todo);
+	destroy_work_queue (batch->done);
+	free (batch);
+}
+
+int read_file_list (const char* list_file_name, char*** file_names) {
+	FILE* fp = fopen (list_file_name, "r");
+	char line[1024];
+	int count = 0, capacity = 16;
+
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open list file %s\n", list_file_name);
+		return -1;
+	}
+	*file_names = (char**)malloc (capacity * sizeof (char*));
+	while (fgets (line, sizeof (line), fp)) {
+		char* s = line;
+		size_t len;
+		while (' ' == *s || '\t' == *s) {
+			s++;
+		}
+		len = strlen (s);
+		while (len > 0 && ('\n' == s[len - 1] || '\r' == s[len - 1] ||
+			' ' == s[len - 1] || '\t' == s[len - 1])) {
+			s[--len] = '\0';
+		}
+		if (0 == len || '#' == s[0]) {
+			continue;
+		}
+		if (count == capacity) {
+			capacity *= 2;
+			*file_names = (char**)realloc (*file_names, capacity * sizeof (char*));
+		}
+		(*file_names)[count] = (char*)malloc (len + 1);
+		memcpy ((*file_names)[count], s, len + 1);
+		count++;
+	}
+	fclose (fp);
+	return count;
+}
+
+void free_file_list (char** file_names, int count) {
+	int i;
+	for (i = 0; i < count; i++) {
+		free (file_names[i]);
+	}
+	free (file_names);
+}
+
+static int compare_names (const void* a, const void* b) {
+	return strcmp (*(char* const*)a, *(char* const*)b);
+}
+
+static bool is_mesh_file_name (const char* name) {
+	const char* dot = strrchr (name, '.');
+	return dot && (0 == strcmp (dot, ".obj") || 0 == strcmp (dot, ".cmsh"));
+}
+
+static void add_name (
+	char*** file_names,
+	int* count,
+	int* capacity,
+	const char* dir_name,
+	const char* name
+) {
+	size_t len = strlen (dir_name) + strlen (name) + 2;
+	if (*count == *capacity) {
+		*capacity *= 2;
+		*file_names = (char**)realloc (*file_names, *capacity * sizeof (char*));
+	}
+	(*file_names)[*count] = (char*)malloc (len);
+	sprintf ((*file_names)[*count], "%s/%s", dir_name, name);
+	(*count)++;
+}
+
+int read_mesh_directory (const char* dir_name, char*** file_names) {
+	int count = 0, capacity = 16;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE find;
+	char pattern[1024];
+
+	snprintf (pattern, sizeof (pattern), "%s\\*", dir_name);
+	find = FindFirstFileA (pattern, &found);
+	if (INVALID_HANDLE_VALUE == find) {
+		fprintf (stderr, "ERROR: could not open directory %s\n", dir_name);
+		return -1;
+	}
+	*file_names = (char**)malloc (capacity * sizeof (char*));
+	do {
+		if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+			is_mesh_file_name (found.cFileName)) {
+			add_name (file_names, &count, &capacity, dir_name, found.cFileName);
+		}
+	} while (FindNextFileA (find, &found));
+	FindClose (find);
+#else
+	DIR* dir = opendir (dir_name);
+	struct dirent* entry;
+
+	if (!dir) {
+		fprintf (stderr, "ERROR: could not open directory %s\n", dir_name);
+		return -1;
+	}
+	*file_names = (char**)malloc (capacity * sizeof (char*));
+	while ((entry = readdir (dir))) {
+		if ('.' != entry->d_name[0] && is_mesh_file_name (entry->d_name)) {
+			add_name (file_names, &count, &capacity, dir_name, entry->d_name);
+		}
+	}
+	closedir (dir);
+#endif
+	// readdir order is whatever the file system keeps
+	qsort (*file_names, count, sizeof (char*), compare_names);
+	return count;
+}
+
+bool is_directory (const char* path) {
+	struct stat st;
+	return 0 == stat (path, &st) && S_ISDIR (st.st_mode);
+}
+
+bool make_directory (const char* path) {
+	if (is_directory (path)) {
+		return true;
+	}
+#ifdef _WIN32
+	_mkdir (path);
+#else
+	mkdir (path, 0755);
+#endif
+	if (!is_directory (path)) {
+		fprintf (stderr, "ERROR: could not make directory %s\n", path);
+		return false;
+	}
+	return true;
+}
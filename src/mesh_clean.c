@@ -0,0 +1,150 @@
+//
+// Degenerate and duplicate triangle removal
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "mesh_clean.h"
+#include "mesh_utils.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// follows the degenerate verdicts of classify_triangle ()
+#define TRI_DUPLICATE (TRI_ZERO_AREA + 1)
+
+// per-thread partial results. both passes over the triangles split the
+// range identically, so a thread's keep count is also its write offset
+typedef struct clean_partial_t {
+	int counts[TRI_DUPLICATE + 1];
+	int write_offset;
+} clean_partial_t;
+
+typedef struct clean_job_t {
+	obj_mesh_t* mesh;
+	clean_partial_t* partials;
+	float area_threshold;
+	const int* dup_ids;
+	const int* dup_first;
+	unsigned char* verdicts;
+	int* ivp;
+	int* ivt;
+	int* ivn;
+	int* tri_material;
+} clean_job_t;
+
+static void classify_range (int begin, int end, int thread_idx, void* user) {
+	clean_job_t* job = (clean_job_t*)user;
+	clean_partial_t* part = &job->partials[thread_idx];
+	int i;
+
+	memset (part->counts, 0, sizeof (part->counts));
+	for (i = begin; i < end; i++) {
+		int verdict = classify_triangle (job->mesh, i, job->area_threshold);
+		if (TRI_OK == verdict && job->dup_first[job->dup_ids[i]] != i) {
+			verdict = TRI_DUPLICATE;
+		}
+		job->verdicts[i] = (unsigned char)verdict;
+		part->counts[verdict]++;
+	}
+}
+
+static void compact_range (int begin, int end, int thread_idx, void* user) {
+	clean_job_t* job = (clean_job_t*)user;
+	int out = job->partials[thread_idx].write_offset;
+	int i;
+
+	for (i = begin; i < end; i++) {
+		if (job->verdicts[i] != TRI_OK) {
+			continue;
+		}
+		memcpy (&job->ivp[out * 3], &job->mesh->ivp[i * 3], 3 * sizeof (int));
+		memcpy (&job->ivt[out * 3], &job->mesh->ivt[i * 3], 3 * sizeof (int));
+		memcpy (&job->ivn[out * 3], &job->mesh->ivn[i * 3], 3 * sizeof (int));
+		if (job->tri_material) {
+			job->tri_material[out] = job->mesh->tri_material[i];
+		}
+		out++;
+	}
+}
+
+void clean_obj_mesh (
+	obj_mesh_t* mesh,
+	float area_epsilon,
+	int thread_count,
+	mesh_clean_report_t* report
+) {
+	clean_job_t job;
+	mesh_clean_report_t r;
+	float bb_min[3], bb_max[3];
+	int* dup_ids = NULL;
+	int* dup_first = NULL;
+	int tri_count = mesh->tri_count;
+	int i, kept = 0;
+
+	memset (&r, 0, sizeof (r));
+	r.seconds = get_wall_time ();
+	r.tris_before = tri_count;
+	thread_count = resolve_thread_count (thread_count);
+	memset (&job, 0, sizeof (job));
+	job.mesh = mesh;
+	job.partials = (clean_partial_t*)calloc (thread_count,
+		sizeof (clean_partial_t));
+
+	// the area threshold scales with the mesh
+	obj_mesh_bounds (mesh, bb_min, bb_max, thread_count);
+	job.area_threshold = zero_area_threshold (bb_min, bb_max, area_epsilon);
+
+	dup_ids = (int*)malloc ((tri_count + 1) * sizeof (int));
+	dup_first = (int*)malloc ((tri_count + 1) * sizeof (int));
+	dedup_triangles (mesh, dup_ids, dup_first, thread_count);
+	job.dup_ids = dup_ids;
+	job.dup_first = dup_first;
+	job.verdicts = (unsigned char*)malloc (tri_count + 1);
+	parallel_for (tri_count, thread_count, classify_range, &job);
+	free (dup_ids);
+	free (dup_first);
+
+	for (i = 0; i < thread_count; i++) {
+		job.partials[i].write_offset = kept;
+		kept += job.partials[i].counts[TRI_OK];
+		r.removed_index_collapse += job.partials[i].counts[TRI_INDEX_COLLAPSE];
+		r.removed_zero_area += job.partials[i].counts[TRI_ZERO_AREA];
+		r.removed_duplicate += job.partials[i].counts[TRI_DUPLICATE];
+	}
+	if (kept < tri_count) {
+		job.ivp = (int*)malloc ((kept * 3 + 1) * sizeof (int));
+		job.ivt = (int*)malloc ((kept * 3 + 1) * sizeof (int));
+		job.ivn = (int*)malloc ((kept * 3 + 1) * sizeof (int));
+		if (mesh->tri_material) {
+			job.tri_material = (int*)malloc ((kept + 1) * sizeof (int));
+		}
+		parallel_for (tri_count, thread_count, compact_range, &job);
+		free (mesh->ivp);
+		free (mesh->ivt);
+		free (mesh->ivn);
+		mesh->ivp = job.ivp;
+		mesh->ivt = job.ivt;
+		mesh->ivn = job.ivn;
+		if (job.tri_material) {
+			free (mesh->tri_material);
+			mesh->tri_material = job.tri_material;
+		}
+		mesh->tri_count = kept;
+	}
+	free (job.verdicts);
+	free (job.partials);
+
+	r.tris_after = mesh->tri_count;
+	r.seconds = get_wall_time () - r.seconds;
+	if (report) {
+		*report = r;
+	}
+}
+
+void print_mesh_clean_report (const mesh_clean_report_t* report) {
+	printf ("clean: %i -> %i triangles in %.3fs. removed %i index collapse, "
+		"%i zero area, %i duplicate\n", report->tris_before, report->tris_after,
+		report->seconds, report->removed_index_collapse, report->removed_zero_area,
+		report->removed_duplicate);
+}
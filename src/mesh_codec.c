@@ -0,0 +1,628 @@
+//
+// Compressed binary mesh format (.cmsh)
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "mesh_codec.h"
+#include "threads.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CMSH_HEADER_BYTES 24
+#define CMSH_DIR_ENTRY_BYTES 20
+// zero bytes after each block so the plane decoder can over-read
+#define CMSH_BLOCK_PADDING 16
+
+// growable byte buffer for one encoded block
+typedef struct byte_buffer_t {
+	unsigned char* data;
+	size_t size;
+	size_t cap;
+} byte_buffer_t;
+
+typedef struct cmsh_block_t {
+	int tri_first;
+	int tri_count;
+	int vertex_count;
+	int vertex_first;
+	int index_first;
+	unsigned long long offset;
+	unsigned int size;
+	byte_buffer_t bytes;
+	bool ok;
+} cmsh_block_t;
+
+typedef struct cmsh_job_t {
+	const obj_mesh_t* src;
+	cmsh_block_t* blocks;
+	const unsigned char* file;
+	cmsh_mesh_t* dst;
+} cmsh_job_t;
+
+static void put_u32 (unsigned char* p, unsigned int v) {
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static unsigned int get_u32 (const unsigned char* p) {
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+		((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void buffer_reserve (byte_buffer_t* b, size_t extra) {
+	if (b->size + extra > b->cap) {
+		size_t cap = b->cap ? b->cap : 4096;
+		while (cap < b->size + extra) {
+			cap *= 2;
+		}
+		b->data = (unsigned char*)realloc (b->data, cap);
+		b->cap = cap;
+	}
+}
+
+static void buffer_put_byte (byte_buffer_t* b, unsigned char v) {
+	buffer_reserve (b, 1);
+	b->data[b->size++] = v;
+}
+
+static void buffer_put_varint (byte_buffer_t* b, unsigned int v) {
+	while (v >= 0x80) {
+		buffer_put_byte (b, (unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	buffer_put_byte (b, (unsigned char)v);
+}
+
+//
+// groups of 16 bytes: 16-bit mask of non-zero bytes, then those bytes
+static void encode_plane (byte_buffer_t* b, const unsigned char* plane,
+	int n) {
+	int g, i;
+	buffer_reserve (b, n + (n / 16 + 1) * 2);
+	for (g = 0; g < n; g += 16) {
+		unsigned int mask = 0;
+		size_t mask_at = b->size;
+		b->size += 2;
+		for (i = 0; i < 16 && g + i < n; i++) {
+			if (plane[g + i]) {
+				mask |= 1u << i;
+				b->data[b->size++] = plane[g + i];
+			}
+		}
+		b->data[mask_at] = (unsigned char)mask;
+		b->data[mask_at + 1] = (unsigned char)(mask >> 8);
+	}
+}
+
+static unsigned int float_bits (float f) {
+	unsigned int u;
+	memcpy (&u, &f, 4);
+	return u;
+}
+
+static void encode_block_range (int begin, int end, int thread_idx,
+	void* user) {
+	cmsh_job_t* job = (cmsh_job_t*)user;
+	const obj_mesh_t* src = job->src;
+	int b;
+
+	for (b = begin; b < end; b++) {
+		cmsh_block_t* block = &job->blocks[b];
+		byte_buffer_t* out = &block->bytes;
+		int corners = block->tri_count * 3;
+		unsigned int table_size = 16, mask;
+		int* table = NULL;
+		int* local_corner = (int*)malloc (corners * sizeof (int));
+		unsigned char* plane = NULL;
+		size_t index_bytes_at;
+		int next = 0, i, c, p;
+
+		while (table_size < (unsigned int)corners * 2) {
+			table_size *= 2;
+		}
+		mask = table_size - 1;
+		table = (int*)malloc (table_size * sizeof (int));
+		memset (table, 0xff, table_size * sizeof (int));
+
+		// indices, building the block's vertex list in first-use order
+		buffer_reserve (out, 4);
+		index_bytes_at = out->size;
+		out->size += 4;
+		for (i = 0; i < corners; i++) {
+			int k = block->tri_first * 3 + i;
+			unsigned int h = (unsigned int)src->ivp[k] * 73856093u ^
+				(unsigned int)src->ivt[k] * 19349663u ^
+				(unsigned int)src->ivn[k] * 83492791u;
+			unsigned int slot = h & mask;
+			int idx = -1;
+			while (table[slot] >= 0) {
+				int o = block->tri_first * 3 + local_corner[table[slot]];
+				if (src->ivp[o] == src->ivp[k] && src->ivt[o] == src->ivt[k] &&
+					src->ivn[o] == src->ivn[k]) {
+					idx = table[slot];
+					break;
+				}
+				slot = (slot + 1) & mask;
+			}
+			if (idx < 0) {
+				idx = next++;
+				table[slot] = idx;
+				local_corner[idx] = i;
+				buffer_put_varint (out, 0);
+			} else {
+				buffer_put_varint (out, (unsigned int)(next - idx));
+			}
+		}
+		put_u32 (&out->data[index_bytes_at], (unsigned int)(out->size -
+			index_bytes_at - 4));
+		block->vertex_count = next;
+
+		// vertex components as XOR deltas split into byte planes
+		plane = (unsigned char*)malloc (next * 4 + 1);
+		for (c = 0; c < CMSH_VERTEX_FLOATS; c++) {
+			unsigned int prev = 0;
+			for (i = 0; i < next; i++) {
+				int k = block->tri_first * 3 + local_corner[i];
+				float f = 0.0f;
+				unsigned int bits;
+				if (c < 3) {
+					f = src->vp[src->ivp[k] * 3 + c];
+				} else if (c < 5) {
+					f = src->ivt[k] < 0 ? 0.0f : src->vt[src->ivt[k] * 2 + c - 3];
+				} else {
+					f = src->ivn[k] < 0 ? 0.0f : src->vn[src->ivn[k] * 3 + c - 5];
+				}
+				bits = float_bits (f);
+				for (p = 0; p < 4; p++) {
+					plane[p * next + i] = (unsigned char)((bits ^ prev) >> (8 * p));
+				}
+				prev = bits;
+			}
+			for (p = 0; p < 4; p++) {
+				encode_plane (out, &plane[p * next], next);
+			}
+		}
+		buffer_reserve (out, CMSH_BLOCK_PADDING);
+		memset (&out->data[out->size], 0, CMSH_BLOCK_PADDING);
+		out->size += CMSH_BLOCK_PADDING;
+		block->size = (unsigned int)out->size;
+
+		free (plane);
+		free (table);
+		free (local_corner);
+	}
+	(void)thread_idx;
+}
+
+bool write_cmsh_file (
+	const char* file_name,
+	const obj_mesh_t* mesh,
+	int thread_count
+) {
+	cmsh_job_t job;
+	cmsh_block_t* blocks = NULL;
+	unsigned char header[CMSH_HEADER_BYTES];
+	unsigned long long offset;
+	unsigned int flags = 0;
+	int block_count = (mesh->tri_count + CMSH_BLOCK_TRIANGLES - 1) /
+		CMSH_BLOCK_TRIANGLES;
+	int vertex_count = 0, i;
+	bool ok = true;
+	FILE* fp = NULL;
+
+	for (i = 0; i < mesh->tri_count * 3; i++) {
+		if (mesh->ivt[i] >= 0) {
+			flags |= CMSH_HAS_TEX_COORDS;
+		}
+		if (mesh->ivn[i] >= 0) {
+			flags |= CMSH_HAS_NORMALS;
+		}
+	}
+	blocks = (cmsh_block_t*)calloc (block_count + 1, sizeof (cmsh_block_t));
+	for (i = 0; i < block_count; i++) {
+		blocks[i].tri_first = i * CMSH_BLOCK_TRIANGLES;
+		blocks[i].tri_count = mesh->tri_count - blocks[i].tri_first;
+		if (blocks[i].tri_count > CMSH_BLOCK_TRIANGLES) {
+			blocks[i].tri_count = CMSH_BLOCK_TRIANGLES;
+		}
+	}
+	job.src = mesh;
+	job.blocks = blocks;
+	parallel_for (block_count, thread_count, encode_block_range, &job);
+
+	fp = fopen (file_name, "wb");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open %s for writing\n", file_name);
+		ok = false;
+	} else {
+		offset = CMSH_HEADER_BYTES + (unsigned long long)block_count *
+			CMSH_DIR_ENTRY_BYTES;
+		for (i = 0; i < block_count; i++) {
+			vertex_count += blocks[i].vertex_count;
+		}
+		memcpy (header, "CMSH", 4);
+		put_u32 (&header[4], CMSH_VERSION);
+		put_u32 (&header[8], (unsigned int)vertex_count);
+		put_u32 (&header[12], (unsigned int)(mesh->tri_count * 3));
+		put_u32 (&header[16], (unsigned int)block_count);
+		put_u32 (&header[20], flags);
+		ok = 1 == fwrite (header, CMSH_HEADER_BYTES, 1, fp);
+		for (i = 0; i < block_count && ok; i++) {
+			unsigned char entry[CMSH_DIR_ENTRY_BYTES];
+			put_u32 (&entry[0], (unsigned int)blocks[i].vertex_count);
+			put_u32 (&entry[4], (unsigned int)(blocks[i].tri_count * 3));
+			put_u32 (&entry[8], (unsigned int)offset);
+			put_u32 (&entry[12], (unsigned int)(offset >> 32));
+			put_u32 (&entry[16], blocks[i].size);
+			ok = 1 == fwrite (entry, CMSH_DIR_ENTRY_BYTES, 1, fp);
+			offset += blocks[i].size;
+		}
+		for (i = 0; i < block_count && ok; i++) {
+			ok = 1 == fwrite (blocks[i].bytes.data, blocks[i].size, 1, fp);
+		}
+		if (!ok) {
+			fprintf (stderr, "ERROR: could not write %s\n", file_name);
+		}
+		fclose (fp);
+	}
+	for (i = 0; i < block_count; i++) {
+		free (blocks[i].bytes.data);
+	}
+	free (blocks);
+	return ok;
+}
+
+//
+// the hot loop. all-zero and all-set groups are the common cases
+static const unsigned char* decode_plane (const unsigned char* src,
+	const unsigned char* end, unsigned char* plane, int n) {
+	int g, i;
+	for (g = 0; g < n; g += 16) {
+		unsigned int mask;
+		unsigned char group[16];
+		unsigned char* dst = g + 16 <= n ? &plane[g] : group;
+		if (src + 2 + 16 > end) {
+			return NULL;
+		}
+		mask = (unsigned int)src[0] | ((unsigned int)src[1] << 8);
+		src += 2;
+		if (0 == mask) {
+			memset (dst, 0, 16);
+		} else if (0xffff == mask) {
+			memcpy (dst, src, 16);
+			src += 16;
+		} else {
+			for (i = 0; i < 16; i++) {
+				unsigned int bit = (mask >> i) & 1;
+				dst[i] = src[0] & (unsigned char)(0 - bit);
+				src += bit;
+			}
+		}
+		if (dst == group) {
+			memcpy (&plane[g], group, n - g);
+		}
+	}
+	return src;
+}
+
+static void decode_block_range (int begin, int end, int thread_idx,
+	void* user) {
+	cmsh_job_t* job = (cmsh_job_t*)user;
+	int b;
+
+	for (b = begin; b < end; b++) {
+		cmsh_block_t* block = &job->blocks[b];
+		const unsigned char* src = job->file + block->offset;
+		const unsigned char* block_end = src + block->size;
+		const unsigned char* index_end;
+		unsigned int* indices = &job->dst->indices[block->index_first];
+		float* vertices = &job->dst->vertices[(size_t)block->vertex_first *
+			CMSH_VERTEX_FLOATS];
+		int n = block->vertex_count;
+		unsigned char* planes = NULL;
+		int next = 0, i, c;
+
+		block->ok = false;
+		if (block->size < 4 + CMSH_BLOCK_PADDING) {
+			continue;
+		}
+		index_end = src + 4 + get_u32 (src);
+		src += 4;
+		if (index_end > block_end) {
+			continue;
+		}
+		for (i = 0; i < block->tri_count * 3; i++) {
+			unsigned int code = 0;
+			int shift = 0;
+			while (src < index_end) {
+				unsigned char byte = *src++;
+				code |= (unsigned int)(byte & 0x7f) << shift;
+				shift += 7;
+				if (!(byte & 0x80) || shift > 28) {
+					break;
+				}
+			}
+			if (0 == code) {
+				indices[i] = block->vertex_first + next++;
+			} else {
+				if ((int)code > next) {
+					break;
+				}
+				indices[i] = block->vertex_first + next - code;
+			}
+		}
+		if (i < block->tri_count * 3 || next != n || src != index_end) {
+			continue;
+		}
+
+		planes = (unsigned char*)malloc (n * 4 + 16);
+		for (c = 0; c < CMSH_VERTEX_FLOATS && src; c++) {
+			unsigned int prev = 0;
+			int p;
+			for (p = 0; p < 4 && src; p++) {
+				src = decode_plane (src, block_end, &planes[p * n], n);
+			}
+			if (!src) {
+				break;
+			}
+			for (i = 0; i < n; i++) {
+				unsigned int bits = (unsigned int)planes[i] |
+					((unsigned int)planes[n + i] << 8) |
+					((unsigned int)planes[2 * n + i] << 16) |
+					((unsigned int)planes[3 * n + i] << 24);
+				prev ^= bits;
+				memcpy (&vertices[(size_t)i * CMSH_VERTEX_FLOATS + c], &prev, 4);
+			}
+		}
+		free (planes);
+		block->ok = src != NULL;
+	}
+	(void)thread_idx;
+}
+
+bool load_cmsh_mesh (
+	const char* file_name,
+	cmsh_mesh_t* mesh,
+	int thread_count,
+	double* decode_seconds
+) {
+	FILE* fp = NULL;
+	unsigned char* data = NULL;
+	cmsh_block_t* blocks = NULL;
+	cmsh_job_t job;
+	unsigned long long vertex_count, index_count, block_count, payload;
+	unsigned long long vertex_total = 0, index_total = 0;
+	long sz = 0;
+	int i;
+	bool ok = true;
+	double t0;
+
+	memset (mesh, 0, sizeof (cmsh_mesh_t));
+	fp = fopen (file_name, "rb");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not find file %s\n", file_name);
+		return false;
+	}
+	fseek (fp, 0, SEEK_END);
+	sz = ftell (fp);
+	rewind (fp);
+	data = sz >= 0 ? (unsigned char*)malloc (sz + 1) : NULL;
+	if (!data || (long)fread (data, 1, sz, fp) != sz) {
+		fprintf (stderr, "ERROR: could not read file %s\n", file_name);
+		fclose (fp);
+		free (data);
+		return false;
+	}
+	fclose (fp);
+
+	if (sz < CMSH_HEADER_BYTES || memcmp (data, "CMSH", 4) ||
+		get_u32 (&data[4]) != CMSH_VERSION) {
+		fprintf (stderr, "ERROR: %s is not a version %i .cmsh file\n", file_name,
+			CMSH_VERSION);
+		free (data);
+		return false;
+	}
+	vertex_count = get_u32 (&data[8]);
+	index_count = get_u32 (&data[12]);
+	block_count = get_u32 (&data[16]);
+	mesh->flags = get_u32 (&data[20]);
+	// nothing is allocated from these counts until they are known to fit the
+	// file: every index takes at least a byte, and every vertex is used by
+	// at least one index
+	payload = (unsigned long long)sz - CMSH_HEADER_BYTES;
+	ok = block_count <= payload / CMSH_DIR_ENTRY_BYTES &&
+		block_count <= INT_MAX;
+	if (ok) {
+		payload -= block_count * CMSH_DIR_ENTRY_BYTES;
+		ok = index_count <= payload && index_count <= INT_MAX &&
+			0 == index_count % 3 && vertex_count <= index_count;
+	}
+	if (ok) {
+		blocks = (cmsh_block_t*)calloc ((size_t)block_count + 1,
+			sizeof (cmsh_block_t));
+	}
+	for (i = 0; i < (int)block_count && ok; i++) {
+		const unsigned char* entry = &data[CMSH_HEADER_BYTES +
+			(size_t)i * CMSH_DIR_ENTRY_BYTES];
+		unsigned long long block_vertices = get_u32 (&entry[0]);
+		unsigned long long block_indices = get_u32 (&entry[4]);
+		blocks[i].offset = (unsigned long long)get_u32 (&entry[8]) |
+			((unsigned long long)get_u32 (&entry[12]) << 32);
+		blocks[i].size = get_u32 (&entry[16]);
+		ok = 0 == block_indices % 3 && block_vertices <= block_indices &&
+			block_indices <= blocks[i].size &&
+			blocks[i].offset >= (unsigned long long)sz - payload &&
+			blocks[i].offset <= (unsigned long long)sz &&
+			blocks[i].size <= (unsigned long long)sz - blocks[i].offset &&
+			block_indices <= index_count - index_total &&
+			block_vertices <= vertex_count - vertex_total;
+		if (!ok) {
+			break;
+		}
+		blocks[i].vertex_count = (int)block_vertices;
+		blocks[i].tri_count = (int)(block_indices / 3);
+		blocks[i].vertex_first = (int)vertex_total;
+		blocks[i].index_first = (int)index_total;
+		vertex_total += block_vertices;
+		index_total += block_indices;
+	}
+	if (!ok || vertex_total != vertex_count || index_total != index_count) {
+		fprintf (stderr, "ERROR: corrupt .cmsh directory in %s\n", file_name);
+		free (blocks);
+		free (data);
+		memset (mesh, 0, sizeof (cmsh_mesh_t));
+		return false;
+	}
+	mesh->vertex_count = (int)vertex_count;
+	mesh->index_count = (int)index_count;
+
+	mesh->vertices = (float*)malloc (((size_t)mesh->vertex_count *
+		CMSH_VERTEX_FLOATS + 1) * sizeof (float));
+	mesh->indices = (unsigned int*)malloc (((size_t)mesh->index_count + 1) *
+		sizeof (unsigned int));
+	job.blocks = blocks;
+	job.file = data;
+	job.dst = mesh;
+	t0 = get_wall_time ();
+	parallel_for ((int)block_count, thread_count, decode_block_range, &job);
+	if (decode_seconds) {
+		*decode_seconds = get_wall_time () - t0;
+	}
+	for (i = 0; i < (int)block_count; i++) {
+		if (!blocks[i].ok) {
+			fprintf (stderr, "ERROR: corrupt block %i in %s\n", i, file_name);
+			ok = false;
+			break;
+		}
+	}
+	free (blocks);
+	free (data);
+	if (!ok) {
+		free_cmsh_mesh (mesh);
+	}
+	return ok;
+}
+
+void free_cmsh_mesh (cmsh_mesh_t* mesh) {
+	free (mesh->vertices);
+	free (mesh->indices);
+	memset (mesh, 0, sizeof (cmsh_mesh_t));
+}
+
+void reorder_cmsh_triangles (cmsh_mesh_t* mesh, const int* order) {
+	int tri_count = mesh->index_count / 3, t;
+	unsigned int* copy = (unsigned int*)malloc ((size_t)mesh->index_count *
+		sizeof (unsigned int) + 1);
+	memcpy (copy, mesh->indices, (size_t)mesh->index_count *
+		sizeof (unsigned int));
+	for (t = 0; t < tri_count; t++) {
+		memcpy (&mesh->indices[t * 3], &copy[order[t] * 3],
+			3 * sizeof (unsigned int));
+	}
+	free (copy);
+}
+
+typedef struct cmsh_expand_job_t {
+	const cmsh_mesh_t* mesh;
+	vertex_streams_t out;
+} cmsh_expand_job_t;
+
+static void cmsh_expand_range (int begin, int end, int thread_idx,
+	void* user) {
+	cmsh_expand_job_t* job = (cmsh_expand_job_t*)user;
+	const vertex_streams_t* out = &job->out;
+	const float* corners[3];
+	int t, i, k;
+
+	for (t = begin; t < end; t++) {
+		float face_n[3] = { 0.0f, 0.0f, 1.0f };
+		for (i = 0; i < 3; i++) {
+			corners[i] = &job->mesh->vertices[
+				(size_t)job->mesh->indices[t * 3 + i] * CMSH_VERTEX_FLOATS];
+		}
+		if (out->normals && !(job->mesh->flags & CMSH_HAS_NORMALS)) {
+			float e0[3], e1[3], len;
+			for (k = 0; k < 3; k++) {
+				e0[k] = corners[1][k] - corners[0][k];
+				e1[k] = corners[2][k] - corners[0][k];
+			}
+			face_n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+			face_n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+			face_n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+			len = sqrtf (face_n[0] * face_n[0] + face_n[1] * face_n[1] +
+				face_n[2] * face_n[2]);
+			if (len > 0.0f) {
+				for (k = 0; k < 3; k++) {
+					face_n[k] /= len;
+				}
+			}
+		}
+		for (i = 0; i < 3; i++) {
+			size_t corner = (size_t)t * 3 + i;
+			const float* v = corners[i];
+			memcpy (&out->points[corner * out->points_stride], v,
+				3 * sizeof (float));
+			if (out->tex_coords) {
+				memcpy (&out->tex_coords[corner * out->tex_coords_stride], v + 3,
+					2 * sizeof (float));
+			}
+			if (out->normals) {
+				memcpy (&out->normals[corner * out->normals_stride],
+					job->mesh->flags & CMSH_HAS_NORMALS ? v + 5 : face_n,
+					3 * sizeof (float));
+			}
+		}
+	}
+	(void)thread_idx;
+}
+
+void expand_cmsh_mesh_into (
+	const cmsh_mesh_t* mesh,
+	const vertex_streams_t* streams,
+	int thread_count
+) {
+	cmsh_expand_job_t job;
+	job.mesh = mesh;
+	job.out = *streams;
+	parallel_for (mesh->index_count / 3, thread_count, cmsh_expand_range, &job);
+}
+
+bool load_cmsh_file (
+	const char* file_name,
+	float** points,
+	float** tex_coords,
+	float** normals,
+	int* point_count,
+	int thread_count
+) {
+	cmsh_mesh_t mesh;
+	vertex_streams_t streams;
+	double decode_seconds = 0.0;
+
+	if (!load_cmsh_mesh (file_name, &mesh, thread_count, &decode_seconds)) {
+		return false;
+	}
+	printf ("decoded %i vertices %i indices from %s in %.3fs\n",
+		mesh.vertex_count, mesh.index_count, file_name, decode_seconds);
+	*point_count = mesh.index_count;
+	*points = (float*)malloc (((size_t)mesh.index_count * 3 + 1) *
+		sizeof (float));
+	*tex_coords = (float*)malloc (((size_t)mesh.index_count * 2 + 1) *
+		sizeof (float));
+	*normals = (float*)malloc (((size_t)mesh.index_count * 3 + 1) *
+		sizeof (float));
+	separate_vertex_streams (*points, *tex_coords, *normals, &streams);
+	expand_cmsh_mesh_into (&mesh, &streams, thread_count);
+	free_cmsh_mesh (&mesh);
+	return true;
+}
+
+bool is_cmsh_file_name (const char* file_name) {
+	size_t len = strlen (file_name);
+	return len > 5 && 0 == strcmp (&file_name[len - 5], ".cmsh");
+}
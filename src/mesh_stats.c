@@ -0,0 +1,213 @@
+//
+// Headless mesh analysis for --stats
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "mesh_stats.h"
+#include "mesh_utils.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// per-thread partial results
+typedef struct stats_partial_t {
+	int degenerate_index_count;
+	int degenerate_area_count;
+} stats_partial_t;
+
+typedef struct stats_job_t {
+	const obj_mesh_t* mesh;
+	stats_partial_t* partials;
+	float area_threshold;
+	const unsigned int* indices;
+	int unique_vertex_count;
+	mesh_stats_t* stats;
+} stats_job_t;
+
+typedef struct cache_config_t {
+	const char* name;
+	int size;
+	bool lru;
+} cache_config_t;
+
+static const cache_config_t cache_configs[MESH_STATS_CACHE_CONFIGS] = {
+	{ "FIFO 16", 16, false },
+	{ "FIFO 32", 32, false },
+	{ "LRU 32", 32, true }
+};
+
+static void degenerate_range (int begin, int end, int thread_idx,
+	void* user) {
+	stats_job_t* job = (stats_job_t*)user;
+	stats_partial_t* part = &job->partials[thread_idx];
+	int i;
+
+	part->degenerate_index_count = 0;
+	part->degenerate_area_count = 0;
+	for (i = begin; i < end; i++) {
+		switch (classify_triangle (job->mesh, i, job->area_threshold)) {
+		case TRI_INDEX_COLLAPSE:
+			part->degenerate_index_count++;
+			break;
+		case TRI_ZERO_AREA:
+			part->degenerate_area_count++;
+			break;
+		}
+	}
+}
+
+//
+// replay the index buffer through a post-transform cache. a FIFO cache
+// holds a vertex while fewer than size misses have happened since it went in
+static void cache_sim_range (int begin, int end, int thread_idx, void* user) {
+	stats_job_t* job = (stats_job_t*)user;
+	int corner_count = job->mesh->tri_count * 3;
+	int c;
+
+	for (c = begin; c < end; c++) {
+		const cache_config_t* cfg = &cache_configs[c];
+		long long misses = 0;
+		int i;
+
+		if (cfg->lru) {
+			int lru[64];
+			int used = 0;
+			for (i = 0; i < corner_count; i++) {
+				int v = (int)job->indices[i];
+				int j, found = -1;
+				for (j = 0; j < used; j++) {
+					if (lru[j] == v) {
+						found = j;
+						break;
+					}
+				}
+				if (found < 0) {
+					misses++;
+					found = used < cfg->size ? used++ : used - 1;
+				}
+				// move to front
+				for (j = found; j > 0; j--) {
+					lru[j] = lru[j - 1];
+				}
+				lru[0] = v;
+			}
+		} else {
+			long long* inserted_at = (long long*)malloc (
+				(job->unique_vertex_count + 1) * sizeof (long long));
+			for (i = 0; i < job->unique_vertex_count; i++) {
+				inserted_at[i] = -(long long)cfg->size - 1;
+			}
+			for (i = 0; i < corner_count; i++) {
+				int v = (int)job->indices[i];
+				if (misses - inserted_at[v] >= cfg->size) {
+					misses++;
+					inserted_at[v] = misses;
+				}
+			}
+			free (inserted_at);
+		}
+		job->stats->cache_names[c] = cfg->name;
+		job->stats->acmr[c] = job->mesh->tri_count > 0 ?
+			(float)((double)misses / job->mesh->tri_count) : 0.0f;
+		job->stats->atvr[c] = job->unique_vertex_count > 0 ?
+			(float)((double)misses / job->unique_vertex_count) : 0.0f;
+	}
+	(void)thread_idx;
+}
+
+void compute_mesh_stats (
+	const obj_mesh_t* mesh,
+	mesh_stats_t* stats,
+	int thread_count
+) {
+	stats_job_t job;
+	unsigned int* indices = NULL;
+	int* ids = NULL;
+	int i, unique_tris;
+
+	memset (stats, 0, sizeof (mesh_stats_t));
+	stats->vp_count = mesh->vp_count;
+	stats->vt_count = mesh->vt_count;
+	stats->vn_count = mesh->vn_count;
+	stats->tri_count = mesh->tri_count;
+	thread_count = resolve_thread_count (thread_count);
+	job.mesh = mesh;
+	job.stats = stats;
+	job.partials = (stats_partial_t*)calloc (thread_count,
+		sizeof (stats_partial_t));
+
+	obj_mesh_bounds (mesh, stats->bb_min, stats->bb_max, thread_count);
+
+	// degenerate triangles. area threshold scales with the mesh
+	job.area_threshold = zero_area_threshold (stats->bb_min, stats->bb_max,
+		MESH_AREA_EPSILON);
+	parallel_for (mesh->tri_count, thread_count, degenerate_range, &job);
+	for (i = 0; i < thread_count; i++) {
+		stats->degenerate_index_count += job.partials[i].degenerate_index_count;
+		stats->degenerate_area_count += job.partials[i].degenerate_area_count;
+	}
+
+	// duplicate triangles by sorted position indices
+	ids = (int*)malloc ((mesh->tri_count + 1) * sizeof (int));
+	unique_tris = dedup_triangles (mesh, ids, NULL, thread_count);
+	stats->duplicate_count = mesh->tri_count - unique_tris;
+	free (ids);
+
+	// unique vertices and vertex cache behaviour of the resulting index buffer
+	indices = (unsigned int*)malloc ((mesh->tri_count * 3 + 1) *
+		sizeof (unsigned int));
+	stats->unique_vertex_count = index_obj_mesh (mesh, indices, NULL,
+		thread_count);
+	job.indices = indices;
+	job.unique_vertex_count = stats->unique_vertex_count;
+	parallel_for (MESH_STATS_CACHE_CONFIGS, thread_count, cache_sim_range,
+		&job);
+
+	free (indices);
+	free (job.partials);
+}
+
+static void print_format_cost (const char* name, int vertex_bytes,
+	long long vertex_count, int index_bytes, long long index_count) {
+	long long total = vertex_bytes * vertex_count + index_bytes * index_count;
+	double per_vertex = vertex_count > 0 ? (double)total / vertex_count : 0.0;
+	printf ("  %-42s %12.2f MB %8.2f B/vertex\n", name,
+		(double)total / (1024.0 * 1024.0), per_vertex);
+}
+
+void print_mesh_stats (const mesh_stats_t* stats) {
+	long long corners = (long long)stats->tri_count * 3;
+	long long unique = stats->unique_vertex_count;
+	int index_bytes = unique <= 65536 ? 2 : 4;
+	int i;
+
+	printf ("triangles:            %i\n", stats->tri_count);
+	printf ("vertices (expanded):  %lli\n", corners);
+	printf ("vertices (unique):    %lli\n", unique);
+	printf ("unique vertex ratio:  %.4f\n", corners > 0 ?
+		(double)unique / corners : 0.0);
+	printf ("obj v/vt/vn:          %i / %i / %i\n", stats->vp_count,
+		stats->vt_count, stats->vn_count);
+	printf ("degenerate triangles: %i (index collapse) %i (zero area)\n",
+		stats->degenerate_index_count, stats->degenerate_area_count);
+	printf ("duplicate triangles:  %i\n", stats->duplicate_count);
+	printf ("bounds:               (%g %g %g) - (%g %g %g)\n",
+		stats->bb_min[0], stats->bb_min[1], stats->bb_min[2],
+		stats->bb_max[0], stats->bb_max[1], stats->bb_max[2]);
+	for (i = 0; i < MESH_STATS_CACHE_CONFIGS; i++) {
+		printf ("vertex cache %-8s ACMR %.3f ATVR %.3f\n", stats->cache_names[i],
+			stats->acmr[i], stats->atvr[i]);
+	}
+	printf ("memory by vertex format:\n");
+	// what the viewer uploads today: 3 separate float streams, no indices
+	print_format_cost ("float32 pos/uv/normal, no indices", 32, corners, 0, 0);
+	print_format_cost ("float32 pos/uv/normal, indexed", 32, unique,
+		index_bytes, corners);
+	// half-float uv and 10:10:10:2 normal
+	print_format_cost ("float32 pos, half uv, 10_10_10 normal", 20, unique,
+		index_bytes, corners);
+	// 16-bit positions quantised to the bounding box
+	print_format_cost ("unorm16 pos, unorm16 uv, 10_10_10 normal", 16, unique,
+		index_bytes, corners);
+}
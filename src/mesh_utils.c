@@ -0,0 +1,482 @@
+//
+// Operations on indexed obj_mesh_t meshes
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "mesh_utils.h"
+#include "threads.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct dedup_job_t {
+	int count;
+	item_hash_fn hash;
+	item_equal_fn equal;
+	const void* user;
+	unsigned int* hashes;
+	int* ids;
+	int partition_count;
+	// per partition: number of unique items and which items they were
+	int* unique_counts;
+	int** reps;
+	int* offsets;
+} dedup_job_t;
+
+//
+// final mix from murmur3 so that similar keys spread over the whole table
+static unsigned int mix_hash (unsigned int h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+//
+// partitions come from the top bits, table slots from a re-mix of the hash
+static int hash_partition (unsigned int h, int partition_count) {
+	return (int)(((unsigned long long)h * partition_count) >> 32);
+}
+
+static void dedup_hash_range (int begin, int end, int thread_idx, void* user) {
+	dedup_job_t* job = (dedup_job_t*)user;
+	int i;
+	for (i = begin; i < end; i++) {
+		job->hashes[i] = mix_hash (job->hash (i, job->user));
+	}
+	(void)thread_idx;
+}
+
+//
+// each partition scans every hash but only inserts the items it owns
+static void dedup_partition (int begin, int end, int thread_idx, void* user) {
+	dedup_job_t* job = (dedup_job_t*)user;
+	int p;
+
+	for (p = begin; p < end; p++) {
+		int owned = 0, unique = 0, i;
+		unsigned int table_size = 16, mask;
+		int* table = NULL;
+
+		for (i = 0; i < job->count; i++) {
+			if (hash_partition (job->hashes[i], job->partition_count) == p) {
+				owned++;
+			}
+		}
+		while (table_size < (unsigned int)owned * 2) {
+			table_size *= 2;
+		}
+		mask = table_size - 1;
+		table = (int*)malloc (table_size * sizeof (int));
+		memset (table, 0xff, table_size * sizeof (int));
+		job->reps[p] = (int*)malloc ((owned + 1) * sizeof (int));
+
+		for (i = 0; i < job->count; i++) {
+			unsigned int h = job->hashes[i];
+			unsigned int slot;
+			if (hash_partition (h, job->partition_count) != p) {
+				continue;
+			}
+			// linear probing
+			for (slot = mix_hash (h ^ 0x9e3779b9) & mask; ; slot = (slot + 1) & mask) {
+				int r = table[slot];
+				if (r < 0) {
+					table[slot] = i;
+					job->ids[i] = unique;
+					job->reps[p][unique++] = i;
+					break;
+				}
+				if (job->hashes[r] == h && job->equal (r, i, job->user)) {
+					job->ids[i] = job->ids[r];
+					break;
+				}
+			}
+		}
+		job->unique_counts[p] = unique;
+		free (table);
+	}
+	(void)thread_idx;
+}
+
+static void dedup_offset_range (int begin, int end, int thread_idx,
+	void* user) {
+	dedup_job_t* job = (dedup_job_t*)user;
+	int i;
+	for (i = begin; i < end; i++) {
+		job->ids[i] += job->offsets[hash_partition (job->hashes[i],
+			job->partition_count)];
+	}
+	(void)thread_idx;
+}
+
+int dedup_items (
+	int count,
+	item_hash_fn hash,
+	item_equal_fn equal,
+	const void* user,
+	int* ids,
+	int* first_item,
+	int thread_count
+) {
+	dedup_job_t job;
+	int total = 0, p;
+
+	if (count <= 0) {
+		return 0;
+	}
+	thread_count = resolve_thread_count (thread_count);
+	job.count = count;
+	job.hash = hash;
+	job.equal = equal;
+	job.user = user;
+	job.ids = ids;
+	job.partition_count = thread_count;
+	job.hashes = (unsigned int*)malloc (count * sizeof (unsigned int));
+	job.unique_counts = (int*)calloc (thread_count, sizeof (int));
+	job.offsets = (int*)calloc (thread_count, sizeof (int));
+	job.reps = (int**)calloc (thread_count, sizeof (int*));
+
+	parallel_for (count, thread_count, dedup_hash_range, &job);
+	parallel_for (job.partition_count, thread_count, dedup_partition, &job);
+	for (p = 0; p < job.partition_count; p++) {
+		job.offsets[p] = total;
+		if (first_item) {
+			memcpy (&first_item[total], job.reps[p],
+				job.unique_counts[p] * sizeof (int));
+		}
+		total += job.unique_counts[p];
+		free (job.reps[p]);
+	}
+	parallel_for (count, thread_count, dedup_offset_range, &job);
+
+	free (job.hashes);
+	free (job.unique_counts);
+	free (job.offsets);
+	free (job.reps);
+	return total;
+}
+
+static unsigned int corner_hash (int item, const void* user) {
+	const obj_mesh_t* mesh = (const obj_mesh_t*)user;
+	unsigned int h = (unsigned int)mesh->ivp[item];
+	h = h * 31 + mix_hash ((unsigned int)mesh->ivt[item]);
+	h = h * 31 + mix_hash ((unsigned int)mesh->ivn[item] + 0x9e3779b9);
+	return h;
+}
+
+static bool corner_equal (int a, int b, const void* user) {
+	const obj_mesh_t* mesh = (const obj_mesh_t*)user;
+	return mesh->ivp[a] == mesh->ivp[b] && mesh->ivt[a] == mesh->ivt[b] &&
+		mesh->ivn[a] == mesh->ivn[b];
+}
+
+int index_obj_mesh (
+	const obj_mesh_t* mesh,
+	unsigned int* indices,
+	int* first_corner,
+	int thread_count
+) {
+	// ids are non-negative so the buffer can be reused as unsigned
+	return dedup_items (mesh->tri_count * 3, corner_hash, corner_equal, mesh,
+		(int*)indices, first_corner, thread_count);
+}
+
+static void sort3 (const int* in, int* out) {
+	int a = in[0], b = in[1], c = in[2], t;
+	if (a > b) { t = a; a = b; b = t; }
+	if (b > c) { t = b; b = c; c = t; }
+	if (a > b) { t = a; a = b; b = t; }
+	out[0] = a;
+	out[1] = b;
+	out[2] = c;
+}
+
+static unsigned int tri_hash (int item, const void* user) {
+	const obj_mesh_t* mesh = (const obj_mesh_t*)user;
+	int s[3];
+	sort3 (&mesh->ivp[item * 3], s);
+	return (unsigned int)s[0] * 73856093u ^ (unsigned int)s[1] * 19349663u ^
+		(unsigned int)s[2] * 83492791u;
+}
+
+static bool tri_equal (int a, int b, const void* user) {
+	const obj_mesh_t* mesh = (const obj_mesh_t*)user;
+	int sa[3], sb[3];
+	sort3 (&mesh->ivp[a * 3], sa);
+	sort3 (&mesh->ivp[b * 3], sb);
+	return sa[0] == sb[0] && sa[1] == sb[1] && sa[2] == sb[2];
+}
+
+int dedup_triangles (
+	const obj_mesh_t* mesh,
+	int* ids,
+	int* first_tri,
+	int thread_count
+) {
+	return dedup_items (mesh->tri_count, tri_hash, tri_equal, mesh, ids,
+		first_tri, thread_count);
+}
+
+typedef struct bounds_job_t {
+	const obj_mesh_t* mesh;
+	// 6 floats per thread, min then max
+	float* partials;
+} bounds_job_t;
+
+static void bounds_range (int begin, int end, int thread_idx, void* user) {
+	bounds_job_t* job = (bounds_job_t*)user;
+	float* bb = &job->partials[thread_idx * 6];
+	const float* vp = job->mesh->vp;
+	int i, k;
+
+	for (i = begin; i < end; i++) {
+		for (k = 0; k < 3; k++) {
+			float f = vp[i * 3 + k];
+			bb[k] = f < bb[k] ? f : bb[k];
+			bb[k + 3] = f > bb[k + 3] ? f : bb[k + 3];
+		}
+	}
+}
+
+void obj_mesh_bounds (
+	const obj_mesh_t* mesh,
+	float* bb_min,
+	float* bb_max,
+	int thread_count
+) {
+	bounds_job_t job;
+	int i, k;
+
+	if (mesh->vp_count < 1) {
+		memset (bb_min, 0, 3 * sizeof (float));
+		memset (bb_max, 0, 3 * sizeof (float));
+		return;
+	}
+	thread_count = resolve_thread_count (thread_count);
+	job.mesh = mesh;
+	job.partials = (float*)malloc (thread_count * 6 * sizeof (float));
+	// threads that get no vertices leave their partials empty
+	for (i = 0; i < thread_count; i++) {
+		for (k = 0; k < 3; k++) {
+			job.partials[i * 6 + k] = FLT_MAX;
+			job.partials[i * 6 + k + 3] = -FLT_MAX;
+		}
+	}
+	parallel_for (mesh->vp_count, thread_count, bounds_range, &job);
+	for (k = 0; k < 3; k++) {
+		bb_min[k] = FLT_MAX;
+		bb_max[k] = -FLT_MAX;
+		for (i = 0; i < thread_count; i++) {
+			float lo = job.partials[i * 6 + k], hi = job.partials[i * 6 + k + 3];
+			bb_min[k] = lo < bb_min[k] ? lo : bb_min[k];
+			bb_max[k] = hi > bb_max[k] ? hi : bb_max[k];
+		}
+	}
+	free (job.partials);
+}
+
+float zero_area_threshold (
+	const float* bb_min,
+	const float* bb_max,
+	float area_epsilon
+) {
+	float diag2 = 0.0f;
+	int k;
+	for (k = 0; k < 3; k++) {
+		diag2 += (bb_max[k] - bb_min[k]) * (bb_max[k] - bb_min[k]);
+	}
+	// compared against |cross|^2, and |cross| is twice the area
+	return 4.0f * area_epsilon * area_epsilon * diag2 * diag2;
+}
+
+int classify_triangle (const obj_mesh_t* mesh, int tri, float threshold) {
+	const int* ivp = &mesh->ivp[tri * 3];
+	const float* vp = mesh->vp;
+	int a = ivp[0], b = ivp[1], c = ivp[2];
+	float e0[3], e1[3], n[3];
+	int k;
+
+	if (a == b || b == c || a == c) {
+		return TRI_INDEX_COLLAPSE;
+	}
+	for (k = 0; k < 3; k++) {
+		e0[k] = vp[b * 3 + k] - vp[a * 3 + k];
+		e1[k] = vp[c * 3 + k] - vp[a * 3 + k];
+	}
+	n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+	n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+	n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+	if (n[0] * n[0] + n[1] * n[1] + n[2] * n[2] <= threshold) {
+		return TRI_ZERO_AREA;
+	}
+	return TRI_OK;
+}
+
+typedef struct expand_job_t {
+	const obj_mesh_t* mesh;
+	vertex_streams_t out;
+} expand_job_t;
+
+void separate_vertex_streams (
+	float* points,
+	float* tex_coords,
+	float* normals,
+	vertex_streams_t* streams
+) {
+	streams->points = points;
+	streams->tex_coords = tex_coords;
+	streams->normals = normals;
+	streams->points_stride = 3;
+	streams->tex_coords_stride = 2;
+	streams->normals_stride = 3;
+}
+
+void interleaved_vertex_streams (float* vertices, vertex_streams_t* streams) {
+	streams->points = vertices;
+	streams->tex_coords = vertices + 3;
+	streams->normals = vertices + 5;
+	streams->points_stride = INTERLEAVED_VERTEX_FLOATS;
+	streams->tex_coords_stride = INTERLEAVED_VERTEX_FLOATS;
+	streams->normals_stride = INTERLEAVED_VERTEX_FLOATS;
+}
+
+//
+// permute groups of per_tri ints, one group per triangle
+static void reorder_triangle_ints (int* items, int per_tri, const int* order,
+	int tri_count) {
+	size_t bytes = (size_t)tri_count * per_tri * sizeof (int);
+	int* copy = (int*)malloc (bytes + 1);
+	int t;
+	memcpy (copy, items, bytes);
+	for (t = 0; t < tri_count; t++) {
+		memcpy (&items[t * per_tri], &copy[order[t] * per_tri],
+			per_tri * sizeof (int));
+	}
+	free (copy);
+}
+
+void reorder_obj_mesh_triangles (obj_mesh_t* mesh, const int* order) {
+	reorder_triangle_ints (mesh->ivp, 3, order, mesh->tri_count);
+	reorder_triangle_ints (mesh->ivt, 3, order, mesh->tri_count);
+	reorder_triangle_ints (mesh->ivn, 3, order, mesh->tri_count);
+	if (mesh->tri_material) {
+		reorder_triangle_ints (mesh->tri_material, 1, order, mesh->tri_count);
+	}
+}
+
+void copy_vertex_streams (
+	const vertex_streams_t* from,
+	const vertex_streams_t* to,
+	int point_count
+) {
+	int i;
+	for (i = 0; i < point_count; i++) {
+		memcpy (&to->points[(size_t)i * to->points_stride],
+			&from->points[(size_t)i * from->points_stride], 3 * sizeof (float));
+		if (from->tex_coords && to->tex_coords) {
+			memcpy (&to->tex_coords[(size_t)i * to->tex_coords_stride],
+				&from->tex_coords[(size_t)i * from->tex_coords_stride],
+				2 * sizeof (float));
+		}
+		if (from->normals && to->normals) {
+			memcpy (&to->normals[(size_t)i * to->normals_stride],
+				&from->normals[(size_t)i * from->normals_stride], 3 * sizeof (float));
+		}
+	}
+}
+
+static void expand_range (int begin, int end, int thread_idx, void* user) {
+	expand_job_t* job = (expand_job_t*)user;
+	const obj_mesh_t* mesh = job->mesh;
+	const vertex_streams_t* out = &job->out;
+	int t, i, k;
+
+	for (t = begin; t < end; t++) {
+		float face_n[3] = { 0.0f, 0.0f, 1.0f };
+		bool have_face_n = false;
+
+		for (i = t * 3; i < t * 3 + 3; i++) {
+			int vp = mesh->ivp[i], vt = mesh->ivt[i], vn = mesh->ivn[i];
+			float* p = &out->points[(size_t)i * out->points_stride];
+			for (k = 0; k < 3; k++) {
+				p[k] = mesh->vp[vp * 3 + k];
+			}
+			if (out->tex_coords) {
+				float* st = &out->tex_coords[(size_t)i * out->tex_coords_stride];
+				st[0] = vt < 0 ? 0.0f : mesh->vt[vt * 2];
+				st[1] = vt < 0 ? 0.0f : mesh->vt[vt * 2 + 1];
+			}
+			if (!out->normals) {
+				continue;
+			}
+			if (vn < 0 && !have_face_n) {
+				const float* a = &mesh->vp[mesh->ivp[t * 3] * 3];
+				const float* b = &mesh->vp[mesh->ivp[t * 3 + 1] * 3];
+				const float* c = &mesh->vp[mesh->ivp[t * 3 + 2] * 3];
+				float e0[3], e1[3], len;
+				for (k = 0; k < 3; k++) {
+					e0[k] = b[k] - a[k];
+					e1[k] = c[k] - a[k];
+				}
+				face_n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+				face_n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+				face_n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+				len = sqrtf (face_n[0] * face_n[0] + face_n[1] * face_n[1] +
+					face_n[2] * face_n[2]);
+				if (len > 0.0f) {
+					for (k = 0; k < 3; k++) {
+						face_n[k] /= len;
+					}
+				}
+				have_face_n = true;
+			}
+			for (k = 0; k < 3; k++) {
+				out->normals[(size_t)i * out->normals_stride + k] = vn < 0 ?
+					face_n[k] : mesh->vn[vn * 3 + k];
+			}
+		}
+	}
+	(void)thread_idx;
+}
+
+void expand_obj_mesh_into (
+	const obj_mesh_t* mesh,
+	const vertex_streams_t* streams,
+	int thread_count
+) {
+	expand_job_t job;
+	job.mesh = mesh;
+	job.out = *streams;
+	parallel_for (mesh->tri_count, thread_count, expand_range, &job);
+}
+
+bool expand_obj_mesh (
+	const obj_mesh_t* mesh,
+	float** points,
+	float** tex_coords,
+	float** normals,
+	int* point_count,
+	int thread_count
+) {
+	vertex_streams_t streams;
+	int corners = mesh->tri_count * 3;
+
+	*points = (float*)malloc ((corners * 3 + 1) * sizeof (float));
+	*tex_coords = (float*)malloc ((corners * 2 + 1) * sizeof (float));
+	*normals = (float*)malloc ((corners * 3 + 1) * sizeof (float));
+	if (!*points || !*tex_coords || !*normals) {
+		fprintf (stderr, "ERROR: out of memory expanding mesh\n");
+		free (*points);
+		free (*tex_coords);
+		free (*normals);
+		return false;
+	}
+	separate_vertex_streams (*points, *tex_coords, *normals, &streams);
+	expand_obj_mesh_into (mesh, &streams, thread_count);
+	*point_count = corners;
+	return true;
+}
@@ -0,0 +1,294 @@
+//
+// Epsilon welding of near-duplicate vertex positions
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "mesh_weld.h"
+#include "mesh_utils.h"
+#include "threads.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct weld_job_t {
+	obj_mesh_t* mesh;
+	float inv_cell;
+	float tol2;
+	// integer grid cell of each position, 3 per position
+	long long* cell_xyz;
+	// dense cell id of each position, and the first position in each cell
+	int* cell_of;
+	int* cell_first;
+	int cell_count;
+	// positions sorted by cell. cell c owns cell_verts[cell_start[c]..c+1]
+	int* cell_start;
+	int* cell_verts;
+	// open-addressing lookup from cell coordinates to cell id
+	int* table;
+	unsigned int mask;
+	// lowest position in reach, then the root of its chain
+	int* rep;
+	int* root;
+	int* new_index;
+	float* new_vp;
+} weld_job_t;
+
+static unsigned int cell_key_hash (const long long* c) {
+	unsigned long long h = (unsigned long long)c[0] * 73856093ull ^
+		(unsigned long long)c[1] * 19349663ull ^
+		(unsigned long long)c[2] * 83492791ull;
+	return (unsigned int)(h ^ (h >> 32));
+}
+
+static unsigned int cell_hash (int item, const void* user) {
+	const weld_job_t* job = (const weld_job_t*)user;
+	return cell_key_hash (&job->cell_xyz[item * 3]);
+}
+
+static bool cell_equal (int a, int b, const void* user) {
+	const weld_job_t* job = (const weld_job_t*)user;
+	return 0 == memcmp (&job->cell_xyz[a * 3], &job->cell_xyz[b * 3],
+		3 * sizeof (long long));
+}
+
+static void cell_coords_range (int begin, int end, int thread_idx,
+	void* user) {
+	weld_job_t* job = (weld_job_t*)user;
+	int i, k;
+	for (i = begin; i < end; i++) {
+		for (k = 0; k < 3; k++) {
+			job->cell_xyz[i * 3 + k] = (long long)floor (
+				(double)job->mesh->vp[i * 3 + k] * job->inv_cell);
+		}
+	}
+	(void)thread_idx;
+}
+
+static int find_cell (const weld_job_t* job, const long long* c) {
+	unsigned int slot = cell_key_hash (c) & job->mask;
+	while (job->table[slot] >= 0) {
+		int id = job->table[slot];
+		if (0 == memcmp (&job->cell_xyz[job->cell_first[id] * 3], c,
+			3 * sizeof (long long))) {
+			return id;
+		}
+		slot = (slot + 1) & job->mask;
+	}
+	return -1;
+}
+
+//
+// for each position, find the lowest-numbered position within tolerance in
+// the 3x3x3 block of cells around it
+static void weld_cells_range (int begin, int end, int thread_idx,
+	void* user) {
+	weld_job_t* job = (weld_job_t*)user;
+	const float* vp = job->mesh->vp;
+	int c;
+
+	for (c = begin; c < end; c++) {
+		const long long* cc = &job->cell_xyz[job->cell_first[c] * 3];
+		int n[27], nc = 0, dx, dy, dz, i;
+
+		for (dx = -1; dx <= 1; dx++) {
+			for (dy = -1; dy <= 1; dy++) {
+				for (dz = -1; dz <= 1; dz++) {
+					long long key[3] = { cc[0] + dx, cc[1] + dy, cc[2] + dz };
+					int id = find_cell (job, key);
+					if (id >= 0) {
+						n[nc++] = id;
+					}
+				}
+			}
+		}
+		for (i = job->cell_start[c]; i < job->cell_start[c + 1]; i++) {
+			int v = job->cell_verts[i];
+			int best = v, j;
+			for (j = 0; j < nc; j++) {
+				int k;
+				// cell lists are ascending so stop at the first hit
+				for (k = job->cell_start[n[j]]; k < job->cell_start[n[j] + 1]; k++) {
+					int u = job->cell_verts[k];
+					float d[3];
+					if (u >= best) {
+						break;
+					}
+					d[0] = vp[u * 3] - vp[v * 3];
+					d[1] = vp[u * 3 + 1] - vp[v * 3 + 1];
+					d[2] = vp[u * 3 + 2] - vp[v * 3 + 2];
+					if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] <= job->tol2) {
+						best = u;
+						break;
+					}
+				}
+			}
+			job->rep[v] = best;
+		}
+	}
+	(void)thread_idx;
+}
+
+static void find_roots_range (int begin, int end, int thread_idx,
+	void* user) {
+	weld_job_t* job = (weld_job_t*)user;
+	int i;
+	for (i = begin; i < end; i++) {
+		int r = i;
+		// reps only ever point to lower indices so this terminates
+		while (job->rep[r] != r) {
+			r = job->rep[r];
+		}
+		job->root[i] = r;
+	}
+	(void)thread_idx;
+}
+
+static void remap_positions_range (int begin, int end, int thread_idx,
+	void* user) {
+	weld_job_t* job = (weld_job_t*)user;
+	int i;
+	for (i = begin; i < end; i++) {
+		if (job->root[i] == i) {
+			memcpy (&job->new_vp[job->new_index[i] * 3], &job->mesh->vp[i * 3],
+				3 * sizeof (float));
+		}
+	}
+	(void)thread_idx;
+}
+
+static void remap_corners_range (int begin, int end, int thread_idx,
+	void* user) {
+	weld_job_t* job = (weld_job_t*)user;
+	int i;
+	for (i = begin; i < end; i++) {
+		job->mesh->ivp[i] = job->new_index[job->root[job->mesh->ivp[i]]];
+	}
+	(void)thread_idx;
+}
+
+static int count_unique_vertices (const obj_mesh_t* mesh, int thread_count) {
+	unsigned int* indices = (unsigned int*)malloc ((mesh->tri_count * 3 + 1) *
+		sizeof (unsigned int));
+	int n = index_obj_mesh (mesh, indices, NULL, thread_count);
+	free (indices);
+	return n;
+}
+
+void weld_obj_mesh (
+	obj_mesh_t* mesh,
+	float tolerance,
+	int thread_count,
+	mesh_weld_report_t* report
+) {
+	weld_job_t job;
+	mesh_weld_report_t r;
+	unsigned int table_size = 16;
+	int count = mesh->vp_count;
+	int i, kept = 0;
+
+	memset (&r, 0, sizeof (r));
+	r.positions_before = count;
+	r.vertices_before = count_unique_vertices (mesh, thread_count);
+	if (count <= 0 || tolerance <= 0.0f) {
+		r.positions_after = count;
+		r.vertices_after = r.vertices_before;
+		if (report) {
+			*report = r;
+		}
+		return;
+	}
+	r.seconds = get_wall_time ();
+	thread_count = resolve_thread_count (thread_count);
+	memset (&job, 0, sizeof (job));
+	job.mesh = mesh;
+	job.inv_cell = 1.0f / tolerance;
+	job.tol2 = tolerance * tolerance;
+
+	// bucket positions into grid cells
+	job.cell_xyz = (long long*)malloc (count * 3 * sizeof (long long));
+	job.cell_of = (int*)malloc (count * sizeof (int));
+	job.cell_first = (int*)malloc (count * sizeof (int));
+	parallel_for (count, thread_count, cell_coords_range, &job);
+	job.cell_count = dedup_items (count, cell_hash, cell_equal, &job,
+		job.cell_of, job.cell_first, thread_count);
+
+	// counting sort of positions by cell, keeping each cell's list ascending
+	job.cell_start = (int*)calloc (job.cell_count + 1, sizeof (int));
+	job.cell_verts = (int*)malloc (count * sizeof (int));
+	for (i = 0; i < count; i++) {
+		job.cell_start[job.cell_of[i] + 1]++;
+	}
+	for (i = 0; i < job.cell_count; i++) {
+		job.cell_start[i + 1] += job.cell_start[i];
+	}
+	{
+		int* fill = (int*)malloc ((job.cell_count + 1) * sizeof (int));
+		memcpy (fill, job.cell_start, (job.cell_count + 1) * sizeof (int));
+		for (i = 0; i < count; i++) {
+			job.cell_verts[fill[job.cell_of[i]]++] = i;
+		}
+		free (fill);
+	}
+
+	// neighbour lookup table
+	while (table_size < (unsigned int)job.cell_count * 2) {
+		table_size *= 2;
+	}
+	job.mask = table_size - 1;
+	job.table = (int*)malloc (table_size * sizeof (int));
+	memset (job.table, 0xff, table_size * sizeof (int));
+	for (i = 0; i < job.cell_count; i++) {
+		unsigned int slot = cell_key_hash (&job.cell_xyz[job.cell_first[i] * 3]) &
+			job.mask;
+		while (job.table[slot] >= 0) {
+			slot = (slot + 1) & job.mask;
+		}
+		job.table[slot] = i;
+	}
+
+	job.rep = (int*)malloc (count * sizeof (int));
+	job.root = (int*)malloc (count * sizeof (int));
+	parallel_for (job.cell_count, thread_count, weld_cells_range, &job);
+	parallel_for (count, thread_count, find_roots_range, &job);
+
+	// renumber surviving positions in their original order
+	job.new_index = (int*)malloc (count * sizeof (int));
+	for (i = 0; i < count; i++) {
+		if (job.root[i] == i) {
+			job.new_index[i] = kept++;
+		}
+	}
+	job.new_vp = (float*)malloc ((kept * 3 + 1) * sizeof (float));
+	parallel_for (count, thread_count, remap_positions_range, &job);
+	parallel_for (mesh->tri_count * 3, thread_count, remap_corners_range, &job);
+	free (mesh->vp);
+	mesh->vp = job.new_vp;
+	mesh->vp_count = kept;
+
+	free (job.cell_xyz);
+	free (job.cell_of);
+	free (job.cell_first);
+	free (job.cell_start);
+	free (job.cell_verts);
+	free (job.table);
+	free (job.rep);
+	free (job.root);
+	free (job.new_index);
+
+	r.seconds = get_wall_time () - r.seconds;
+	r.grid_cells = job.cell_count;
+	r.positions_after = kept;
+	r.vertices_after = count_unique_vertices (mesh, thread_count);
+	if (report) {
+		*report = r;
+	}
+}
+
+void print_mesh_weld_report (const mesh_weld_report_t* report) {
+	printf ("weld: positions %i -> %i, vertices %i -> %i, %i grid cells, "
+		"%.3fs (%.1f M positions/s)\n", report->positions_before,
+		report->positions_after, report->vertices_before, report->vertices_after,
+		report->grid_cells, report->seconds, report->seconds > 0.0 ?
+		report->positions_before / report->seconds * 1e-6 : 0.0);
+}
@@ -4,6 +4,8 @@
 // antongerdelan.net
 //
 #include "obj_parser.h"
+#include "threads.h"
+#include <math.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -159,3 +161,633 @@ bool load_obj_file  (
 	printf ("allocated %i points\n", *point_count);
 	return true;
 }
+
+//
+// Parallel indexed loader
+// --------------------------------------------------------------------------
+
+// a usemtl line: the material name, and how many triangles of its chunk
+// came before it
+typedef struct obj_usemtl_t {
+	const char* name;
+	int name_len;
+	int tri;
+} obj_usemtl_t;
+
+// a line-aligned slice of the file parsed by one thread
+typedef struct obj_chunk_t {
+	const char* begin;
+	const char* end;
+	// counts found in this chunk during the first pass
+	int vp_count;
+	int vt_count;
+	int vn_count;
+	int tri_count;
+	// index of this chunk's first element in the whole-file arrays
+	int vp_first;
+	int vt_first;
+	int vn_first;
+	int tri_first;
+	// usemtl lines found in the first pass
+	obj_usemtl_t* usemtls;
+	int usemtl_count;
+	int usemtl_capacity;
+	// the chunk's first mtllib line, if any
+	const char* mtllib;
+	int mtllib_len;
+	bool ok;
+} obj_chunk_t;
+
+typedef struct obj_parse_job_t {
+	obj_chunk_t* chunks;
+	obj_mesh_t* mesh;
+} obj_parse_job_t;
+
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+	1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const char* skip_blanks (const char* s, const char* end) {
+	while (s < end && (*s == ' ' || *s == '\t' || *s == '\r')) {
+		s++;
+	}
+	return s;
+}
+
+//
+// sscanf is far too slow for big files, so parse plain decimal floats by hand
+// and fall back to strtod for anything unusual (nan, inf, hex)
+static const char* parse_float (const char* s, const char* end, float* out) {
+	unsigned long long mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool negative = false;
+	const char* start;
+	double value;
+
+	s = skip_blanks (s, end);
+	start = s;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s == '-';
+		s++;
+	}
+	while (s < end && *s >= '0' && *s <= '9') {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*s - '0');
+			if (mantissa) {
+				digits++;
+			}
+		} else {
+			exponent++;
+		}
+		s++;
+	}
+	if (s < end && *s == '.') {
+		s++;
+		while (s < end && *s >= '0' && *s <= '9') {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*s - '0');
+				if (mantissa) {
+					digits++;
+				}
+				exponent--;
+			}
+			s++;
+		}
+	}
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		bool eneg = false;
+		int e = 0;
+		s++;
+		if (s < end && (*s == '-' || *s == '+')) {
+			eneg = *s == '-';
+			s++;
+		}
+		while (s < end && *s >= '0' && *s <= '9') {
+			if (e < 10000) {
+				e = e * 10 + (*s - '0');
+			}
+			s++;
+		}
+		exponent += eneg ? -e : e;
+	}
+	if (s == start || (s < end && *s != ' ' && *s != '\t' && *s != '\r' &&
+		*s != '\n')) {
+		char tmp[64];
+		int len = (int)(end - start) < 63 ? (int)(end - start) : 63;
+		char* tmp_end = NULL;
+		memcpy (tmp, start, len);
+		tmp[len] = '\0';
+		*out = (float)strtod (tmp, &tmp_end);
+		if (tmp_end == tmp) {
+			return NULL;
+		}
+		return start + (tmp_end - tmp);
+	}
+	value = (double)mantissa;
+	if (exponent < 0) {
+		value = -exponent <= 22 ? value / pow10_table[-exponent] :
+			value * pow (10.0, exponent);
+	} else if (exponent > 0) {
+		value = exponent <= 22 ? value * pow10_table[exponent] :
+			value * pow (10.0, exponent);
+	}
+	*out = (float)(negative ? -value : value);
+	return s;
+}
+
+static const char* parse_int (const char* s, const char* end, int* out) {
+	bool negative = false;
+	long long v = 0;
+	const char* start;
+
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s == '-';
+		s++;
+	}
+	start = s;
+	while (s < end && *s >= '0' && *s <= '9') {
+		if (v < 0x7fffffff) {
+			v = v * 10 + (*s - '0');
+		}
+		s++;
+	}
+	if (s == start) {
+		return NULL;
+	}
+	*out = (int)(negative ? -v : v);
+	return s;
+}
+
+//
+// turn a 1-based or negative (relative) .obj index into a 0-based one.
+// seen is how many of that element were declared before this line
+static bool resolve_index (int idx, int seen, int total, int* out) {
+	if (idx > 0) {
+		*out = idx - 1;
+	} else if (idx < 0) {
+		*out = seen + idx;
+	} else {
+		return false;
+	}
+	return *out >= 0 && *out < total;
+}
+
+//
+// count the corners in an f line starting after the 'f'
+static int count_face_corners (const char* s, const char* end) {
+	int n = 0;
+	while (true) {
+		s = skip_blanks (s, end);
+		if (s >= end || *s == '\n' || *s == '#') {
+			break;
+		}
+		n++;
+		while (s < end && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n') {
+			s++;
+		}
+	}
+	return n;
+}
+
+//
+// true if the line at s starts with keyword followed by a blank
+static bool is_keyword (const char* s, const char* eol, const char* keyword) {
+	int len = (int)strlen (keyword);
+	return eol - s > len && 0 == strncmp (s, keyword, len) &&
+		(s[len] == ' ' || s[len] == '\t');
+}
+
+//
+// the rest of the line after a keyword, trimmed. names may contain spaces
+static const char* line_argument (const char* s, const char* eol, int* len) {
+	s = skip_blanks (s, eol);
+	while (eol > s && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r')) {
+		eol--;
+	}
+	*len = (int)(eol - s);
+	return s;
+}
+
+static void count_chunk (int begin, int end, int thread_idx, void* user) {
+	obj_parse_job_t* job = (obj_parse_job_t*)user;
+	int c;
+
+	for (c = begin; c < end; c++) {
+		obj_chunk_t* chunk = &job->chunks[c];
+		const char* s = chunk->begin;
+
+		while (s < chunk->end) {
+			const char* eol = (const char*)memchr (s, '\n', chunk->end - s);
+			if (!eol) {
+				eol = chunk->end;
+			}
+			s = skip_blanks (s, eol);
+			if (eol - s > 1) {
+				if (s[0] == 'v') {
+					if (s[1] == ' ' || s[1] == '\t') {
+						chunk->vp_count++;
+					} else if (s[1] == 't') {
+						chunk->vt_count++;
+					} else if (s[1] == 'n') {
+						chunk->vn_count++;
+					}
+				} else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+					int corners = count_face_corners (s + 1, eol);
+					if (corners >= 3) {
+						chunk->tri_count += corners - 2;
+					}
+				} else if (is_keyword (s, eol, "usemtl")) {
+					obj_usemtl_t* u;
+					if (chunk->usemtl_count == chunk->usemtl_capacity) {
+						chunk->usemtl_capacity = chunk->usemtl_capacity > 0 ?
+							chunk->usemtl_capacity * 2 : 16;
+						chunk->usemtls = (obj_usemtl_t*)realloc (chunk->usemtls,
+							chunk->usemtl_capacity * sizeof (obj_usemtl_t));
+					}
+					u = &chunk->usemtls[chunk->usemtl_count++];
+					u->name = line_argument (s + 6, eol, &u->name_len);
+					u->tri = chunk->tri_count;
+				} else if (!chunk->mtllib && is_keyword (s, eol, "mtllib")) {
+					chunk->mtllib = line_argument (s + 6, eol, &chunk->mtllib_len);
+				}
+			}
+			s = eol + 1;
+		}
+	}
+	(void)thread_idx;
+}
+
+//
+// parse one v/vt/vn index triplet such as 3, 3/1, 3//2 or 3/1/2
+static const char* parse_corner (const char* s, const char* end, int vp_seen,
+	int vt_seen, int vn_seen, const obj_mesh_t* mesh, int* vp, int* vt,
+	int* vn) {
+	int idx = 0;
+
+	*vt = *vn = -1;
+	s = parse_int (s, end, &idx);
+	if (!s || !resolve_index (idx, vp_seen, mesh->vp_count, vp)) {
+		return NULL;
+	}
+	if (s < end && *s == '/') {
+		s++;
+		if (s < end && *s != '/') {
+			s = parse_int (s, end, &idx);
+			if (!s || !resolve_index (idx, vt_seen, mesh->vt_count, vt)) {
+				return NULL;
+			}
+		}
+		if (s < end && *s == '/') {
+			s++;
+			s = parse_int (s, end, &idx);
+			if (!s || !resolve_index (idx, vn_seen, mesh->vn_count, vn)) {
+				return NULL;
+			}
+		}
+	}
+	return s;
+}
+
+static void parse_chunk (int begin, int end, int thread_idx, void* user) {
+	obj_parse_job_t* job = (obj_parse_job_t*)user;
+	obj_mesh_t* mesh = job->mesh;
+	int c;
+
+	for (c = begin; c < end; c++) {
+		obj_chunk_t* chunk = &job->chunks[c];
+		const char* s = chunk->begin;
+		int vp = chunk->vp_first, vt = chunk->vt_first, vn = chunk->vn_first;
+		int tri = chunk->tri_first;
+		int line_number = 0;
+
+		chunk->ok = true;
+		while (s < chunk->end && chunk->ok) {
+			const char* eol = (const char*)memchr (s, '\n', chunk->end - s);
+			if (!eol) {
+				eol = chunk->end;
+			}
+			line_number++;
+			s = skip_blanks (s, eol);
+			if (eol - s > 1 && s[0] == 'v') {
+				if (s[1] == ' ' || s[1] == '\t') {
+					float* p = &mesh->vp[vp * 3];
+					// any trailing w or vertex colour is ignored
+					const char* t = parse_float (s + 1, eol, &p[0]);
+					t = t ? parse_float (t, eol, &p[1]) : NULL;
+					t = t ? parse_float (t, eol, &p[2]) : NULL;
+					chunk->ok = t != NULL;
+					vp++;
+				} else if (s[1] == 't') {
+					float* p = &mesh->vt[vt * 2];
+					const char* t = parse_float (s + 2, eol, &p[0]);
+					p[1] = 0.0f;
+					// v is optional in the spec
+					if (t && skip_blanks (t, eol) < eol) {
+						t = parse_float (t, eol, &p[1]);
+					}
+					chunk->ok = t != NULL;
+					vt++;
+				} else if (s[1] == 'n') {
+					float* p = &mesh->vn[vn * 3];
+					const char* t = parse_float (s + 2, eol, &p[0]);
+					t = t ? parse_float (t, eol, &p[1]) : NULL;
+					t = t ? parse_float (t, eol, &p[2]) : NULL;
+					chunk->ok = t != NULL;
+					vn++;
+				}
+			} else if (eol - s > 1 && s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+				int first[3] = { 0, 0, 0 }, prev[3] = { 0, 0, 0 }, cur[3];
+				int corners = 0;
+				const char* t = s + 1;
+
+				// fan-triangulate polygons: (0, i-1, i)
+				while (chunk->ok) {
+					t = skip_blanks (t, eol);
+					if (t >= eol || *t == '#') {
+						break;
+					}
+					t = parse_corner (t, eol, vp, vt, vn, mesh, &cur[0], &cur[1],
+						&cur[2]);
+					if (!t) {
+						chunk->ok = false;
+						break;
+					}
+					if (0 == corners) {
+						memcpy (first, cur, sizeof (first));
+					} else if (corners >= 2) {
+						int k = tri * 3;
+						mesh->ivp[k] = first[0];
+						mesh->ivt[k] = first[1];
+						mesh->ivn[k] = first[2];
+						mesh->ivp[k + 1] = prev[0];
+						mesh->ivt[k + 1] = prev[1];
+						mesh->ivn[k + 1] = prev[2];
+						mesh->ivp[k + 2] = cur[0];
+						mesh->ivt[k + 2] = cur[1];
+						mesh->ivn[k + 2] = cur[2];
+						tri++;
+					}
+					memcpy (prev, cur, sizeof (prev));
+					corners++;
+				}
+			}
+			if (!chunk->ok) {
+				fprintf (stderr, "ERROR: could not parse line %i of chunk %i:\n%.*s\n",
+					line_number, c, (int)(eol - s), s);
+			}
+			s = eol + 1;
+		}
+	}
+	(void)thread_idx;
+}
+
+static unsigned int hash_name (const char* name, int len) {
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return h;
+}
+
+//
+// number the materials named by the chunks' usemtl lines in order of first
+// use and give each triangle the one in force where it was declared. this is
+// one pass over the lines and one over the triangles, however many groups
+static void resolve_materials (
+	obj_chunk_t* chunks,
+	int chunk_count,
+	obj_mesh_t* mesh
+) {
+	int* table = NULL;
+	int usemtl_total = 0, table_size = 1, filled = 0, current = -1, c, i, t;
+
+	for (c = 0; c < chunk_count; c++) {
+		usemtl_total += chunks[c].usemtl_count;
+		if (chunks[c].mtllib && !mesh->mtllib[0]) {
+			int len = chunks[c].mtllib_len < (int)sizeof (mesh->mtllib) - 1 ?
+				chunks[c].mtllib_len : (int)sizeof (mesh->mtllib) - 1;
+			memcpy (mesh->mtllib, chunks[c].mtllib, len);
+			mesh->mtllib[len] = '\0';
+		}
+	}
+	if (0 == usemtl_total) {
+		return;
+	}
+	// open addressing over material numbers, at most half full
+	while (table_size < usemtl_total * 2) {
+		table_size *= 2;
+	}
+	table = (int*)malloc (table_size * sizeof (int));
+	memset (table, 0xff, table_size * sizeof (int));
+	mesh->material_names = (char**)malloc (usemtl_total * sizeof (char*));
+	mesh->tri_material = (int*)malloc ((mesh->tri_count + 1) * sizeof (int));
+	for (c = 0; c < chunk_count; c++) {
+		for (i = 0; i < chunks[c].usemtl_count; i++) {
+			const obj_usemtl_t* u = &chunks[c].usemtls[i];
+			unsigned int slot = hash_name (u->name, u->name_len) & (table_size - 1);
+			int until = chunks[c].tri_first + u->tri;
+
+			for (t = filled; t < until; t++) {
+				mesh->tri_material[t] = current;
+			}
+			filled = until;
+			while (table[slot] >= 0) {
+				const char* name = mesh->material_names[table[slot]];
+				if ((int)strlen (name) == u->name_len &&
+					0 == memcmp (name, u->name, u->name_len)) {
+					break;
+				}
+				slot = (slot + 1) & (table_size - 1);
+			}
+			if (table[slot] < 0) {
+				char* name = (char*)malloc (u->name_len + 1);
+				memcpy (name, u->name, u->name_len);
+				name[u->name_len] = '\0';
+				table[slot] = mesh->material_count;
+				mesh->material_names[mesh->material_count++] = name;
+			}
+			current = table[slot];
+		}
+	}
+	for (t = filled; t < mesh->tri_count; t++) {
+		mesh->tri_material[t] = current;
+	}
+	free (table);
+}
+
+bool load_obj_mesh (const char* file_name, obj_mesh_t* mesh, int thread_count) {
+	FILE* fp = NULL;
+	char* data = NULL;
+	long sz = 0;
+	obj_chunk_t* chunks = NULL;
+	obj_parse_job_t job;
+	int chunk_count, i;
+	bool ok = true;
+
+	memset (mesh, 0, sizeof (obj_mesh_t));
+	fp = fopen (file_name, "rb");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not find file %s\n", file_name);
+		return false;
+	}
+	fseek (fp, 0, SEEK_END);
+	sz = ftell (fp);
+	rewind (fp);
+	data = (char*)malloc (sz + 1);
+	if (!data || (long)fread (data, 1, sz, fp) != sz) {
+		fprintf (stderr, "ERROR: could not read file %s\n", file_name);
+		fclose (fp);
+		free (data);
+		return false;
+	}
+	data[sz] = '\0';
+	fclose (fp);
+
+	// a few chunks per thread so uneven line mixes still balance out
+	thread_count = resolve_thread_count (thread_count);
+	chunk_count = thread_count * 4;
+	if (sz < (long)chunk_count * 4096) {
+		chunk_count = 1 + (int)(sz / 4096);
+	}
+	chunks = (obj_chunk_t*)calloc (chunk_count, sizeof (obj_chunk_t));
+	for (i = 0; i < chunk_count; i++) {
+		long off = (long)(((long long)sz * i) / chunk_count);
+		// start each chunk on the line after its nominal split point
+		if (i > 0) {
+			const char* nl = (const char*)memchr (data + off, '\n', sz - off);
+			off = nl ? (long)(nl - data) + 1 : sz;
+			if (off < (long)(chunks[i - 1].begin - data)) {
+				off = (long)(chunks[i - 1].begin - data);
+			}
+			chunks[i - 1].end = data + off;
+		}
+		chunks[i].begin = data + off;
+	}
+	chunks[chunk_count - 1].end = data + sz;
+	job.chunks = chunks;
+	job.mesh = mesh;
+
+	parallel_for (chunk_count, thread_count, count_chunk, &job);
+	for (i = 0; i < chunk_count; i++) {
+		chunks[i].vp_first = mesh->vp_count;
+		chunks[i].vt_first = mesh->vt_count;
+		chunks[i].vn_first = mesh->vn_count;
+		chunks[i].tri_first = mesh->tri_count;
+		mesh->vp_count += chunks[i].vp_count;
+		mesh->vt_count += chunks[i].vt_count;
+		mesh->vn_count += chunks[i].vn_count;
+		mesh->tri_count += chunks[i].tri_count;
+	}
+	mesh->vp = (float*)malloc ((mesh->vp_count * 3 + 1) * sizeof (float));
+	mesh->vt = (float*)malloc ((mesh->vt_count * 2 + 1) * sizeof (float));
+	mesh->vn = (float*)malloc ((mesh->vn_count * 3 + 1) * sizeof (float));
+	mesh->ivp = (int*)malloc ((mesh->tri_count * 3 + 1) * sizeof (int));
+	mesh->ivt = (int*)malloc ((mesh->tri_count * 3 + 1) * sizeof (int));
+	mesh->ivn = (int*)malloc ((mesh->tri_count * 3 + 1) * sizeof (int));
+	if (!mesh->vp || !mesh->vt || !mesh->vn || !mesh->ivp || !mesh->ivt ||
+		!mesh->ivn) {
+		fprintf (stderr, "ERROR: out of memory loading %s\n", file_name);
+		ok = false;
+	} else {
+		parallel_for (chunk_count, thread_count, parse_chunk, &job);
+		for (i = 0; i < chunk_count; i++) {
+			ok = ok && chunks[i].ok;
+		}
+		resolve_materials (chunks, chunk_count, mesh);
+	}
+	for (i = 0; i < chunk_count; i++) {
+		free (chunks[i].usemtls);
+	}
+	free (chunks);
+	free (data);
+	if (!ok) {
+		free_obj_mesh (mesh);
+	}
+	return ok;
+}
+
+void free_obj_mesh (obj_mesh_t* mesh) {
+	int i;
+
+	free (mesh->vp);
+	free (mesh->vt);
+	free (mesh->vn);
+	free (mesh->ivp);
+	free (mesh->ivt);
+	free (mesh->ivn);
+	for (i = 0; i < mesh->material_count; i++) {
+		free (mesh->material_names[i]);
+	}
+	free (mesh->material_names);
+	free (mesh->tri_material);
+	memset (mesh, 0, sizeof (obj_mesh_t));
+}
+
+bool load_mtl_file (
+	const char* file_name,
+	obj_material_t** materials,
+	int* material_count
+) {
+	FILE* fp = fopen (file_name, "r");
+	obj_material_t* m = NULL;
+	char line[1024];
+	int capacity = 0;
+
+	*materials = NULL;
+	*material_count = 0;
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open material library %s\n",
+			file_name);
+		return false;
+	}
+	while (fgets (line, sizeof (line), fp)) {
+		const char* eol = line + strlen (line);
+		const char* s = skip_blanks (line, eol);
+		const char* arg;
+		int len;
+
+		if (eol > s && eol[-1] == '\n') {
+			eol--;
+		}
+		if (is_keyword (s, eol, "newmtl")) {
+			if (*material_count == capacity) {
+				capacity = capacity > 0 ? capacity * 2 : 16;
+				*materials = (obj_material_t*)realloc (*materials, capacity *
+					sizeof (obj_material_t));
+			}
+			m = &(*materials)[(*material_count)++];
+			memset (m, 0, sizeof (obj_material_t));
+			m->kd[0] = m->kd[1] = m->kd[2] = 1.0f;
+			arg = line_argument (s + 6, eol, &len);
+			len = len < (int)sizeof (m->name) - 1 ? len : (int)sizeof (m->name) - 1;
+			memcpy (m->name, arg, len);
+		} else if (m && is_keyword (s, eol, "Kd")) {
+			// g and b are optional and default to r. spectral and xyz colours
+			// are not supported and stay white
+			const char* t = parse_float (s + 2, eol, &m->kd[0]);
+			const char* u = t ? parse_float (t, eol, &m->kd[1]) : NULL;
+			if (!t) {
+				m->kd[0] = m->kd[1] = m->kd[2] = 1.0f;
+			} else if (!u || !parse_float (u, eol, &m->kd[2])) {
+				m->kd[1] = m->kd[2] = m->kd[0];
+			}
+		} else if (m && is_keyword (s, eol, "map_Kd")) {
+			// options such as -s 1 1 1 come before the file, so take the last word
+			const char* word;
+			arg = line_argument (s + 6, eol, &len);
+			word = arg + len;
+			while (word > arg && word[-1] != ' ' && word[-1] != '\t') {
+				word--;
+			}
+			len = (int)(arg + len - word);
+			len = len < (int)sizeof (m->map_kd) - 1 ? len :
+				(int)sizeof (m->map_kd) - 1;
+			memcpy (m->map_kd, word, len);
+			m->map_kd[len] = '\0';
+		}
+	}
+	fclose (fp);
+	return true;
+}
@@ -0,0 +1,373 @@
+//
+// Software hierarchical-Z occlusion culling against a few large occluders
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "occlusion.h"
+#include "threads.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct occluder_area_t {
+	float area;
+	int tri;
+} occluder_area_t;
+
+typedef struct area_job_t {
+	const float* points;
+	int stride;
+	// NULL for a triangle soup
+	const unsigned int* indices;
+	occluder_area_t* areas;
+} area_job_t;
+
+static const float* corner_point (const area_job_t* job, int t, int c) {
+	size_t v = job->indices ? job->indices[t * 3 + c] : (size_t)t * 3 + c;
+	return &job->points[v * job->stride];
+}
+
+typedef struct pyramid_job_t {
+	occlusion_t* occ;
+	int level;
+} pyramid_job_t;
+
+bool create_occlusion (
+	occlusion_t* occ,
+	int width,
+	int height,
+	int thread_count
+) {
+	int w = width, h = height, l;
+
+	memset (occ, 0, sizeof (occlusion_t));
+	if (width < 1 || height < 1) {
+		return false;
+	}
+	occ->width = width;
+	occ->height = height;
+	occ->thread_count = thread_count;
+	for (l = 0; l < OCCLUSION_MAX_LEVELS; l++) {
+		occ->level_width[l] = w;
+		occ->level_height[l] = h;
+		occ->levels[l] = (float*)malloc (w * h * sizeof (float));
+		occ->level_count++;
+		if (1 == w && 1 == h) {
+			break;
+		}
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	return true;
+}
+
+void free_occlusion (occlusion_t* occ) {
+	int l;
+	for (l = 0; l < occ->level_count; l++) {
+		free (occ->levels[l]);
+	}
+	free (occ->occluders);
+	free (occ->screen);
+	free (occ->clipped);
+	memset (occ, 0, sizeof (occlusion_t));
+}
+
+static void area_range (int begin, int end, int thread_idx, void* user) {
+	area_job_t* job = (area_job_t*)user;
+	int t;
+	for (t = begin; t < end; t++) {
+		const float* p0 = corner_point (job, t, 0);
+		const float* p1 = corner_point (job, t, 1);
+		const float* p2 = corner_point (job, t, 2);
+		float e1[3], e2[3], c[3];
+		int k;
+		for (k = 0; k < 3; k++) {
+			e1[k] = p1[k] - p0[k];
+			e2[k] = p2[k] - p0[k];
+		}
+		c[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		c[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		c[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		job->areas[t].area = 0.5f * sqrtf (c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+		job->areas[t].tri = t;
+	}
+	(void)thread_idx;
+}
+
+static int compare_areas (const void* a, const void* b) {
+	const occluder_area_t* x = (const occluder_area_t*)a;
+	const occluder_area_t* y = (const occluder_area_t*)b;
+	if (x->area != y->area) {
+		return x->area > y->area ? -1 : 1;
+	}
+	return x->tri - y->tri;
+}
+
+void select_occluders (
+	occlusion_t* occ,
+	const float* points,
+	int stride,
+	int point_count,
+	int max_triangles
+) {
+	select_occluders_indexed (occ, points, stride, NULL, point_count / 3,
+		max_triangles);
+}
+
+void select_occluders_indexed (
+	occlusion_t* occ,
+	const float* points,
+	int stride,
+	const unsigned int* indices,
+	int tri_count,
+	int max_triangles
+) {
+	int count = 0;
+	float* occluders = pick_occluders (points, stride, indices, tri_count,
+		max_triangles, occ->thread_count, &count);
+	set_occluders (occ, occluders, count);
+}
+
+float* pick_occluders (
+	const float* points,
+	int stride,
+	const unsigned int* indices,
+	int tri_count,
+	int max_triangles,
+	int thread_count,
+	int* count
+) {
+	area_job_t job;
+	float* occluders;
+	int i, v;
+
+	*count = tri_count < max_triangles ? tri_count : max_triangles;
+	occluders = (float*)malloc (*count * 9 * sizeof (float) + 1);
+	if (tri_count < 1) {
+		return occluders;
+	}
+	job.points = points;
+	job.stride = stride;
+	job.indices = indices;
+	job.areas = (occluder_area_t*)malloc (tri_count * sizeof (occluder_area_t));
+	parallel_for (tri_count, thread_count, area_range, &job);
+	qsort (job.areas, tri_count, sizeof (occluder_area_t), compare_areas);
+	for (i = 0; i < *count; i++) {
+		for (v = 0; v < 3; v++) {
+			memcpy (&occluders[i * 9 + v * 3],
+				corner_point (&job, job.areas[i].tri, v), 3 * sizeof (float));
+		}
+	}
+	printf ("occlusion: %i occluders, smallest area %g\n", *count,
+		*count > 0 ? job.areas[*count - 1].area : 0.0f);
+	free (job.areas);
+	return occluders;
+}
+
+void set_occluders (occlusion_t* occ, float* occluders, int count) {
+	free (occ->occluders);
+	free (occ->screen);
+	free (occ->clipped);
+	occ->occluders = occluders;
+	occ->occluder_count = count;
+	occ->screen = (float*)malloc (count * 9 * sizeof (float) + 1);
+	occ->clipped = (unsigned char*)malloc (count * 3 + 1);
+}
+
+//
+// model space to window x, y and 0..1 depth. returns false for points behind
+// the near plane, where the projection is meaningless
+static bool project_point (const float* m, const float* p, float width,
+	float height, float* out) {
+	float x = m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12];
+	float y = m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13];
+	float z = m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14];
+	float w = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15];
+	if (w <= 1e-6f || z < -w) {
+		return false;
+	}
+	out[0] = (x / w * 0.5f + 0.5f) * width;
+	out[1] = (y / w * 0.5f + 0.5f) * height;
+	out[2] = z / w * 0.5f + 0.5f;
+	return true;
+}
+
+static void transform_range (int begin, int end, int thread_idx, void* user) {
+	occlusion_t* occ = (occlusion_t*)user;
+	int v;
+	for (v = begin; v < end; v++) {
+		occ->clipped[v] = project_point (occ->clip_matrix, &occ->occluders[v * 3],
+			(float)occ->width, (float)occ->height, &occ->screen[v * 3]) ? 0 : 1;
+	}
+	(void)thread_idx;
+}
+
+//
+// rasterise every occluder into rows [begin, end) of the depth buffer.
+// coverage is sampled at pixel centres and depth is interpolated, keeping the
+// nearest. occluders are not back-face culled: a wall hides things from
+// either side
+static void raster_rows (int begin, int end, int thread_idx, void* user) {
+	occlusion_t* occ = (occlusion_t*)user;
+	float* depth = occ->levels[0];
+	int w = occ->width, t, x, y;
+
+	for (y = begin; y < end; y++) {
+		for (x = 0; x < w; x++) {
+			depth[y * w + x] = 1.0f;
+		}
+	}
+	for (t = 0; t < occ->occluder_count; t++) {
+		const float* a = &occ->screen[t * 9];
+		const float* b = a + 3;
+		const float* c = a + 6;
+		float area, inv_area, min_x, max_x, min_y, max_y;
+		int x0, x1, y0, y1;
+
+		// a triangle crossing the near plane is skipped rather than clipped.
+		// that only loses occlusion, never hides something visible
+		if (occ->clipped[t * 3] || occ->clipped[t * 3 + 1] ||
+			occ->clipped[t * 3 + 2]) {
+			continue;
+		}
+		area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+		if (fabsf (area) < 1e-12f) {
+			continue;
+		}
+		inv_area = 1.0f / area;
+		min_x = fminf (a[0], fminf (b[0], c[0]));
+		max_x = fmaxf (a[0], fmaxf (b[0], c[0]));
+		min_y = fminf (a[1], fminf (b[1], c[1]));
+		max_y = fmaxf (a[1], fmaxf (b[1], c[1]));
+		if (max_x < 0.0f || min_x > (float)w || max_y < (float)begin ||
+			min_y > (float)end) {
+			continue;
+		}
+		x0 = (int)fmaxf (ceilf (min_x - 0.5f), 0.0f);
+		x1 = (int)fminf (floorf (max_x - 0.5f), (float)(w - 1));
+		y0 = (int)fmaxf (ceilf (min_y - 0.5f), (float)begin);
+		y1 = (int)fminf (floorf (max_y - 0.5f), (float)(end - 1));
+		for (y = y0; y <= y1; y++) {
+			float py = (float)y + 0.5f;
+			for (x = x0; x <= x1; x++) {
+				float px = (float)x + 0.5f;
+				// barycentrics from edge functions, normalised so the triangle's
+				// winding doesn't matter
+				float l0 = ((b[0] - px) * (c[1] - py) - (b[1] - py) * (c[0] - px)) *
+					inv_area;
+				float l1 = ((c[0] - px) * (a[1] - py) - (c[1] - py) * (a[0] - px)) *
+					inv_area;
+				float l2 = 1.0f - l0 - l1;
+				float z;
+				if (l0 < 0.0f || l1 < 0.0f || l2 < 0.0f) {
+					continue;
+				}
+				z = l0 * a[2] + l1 * b[2] + l2 * c[2];
+				if (z < depth[y * w + x]) {
+					depth[y * w + x] = z;
+				}
+			}
+		}
+	}
+	(void)thread_idx;
+}
+
+//
+// each texel of a level is the farthest of the 2x2 texels below it
+static void pyramid_rows (int begin, int end, int thread_idx, void* user) {
+	pyramid_job_t* job = (pyramid_job_t*)user;
+	const occlusion_t* occ = job->occ;
+	const float* src = occ->levels[job->level - 1];
+	float* dst = occ->levels[job->level];
+	int sw = occ->level_width[job->level - 1];
+	int sh = occ->level_height[job->level - 1];
+	int dw = occ->level_width[job->level];
+	int x, y;
+
+	for (y = begin; y < end; y++) {
+		int sy0 = y * 2, sy1 = y * 2 + 1 < sh ? y * 2 + 1 : sh - 1;
+		for (x = 0; x < dw; x++) {
+			int sx0 = x * 2, sx1 = x * 2 + 1 < sw ? x * 2 + 1 : sw - 1;
+			dst[y * dw + x] = fmaxf (
+				fmaxf (src[sy0 * sw + sx0], src[sy0 * sw + sx1]),
+				fmaxf (src[sy1 * sw + sx0], src[sy1 * sw + sx1]));
+		}
+	}
+	(void)thread_idx;
+}
+
+void render_occluders (occlusion_t* occ, const float* clip_matrix) {
+	double t0 = get_wall_time ();
+	pyramid_job_t job;
+	int t, l;
+
+	memcpy (occ->clip_matrix, clip_matrix, 16 * sizeof (float));
+	parallel_for (occ->occluder_count * 3, occ->thread_count, transform_range,
+		occ);
+	parallel_for (occ->height, occ->thread_count, raster_rows, occ);
+	job.occ = occ;
+	for (l = 1; l < occ->level_count; l++) {
+		job.level = l;
+		parallel_for (occ->level_height[l], occ->thread_count, pyramid_rows,
+			&job);
+	}
+	occ->triangles_drawn = 0;
+	for (t = 0; t < occ->occluder_count; t++) {
+		occ->triangles_drawn += (occ->clipped[t * 3] | occ->clipped[t * 3 + 1] |
+			occ->clipped[t * 3 + 2]) ? 0 : 1;
+	}
+	occ->raster_seconds = get_wall_time () - t0;
+}
+
+bool test_occlusion_box (
+	const occlusion_t* occ,
+	const float* bb_min,
+	const float* bb_max
+) {
+	float min_x = 1e30f, max_x = -1e30f, min_y = 1e30f, max_y = -1e30f;
+	float min_z = 1e30f, farthest = 0.0f;
+	int x0, x1, y0, y1, l, x, y, i;
+
+	if (occ->occluder_count < 1) {
+		return false;
+	}
+	// the nearest point of a box in front of the eye is one of its corners,
+	// and the hull of the projected corners bounds its screen footprint
+	for (i = 0; i < 8; i++) {
+		float p[3], s[3];
+		p[0] = (i & 1) ? bb_max[0] : bb_min[0];
+		p[1] = (i & 2) ? bb_max[1] : bb_min[1];
+		p[2] = (i & 4) ? bb_max[2] : bb_min[2];
+		if (!project_point (occ->clip_matrix, p, (float)occ->width,
+			(float)occ->height, s)) {
+			return false;
+		}
+		min_x = fminf (min_x, s[0]);
+		max_x = fmaxf (max_x, s[0]);
+		min_y = fminf (min_y, s[1]);
+		max_y = fmaxf (max_y, s[1]);
+		min_z = fminf (min_z, s[2]);
+	}
+	// partly off screen: the off-screen part can't be proven hidden
+	if (min_x < 0.0f || min_y < 0.0f || max_x >= (float)occ->width ||
+		max_y >= (float)occ->height) {
+		return false;
+	}
+	x0 = (int)min_x;
+	x1 = (int)max_x;
+	y0 = (int)min_y;
+	y1 = (int)max_y;
+	// coarsest level where the rectangle spans at most 2x2 texels
+	for (l = 0; l < occ->level_count - 1; l++) {
+		if ((x1 >> l) - (x0 >> l) <= 1 && (y1 >> l) - (y0 >> l) <= 1) {
+			break;
+		}
+	}
+	for (y = y0 >> l; y <= y1 >> l; y++) {
+		for (x = x0 >> l; x <= x1 >> l; x++) {
+			farthest = fmaxf (farthest, occ->levels[l][y * occ->level_width[l] + x]);
+		}
+	}
+	return min_z > farthest;
+}
@@ -0,0 +1,520 @@
+//
+// Octree of mesh chunks with per-node LODs for out-of-core viewing (.oct)
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "octree.h"
+#include "mesh_utils.h"
+#include "threads.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OCTREE_HEADER_BYTES 16
+#define OCTREE_NODE_BYTES 56
+
+// build-time data kept alongside each node
+typedef struct octree_build_t {
+	int* tris;
+	int tri_count;
+	int depth;
+	// the octant this node covers. bb_min/max in the node are the tight bounds
+	float cell_min[3];
+	float cell_size;
+	float* payload;
+} octree_build_t;
+
+typedef struct octree_job_t {
+	const float* points;
+	const float* tex_coords;
+	const float* normals;
+	octree_node_t* nodes;
+	octree_build_t* builds;
+	// build_payload_range () indices are relative to this node
+	int first_node;
+} octree_job_t;
+
+// one vertex cluster of an inner node's LOD
+typedef struct lod_cluster_t {
+	long long key;
+	double pos[3];
+	float normal[3];
+	float uv[2];
+	int count;
+} lod_cluster_t;
+
+static void put_u32 (unsigned char* p, unsigned int v) {
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static unsigned int get_u32 (const unsigned char* p) {
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+		((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void put_f32 (unsigned char* p, float f) {
+	unsigned int u;
+	memcpy (&u, &f, 4);
+	put_u32 (p, u);
+}
+
+static float get_f32 (const unsigned char* p) {
+	unsigned int u = get_u32 (p);
+	float f;
+	memcpy (&f, &u, 4);
+	return f;
+}
+
+static void write_vertex (const octree_job_t* job, int corner, float* out) {
+	memcpy (out, &job->points[(size_t)corner * 3], 3 * sizeof (float));
+	memcpy (out + 3, &job->tex_coords[(size_t)corner * 2], 2 * sizeof (float));
+	memcpy (out + 5, &job->normals[(size_t)corner * 3], 3 * sizeof (float));
+}
+
+static long long cluster_key (const octree_build_t* b, const float* p) {
+	long long c[3];
+	int k;
+	for (k = 0; k < 3; k++) {
+		c[k] = (long long)((p[k] - b->cell_min[k]) / b->cell_size *
+			OCTREE_LOD_GRID);
+		c[k] = c[k] < 0 ? 0 : (c[k] >= OCTREE_LOD_GRID ? OCTREE_LOD_GRID - 1 :
+			c[k]);
+	}
+	return (c[0] * OCTREE_LOD_GRID + c[1]) * OCTREE_LOD_GRID + c[2];
+}
+
+//
+// find or add the cluster for key. clusters is an open-addressing table
+static int find_cluster (lod_cluster_t* clusters, unsigned int mask,
+	long long key) {
+	unsigned int slot = (unsigned int)((key * 0x9e3779b97f4a7c15ull) >> 40) &
+		mask;
+	while (clusters[slot].count && clusters[slot].key != key) {
+		slot = (slot + 1) & mask;
+	}
+	clusters[slot].key = key;
+	return (int)slot;
+}
+
+//
+// vertex clustering: snap every corner to the mean of its grid cell and drop
+// triangles that collapse. enough to give a stand-in with the right outline
+static void build_lod (const octree_job_t* job, octree_node_t* node,
+	octree_build_t* b) {
+	size_t corners = (size_t)b->tri_count * 3, i;
+	// a node can't have more clusters than corners or grid cells
+	size_t max_clusters = corners < (size_t)OCTREE_LOD_GRID * OCTREE_LOD_GRID *
+		OCTREE_LOD_GRID ? corners : (size_t)OCTREE_LOD_GRID * OCTREE_LOD_GRID *
+		OCTREE_LOD_GRID;
+	unsigned int table_size = 16, mask;
+	lod_cluster_t* clusters = NULL;
+	int* corner_cluster = (int*)malloc (corners * sizeof (int));
+	float* out = NULL;
+	size_t kept = 0;
+	int t, k;
+
+	while (table_size < max_clusters * 2) {
+		table_size *= 2;
+	}
+	mask = table_size - 1;
+	clusters = (lod_cluster_t*)calloc (table_size, sizeof (lod_cluster_t));
+	for (i = 0; i < corners; i++) {
+		int corner = b->tris[i / 3] * 3 + (int)(i % 3);
+		const float* p = &job->points[(size_t)corner * 3];
+		int c = find_cluster (clusters, mask, cluster_key (b, p));
+		lod_cluster_t* cl = &clusters[c];
+		if (0 == cl->count) {
+			memcpy (cl->uv, &job->tex_coords[(size_t)corner * 2],
+				2 * sizeof (float));
+		}
+		for (k = 0; k < 3; k++) {
+			cl->pos[k] += p[k];
+			cl->normal[k] += job->normals[(size_t)corner * 3 + k];
+		}
+		cl->count++;
+		corner_cluster[i] = c;
+	}
+
+	// count what survives first, so the payload is only as big as the LOD
+	for (t = 0; t < b->tri_count; t++) {
+		const int* cc = &corner_cluster[(size_t)t * 3];
+		kept += cc[0] != cc[1] && cc[1] != cc[2] && cc[0] != cc[2] ? 1 : 0;
+	}
+	out = (float*)malloc ((kept * 3 * OCTREE_VERTEX_FLOATS + 1) *
+		sizeof (float));
+	kept = 0;
+	for (t = 0; t < b->tri_count; t++) {
+		const int* tri = &corner_cluster[(size_t)t * 3];
+		int j;
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+			continue;
+		}
+		for (j = 0; j < 3; j++) {
+			const lod_cluster_t* cl = &clusters[tri[j]];
+			float* v = &out[(kept * 3 + j) * OCTREE_VERTEX_FLOATS];
+			float len = sqrtf (cl->normal[0] * cl->normal[0] +
+				cl->normal[1] * cl->normal[1] + cl->normal[2] * cl->normal[2]);
+			for (k = 0; k < 3; k++) {
+				v[k] = (float)(cl->pos[k] / cl->count);
+				v[5 + k] = len > 0.0f ? cl->normal[k] / len : 0.0f;
+			}
+			v[3] = cl->uv[0];
+			v[4] = cl->uv[1];
+		}
+		kept++;
+	}
+	node->vertex_count = (unsigned int)(kept * 3);
+	node->error = b->cell_size / OCTREE_LOD_GRID;
+	b->payload = out;
+	free (clusters);
+	free (corner_cluster);
+}
+
+static void build_payload_range (int begin, int end, int thread_idx,
+	void* user) {
+	octree_job_t* job = (octree_job_t*)user;
+	int n;
+	size_t i;
+
+	for (n = job->first_node + begin; n < job->first_node + end; n++) {
+		octree_node_t* node = &job->nodes[n];
+		octree_build_t* b = &job->builds[n];
+		size_t corners = (size_t)b->tri_count * 3;
+		if (node->child_count > 0) {
+			build_lod (job, node, b);
+		} else {
+			b->payload = (float*)malloc ((corners * OCTREE_VERTEX_FLOATS + 1) *
+				sizeof (float));
+			for (i = 0; i < corners; i++) {
+				write_vertex (job, b->tris[i / 3] * 3 + (int)(i % 3),
+					&b->payload[i * OCTREE_VERTEX_FLOATS]);
+			}
+			node->vertex_count = (unsigned int)corners;
+			node->error = 0.0f;
+		}
+		node->size = node->vertex_count * OCTREE_VERTEX_FLOATS * sizeof (float);
+	}
+	(void)thread_idx;
+}
+
+static void tight_bounds (const octree_job_t* job, octree_node_t* node,
+	const octree_build_t* b) {
+	size_t i;
+	int k;
+	for (k = 0; k < 3; k++) {
+		node->bb_min[k] = FLT_MAX;
+		node->bb_max[k] = -FLT_MAX;
+	}
+	for (i = 0; i < (size_t)b->tri_count * 3; i++) {
+		const float* p = &job->points[((size_t)b->tris[i / 3] * 3 + i % 3) * 3];
+		for (k = 0; k < 3; k++) {
+			node->bb_min[k] = p[k] < node->bb_min[k] ? p[k] : node->bb_min[k];
+			node->bb_max[k] = p[k] > node->bb_max[k] ? p[k] : node->bb_max[k];
+		}
+	}
+}
+
+bool write_octree_file (
+	const char* file_name,
+	const obj_mesh_t* mesh,
+	int thread_count
+) {
+	octree_job_t job;
+	octree_node_t* nodes = NULL;
+	octree_build_t* builds = NULL;
+	float* points = NULL;
+	float* tex_coords = NULL;
+	float* normals = NULL;
+	float* centroids = NULL;
+	int point_count = 0, node_count = 1, node_cap = 64, n, i, k;
+	unsigned long long offset;
+	unsigned char header[OCTREE_HEADER_BYTES];
+	FILE* fp = NULL;
+	bool ok = true;
+
+	if (mesh->tri_count <= 0) {
+		fprintf (stderr, "ERROR: no triangles to chunk\n");
+		return false;
+	}
+	if (!expand_obj_mesh (mesh, &points, &tex_coords, &normals, &point_count,
+		thread_count)) {
+		return false;
+	}
+	memset (&job, 0, sizeof (job));
+	job.points = points;
+	job.tex_coords = tex_coords;
+	job.normals = normals;
+
+	centroids = (float*)malloc ((size_t)mesh->tri_count * 3 * sizeof (float));
+	for (i = 0; i < mesh->tri_count; i++) {
+		const float* tri = &points[(size_t)i * 9];
+		for (k = 0; k < 3; k++) {
+			centroids[(size_t)i * 3 + k] = (tri[k] + tri[3 + k] + tri[6 + k]) /
+				3.0f;
+		}
+	}
+
+	// root covers a cube around the whole mesh
+	nodes = (octree_node_t*)calloc (node_cap, sizeof (octree_node_t));
+	builds = (octree_build_t*)calloc (node_cap, sizeof (octree_build_t));
+	builds[0].tri_count = mesh->tri_count;
+	builds[0].tris = (int*)malloc (mesh->tri_count * sizeof (int));
+	for (i = 0; i < mesh->tri_count; i++) {
+		builds[0].tris[i] = i;
+	}
+	job.nodes = nodes;
+	job.builds = builds;
+	tight_bounds (&job, &nodes[0], &builds[0]);
+	builds[0].cell_size = 0.0f;
+	for (k = 0; k < 3; k++) {
+		float extent = nodes[0].bb_max[k] - nodes[0].bb_min[k];
+		builds[0].cell_min[k] = nodes[0].bb_min[k];
+		builds[0].cell_size = extent > builds[0].cell_size ? extent :
+			builds[0].cell_size;
+	}
+	if (builds[0].cell_size <= 0.0f) {
+		builds[0].cell_size = 1.0f;
+	}
+
+	// split breadth-first so each node's children end up next to each other
+	for (n = 0; n < node_count; n++) {
+		octree_build_t* b = &builds[n];
+		int counts[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		int* octant = NULL;
+		float half = b->cell_size * 0.5f;
+		int o;
+
+		nodes[n].first_child = -1;
+		if (b->tri_count <= OCTREE_LEAF_TRIANGLES || b->depth >=
+			OCTREE_MAX_DEPTH) {
+			continue;
+		}
+		octant = (int*)malloc (b->tri_count * sizeof (int));
+		for (i = 0; i < b->tri_count; i++) {
+			const float* c = &centroids[b->tris[i] * 3];
+			o = 0;
+			for (k = 0; k < 3; k++) {
+				if (c[k] >= b->cell_min[k] + half) {
+					o |= 1 << k;
+				}
+			}
+			octant[i] = o;
+			counts[o]++;
+		}
+		if (node_count + 8 > node_cap) {
+			node_cap *= 2;
+			nodes = (octree_node_t*)realloc (nodes, node_cap *
+				sizeof (octree_node_t));
+			builds = (octree_build_t*)realloc (builds, node_cap *
+				sizeof (octree_build_t));
+			b = &builds[n];
+			job.nodes = nodes;
+			job.builds = builds;
+		}
+		nodes[n].first_child = node_count;
+		for (o = 0; o < 8; o++) {
+			octree_build_t* c = NULL;
+			int j = 0;
+			if (0 == counts[o]) {
+				continue;
+			}
+			memset (&nodes[node_count], 0, sizeof (octree_node_t));
+			c = &builds[node_count];
+			memset (c, 0, sizeof (octree_build_t));
+			c->depth = b->depth + 1;
+			c->cell_size = half;
+			for (k = 0; k < 3; k++) {
+				c->cell_min[k] = b->cell_min[k] + ((o >> k) & 1 ? half : 0.0f);
+			}
+			c->tris = (int*)malloc (counts[o] * sizeof (int));
+			for (i = 0; i < b->tri_count; i++) {
+				if (octant[i] == o) {
+					c->tris[j++] = b->tris[i];
+				}
+			}
+			c->tri_count = counts[o];
+			tight_bounds (&job, &nodes[node_count], c);
+			nodes[n].child_count++;
+			node_count++;
+		}
+		free (octant);
+	}
+
+	fp = fopen (file_name, "wb");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open %s for writing\n", file_name);
+		ok = false;
+	} else {
+		unsigned char rec[OCTREE_NODE_BYTES];
+		int batch = resolve_thread_count (thread_count);
+
+		memcpy (header, "OCTM", 4);
+		put_u32 (&header[4], OCTREE_VERSION);
+		put_u32 (&header[8], (unsigned int)node_count);
+		put_u32 (&header[12], 0);
+		ok = 1 == fwrite (header, OCTREE_HEADER_BYTES, 1, fp);
+		// the node table is filled in once every payload's size is known
+		memset (rec, 0, sizeof (rec));
+		for (n = 0; n < node_count && ok; n++) {
+			ok = 1 == fwrite (rec, OCTREE_NODE_BYTES, 1, fp);
+		}
+		offset = OCTREE_HEADER_BYTES + (unsigned long long)node_count *
+			OCTREE_NODE_BYTES;
+		// build a payload per thread at a time and write each out as soon as it
+		// is done, so only a batch of them is ever held in memory
+		for (job.first_node = 0; job.first_node < node_count && ok;
+			job.first_node += batch) {
+			int count = node_count - job.first_node < batch ? node_count -
+				job.first_node : batch;
+			parallel_for (count, batch, build_payload_range, &job);
+			for (n = job.first_node; n < job.first_node + count; n++) {
+				nodes[n].offset = offset;
+				offset += nodes[n].size;
+				// floats go out as-is; every platform we build for is
+				// little-endian
+				if (ok && nodes[n].size > 0) {
+					ok = 1 == fwrite (builds[n].payload, nodes[n].size, 1, fp);
+				}
+				free (builds[n].payload);
+				builds[n].payload = NULL;
+			}
+		}
+		ok = ok && 0 == fseek (fp, OCTREE_HEADER_BYTES, SEEK_SET);
+		for (n = 0; n < node_count && ok; n++) {
+			for (k = 0; k < 3; k++) {
+				put_f32 (&rec[k * 4], nodes[n].bb_min[k]);
+				put_f32 (&rec[12 + k * 4], nodes[n].bb_max[k]);
+			}
+			put_f32 (&rec[24], nodes[n].error);
+			put_u32 (&rec[28], (unsigned int)nodes[n].first_child);
+			put_u32 (&rec[32], (unsigned int)nodes[n].child_count);
+			put_u32 (&rec[36], nodes[n].vertex_count);
+			put_u32 (&rec[40], (unsigned int)nodes[n].offset);
+			put_u32 (&rec[44], (unsigned int)(nodes[n].offset >> 32));
+			put_u32 (&rec[48], nodes[n].size);
+			put_u32 (&rec[52], 0);
+			ok = 1 == fwrite (rec, OCTREE_NODE_BYTES, 1, fp);
+		}
+		if (!ok) {
+			fprintf (stderr, "ERROR: could not write %s\n", file_name);
+		}
+		ok = 0 == fclose (fp) && ok;
+	}
+	if (ok) {
+		int leaves = 0;
+		for (n = 0; n < node_count; n++) {
+			leaves += 0 == nodes[n].child_count ? 1 : 0;
+		}
+		printf ("octree: %i nodes (%i leaves) %.2f MB written to %s\n", node_count,
+			leaves, (double)offset / (1024.0 * 1024.0), file_name);
+	}
+
+	for (n = 0; n < node_count; n++) {
+		free (builds[n].tris);
+		free (builds[n].payload);
+	}
+	free (builds);
+	free (nodes);
+	free (centroids);
+	free (points);
+	free (tex_coords);
+	free (normals);
+	return ok;
+}
+
+bool load_octree_nodes (
+	const char* file_name,
+	octree_node_t** nodes,
+	int* node_count
+) {
+	unsigned char header[OCTREE_HEADER_BYTES];
+	unsigned char* recs = NULL;
+	FILE* fp = NULL;
+	int n, k;
+
+	*nodes = NULL;
+	*node_count = 0;
+	fp = fopen (file_name, "rb");
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not find file %s\n", file_name);
+		return false;
+	}
+	if (1 != fread (header, OCTREE_HEADER_BYTES, 1, fp) ||
+		memcmp (header, "OCTM", 4) || get_u32 (&header[4]) != OCTREE_VERSION) {
+		fprintf (stderr, "ERROR: %s is not a version %i .oct file\n", file_name,
+			OCTREE_VERSION);
+		fclose (fp);
+		return false;
+	}
+	*node_count = (int)get_u32 (&header[8]);
+	recs = (unsigned char*)malloc ((size_t)*node_count * OCTREE_NODE_BYTES + 1);
+	if (1 != fread (recs, (size_t)*node_count * OCTREE_NODE_BYTES, 1, fp)) {
+		fprintf (stderr, "ERROR: truncated node table in %s\n", file_name);
+		free (recs);
+		fclose (fp);
+		*node_count = 0;
+		return false;
+	}
+	fclose (fp);
+	*nodes = (octree_node_t*)calloc (*node_count, sizeof (octree_node_t));
+	for (n = 0; n < *node_count; n++) {
+		const unsigned char* rec = &recs[n * OCTREE_NODE_BYTES];
+		octree_node_t* node = &(*nodes)[n];
+		for (k = 0; k < 3; k++) {
+			node->bb_min[k] = get_f32 (&rec[k * 4]);
+			node->bb_max[k] = get_f32 (&rec[12 + k * 4]);
+		}
+		node->error = get_f32 (&rec[24]);
+		node->first_child = (int)get_u32 (&rec[28]);
+		node->child_count = (int)get_u32 (&rec[32]);
+		node->vertex_count = get_u32 (&rec[36]);
+		node->offset = (unsigned long long)get_u32 (&rec[40]) |
+			((unsigned long long)get_u32 (&rec[44]) << 32);
+		node->size = get_u32 (&rec[48]);
+		if (node->child_count > 0 && (node->first_child <= n ||
+			node->first_child + node->child_count > *node_count)) {
+			fprintf (stderr, "ERROR: bad child range in node %i of %s\n", n,
+				file_name);
+			free (recs);
+			free (*nodes);
+			*nodes = NULL;
+			*node_count = 0;
+			return false;
+		}
+	}
+	free (recs);
+	return true;
+}
+
+bool read_octree_node_data (
+	FILE* fp,
+	const octree_node_t* node,
+	float** vertices
+) {
+	*vertices = (float*)malloc (node->size + 1);
+	if (!*vertices) {
+		return false;
+	}
+	// 64-bit seeks where the platform has them, for files over 2GB
+#ifdef _WIN32
+	if (0 != _fseeki64 (fp, (long long)node->offset, SEEK_SET) ||
+#else
+	if (0 != fseeko (fp, (off_t)node->offset, SEEK_SET) ||
+#endif
+		(node->size > 0 && 1 != fread (*vertices, node->size, 1, fp))) {
+		free (*vertices);
+		*vertices = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool is_octree_file_name (const char* file_name) {
+	size_t len = strlen (file_name);
+	return len > 4 && 0 == strcmp (&file_name[len - 4], ".oct");
+}
@@ -0,0 +1,1134 @@
+//
+// PNG writer that filters and deflates bands of rows on several threads
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "png_writer.h"
+#include "threads.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+// tokens per deflate block. more amortises the code tables over more data
+#define BLOCK_TOKENS 32768
+// bands per thread in each batch of rows, so the threads end close together
+#define SLAB_BANDS 2
+#define ADLER_BASE 65521
+
+static const int len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+	67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const int len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5,
+	5, 5, 5, 0
+};
+static const int dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+	769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const int dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+	11, 11, 12, 12, 13, 13
+};
+// order the code length code lengths are sent in
+static const int code_length_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+// zlib's settings by level. a match good long cuts the search for a longer
+// one to a quarter of the chain, and one nice long ends it. levels 1 to 3
+// take the first match found and only hash the bytes inside it when it is no
+// longer than lazy. higher levels look for a longer match at the next byte
+// before taking one shorter than lazy
+typedef struct level_config_t {
+	int good;
+	int lazy;
+	int nice;
+	int chain;
+} level_config_t;
+
+static const level_config_t level_configs[10] = {
+	{ 0, 0, 0, 0 },
+	{ 4, 4, 8, 4 },
+	{ 4, 5, 16, 8 },
+	{ 4, 6, 32, 32 },
+	{ 4, 4, 16, 16 },
+	{ 8, 16, 32, 32 },
+	{ 8, 16, 128, 128 },
+	{ 8, 32, 128, 256 },
+	{ 32, 128, 258, 1024 },
+	{ 32, 258, 258, 4096 }
+};
+
+static const char* filter_names[PNG_FILTERS] = {
+	"none", "sub", "up", "average", "paeth", "adaptive"
+};
+
+typedef struct huffman_t {
+	unsigned short codes[288];
+	unsigned char lengths[288];
+} huffman_t;
+
+//
+// bits go in least significant first, as deflate wants
+typedef struct bit_writer_t {
+	unsigned char* data;
+	size_t size;
+	size_t capacity;
+	unsigned long long bits;
+	int count;
+} bit_writer_t;
+
+//
+// a run of whole filtered rows, compressed on one thread
+typedef struct png_band_t {
+	// the band's bytes, with up to WINDOW_SIZE bytes of dictionary before
+	const unsigned char* data;
+	int dict_len;
+	int len;
+	// the first band of the image starts the zlib stream; the last ends it
+	bool first;
+	bool last;
+	bit_writer_t out;
+	unsigned int adler;
+	// running CRC of "IDAT" and out, not yet inverted
+	unsigned int crc;
+} png_band_t;
+
+//
+// per thread, so no locking
+typedef struct png_scratch_t {
+	int* head;
+	int* prev;
+	unsigned int* tokens;
+	// a row per filter, for trying them all
+	unsigned char* trial_rows;
+} png_scratch_t;
+
+struct png_writer_t {
+	FILE* fp;
+	int width;
+	int height;
+	int channels;
+	int row_bytes;
+	png_settings_t settings;
+	int thread_count;
+	int rows_done;
+	bool ok;
+	// rows waiting to be compressed, after a copy of the row before them
+	unsigned char* raw;
+	int raw_rows;
+	int slab_rows;
+	int band_rows;
+	// WINDOW_SIZE bytes of dictionary, ending with the last bytes filtered,
+	// then room for a slab of filtered rows
+	unsigned char* filtered;
+	int dict_len;
+	png_band_t* bands;
+	int band_count;
+	png_scratch_t* scratch;
+	unsigned int adler;
+	unsigned char len_symbols[MAX_MATCH + 1];
+	unsigned char dist_symbols[512];
+	unsigned int crc_table[256];
+	huffman_t fixed_lit;
+	huffman_t fixed_dist;
+};
+
+void default_png_settings (png_settings_t* settings) {
+	settings->filter = PNG_FILTER_ADAPTIVE;
+	settings->level = 6;
+	settings->thread_count = 0;
+}
+
+const char* png_filter_name (int filter) {
+	if (filter < 0 || filter >= PNG_FILTERS) {
+		return "unknown";
+	}
+	return filter_names[filter];
+}
+
+int parse_png_filter (const char* name) {
+	int i;
+	for (i = 0; i < PNG_FILTERS; i++) {
+		if (0 == strcmp (name, filter_names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static unsigned int update_crc (const unsigned int* table, unsigned int crc,
+	const unsigned char* data, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static unsigned int update_adler (unsigned int adler, const unsigned char* data,
+	size_t len) {
+	unsigned int a = adler & 0xFFFF, b = adler >> 16;
+	while (len > 0) {
+		// the most bytes that can be summed before b could overflow
+		size_t n = len < 5552 ? len : 5552;
+		len -= n;
+		while (n-- > 0) {
+			a += *data++;
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+	}
+	return a | (b << 16);
+}
+
+//
+// Adler-32 of two runs of bytes from each one's, len_b being the second's
+// length. the same sums as zlib's adler32_combine ()
+static unsigned int combine_adler (unsigned int adler_a, unsigned int adler_b,
+	size_t len_b) {
+	unsigned int rem = (unsigned int)(len_b % ADLER_BASE);
+	unsigned int a = adler_a & 0xFFFF;
+	unsigned int b = (unsigned int)(((unsigned long long)rem * a) % ADLER_BASE);
+
+	a += (adler_b & 0xFFFF) + ADLER_BASE - 1;
+	b += (adler_a >> 16) + (adler_b >> 16) + ADLER_BASE - rem;
+	if (a >= ADLER_BASE) {
+		a -= ADLER_BASE;
+	}
+	if (a >= ADLER_BASE) {
+		a -= ADLER_BASE;
+	}
+	if (b >= ADLER_BASE * 2) {
+		b -= ADLER_BASE * 2;
+	}
+	if (b >= ADLER_BASE) {
+		b -= ADLER_BASE;
+	}
+	return a | (b << 16);
+}
+
+static void reserve_bits (bit_writer_t* bw, size_t bytes) {
+	if (bw->size + bytes > bw->capacity) {
+		size_t capacity = bw->capacity * 2;
+		if (capacity < bw->size + bytes) {
+			capacity = bw->size + bytes;
+		}
+		bw->data = (unsigned char*)realloc (bw->data, capacity);
+		bw->capacity = capacity;
+	}
+}
+
+//
+// room must have been made with reserve_bits ()
+static void put_bits (bit_writer_t* bw, unsigned int value, int count) {
+	bw->bits |= (unsigned long long)value << bw->count;
+	bw->count += count;
+	while (bw->count >= 8) {
+		bw->data[bw->size++] = (unsigned char)bw->bits;
+		bw->bits >>= 8;
+		bw->count -= 8;
+	}
+}
+
+static void align_bits (bit_writer_t* bw) {
+	if (bw->count > 0) {
+		bw->data[bw->size++] = (unsigned char)bw->bits;
+	}
+	bw->bits = 0;
+	bw->count = 0;
+}
+
+static unsigned int reverse_bits (unsigned int code, int count) {
+	unsigned int r = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		r = (r << 1) | (code & 1);
+		code >>= 1;
+	}
+	return r;
+}
+
+//
+// Huffman code lengths for freq, none longer than max_bits. when the tree is
+// too deep the counts are halved and it is built again. always
+// gives at least two codes, which inflaters expect
+static void build_lengths (const unsigned int* freq, int count, int max_bits,
+	unsigned char* lengths) {
+	unsigned int f[288], weight[576];
+	int leaves[288], parent[576], depth[576];
+	int i, j;
+
+	memcpy (f, freq, count * sizeof (unsigned int));
+	for (;;) {
+		int used = 0, next_leaf = 0, next_node, node, deepest = 0;
+
+		memset (lengths, 0, count);
+		for (i = 0; i < count; i++) {
+			if (f[i]) {
+				leaves[used++] = i;
+			}
+		}
+		if (used < 2) {
+			int a = used ? leaves[0] : 0;
+			lengths[a] = 1;
+			lengths[a ? 0 : 1] = 1;
+			return;
+		}
+		// few enough symbols that an insertion sort is fine
+		for (i = 1; i < used; i++) {
+			int leaf = leaves[i];
+			for (j = i; j > 0 && f[leaves[j - 1]] > f[leaf]; j--) {
+				leaves[j] = leaves[j - 1];
+			}
+			leaves[j] = leaf;
+		}
+		for (i = 0; i < used; i++) {
+			weight[i] = f[leaves[i]];
+		}
+		// two queues: sorted leaves, and nodes, which are made in weight order
+		next_node = used;
+		for (node = used; node < used * 2 - 1; node++) {
+			int pick[2], k;
+			for (k = 0; k < 2; k++) {
+				if (next_leaf < used && (next_node >= node ||
+					weight[next_leaf] <= weight[next_node])) {
+					pick[k] = next_leaf++;
+				} else {
+					pick[k] = next_node++;
+				}
+			}
+			weight[node] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = node;
+			parent[pick[1]] = node;
+		}
+		// parents come after their children
+		depth[used * 2 - 2] = 0;
+		for (node = used * 2 - 3; node >= 0; node--) {
+			depth[node] = depth[parent[node]] + 1;
+		}
+		for (i = 0; i < used; i++) {
+			deepest = depth[i] > deepest ? depth[i] : deepest;
+		}
+		if (deepest <= max_bits) {
+			for (i = 0; i < used; i++) {
+				lengths[leaves[i]] = (unsigned char)depth[i];
+			}
+			return;
+		}
+		for (i = 0; i < count; i++) {
+			f[i] = f[i] ? (f[i] >> 1) | 1 : 0;
+		}
+	}
+}
+
+//
+// canonical codes for lengths, bit-reversed to be written least significant
+// bit first
+static void build_codes (huffman_t* h, int count) {
+	int bl_count[16], next_code[16];
+	int i, code = 0;
+
+	memset (bl_count, 0, sizeof (bl_count));
+	for (i = 0; i < count; i++) {
+		bl_count[h->lengths[i]]++;
+	}
+	bl_count[0] = 0;
+	for (i = 1; i < 16; i++) {
+		code = (code + bl_count[i - 1]) << 1;
+		next_code[i] = code;
+	}
+	for (i = 0; i < count; i++) {
+		if (h->lengths[i]) {
+			h->codes[i] = (unsigned short)reverse_bits (next_code[h->lengths[i]]++,
+				h->lengths[i]);
+		}
+	}
+}
+
+static int dist_symbol (const png_writer_t* pw, int dist) {
+	int d = dist - 1;
+	return d < 256 ? pw->dist_symbols[d] : pw->dist_symbols[256 + (d >> 7)];
+}
+
+static void init_tables (png_writer_t* pw) {
+	int s, i;
+
+	for (s = 0; s < 28; s++) {
+		for (i = 0; i < (1 << len_extra[s]); i++) {
+			pw->len_symbols[len_base[s] + i] = (unsigned char)s;
+		}
+	}
+	pw->len_symbols[MAX_MATCH] = 28;
+	for (s = 0; s < 30; s++) {
+		for (i = 0; i < (1 << dist_extra[s]); i++) {
+			int d = dist_base[s] - 1 + i;
+			if (d < 256) {
+				pw->dist_symbols[d] = (unsigned char)s;
+			} else {
+				pw->dist_symbols[256 + (d >> 7)] = (unsigned char)s;
+			}
+		}
+	}
+	for (i = 0; i < 256; i++) {
+		unsigned int c = (unsigned int)i;
+		int k;
+		for (k = 0; k < 8; k++) {
+			c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		}
+		pw->crc_table[i] = c;
+	}
+	for (i = 0; i < 288; i++) {
+		pw->fixed_lit.lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+	}
+	build_codes (&pw->fixed_lit, 288);
+	for (i = 0; i < 30; i++) {
+		pw->fixed_dist.lengths[i] = 5;
+	}
+	build_codes (&pw->fixed_dist, 30);
+}
+
+static int paeth (int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs (p - a), pb = abs (p - b), pc = abs (p - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+//
+// filter row into out, prior being the row above it. bpp bytes per pixel
+static void filter_row (int filter, const unsigned char* row,
+	const unsigned char* prior, int row_bytes, int bpp, unsigned char* out) {
+	int i;
+
+	switch (filter) {
+	case PNG_FILTER_SUB:
+		for (i = 0; i < bpp; i++) {
+			out[i] = row[i];
+		}
+		for (; i < row_bytes; i++) {
+			out[i] = (unsigned char)(row[i] - row[i - bpp]);
+		}
+		break;
+	case PNG_FILTER_UP:
+		for (i = 0; i < row_bytes; i++) {
+			out[i] = (unsigned char)(row[i] - prior[i]);
+		}
+		break;
+	case PNG_FILTER_AVERAGE:
+		for (i = 0; i < bpp; i++) {
+			out[i] = (unsigned char)(row[i] - (prior[i] >> 1));
+		}
+		for (; i < row_bytes; i++) {
+			out[i] = (unsigned char)(row[i] - ((row[i - bpp] + prior[i]) >> 1));
+		}
+		break;
+	case PNG_FILTER_PAETH:
+		for (i = 0; i < bpp; i++) {
+			out[i] = (unsigned char)(row[i] - prior[i]);
+		}
+		for (; i < row_bytes; i++) {
+			out[i] = (unsigned char)(row[i] - paeth (row[i - bpp], prior[i],
+				prior[i - bpp]));
+		}
+		break;
+	default:
+		memcpy (out, row, row_bytes);
+		break;
+	}
+}
+
+//
+// sum of the bytes as signed values, which is smaller for rows that will
+// compress well
+static unsigned int row_cost (const unsigned char* row, int row_bytes) {
+	unsigned int sum = 0;
+	int i;
+	for (i = 0; i < row_bytes; i++) {
+		sum += row[i] < 128 ? row[i] : 256 - row[i];
+	}
+	return sum;
+}
+
+static void filter_rows_job (int begin, int end, int thread_idx, void* user) {
+	png_writer_t* pw = (png_writer_t*)user;
+	unsigned char* trials = pw->scratch[thread_idx].trial_rows;
+	int rb = pw->row_bytes, bpp = pw->channels;
+	int r;
+
+	for (r = begin; r < end; r++) {
+		const unsigned char* prior = pw->raw + (size_t)r * rb;
+		const unsigned char* row = prior + rb;
+		unsigned char* out = pw->filtered + WINDOW_SIZE + (size_t)r * (rb + 1);
+		int filter = pw->settings.filter;
+
+		if (PNG_FILTER_ADAPTIVE == filter) {
+			unsigned int best_cost = 0;
+			int f;
+			for (f = 0; f < PNG_FILTER_ADAPTIVE; f++) {
+				unsigned int cost;
+				filter_row (f, row, prior, rb, bpp, trials + (size_t)f * rb);
+				cost = row_cost (trials + (size_t)f * rb, rb);
+				if (0 == f || cost < best_cost) {
+					best_cost = cost;
+					filter = f;
+				}
+			}
+			memcpy (out + 1, trials + (size_t)filter * rb, rb);
+		} else {
+			filter_row (filter, row, prior, rb, bpp, out + 1);
+		}
+		out[0] = (unsigned char)filter;
+	}
+}
+
+static unsigned int hash3 (const unsigned char* p) {
+	unsigned int v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void insert_string (const unsigned char* base, int pos, int* head,
+	int* prev) {
+	unsigned int h = hash3 (base + pos);
+	prev[pos & WINDOW_MASK] = head[h];
+	head[h] = pos + 1;
+}
+
+//
+// longest match for pos in the window before it, of at most end - pos bytes.
+// 0 if none is MIN_MATCH long
+static int find_match (const unsigned char* base, int pos, int end,
+	const int* head, const int* prev, int chain, int nice, int* dist) {
+	int limit = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+	int best = MIN_MATCH - 1;
+	int candidate;
+
+	if (limit < MIN_MATCH) {
+		return 0;
+	}
+	candidate = head[hash3 (base + pos)] - 1;
+	while (candidate >= 0 && chain-- > 0) {
+		int next;
+		if (pos - candidate > WINDOW_SIZE) {
+			break;
+		}
+		if (base[candidate + best] == base[pos + best] &&
+			base[candidate] == base[pos]) {
+			int len = 0;
+			while (len < limit && base[candidate + len] == base[pos + len]) {
+				len++;
+			}
+			if (len > best) {
+				best = len;
+				*dist = pos - candidate;
+				if (len >= nice || len == limit) {
+					break;
+				}
+			}
+		}
+		next = prev[candidate & WINDOW_MASK] - 1;
+		// a newer position has taken the slot, so the chain has ended
+		if (next >= candidate) {
+			break;
+		}
+		candidate = next;
+	}
+	return best >= MIN_MATCH ? best : 0;
+}
+
+static void write_stored (bit_writer_t* bw, const unsigned char* data,
+	int len, bool final) {
+	do {
+		int n = len < 65535 ? len : 65535;
+		reserve_bits (bw, (size_t)n + 6);
+		put_bits (bw, final && n == len ? 1 : 0, 1);
+		put_bits (bw, 0, 2);
+		align_bits (bw);
+		put_bits (bw, n & 0xFFFF, 16);
+		put_bits (bw, ~n & 0xFFFF, 16);
+		memcpy (bw->data + bw->size, data, n);
+		bw->size += n;
+		data += n;
+		len -= n;
+	} while (len > 0);
+}
+
+static size_t stored_bits (int len) {
+	int blocks = (len + 65534) / 65535;
+	return (size_t)(blocks > 0 ? blocks : 1) * (3 + 7 + 32) + (size_t)len * 8;
+}
+
+static void write_tokens (bit_writer_t* bw, const png_writer_t* pw,
+	const unsigned int* tokens, int count, const huffman_t* lit,
+	const huffman_t* dist) {
+	int i;
+	for (i = 0; i < count; i++) {
+		unsigned int t = tokens[i];
+		if (t & 0x80000000u) {
+			int len = (t >> 16) & 0x1FF, d = t & 0xFFFF;
+			int ls = pw->len_symbols[len], ds = dist_symbol (pw, d);
+			put_bits (bw, lit->codes[257 + ls], lit->lengths[257 + ls]);
+			put_bits (bw, len - len_base[ls], len_extra[ls]);
+			put_bits (bw, dist->codes[ds], dist->lengths[ds]);
+			put_bits (bw, d - dist_base[ds], dist_extra[ds]);
+		} else {
+			put_bits (bw, lit->codes[t], lit->lengths[t]);
+		}
+	}
+	put_bits (bw, lit->codes[256], lit->lengths[256]);
+}
+
+//
+// one deflate block of tokens, which stand for the len bytes at raw, with
+// dynamic codes, fixed codes or stored, whichever is smallest
+static void write_block (bit_writer_t* bw, const png_writer_t* pw,
+	const unsigned int* tokens, int count, const unsigned char* raw, int len,
+	bool final) {
+	unsigned int lit_freq[286], dist_freq[30], cl_freq[19];
+	// run-length coded code lengths: symbol, then its extra bits
+	unsigned char rle[286 + 30][2];
+	unsigned char all_lengths[286 + 30];
+	huffman_t lit, dist, cl;
+	size_t extra_bits = 0, dynamic_bits, fixed_bits = 3, stored;
+	int hlit = 286, hdist = 30, hclen = 19, rle_count = 0;
+	int i;
+
+	memset (lit_freq, 0, sizeof (lit_freq));
+	memset (dist_freq, 0, sizeof (dist_freq));
+	memset (cl_freq, 0, sizeof (cl_freq));
+	for (i = 0; i < count; i++) {
+		unsigned int t = tokens[i];
+		if (t & 0x80000000u) {
+			int ls = pw->len_symbols[(t >> 16) & 0x1FF];
+			int ds = dist_symbol (pw, t & 0xFFFF);
+			lit_freq[257 + ls]++;
+			dist_freq[ds]++;
+			extra_bits += len_extra[ls] + dist_extra[ds];
+		} else {
+			lit_freq[t]++;
+		}
+	}
+	lit_freq[256] = 1;
+	build_lengths (lit_freq, 286, 15, lit.lengths);
+	build_lengths (dist_freq, 30, 15, dist.lengths);
+	build_codes (&lit, 286);
+	build_codes (&dist, 30);
+	while (hlit > 257 && 0 == lit.lengths[hlit - 1]) {
+		hlit--;
+	}
+	while (hdist > 1 && 0 == dist.lengths[hdist - 1]) {
+		hdist--;
+	}
+	memcpy (all_lengths, lit.lengths, hlit);
+	memcpy (all_lengths + hlit, dist.lengths, hdist);
+	for (i = 0; i < hlit + hdist;) {
+		int value = all_lengths[i], run = 1;
+		while (i + run < hlit + hdist && all_lengths[i + run] == value) {
+			run++;
+		}
+		i += run;
+		if (0 == value) {
+			while (run >= 11) {
+				int n = run < 138 ? run : 138;
+				rle[rle_count][0] = 18;
+				rle[rle_count++][1] = (unsigned char)(n - 11);
+				run -= n;
+			}
+			if (run >= 3) {
+				rle[rle_count][0] = 17;
+				rle[rle_count++][1] = (unsigned char)(run - 3);
+				run = 0;
+			}
+		} else {
+			rle[rle_count][0] = (unsigned char)value;
+			rle[rle_count++][1] = 0;
+			run--;
+			while (run >= 3) {
+				int n = run < 6 ? run : 6;
+				rle[rle_count][0] = 16;
+				rle[rle_count++][1] = (unsigned char)(n - 3);
+				run -= n;
+			}
+		}
+		while (run-- > 0) {
+			rle[rle_count][0] = (unsigned char)value;
+			rle[rle_count++][1] = 0;
+		}
+	}
+	for (i = 0; i < rle_count; i++) {
+		cl_freq[rle[i][0]]++;
+	}
+	build_lengths (cl_freq, 19, 7, cl.lengths);
+	build_codes (&cl, 19);
+	while (hclen > 4 && 0 == cl.lengths[code_length_order[hclen - 1]]) {
+		hclen--;
+	}
+
+	dynamic_bits = 3 + 14 + 3 * hclen + extra_bits;
+	for (i = 0; i < rle_count; i++) {
+		int s = rle[i][0];
+		dynamic_bits += cl.lengths[s] + (16 == s ? 2 : 17 == s ? 3 : 18 == s ?
+			7 : 0);
+	}
+	fixed_bits += extra_bits;
+	for (i = 0; i < 286; i++) {
+		dynamic_bits += (size_t)lit_freq[i] * lit.lengths[i];
+		fixed_bits += (size_t)lit_freq[i] * pw->fixed_lit.lengths[i];
+	}
+	for (i = 0; i < 30; i++) {
+		dynamic_bits += (size_t)dist_freq[i] * dist.lengths[i];
+		fixed_bits += (size_t)dist_freq[i] * pw->fixed_dist.lengths[i];
+	}
+	stored = stored_bits (len);
+
+	if (stored <= dynamic_bits && stored <= fixed_bits) {
+		write_stored (bw, raw, len, final);
+		return;
+	}
+	if (fixed_bits <= dynamic_bits) {
+		reserve_bits (bw, fixed_bits / 8 + 16);
+		put_bits (bw, final ? 1 : 0, 1);
+		put_bits (bw, 1, 2);
+		write_tokens (bw, pw, tokens, count, &pw->fixed_lit, &pw->fixed_dist);
+		return;
+	}
+	reserve_bits (bw, dynamic_bits / 8 + 16);
+	put_bits (bw, final ? 1 : 0, 1);
+	put_bits (bw, 2, 2);
+	put_bits (bw, hlit - 257, 5);
+	put_bits (bw, hdist - 1, 5);
+	put_bits (bw, hclen - 4, 4);
+	for (i = 0; i < hclen; i++) {
+		put_bits (bw, cl.lengths[code_length_order[i]], 3);
+	}
+	for (i = 0; i < rle_count; i++) {
+		int s = rle[i][0];
+		put_bits (bw, cl.codes[s], cl.lengths[s]);
+		if (s >= 16) {
+			put_bits (bw, rle[i][1], 16 == s ? 2 : 17 == s ? 3 : 7);
+		}
+	}
+	write_tokens (bw, pw, tokens, count, &lit, &dist);
+}
+
+//
+// tokens waiting to go in a block, and where the bytes they stand for start
+typedef struct token_block_t {
+	unsigned int* tokens;
+	int count;
+	int start;
+} token_block_t;
+
+//
+// add a token, whose bytes end at covered, and write a block when full
+static void add_token (bit_writer_t* bw, const png_writer_t* pw,
+	const unsigned char* base, token_block_t* tb, unsigned int token,
+	int covered) {
+	tb->tokens[tb->count++] = token;
+	if (BLOCK_TOKENS == tb->count) {
+		write_block (bw, pw, tb->tokens, tb->count, base + tb->start,
+			covered - tb->start, false);
+		tb->count = 0;
+		tb->start = covered;
+	}
+}
+
+static unsigned int match_token (int len, int dist) {
+	return 0x80000000u | ((unsigned int)len << 16) | (unsigned int)dist;
+}
+
+//
+// compress [start, end) of base into tokens, with the window before start
+// already hashed. the first match found is taken
+static void deflate_greedy (bit_writer_t* bw, const png_writer_t* pw,
+	const level_config_t* config, const unsigned char* base, int start,
+	int end, png_scratch_t* scratch, token_block_t* tb) {
+	int i = start;
+
+	while (i < end) {
+		int dist = 0, len = find_match (base, i, end, scratch->head,
+			scratch->prev, config->chain, config->nice, &dist);
+		if (i + MIN_MATCH <= end) {
+			insert_string (base, i, scratch->head, scratch->prev);
+		}
+		if (len >= MIN_MATCH) {
+			int k;
+			if (len <= config->lazy) {
+				for (k = 1; k < len && i + k + MIN_MATCH <= end; k++) {
+					insert_string (base, i + k, scratch->head, scratch->prev);
+				}
+			}
+			i += len;
+			add_token (bw, pw, base, tb, match_token (len, dist), i);
+		} else {
+			add_token (bw, pw, base, tb, base[i], i + 1);
+			i++;
+		}
+	}
+}
+
+//
+// as deflate_greedy (), but a match is only taken once the byte after it
+// is found to start no longer one
+static void deflate_lazy (bit_writer_t* bw, const png_writer_t* pw,
+	const level_config_t* config, const unsigned char* base, int start,
+	int end, png_scratch_t* scratch, token_block_t* tb) {
+	int i = start, prev_len = 0, prev_dist = 0;
+	// whether the byte before i is still to be written
+	bool pending = false;
+
+	while (i < end) {
+		int dist = 0, len = 0;
+		if (prev_len < config->lazy) {
+			int chain = prev_len >= config->good ? config->chain >> 2 :
+				config->chain;
+			len = find_match (base, i, end, scratch->head, scratch->prev,
+				chain > 0 ? chain : 1, config->nice, &dist);
+		}
+		if (i + MIN_MATCH <= end) {
+			insert_string (base, i, scratch->head, scratch->prev);
+		}
+		if (prev_len >= MIN_MATCH && len <= prev_len) {
+			int match_end = i - 1 + prev_len, k;
+			for (k = i + 1; k < match_end && k + MIN_MATCH <= end; k++) {
+				insert_string (base, k, scratch->head, scratch->prev);
+			}
+			add_token (bw, pw, base, tb, match_token (prev_len, prev_dist),
+				match_end);
+			i = match_end;
+			prev_len = 0;
+			pending = false;
+		} else {
+			if (pending) {
+				add_token (bw, pw, base, tb, base[i - 1], i);
+			}
+			pending = true;
+			prev_len = len;
+			prev_dist = dist;
+			i++;
+		}
+	}
+	if (pending) {
+		add_token (bw, pw, base, tb, base[end - 1], end);
+	}
+}
+
+static void deflate_band (const png_writer_t* pw, png_band_t* band,
+	png_scratch_t* scratch) {
+	const unsigned char* base = band->data - band->dict_len;
+	int end = band->dict_len + band->len;
+	int level = pw->settings.level;
+	bit_writer_t* bw = &band->out;
+
+	bw->size = 0;
+	bw->bits = 0;
+	bw->count = 0;
+	if (band->first) {
+		// the level in the header is only a hint
+		static const unsigned char flags[4] = { 0x01, 0x5E, 0x9C, 0xDA };
+		int hint = level < 2 ? 0 : level < 6 ? 1 : 6 == level ? 2 : 3;
+		reserve_bits (bw, 2);
+		put_bits (bw, 0x78, 8);
+		put_bits (bw, flags[hint], 8);
+	}
+	if (level <= 0) {
+		write_stored (bw, band->data, band->len, band->last);
+	} else {
+		const level_config_t* config = &level_configs[level];
+		token_block_t tb;
+		int i;
+
+		memset (scratch->head, 0, HASH_SIZE * sizeof (int));
+		// matches can reach back into the bytes of the bands before
+		for (i = 0; i < band->dict_len && i + MIN_MATCH <= end; i++) {
+			insert_string (base, i, scratch->head, scratch->prev);
+		}
+		tb.tokens = scratch->tokens;
+		tb.count = 0;
+		tb.start = band->dict_len;
+		if (level < 4) {
+			deflate_greedy (bw, pw, config, base, band->dict_len, end, scratch,
+				&tb);
+		} else {
+			deflate_lazy (bw, pw, config, base, band->dict_len, end, scratch,
+				&tb);
+		}
+		write_block (bw, pw, tb.tokens, tb.count, base + tb.start,
+			end - tb.start, band->last);
+	}
+	if (band->last) {
+		reserve_bits (bw, 1);
+		align_bits (bw);
+	} else {
+		// sync flush: an empty stored block ends the band on a byte boundary
+		write_stored (bw, NULL, 0, false);
+	}
+	// room for the Adler-32 and the CRC
+	reserve_bits (bw, 8);
+	band->crc = update_crc (pw->crc_table, 0xFFFFFFFFu,
+		(const unsigned char*)"IDAT", 4);
+	band->crc = update_crc (pw->crc_table, band->crc, bw->data, bw->size);
+}
+
+static void deflate_bands_job (int begin, int end, int thread_idx,
+	void* user) {
+	png_writer_t* pw = (png_writer_t*)user;
+	int b;
+	for (b = begin; b < end; b++) {
+		png_band_t* band = &pw->bands[b];
+		band->adler = update_adler (1, band->data, band->len);
+		deflate_band (pw, band, &pw->scratch[thread_idx]);
+	}
+}
+
+static void put_u32 (unsigned char* p, unsigned int v) {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static void write_chunk (png_writer_t* pw, const char* type,
+	const unsigned char* data, unsigned int len) {
+	unsigned char bytes[4];
+	unsigned int crc = update_crc (pw->crc_table, 0xFFFFFFFFu,
+		(const unsigned char*)type, 4);
+
+	crc = update_crc (pw->crc_table, crc, data, len) ^ 0xFFFFFFFFu;
+	put_u32 (bytes, len);
+	pw->ok = pw->ok && 1 == fwrite (bytes, 4, 1, pw->fp);
+	pw->ok = pw->ok && 1 == fwrite (type, 4, 1, pw->fp);
+	if (len > 0) {
+		pw->ok = pw->ok && 1 == fwrite (data, len, 1, pw->fp);
+	}
+	put_u32 (bytes, crc);
+	pw->ok = pw->ok && 1 == fwrite (bytes, 4, 1, pw->fp);
+}
+
+//
+// filter and compress the rows waiting in raw, and write them out
+static void flush_rows (png_writer_t* pw) {
+	int rb = pw->row_bytes + 1;
+	int rows = pw->raw_rows;
+	size_t slab_bytes = (size_t)rows * rb;
+	size_t keep;
+	unsigned char* start = pw->filtered + WINDOW_SIZE;
+	int b;
+
+	parallel_for (rows, pw->thread_count, filter_rows_job, pw);
+	pw->band_count = (rows + pw->band_rows - 1) / pw->band_rows;
+	for (b = 0; b < pw->band_count; b++) {
+		png_band_t* band = &pw->bands[b];
+		int first_row = b * pw->band_rows;
+		int band_rows = rows - first_row < pw->band_rows ? rows - first_row :
+			pw->band_rows;
+		size_t before = (size_t)first_row * rb + pw->dict_len;
+		band->data = start + (size_t)first_row * rb;
+		band->dict_len = before < WINDOW_SIZE ? (int)before : WINDOW_SIZE;
+		band->len = band_rows * rb;
+		band->first = 0 == pw->rows_done && 0 == b;
+		band->last = pw->rows_done + rows == pw->height &&
+			b == pw->band_count - 1;
+	}
+	parallel_for (pw->band_count, pw->thread_count, deflate_bands_job, pw);
+	for (b = 0; b < pw->band_count; b++) {
+		png_band_t* band = &pw->bands[b];
+		unsigned char length[4];
+		pw->adler = combine_adler (pw->adler, band->adler, band->len);
+		if (band->last) {
+			// the stream ends with the Adler-32 of everything in it
+			put_u32 (band->out.data + band->out.size, pw->adler);
+			band->out.size += 4;
+			band->crc = update_crc (pw->crc_table, band->crc,
+				band->out.data + band->out.size - 4, 4);
+		}
+		// deflate_band () left room for the CRC after the data
+		put_u32 (band->out.data + band->out.size, band->crc ^ 0xFFFFFFFFu);
+		put_u32 (length, (unsigned int)band->out.size);
+		pw->ok = pw->ok && 1 == fwrite (length, 4, 1, pw->fp);
+		pw->ok = pw->ok && 1 == fwrite ("IDAT", 4, 1, pw->fp);
+		pw->ok = pw->ok && 1 == fwrite (band->out.data, band->out.size + 4, 1,
+			pw->fp);
+	}
+
+	// the end of what was filtered is the next slab's dictionary
+	keep = slab_bytes + pw->dict_len < WINDOW_SIZE ? slab_bytes + pw->dict_len :
+		WINDOW_SIZE;
+	memmove (pw->filtered + WINDOW_SIZE - keep, start + slab_bytes - keep, keep);
+	pw->dict_len = (int)keep;
+	// and the last row is the next one's prior
+	memcpy (pw->raw, pw->raw + (size_t)rows * pw->row_bytes, pw->row_bytes);
+	pw->rows_done += rows;
+	pw->raw_rows = 0;
+}
+
+png_writer_t* open_png_writer (
+	const char* file_name,
+	int width,
+	int height,
+	int channels,
+	const png_settings_t* settings
+) {
+	static const unsigned char signature[8] = {
+		137, 80, 78, 71, 13, 10, 26, 10
+	};
+	static const unsigned char colour_types[5] = { 0, 0, 4, 2, 6 };
+	png_writer_t* pw = NULL;
+	png_settings_t defaults;
+	unsigned char ihdr[13];
+	size_t band_capacity;
+	int i, max_bands;
+
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+		return NULL;
+	}
+	if (!settings) {
+		default_png_settings (&defaults);
+		settings = &defaults;
+	}
+	pw = (png_writer_t*)calloc (1, sizeof (png_writer_t));
+	pw->fp = fopen (file_name, "wb");
+	if (!pw->fp) {
+		free (pw);
+		return NULL;
+	}
+	pw->width = width;
+	pw->height = height;
+	pw->channels = channels;
+	pw->row_bytes = width * channels;
+	pw->settings = *settings;
+	if (pw->settings.filter < 0 || pw->settings.filter >= PNG_FILTERS) {
+		pw->settings.filter = PNG_FILTER_ADAPTIVE;
+	}
+	pw->settings.level = pw->settings.level < 0 ? 0 : pw->settings.level > 9 ?
+		9 : pw->settings.level;
+	pw->thread_count = resolve_thread_count (settings->thread_count);
+	pw->ok = true;
+	pw->adler = 1;
+	init_tables (pw);
+
+	pw->band_rows = PNG_BAND_BYTES / (pw->row_bytes + 1);
+	pw->band_rows = pw->band_rows > 0 ? pw->band_rows : 1;
+	max_bands = SLAB_BANDS * pw->thread_count;
+	pw->slab_rows = pw->band_rows * max_bands;
+	if (pw->slab_rows > height) {
+		pw->slab_rows = height;
+		max_bands = (height + pw->band_rows - 1) / pw->band_rows;
+	}
+	// one more row, at the front, for the last row of the slab before
+	pw->raw = (unsigned char*)calloc ((size_t)(pw->slab_rows + 1),
+		pw->row_bytes);
+	pw->filtered = (unsigned char*)malloc (WINDOW_SIZE + (size_t)pw->slab_rows *
+		(pw->row_bytes + 1));
+	pw->bands = (png_band_t*)calloc (max_bands, sizeof (png_band_t));
+	// enough that most bands never grow
+	band_capacity = (size_t)pw->band_rows * (pw->row_bytes + 1) / 2 + 64;
+	for (i = 0; i < max_bands; i++) {
+		pw->bands[i].out.capacity = band_capacity;
+		pw->bands[i].out.data = (unsigned char*)malloc (band_capacity);
+	}
+	pw->scratch = (png_scratch_t*)calloc (pw->thread_count,
+		sizeof (png_scratch_t));
+	for (i = 0; i < pw->thread_count; i++) {
+		pw->scratch[i].head = (int*)malloc (HASH_SIZE * sizeof (int));
+		pw->scratch[i].prev = (int*)malloc (WINDOW_SIZE * sizeof (int));
+		pw->scratch[i].tokens = (unsigned int*)malloc (BLOCK_TOKENS *
+			sizeof (unsigned int));
+		pw->scratch[i].trial_rows = (unsigned char*)malloc (
+			(size_t)PNG_FILTER_ADAPTIVE * pw->row_bytes);
+	}
+
+	pw->ok = 1 == fwrite (signature, 8, 1, pw->fp);
+	put_u32 (ihdr, (unsigned int)width);
+	put_u32 (ihdr + 4, (unsigned int)height);
+	ihdr[8] = 8;
+	ihdr[9] = colour_types[channels];
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	write_chunk (pw, "IHDR", ihdr, 13);
+	return pw;
+}
+
+bool write_png_rows (
+	png_writer_t* pw,
+	const unsigned char* rows,
+	int row_count,
+	int stride
+) {
+	int r;
+	for (r = 0; r < row_count; r++) {
+		if (pw->rows_done + pw->raw_rows >= pw->height) {
+			pw->ok = false;
+			break;
+		}
+		memcpy (pw->raw + (size_t)(pw->raw_rows + 1) * pw->row_bytes,
+			rows + (ptrdiff_t)r * stride, pw->row_bytes);
+		pw->raw_rows++;
+		if (pw->raw_rows == pw->slab_rows ||
+			pw->rows_done + pw->raw_rows == pw->height) {
+			flush_rows (pw);
+		}
+	}
+	return pw->ok;
+}
+
+bool close_png_writer (png_writer_t* pw) {
+	bool ok;
+	int i, max_bands;
+
+	if (!pw) {
+		return false;
+	}
+	ok = pw->ok && pw->rows_done == pw->height;
+	if (ok) {
+		write_chunk (pw, "IEND", NULL, 0);
+		ok = pw->ok;
+	}
+	ok = 0 == fclose (pw->fp) && ok;
+	max_bands = (pw->slab_rows + pw->band_rows - 1) / pw->band_rows;
+	for (i = 0; i < max_bands; i++) {
+		free (pw->bands[i].out.data);
+	}
+	for (i = 0; i < pw->thread_count; i++) {
+		free (pw->scratch[i].head);
+		free (pw->scratch[i].prev);
+		free (pw->scratch[i].tokens);
+		free (pw->scratch[i].trial_rows);
+	}
+	free (pw->scratch);
+	free (pw->bands);
+	free (pw->raw);
+	free (pw->filtered);
+	free (pw);
+	return ok;
+}
+
+bool write_png (
+	const char* file_name,
+	int width,
+	int height,
+	int channels,
+	const unsigned char* rows,
+	int stride,
+	const png_settings_t* settings
+) {
+	png_writer_t* pw = open_png_writer (file_name, width, height, channels,
+		settings);
+	if (!pw) {
+		return false;
+	}
+	write_png_rows (pw, rows, height, stride);
+	return close_png_writer (pw);
+}
@@ -0,0 +1,150 @@
+//
+// Images much larger than the framebuffer, drawn a tile at a time
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "poster.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct poster_t {
+	png_writer_t* png;
+	int width;
+	int height;
+	int tile_width;
+	int tile_height;
+	int columns;
+	int rows;
+	int tiles_read;
+	// one tile row of RGB pixels, the poster's width across, bottom row first
+	// as glReadPixels gives them
+	unsigned char* row_buffer;
+	poster_stats_t stats;
+	bool ok;
+};
+
+poster_t* open_poster (
+	const char* file_name,
+	int width,
+	int height,
+	int tile_width,
+	int tile_height,
+	const png_settings_t* png
+) {
+	poster_t* poster = NULL;
+	size_t row_bytes = (size_t)width * 3 * tile_height;
+	png_writer_t* pw = NULL;
+	unsigned char* row_buffer = NULL;
+
+	if (width < 1 || height < 1 || tile_width < 1 || tile_height < 1) {
+		return NULL;
+	}
+	row_buffer = (unsigned char*)malloc (row_bytes);
+	if (!row_buffer) {
+		fprintf (stderr, "ERROR: could not allocate %.1f MB for a row of poster \
+tiles\n", row_bytes / (1024.0 * 1024.0));
+		return NULL;
+	}
+	pw = open_png_writer (file_name, width, height, 3, png);
+	if (!pw) {
+		fprintf (stderr, "ERROR: could not open %s\n", file_name);
+		free (row_buffer);
+		return NULL;
+	}
+	poster = (poster_t*)calloc (1, sizeof (poster_t));
+	poster->png = pw;
+	poster->width = width;
+	poster->height = height;
+	poster->tile_width = tile_width;
+	poster->tile_height = tile_height;
+	poster->columns = (width + tile_width - 1) / tile_width;
+	poster->rows = (height + tile_height - 1) / tile_height;
+	poster->row_buffer = row_buffer;
+	poster->stats.row_buffer_bytes = row_bytes;
+	poster->ok = true;
+	return poster;
+}
+
+int poster_tile_count (const poster_t* poster) {
+	return poster->columns * poster->rows;
+}
+
+void poster_tile_projection (
+	const poster_t* poster,
+	int tile,
+	const float* proj,
+	float* tile_proj
+) {
+	int column = tile % poster->columns, row = tile / poster->columns;
+	// the tile's edges in the poster's normalised device coordinates. tiles
+	// on the right and bottom edges run off the poster; those pixels are
+	// drawn but not read
+	float left = -1.0f + 2.0f * column * poster->tile_width / poster->width;
+	float right = left + 2.0f * poster->tile_width / poster->width;
+	float top = 1.0f - 2.0f * row * poster->tile_height / poster->height;
+	float bottom = top - 2.0f * poster->tile_height / poster->height;
+	float sx = 2.0f / (right - left), ox = -(right + left) / (right - left);
+	float sy = 2.0f / (top - bottom), oy = -(top + bottom) / (top - bottom);
+	int c;
+
+	// x' = sx * x + ox * w, so after the divide by w the tile fills -1 to 1
+	for (c = 0; c < 4; c++) {
+		const float* col = &proj[c * 4];
+		tile_proj[c * 4] = sx * col[0] + ox * col[3];
+		tile_proj[c * 4 + 1] = sy * col[1] + oy * col[3];
+		tile_proj[c * 4 + 2] = col[2];
+		tile_proj[c * 4 + 3] = col[3];
+	}
+}
+
+bool read_poster_tile (poster_t* poster, int tile) {
+	int column = tile % poster->columns, row = tile / poster->columns;
+	int x = column * poster->tile_width, y = row * poster->tile_height;
+	int columns = poster->width - x < poster->tile_width ? poster->width - x :
+		poster->tile_width;
+	int rows = poster->height - y < poster->tile_height ? poster->height - y :
+		poster->tile_height;
+	double t0 = get_wall_time ();
+
+	if (tile != poster->tiles_read || tile >= poster_tile_count (poster)) {
+		poster->ok = false;
+		return false;
+	}
+	// the poster's rows are at the top of tiles that run off its bottom
+	glPixelStorei (GL_PACK_ALIGNMENT, 1);
+	glPixelStorei (GL_PACK_ROW_LENGTH, poster->width);
+	glReadPixels (0, poster->tile_height - rows, columns, rows, GL_RGB,
+		GL_UNSIGNED_BYTE, poster->row_buffer + (size_t)x * 3);
+	glPixelStorei (GL_PACK_ROW_LENGTH, 0);
+	poster->stats.read_seconds += get_wall_time () - t0;
+	poster->tiles_read++;
+	poster->stats.tiles = poster->tiles_read;
+
+	if (column == poster->columns - 1) {
+		size_t stride = (size_t)poster->width * 3;
+		t0 = get_wall_time ();
+		// the last row read is the top one
+		poster->ok = write_png_rows (poster->png, poster->row_buffer +
+			(rows - 1) * stride, rows, -(int)stride) && poster->ok;
+		poster->stats.write_seconds += get_wall_time () - t0;
+	}
+	return poster->ok;
+}
+
+bool close_poster (poster_t* poster, poster_stats_t* stats) {
+	bool ok;
+
+	if (!poster) {
+		return false;
+	}
+	ok = poster->ok && poster->tiles_read == poster_tile_count (poster);
+	ok = close_png_writer (poster->png) && ok;
+	if (stats) {
+		*stats = poster->stats;
+	}
+	free (poster->row_buffer);
+	free (poster);
+	return ok;
+}
@@ -0,0 +1,855 @@
+//
+// Multi-threaded software rasteriser drawing what basic.vert and basic.frag
+// draw, for machines with no GPU
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "soft_raster.h"
+#include "threads.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined (__SSE__) || defined (_M_X64)
+#include <xmmintrin.h>
+#define SOFT_RASTER_SSE
+#endif
+
+// s and t, the eye-space normal and the eye-space position, as the varyings
+// st, n and p of basic.vert
+#define ATTRIBS 8
+// x and y are clipped at this many times w rather than at w, so window
+// coordinates stay small enough for float edge functions while triangles
+// that just cross the edge of the screen need no clipping
+#define GUARD_BAND 4.0f
+// window coordinates are rounded to 1 / this of a pixel
+#define SUBPIXEL_STEPS 256.0f
+// a triangle clipped by all 6 planes
+#define MAX_CLIP_VERTS 9
+
+enum {
+	PLANE_NEAR = 0,
+	PLANE_FAR,
+	PLANE_LEFT,
+	PLANE_RIGHT,
+	PLANE_BOTTOM,
+	PLANE_TOP,
+	PLANES
+};
+
+typedef struct clip_vertex_t {
+	float pos[4];
+	float attr[ATTRIBS];
+} clip_vertex_t;
+
+//
+// after the divide by w. attributes are divided by w too, so that they,
+// like z and q = 1 / w, vary linearly across the screen
+typedef struct window_vertex_t {
+	float x;
+	float y;
+	float z;
+	float q;
+	float attr[ATTRIBS];
+} window_vertex_t;
+
+typedef struct soft_tri_t {
+	// edge functions a x + b y + c with x and y relative to (min_x, min_y).
+	// edge k is 0 along the side opposite corner k and twice the triangle's
+	// area at corner k. a pixel is inside where all three are > threshold
+	float a[3];
+	float b[3];
+	float c[3];
+	float threshold[3];
+	// bounding box in pixels, inside the screen
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+	float inv_area;
+	// value at corner 0, then the changes to corners 1 and 2
+	float z[3];
+	float q[3];
+	float attr[ATTRIBS][3];
+} soft_tri_t;
+
+typedef struct soft_bin_t {
+	// indices into the binning thread's triangles
+	int* tris;
+	int count;
+	int capacity;
+} soft_bin_t;
+
+//
+// what one thread bins in the first pass, and its counters
+typedef struct soft_thread_t {
+	soft_tri_t* tris;
+	int tri_count;
+	int tri_capacity;
+	// one per tile
+	soft_bin_t* bins;
+	long long culled;
+	long long clipped;
+	long long binned;
+	long long bin_entries;
+	long long shaded;
+} soft_thread_t;
+
+struct soft_raster_t {
+	int width;
+	int height;
+	// pixels from one row to the next: the width rounded up to 4, so groups
+	// of 4 pixels never run off a row
+	int stride;
+	// RGBA8 and depth, bottom row first as in GL
+	unsigned int* colour;
+	float* depth;
+	int tiles_x;
+	int tiles_y;
+	int thread_count;
+	soft_thread_t* threads;
+	bool cull_back;
+	soft_raster_stats_t stats;
+};
+
+typedef struct draw_job_t {
+	soft_raster_t* sr;
+	const transforms_t* transforms;
+	const float* points;
+	const float* tex_coords;
+	const float* normals;
+	const soft_texture_t* texture;
+	float kd[3];
+	unsigned int clear_colour;
+} draw_job_t;
+
+//
+// four floats, one per pixel of a group
+#ifdef SOFT_RASTER_SSE
+typedef __m128 lanes_t;
+
+static inline lanes_t lanes_set (float a) {
+	return _mm_set1_ps (a);
+}
+static inline lanes_t lanes_ramp () {
+	return _mm_set_ps (3.0f, 2.0f, 1.0f, 0.0f);
+}
+static inline lanes_t lanes_load (const float* p) {
+	return _mm_loadu_ps (p);
+}
+static inline void lanes_store (float* p, lanes_t a) {
+	_mm_storeu_ps (p, a);
+}
+static inline lanes_t lanes_add (lanes_t a, lanes_t b) {
+	return _mm_add_ps (a, b);
+}
+static inline lanes_t lanes_mul (lanes_t a, lanes_t b) {
+	return _mm_mul_ps (a, b);
+}
+static inline lanes_t lanes_div (lanes_t a, lanes_t b) {
+	return _mm_div_ps (a, b);
+}
+static inline lanes_t lanes_sqrt (lanes_t a) {
+	return _mm_sqrt_ps (a);
+}
+//
+// bit i set where a[i] > b[i]
+static inline int lanes_greater (lanes_t a, lanes_t b) {
+	return _mm_movemask_ps (_mm_cmpgt_ps (a, b));
+}
+static inline int lanes_less (lanes_t a, lanes_t b) {
+	return _mm_movemask_ps (_mm_cmplt_ps (a, b));
+}
+#else
+typedef struct lanes_t {
+	float v[4];
+} lanes_t;
+
+static inline lanes_t lanes_set (float a) {
+	lanes_t r = { { a, a, a, a } };
+	return r;
+}
+static inline lanes_t lanes_ramp () {
+	lanes_t r = { { 0.0f, 1.0f, 2.0f, 3.0f } };
+	return r;
+}
+static inline lanes_t lanes_load (const float* p) {
+	lanes_t r = { { p[0], p[1], p[2], p[3] } };
+	return r;
+}
+static inline void lanes_store (float* p, lanes_t a) {
+	memcpy (p, a.v, sizeof (a.v));
+}
+static inline lanes_t lanes_add (lanes_t a, lanes_t b) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		a.v[i] += b.v[i];
+	}
+	return a;
+}
+static inline lanes_t lanes_mul (lanes_t a, lanes_t b) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		a.v[i] *= b.v[i];
+	}
+	return a;
+}
+static inline lanes_t lanes_div (lanes_t a, lanes_t b) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		a.v[i] /= b.v[i];
+	}
+	return a;
+}
+static inline lanes_t lanes_sqrt (lanes_t a) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		a.v[i] = sqrtf (a.v[i]);
+	}
+	return a;
+}
+static inline int lanes_greater (lanes_t a, lanes_t b) {
+	int i, mask = 0;
+	for (i = 0; i < 4; i++) {
+		mask |= a.v[i] > b.v[i] ? 1 << i : 0;
+	}
+	return mask;
+}
+static inline int lanes_less (lanes_t a, lanes_t b) {
+	int i, mask = 0;
+	for (i = 0; i < 4; i++) {
+		mask |= a.v[i] < b.v[i] ? 1 << i : 0;
+	}
+	return mask;
+}
+#endif
+
+//
+// value at corner 0 plus b1 and b2 of the changes to corners 1 and 2
+static inline lanes_t interpolate (const float* v, lanes_t b1, lanes_t b2) {
+	return lanes_add (lanes_set (v[0]), lanes_add (lanes_mul (b1,
+		lanes_set (v[1])), lanes_mul (b2, lanes_set (v[2]))));
+}
+
+static unsigned int pack_colour (float r, float g, float b) {
+	// as GL converts to unsigned normalised bytes
+	int ri = (int)(r * 255.0f + 0.5f), gi = (int)(g * 255.0f + 0.5f);
+	int bi = (int)(b * 255.0f + 0.5f);
+	return (unsigned int)ri | ((unsigned int)gi << 8) |
+		((unsigned int)bi << 16) | 0xFF000000u;
+}
+
+static float saturate (float v) {
+	// also makes NaN 0
+	return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;
+}
+
+soft_raster_t* create_soft_raster (int width, int height, int thread_count) {
+	soft_raster_t* sr = NULL;
+	int i, tile_count;
+
+	if (width < 1 || height < 1) {
+		return NULL;
+	}
+	sr = (soft_raster_t*)calloc (1, sizeof (soft_raster_t));
+	sr->width = width;
+	sr->height = height;
+	sr->stride = (width + 3) & ~3;
+	sr->colour = (unsigned int*)malloc ((size_t)sr->stride * height *
+		sizeof (unsigned int));
+	sr->depth = (float*)malloc ((size_t)sr->stride * height * sizeof (float));
+	if (!sr->colour || !sr->depth) {
+		fprintf (stderr, "ERROR: could not allocate a %ix%i software raster\n",
+			width, height);
+		free_soft_raster (sr);
+		return NULL;
+	}
+	sr->tiles_x = (width + SOFT_RASTER_TILE - 1) / SOFT_RASTER_TILE;
+	sr->tiles_y = (height + SOFT_RASTER_TILE - 1) / SOFT_RASTER_TILE;
+	tile_count = sr->tiles_x * sr->tiles_y;
+	sr->thread_count = resolve_thread_count (thread_count);
+	sr->threads = (soft_thread_t*)calloc (sr->thread_count,
+		sizeof (soft_thread_t));
+	for (i = 0; i < sr->thread_count; i++) {
+		sr->threads[i].bins = (soft_bin_t*)calloc (tile_count,
+			sizeof (soft_bin_t));
+	}
+	sr->cull_back = true;
+	clear_soft_raster (sr, 0.0f, 0.0f, 0.0f);
+	return sr;
+}
+
+void free_soft_raster (soft_raster_t* sr) {
+	int i, b;
+
+	if (!sr) {
+		return;
+	}
+	for (i = 0; sr->threads && i < sr->thread_count; i++) {
+		for (b = 0; b < sr->tiles_x * sr->tiles_y; b++) {
+			free (sr->threads[i].bins[b].tris);
+		}
+		free (sr->threads[i].bins);
+		free (sr->threads[i].tris);
+	}
+	free (sr->threads);
+	free (sr->colour);
+	free (sr->depth);
+	free (sr);
+}
+
+static void clear_rows_job (int begin, int end, int thread_idx, void* user) {
+	draw_job_t* job = (draw_job_t*)user;
+	soft_raster_t* sr = job->sr;
+	size_t row = (size_t)sr->stride;
+	int y, x;
+
+	if (begin >= end) {
+		return;
+	}
+	// fill the first row, then copy it to the rest
+	for (x = 0; x < sr->stride; x++) {
+		sr->colour[begin * row + x] = job->clear_colour;
+		sr->depth[begin * row + x] = 1.0f;
+	}
+	for (y = begin + 1; y < end; y++) {
+		memcpy (sr->colour + y * row, sr->colour + begin * row, row *
+			sizeof (unsigned int));
+		memcpy (sr->depth + y * row, sr->depth + begin * row, row *
+			sizeof (float));
+	}
+	(void)thread_idx;
+}
+
+void clear_soft_raster (soft_raster_t* sr, float r, float g, float b) {
+	draw_job_t job;
+
+	memset (&job, 0, sizeof (draw_job_t));
+	job.sr = sr;
+	job.clear_colour = pack_colour (saturate (r), saturate (g), saturate (b));
+	parallel_for (sr->height, sr->thread_count, clear_rows_job, &job);
+}
+
+void set_soft_raster_culling (soft_raster_t* sr, bool cull_back) {
+	sr->cull_back = cull_back;
+}
+
+int soft_raster_thread_count (const soft_raster_t* sr) {
+	return sr->thread_count;
+}
+
+//
+// column-major m times (x, y, z, 1). a column in each lane, so one lanes_t
+// is the whole result
+static inline lanes_t transform_point (const float* m, lanes_t x, lanes_t y,
+	lanes_t z) {
+	return lanes_add (lanes_add (lanes_mul (lanes_load (m), x), lanes_mul (
+		lanes_load (m + 4), y)), lanes_add (lanes_mul (lanes_load (m + 8), z),
+		lanes_load (m + 12)));
+}
+
+//
+// what basic.vert does for one corner, but with no instance matrix. the
+// varyings are left for transform_attributes (), so back faces skip them
+static void transform_position (const transforms_t* t, const float* vp,
+	clip_vertex_t* out) {
+	lanes_store (out->pos, transform_point (t->MVP, lanes_set (vp[0]),
+		lanes_set (vp[1]), lanes_set (vp[2])));
+}
+
+static void transform_attributes (const transforms_t* t, const float* vp,
+	const float* vt, const float* vn, clip_vertex_t* out) {
+	const float* nm = t->normal_matrix;
+	float eye[4];
+	int r;
+
+	lanes_store (eye, transform_point (t->MV, lanes_set (vp[0]),
+		lanes_set (vp[1]), lanes_set (vp[2])));
+	out->attr[0] = vt ? vt[0] : 0.0f;
+	out->attr[1] = vt ? vt[1] : 0.0f;
+	for (r = 0; r < 3; r++) {
+		out->attr[2 + r] = vn ? nm[r] * vn[0] + nm[3 + r] * vn[1] +
+			nm[6 + r] * vn[2] : 0.0f;
+		out->attr[5 + r] = eye[r];
+	}
+}
+
+//
+// >= 0 on the inside of the plane
+static float plane_distance (const float* p, int plane) {
+	switch (plane) {
+	case PLANE_NEAR:
+		return p[2] + p[3];
+	case PLANE_FAR:
+		return p[3] - p[2];
+	case PLANE_LEFT:
+		return p[0] + GUARD_BAND * p[3];
+	case PLANE_RIGHT:
+		return GUARD_BAND * p[3] - p[0];
+	case PLANE_BOTTOM:
+		return p[1] + GUARD_BAND * p[3];
+	default:
+		return GUARD_BAND * p[3] - p[1];
+	}
+}
+
+//
+// bit per plane the point is outside of
+static int outcode (const float* p) {
+	// plane_distance () for every plane, unrolled: this runs on every corner
+	float w = p[3], guard = GUARD_BAND * p[3];
+	return (p[2] + w < 0.0f) << PLANE_NEAR | (w - p[2] < 0.0f) << PLANE_FAR |
+		(p[0] + guard < 0.0f) << PLANE_LEFT |
+		(guard - p[0] < 0.0f) << PLANE_RIGHT |
+		(p[1] + guard < 0.0f) << PLANE_BOTTOM |
+		(guard - p[1] < 0.0f) << PLANE_TOP;
+}
+
+//
+// Sutherland-Hodgman against each plane in planes. returns the corners
+// left, which may be fewer than 3
+static int clip_polygon (clip_vertex_t* verts, int count, int planes) {
+	clip_vertex_t out[MAX_CLIP_VERTS];
+	int plane, i, k;
+
+	for (plane = 0; plane < PLANES && count >= 3; plane++) {
+		int out_count = 0;
+		if (!(planes & (1 << plane))) {
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			const clip_vertex_t* a = &verts[i];
+			const clip_vertex_t* b = &verts[(i + 1) % count];
+			float da = plane_distance (a->pos, plane);
+			float db = plane_distance (b->pos, plane);
+			if (da >= 0.0f) {
+				out[out_count++] = *a;
+			}
+			if ((da >= 0.0f) != (db >= 0.0f)) {
+				float t = da / (da - db);
+				clip_vertex_t* v = &out[out_count++];
+				for (k = 0; k < 4; k++) {
+					v->pos[k] = a->pos[k] + (b->pos[k] - a->pos[k]) * t;
+				}
+				for (k = 0; k < ATTRIBS; k++) {
+					v->attr[k] = a->attr[k] + (b->attr[k] - a->attr[k]) * t;
+				}
+			}
+		}
+		memcpy (verts, out, out_count * sizeof (clip_vertex_t));
+		count = out_count;
+	}
+	return count;
+}
+
+//
+// nearest SUBPIXEL_STEPS step. the guard band keeps v well inside an int
+static float snap (float v) {
+	float steps = v * SUBPIXEL_STEPS;
+	return (float)(int)(steps + (steps >= 0.0f ? 0.5f : -0.5f)) *
+		(1.0f / SUBPIXEL_STEPS);
+}
+
+static void to_window (const soft_raster_t* sr, const clip_vertex_t* c,
+	window_vertex_t* w) {
+	float q = 1.0f / c->pos[3];
+	int k;
+
+	// snapped to SUBPIXEL_STEPS as GL rasterisers do, so edges shared with
+	// neighbouring triangles cover the same pixels
+	w->x = snap ((c->pos[0] * q * 0.5f + 0.5f) * sr->width);
+	w->y = snap ((c->pos[1] * q * 0.5f + 0.5f) * sr->height);
+	w->z = c->pos[2] * q * 0.5f + 0.5f;
+	w->q = q;
+	for (k = 0; k < ATTRIBS; k++) {
+		w->attr[k] = c->attr[k] * q;
+	}
+}
+
+//
+// as setup_triangle () would find after to_window (), for corners all in
+// front of the camera
+static bool faces_back (const soft_raster_t* sr, const clip_vertex_t* v) {
+	float x[3], y[3];
+	int k;
+
+	for (k = 0; k < 3; k++) {
+		float q = 1.0f / v[k].pos[3];
+		x[k] = snap ((v[k].pos[0] * q * 0.5f + 0.5f) * sr->width);
+		y[k] = snap ((v[k].pos[1] * q * 0.5f + 0.5f) * sr->height);
+	}
+	return (double)(x[1] - x[0]) * (y[2] - y[0]) - (double)(x[2] - x[0]) *
+		(y[1] - y[0]) <= 0.0;
+}
+
+static void add_to_bin (soft_bin_t* bin, int tri) {
+	if (bin->count == bin->capacity) {
+		bin->capacity = bin->capacity ? bin->capacity * 2 : 64;
+		bin->tris = (int*)realloc (bin->tris, bin->capacity * sizeof (int));
+	}
+	bin->tris[bin->count++] = tri;
+}
+
+static void setup_triangle (soft_raster_t* sr, soft_thread_t* th,
+	const window_vertex_t* v0, const window_vertex_t* v1,
+	const window_vertex_t* v2) {
+	const window_vertex_t* corners[3];
+	soft_tri_t* tri;
+	double area = (double)(v1->x - v0->x) * (v2->y - v0->y) -
+		(double)(v2->x - v0->x) * (v1->y - v0->y);
+	float min_x, min_y, max_x, max_y;
+	int k, i, tx, ty;
+
+	corners[0] = v0;
+	if (area > 0.0) {
+		corners[1] = v1;
+		corners[2] = v2;
+	} else if (area < 0.0 && !sr->cull_back) {
+		// a back face, drawn anyway: wind it the other way
+		corners[1] = v2;
+		corners[2] = v1;
+		area = -area;
+	} else {
+		th->culled++;
+		return;
+	}
+	min_x = max_x = v0->x;
+	min_y = max_y = v0->y;
+	for (k = 1; k < 3; k++) {
+		min_x = corners[k]->x < min_x ? corners[k]->x : min_x;
+		max_x = corners[k]->x > max_x ? corners[k]->x : max_x;
+		min_y = corners[k]->y < min_y ? corners[k]->y : min_y;
+		max_y = corners[k]->y > max_y ? corners[k]->y : max_y;
+	}
+	if (th->tri_count == th->tri_capacity) {
+		th->tri_capacity = th->tri_capacity ? th->tri_capacity * 2 : 1024;
+		th->tris = (soft_tri_t*)realloc (th->tris, th->tri_capacity *
+			sizeof (soft_tri_t));
+	}
+	tri = &th->tris[th->tri_count];
+	// pixel centres are at + 0.5. truncating rather than rounding down and
+	// up only widens the box, and negative minimums are clamped to 0 below
+	tri->min_x = (int)min_x;
+	tri->min_y = (int)min_y;
+	tri->max_x = (int)max_x + 1;
+	tri->max_y = (int)max_y + 1;
+	tri->min_x = tri->min_x > 0 ? tri->min_x : 0;
+	tri->min_y = tri->min_y > 0 ? tri->min_y : 0;
+	tri->max_x = tri->max_x < sr->width - 1 ? tri->max_x : sr->width - 1;
+	tri->max_y = tri->max_y < sr->height - 1 ? tri->max_y : sr->height - 1;
+	if (tri->min_x > tri->max_x || tri->min_y > tri->max_y) {
+		th->culled++;
+		return;
+	}
+	for (k = 0; k < 3; k++) {
+		// the edge from p to q, opposite corner k
+		const window_vertex_t* p = corners[(k + 1) % 3];
+		const window_vertex_t* q = corners[(k + 2) % 3];
+		float a = p->y - q->y, b = q->x - p->x;
+		tri->a[k] = a;
+		tri->b[k] = b;
+		tri->c[k] = (float)((double)a * (tri->min_x - (double)p->x) +
+			(double)b * (tri->min_y - (double)p->y));
+		// fill rule: pixels exactly on a top or left edge are inside, so a
+		// pixel on an edge two triangles share is drawn once
+		tri->threshold[k] = a > 0.0f || (0.0f == a && b < 0.0f) ? -FLT_MIN :
+			0.0f;
+	}
+	tri->inv_area = (float)(1.0 / area);
+	tri->z[0] = corners[0]->z;
+	tri->z[1] = corners[1]->z - corners[0]->z;
+	tri->z[2] = corners[2]->z - corners[0]->z;
+	tri->q[0] = corners[0]->q;
+	tri->q[1] = corners[1]->q - corners[0]->q;
+	tri->q[2] = corners[2]->q - corners[0]->q;
+	for (i = 0; i < ATTRIBS; i++) {
+		tri->attr[i][0] = corners[0]->attr[i];
+		tri->attr[i][1] = corners[1]->attr[i] - corners[0]->attr[i];
+		tri->attr[i][2] = corners[2]->attr[i] - corners[0]->attr[i];
+	}
+	for (ty = tri->min_y / SOFT_RASTER_TILE; ty <= tri->max_y /
+		SOFT_RASTER_TILE; ty++) {
+		for (tx = tri->min_x / SOFT_RASTER_TILE; tx <= tri->max_x /
+			SOFT_RASTER_TILE; tx++) {
+			add_to_bin (&th->bins[ty * sr->tiles_x + tx], th->tri_count);
+			th->bin_entries++;
+		}
+	}
+	th->tri_count++;
+	th->binned++;
+}
+
+static void setup_job (int begin, int end, int thread_idx, void* user) {
+	draw_job_t* job = (draw_job_t*)user;
+	soft_raster_t* sr = job->sr;
+	soft_thread_t* th = &sr->threads[thread_idx];
+	int t, c, i;
+
+	for (t = begin; t < end; t++) {
+		clip_vertex_t verts[MAX_CLIP_VERTS];
+		window_vertex_t window[MAX_CLIP_VERTS];
+		int codes[3], count = 3;
+
+		for (c = 0; c < 3; c++) {
+			transform_position (job->transforms, &job->points[(t * 3 + c) * 3],
+				&verts[c]);
+			codes[c] = outcode (verts[c].pos);
+		}
+		// all corners outside one plane, or an unclipped back face
+		if ((codes[0] & codes[1] & codes[2]) || (!(codes[0] | codes[1] |
+			codes[2]) && sr->cull_back && faces_back (sr, verts))) {
+			th->culled++;
+			continue;
+		}
+		for (c = 0; c < 3; c++) {
+			int v = t * 3 + c;
+			transform_attributes (job->transforms, &job->points[v * 3],
+				job->tex_coords ? &job->tex_coords[v * 2] : NULL,
+				job->normals ? &job->normals[v * 3] : NULL, &verts[c]);
+		}
+		if (codes[0] | codes[1] | codes[2]) {
+			th->clipped++;
+			count = clip_polygon (verts, 3, codes[0] | codes[1] | codes[2]);
+		}
+		for (i = 0; i < count; i++) {
+			to_window (sr, &verts[i], &window[i]);
+		}
+		// a fan over whatever clipping left
+		for (i = 1; i + 1 < count; i++) {
+			setup_triangle (sr, th, &window[0], &window[i], &window[i + 1]);
+		}
+	}
+}
+
+//
+// bilinear filtered and clamped to the edge, as load_texture () sets up
+static void sample_texture (const soft_texture_t* tex, float s, float t,
+	float* rgb) {
+	const unsigned char* texels[4];
+	float u, v, du, dv;
+	int i0, j0, i1, j1, k;
+
+	if (!tex) {
+		rgb[0] = rgb[1] = rgb[2] = 1.0f;
+		return;
+	}
+	// GL's row 0 is the image's bottom row, the last one stbi_load () gives
+	u = saturate (s) * tex->width - 0.5f;
+	v = (1.0f - saturate (t)) * tex->height - 0.5f;
+	// floor, as u and v are >= -0.5, without a call to floorf ()
+	i0 = (int)(u + 1.0f) - 1;
+	j0 = (int)(v + 1.0f) - 1;
+	du = u - i0;
+	dv = v - j0;
+	i1 = i0 + 1 < tex->width ? i0 + 1 : tex->width - 1;
+	j1 = j0 + 1 < tex->height ? j0 + 1 : tex->height - 1;
+	i0 = i0 > 0 ? i0 : 0;
+	j0 = j0 > 0 ? j0 : 0;
+	texels[0] = tex->rgba + ((size_t)j0 * tex->width + i0) * 4;
+	texels[1] = tex->rgba + ((size_t)j0 * tex->width + i1) * 4;
+	texels[2] = tex->rgba + ((size_t)j1 * tex->width + i0) * 4;
+	texels[3] = tex->rgba + ((size_t)j1 * tex->width + i1) * 4;
+	for (k = 0; k < 3; k++) {
+		float top = texels[0][k] + (texels[1][k] - texels[0][k]) * du;
+		float bottom = texels[2][k] + (texels[3][k] - texels[2][k]) * du;
+		rgb[k] = (top + (bottom - top) * dv) * (1.0f / 255.0f);
+	}
+}
+
+//
+// basic.frag for the pixels of a group of 4 set in mask, at barycentrics
+// b1 and b2 and depth z
+static int shade_pixels (const draw_job_t* job, const soft_tri_t* tri,
+	lanes_t b1, lanes_t b2, lanes_t z, int mask, unsigned int* colour,
+	float* depth) {
+	float zs[4], ss[4], ts[4], dps[4];
+	// perspective-correct: attribute / w and 1 / w are linear on screen
+	lanes_t w = lanes_div (lanes_set (1.0f), interpolate (tri->q, b1, b2));
+	lanes_t nx = lanes_mul (interpolate (tri->attr[2], b1, b2), w);
+	lanes_t ny = lanes_mul (interpolate (tri->attr[3], b1, b2), w);
+	lanes_t nz = lanes_mul (interpolate (tri->attr[4], b1, b2), w);
+	lanes_t px = lanes_mul (interpolate (tri->attr[5], b1, b2), w);
+	lanes_t py = lanes_mul (interpolate (tri->attr[6], b1, b2), w);
+	lanes_t pz = lanes_mul (interpolate (tri->attr[7], b1, b2), w);
+	// dot (normalize (n), normalize (-p))
+	lanes_t n_dot_p = lanes_add (lanes_add (lanes_mul (nx, px),
+		lanes_mul (ny, py)), lanes_mul (nz, pz));
+	lanes_t lengths = lanes_sqrt (lanes_mul (lanes_add (lanes_add (
+		lanes_mul (nx, nx), lanes_mul (ny, ny)), lanes_mul (nz, nz)),
+		lanes_add (lanes_add (lanes_mul (px, px), lanes_mul (py, py)),
+		lanes_mul (pz, pz))));
+	int shaded = 0, i;
+
+	lanes_store (zs, z);
+	lanes_store (ss, lanes_mul (interpolate (tri->attr[0], b1, b2), w));
+	lanes_store (ts, lanes_mul (interpolate (tri->attr[1], b1, b2), w));
+	lanes_store (dps, lanes_div (lanes_mul (lanes_set (-1.0f), n_dot_p),
+		lengths));
+	for (i = 0; i < 4; i++) {
+		float texel[3], dp;
+		if (!(mask & (1 << i))) {
+			continue;
+		}
+		depth[i] = zs[i];
+		sample_texture (job->texture, ss[i], ts[i], texel);
+		// NaN from a zero-length normal goes to 0 in saturate ()
+		dp = dps[i];
+		colour[i] = pack_colour (saturate (texel[0] * job->kd[0] * dp),
+			saturate (texel[1] * job->kd[1] * dp),
+			saturate (texel[2] * job->kd[2] * dp));
+		shaded++;
+	}
+	return shaded;
+}
+
+//
+// draw the part of tri inside the tile from (x0, y0) to before (x1, y1)
+static long long raster_triangle (const draw_job_t* job, const soft_tri_t* tri,
+	int x0, int y0, int x1, int y1) {
+	soft_raster_t* sr = job->sr;
+	// start on a group of 4, as tiles and rows do
+	int min_x = (tri->min_x > x0 ? tri->min_x : x0) & ~3;
+	int max_x = tri->max_x < x1 - 1 ? tri->max_x : x1 - 1;
+	int min_y = tri->min_y > y0 ? tri->min_y : y0;
+	int max_y = tri->max_y < y1 - 1 ? tri->max_y : y1 - 1;
+	lanes_t ramp = lanes_ramp (), inv_area = lanes_set (tri->inv_area);
+	lanes_t step[3], threshold[3];
+	long long shaded = 0;
+	int x, y, k;
+
+	for (k = 0; k < 3; k++) {
+		step[k] = lanes_set (tri->a[k] * 4.0f);
+		threshold[k] = lanes_set (tri->threshold[k]);
+	}
+	for (y = min_y; y <= max_y; y++) {
+		float fy = y + 0.5f - tri->min_y, fx = min_x + 0.5f - tri->min_x;
+		unsigned int* colour = sr->colour + (size_t)y * sr->stride;
+		float* depth = sr->depth + (size_t)y * sr->stride;
+		lanes_t e[3];
+
+		for (k = 0; k < 3; k++) {
+			e[k] = lanes_add (lanes_set (tri->a[k] * fx + tri->b[k] * fy +
+				tri->c[k]), lanes_mul (lanes_set (tri->a[k]), ramp));
+		}
+		for (x = min_x; x <= max_x; x += 4) {
+			int mask = lanes_greater (e[0], threshold[0]) &
+				lanes_greater (e[1], threshold[1]) &
+				lanes_greater (e[2], threshold[2]);
+			if (mask) {
+				lanes_t b1 = lanes_mul (e[1], inv_area);
+				lanes_t b2 = lanes_mul (e[2], inv_area);
+				lanes_t z = interpolate (tri->z, b1, b2);
+				// GL_LESS
+				mask &= lanes_less (z, lanes_load (depth + x));
+				if (mask) {
+					shaded += shade_pixels (job, tri, b1, b2, z, mask,
+						colour + x, depth + x);
+				}
+			}
+			for (k = 0; k < 3; k++) {
+				e[k] = lanes_add (e[k], step[k]);
+			}
+		}
+	}
+	return shaded;
+}
+
+static void raster_job (int begin, int end, int thread_idx, void* user) {
+	draw_job_t* job = (draw_job_t*)user;
+	soft_raster_t* sr = job->sr;
+	int tile_count = sr->tiles_x * sr->tiles_y;
+	int j, tile, t, i;
+
+	// tiles are dealt round the threads, so the busy middle of the screen is
+	// shared out
+	for (j = begin; j < end; j++) {
+		for (tile = j; tile < tile_count; tile += sr->thread_count) {
+			int x0 = (tile % sr->tiles_x) * SOFT_RASTER_TILE;
+			int y0 = (tile / sr->tiles_x) * SOFT_RASTER_TILE;
+			int x1 = x0 + SOFT_RASTER_TILE, y1 = y0 + SOFT_RASTER_TILE;
+			x1 = x1 < sr->width ? x1 : sr->width;
+			y1 = y1 < sr->height ? y1 : sr->height;
+			// binning threads in order are triangles in the order drawn
+			for (t = 0; t < sr->thread_count; t++) {
+				const soft_thread_t* th = &sr->threads[t];
+				const soft_bin_t* bin = &th->bins[tile];
+				for (i = 0; i < bin->count; i++) {
+					sr->threads[thread_idx].shaded += raster_triangle (job,
+						&th->tris[bin->tris[i]], x0, y0, x1, y1);
+				}
+			}
+		}
+	}
+}
+
+void draw_soft_triangles (
+	soft_raster_t* sr,
+	transforms_t* transforms,
+	const float* points,
+	const float* tex_coords,
+	const float* normals,
+	int point_count,
+	const soft_texture_t* texture,
+	const float* kd
+) {
+	int tile_count = sr->tiles_x * sr->tiles_y;
+	draw_job_t job;
+	double t0, t1;
+	int i, b;
+
+	update_derived_transforms (transforms);
+	memset (&job, 0, sizeof (draw_job_t));
+	job.sr = sr;
+	job.transforms = transforms;
+	job.points = points;
+	job.tex_coords = tex_coords;
+	job.normals = normals;
+	job.texture = texture;
+	memcpy (job.kd, kd, sizeof (job.kd));
+	for (i = 0; i < sr->thread_count; i++) {
+		soft_thread_t* th = &sr->threads[i];
+		th->tri_count = 0;
+		th->culled = th->clipped = th->binned = th->bin_entries = 0;
+		th->shaded = 0;
+		for (b = 0; b < tile_count; b++) {
+			th->bins[b].count = 0;
+		}
+	}
+
+	t0 = get_wall_time ();
+	parallel_for (point_count / 3, sr->thread_count, setup_job, &job);
+	t1 = get_wall_time ();
+	parallel_for (sr->thread_count, sr->thread_count, raster_job, &job);
+	sr->stats.raster_seconds += get_wall_time () - t1;
+	sr->stats.setup_seconds += t1 - t0;
+
+	sr->stats.draws++;
+	sr->stats.triangles_in += point_count / 3;
+	for (i = 0; i < sr->thread_count; i++) {
+		const soft_thread_t* th = &sr->threads[i];
+		sr->stats.triangles_culled += th->culled;
+		sr->stats.triangles_clipped += th->clipped;
+		sr->stats.triangles_binned += th->binned;
+		sr->stats.bin_entries += th->bin_entries;
+		sr->stats.pixels_shaded += th->shaded;
+	}
+}
+
+void read_soft_raster_rgb (const soft_raster_t* sr, unsigned char* rgb) {
+	int x, y;
+	for (y = 0; y < sr->height; y++) {
+		const unsigned int* src = sr->colour + (size_t)y * sr->stride;
+		unsigned char* dst = rgb + (size_t)y * sr->width * 3;
+		for (x = 0; x < sr->width; x++) {
+			dst[x * 3] = (unsigned char)src[x];
+			dst[x * 3 + 1] = (unsigned char)(src[x] >> 8);
+			dst[x * 3 + 2] = (unsigned char)(src[x] >> 16);
+		}
+	}
+}
+
+void get_soft_raster_stats (const soft_raster_t* sr,
+	soft_raster_stats_t* stats) {
+	*stats = sr->stats;
+}
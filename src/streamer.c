@@ -0,0 +1,364 @@
+//
+// Out-of-core paging of .oct octree chunks into GL buffers
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "streamer.h"
+#include "gl_state.h"
+#include "octree.h"
+#include "threads.h"
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAMER_REQUEST_CAPACITY 256
+// limit GL uploads per frame so a burst of loads doesn't cause a hitch
+#define STREAMER_UPLOAD_BYTES_PER_FRAME (16 * 1024 * 1024)
+
+enum {
+	CHUNK_ABSENT = 0,
+	CHUNK_QUEUED,
+	CHUNK_RESIDENT
+};
+
+typedef struct chunk_t {
+	int state;
+	GLuint vao;
+	GLuint vbo;
+	long long last_used_frame;
+} chunk_t;
+
+// a read handed from the main thread to a loader and back
+typedef struct load_request_t {
+	int node;
+	float* vertices;
+	bool ok;
+} load_request_t;
+
+struct streamer_t {
+	char file_name[256];
+	octree_node_t* nodes;
+	int node_count;
+	chunk_t* chunks;
+	work_queue_t* requests;
+	work_queue_t* done;
+	worker_group_t* loaders;
+	long long frame;
+	long long resident_bytes;
+	long long budget_bytes;
+	int resident_nodes;
+	// per-frame counters
+	int drawn_nodes;
+	long long drawn_vertices;
+	// rolling one-second window for bandwidth and hit rate
+	double window_start;
+	long long window_bytes;
+	long long window_wanted;
+	long long window_hits;
+	double streamed_mb_per_s;
+	double hit_rate;
+};
+
+static void loader_main (int worker_idx, void* user) {
+	streamer_t* s = (streamer_t*)user;
+	FILE* fp = fopen (s->file_name, "rb");
+	void* item = NULL;
+
+	while (work_queue_pop (s->requests, &item)) {
+		load_request_t* req = (load_request_t*)item;
+		req->ok = fp && read_octree_node_data (fp, &s->nodes[req->node],
+			&req->vertices);
+		// done only closes when the streamer is destroyed, and only blocks
+		// when uploads have fallen behind
+		if (!work_queue_push (s->done, req)) {
+			free (req->vertices);
+			free (req);
+			break;
+		}
+	}
+	if (fp) {
+		fclose (fp);
+	}
+	(void)worker_idx;
+}
+
+streamer_t* create_streamer (
+	const char* file_name,
+	long long budget_bytes,
+	int io_threads
+) {
+	streamer_t* s = (streamer_t*)calloc (1, sizeof (streamer_t));
+
+	strncpy (s->file_name, file_name, sizeof (s->file_name) - 1);
+	if (!load_octree_nodes (file_name, &s->nodes, &s->node_count) ||
+		s->node_count < 1) {
+		free (s);
+		return NULL;
+	}
+	s->chunks = (chunk_t*)calloc (s->node_count, sizeof (chunk_t));
+	s->budget_bytes = budget_bytes;
+	s->requests = create_work_queue (STREAMER_REQUEST_CAPACITY);
+	// loads wait here for upload_finished_loads (). requests is refilled as
+	// loaders drain it, so when uploads fall behind this fills and loaders
+	// block on it until the main thread catches up or destroy_streamer ()
+	// closes it
+	s->done = create_work_queue (STREAMER_REQUEST_CAPACITY + io_threads);
+	s->loaders = start_workers (io_threads < 1 ? 1 : io_threads, loader_main,
+		s);
+	s->window_start = get_wall_time ();
+	printf ("streaming %s: %i nodes, %.1f MB VRAM budget\n", file_name,
+		s->node_count, (double)budget_bytes / (1024.0 * 1024.0));
+	return s;
+}
+
+static void free_chunk (streamer_t* s, int n) {
+	chunk_t* c = &s->chunks[n];
+	delete_vertex_arrays (1, &c->vao);
+	delete_buffers (1, &c->vbo);
+	c->vao = c->vbo = 0;
+	c->state = CHUNK_ABSENT;
+	s->resident_bytes -= s->nodes[n].size;
+	s->resident_nodes--;
+}
+
+void destroy_streamer (streamer_t* s) {
+	void* item = NULL;
+	int n;
+
+	if (!s) {
+		return;
+	}
+	// a loader blocked pushing into a full done queue would never see
+	// requests close
+	work_queue_close (s->requests);
+	work_queue_close (s->done);
+	join_workers (s->loaders);
+	while (work_queue_try_pop (s->requests, &item)) {
+		free (item);
+	}
+	while (work_queue_try_pop (s->done, &item)) {
+		load_request_t* req = (load_request_t*)item;
+		free (req->vertices);
+		free (req);
+	}
+	for (n = 0; n < s->node_count; n++) {
+		if (CHUNK_RESIDENT == s->chunks[n].state) {
+			free_chunk (s, n);
+		}
+	}
+	destroy_work_queue (s->requests);
+	destroy_work_queue (s->done);
+	free (s->chunks);
+	free (s->nodes);
+	free (s);
+}
+
+static void upload_finished_loads (streamer_t* s) {
+	long long uploaded = 0;
+	void* item = NULL;
+
+	while (uploaded < STREAMER_UPLOAD_BYTES_PER_FRAME &&
+		work_queue_try_pop (s->done, &item)) {
+		load_request_t* req = (load_request_t*)item;
+		const octree_node_t* node = &s->nodes[req->node];
+		chunk_t* c = &s->chunks[req->node];
+
+		if (!req->ok) {
+			fprintf (stderr, "ERROR: could not read chunk %i from %s\n", req->node,
+				s->file_name);
+			// leave it queued so we don't hammer the disk retrying every frame
+			free (req);
+			continue;
+		}
+		glGenBuffers (1, &c->vbo);
+		bind_array_buffer (c->vbo);
+		glBufferData (GL_ARRAY_BUFFER, node->size, req->vertices, GL_STATIC_DRAW);
+		glGenVertexArrays (1, &c->vao);
+		bind_vertex_array (c->vao);
+		glEnableVertexAttribArray (0);
+		glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE,
+			OCTREE_VERTEX_FLOATS * sizeof (float), NULL);
+		glEnableVertexAttribArray (1);
+		glVertexAttribPointer (1, 2, GL_FLOAT, GL_FALSE,
+			OCTREE_VERTEX_FLOATS * sizeof (float), (GLvoid*)(3 * sizeof (float)));
+		glEnableVertexAttribArray (2);
+		glVertexAttribPointer (2, 3, GL_FLOAT, GL_FALSE,
+			OCTREE_VERTEX_FLOATS * sizeof (float), (GLvoid*)(5 * sizeof (float)));
+		c->state = CHUNK_RESIDENT;
+		c->last_used_frame = s->frame;
+		s->resident_bytes += node->size;
+		s->resident_nodes++;
+		s->window_bytes += node->size;
+		uploaded += node->size;
+		free (req->vertices);
+		free (req);
+	}
+}
+
+static void request_chunk (streamer_t* s, int n) {
+	load_request_t* req = NULL;
+	if (CHUNK_ABSENT != s->chunks[n].state) {
+		return;
+	}
+	req = (load_request_t*)calloc (1, sizeof (load_request_t));
+	req->node = n;
+	// a full queue just means we ask again next frame
+	if (work_queue_try_push (s->requests, req)) {
+		s->chunks[n].state = CHUNK_QUEUED;
+	} else {
+		free (req);
+	}
+}
+
+static float distance_to_box (const octree_node_t* node, const float* p) {
+	float d2 = 0.0f;
+	int k;
+	for (k = 0; k < 3; k++) {
+		float d = 0.0f;
+		if (p[k] < node->bb_min[k]) {
+			d = node->bb_min[k] - p[k];
+		} else if (p[k] > node->bb_max[k]) {
+			d = p[k] - node->bb_max[k];
+		}
+		d2 += d * d;
+	}
+	return sqrtf (d2);
+}
+
+static void draw_chunk (streamer_t* s, int n) {
+	chunk_t* c = &s->chunks[n];
+	c->last_used_frame = s->frame;
+	if (s->nodes[n].vertex_count > 0) {
+		bind_vertex_array (c->vao);
+		glDrawArrays (GL_TRIANGLES, 0, s->nodes[n].vertex_count);
+		s->drawn_nodes++;
+		s->drawn_vertices += s->nodes[n].vertex_count;
+	}
+}
+
+//
+// draw n, or its children if n's LOD is too coarse and they are all ready.
+// a node's region is covered by its own LOD until every child has arrived
+static void visit (streamer_t* s, int n, const float* cam_pos,
+	float proj_scale, float error_px) {
+	const octree_node_t* node = &s->nodes[n];
+	chunk_t* c = &s->chunks[n];
+	bool resident = CHUNK_RESIDENT == c->state;
+
+	s->window_wanted++;
+	s->window_hits += resident ? 1 : 0;
+	if (node->child_count > 0) {
+		float dist = distance_to_box (node, cam_pos);
+		float projected = node->error * proj_scale / (dist > 1e-4f ? dist : 1e-4f);
+		if (projected > error_px) {
+			bool all_ready = true;
+			int i;
+			for (i = node->first_child; i < node->first_child + node->child_count;
+				i++) {
+				if (CHUNK_RESIDENT != s->chunks[i].state) {
+					s->window_wanted++;
+					request_chunk (s, i);
+					all_ready = false;
+				}
+			}
+			if (all_ready) {
+				for (i = node->first_child; i < node->first_child +
+					node->child_count; i++) {
+					visit (s, i, cam_pos, proj_scale, error_px);
+				}
+				// keep the coarse copy warm; it's the fallback if children go
+				if (resident) {
+					c->last_used_frame = s->frame;
+				}
+				return;
+			}
+		}
+	}
+	if (resident) {
+		draw_chunk (s, n);
+	} else {
+		request_chunk (s, n);
+	}
+}
+
+// qsort has no user pointer, so sort (frame, node) pairs instead
+typedef struct lru_entry_t {
+	long long frame;
+	int node;
+} lru_entry_t;
+
+static int compare_lru_entries (const void* a, const void* b) {
+	const lru_entry_t* x = (const lru_entry_t*)a;
+	const lru_entry_t* y = (const lru_entry_t*)b;
+	if (x->frame != y->frame) {
+		return x->frame < y->frame ? -1 : 1;
+	}
+	return x->node - y->node;
+}
+
+//
+// drop least-recently-drawn chunks until under budget. anything used this
+// frame and the root stay
+static void evict_over_budget (streamer_t* s) {
+	lru_entry_t* entries = NULL;
+	int count = 0, n, i;
+
+	if (s->resident_bytes <= s->budget_bytes) {
+		return;
+	}
+	entries = (lru_entry_t*)malloc (s->resident_nodes * sizeof (lru_entry_t) +
+		1);
+	for (n = 1; n < s->node_count; n++) {
+		if (CHUNK_RESIDENT == s->chunks[n].state &&
+			s->chunks[n].last_used_frame < s->frame) {
+			entries[count].frame = s->chunks[n].last_used_frame;
+			entries[count].node = n;
+			count++;
+		}
+	}
+	qsort (entries, count, sizeof (lru_entry_t), compare_lru_entries);
+	for (i = 0; i < count && s->resident_bytes > s->budget_bytes; i++) {
+		free_chunk (s, entries[i].node);
+	}
+	free (entries);
+}
+
+void draw_streamed (
+	streamer_t* s,
+	const float* cam_pos,
+	float proj_scale,
+	float error_px
+) {
+	double now = get_wall_time ();
+
+	s->frame++;
+	s->drawn_nodes = 0;
+	s->drawn_vertices = 0;
+	upload_finished_loads (s);
+	visit (s, 0, cam_pos, proj_scale, error_px);
+	evict_over_budget (s);
+
+	if (now - s->window_start >= 1.0) {
+		double secs = now - s->window_start;
+		s->streamed_mb_per_s = (double)s->window_bytes / (1024.0 * 1024.0) / secs;
+		s->hit_rate = s->window_wanted > 0 ?
+			(double)s->window_hits / s->window_wanted : 1.0;
+		s->window_bytes = s->window_wanted = s->window_hits = 0;
+		s->window_start = now;
+	}
+}
+
+void get_streamer_stats (streamer_t* s, streamer_stats_t* stats) {
+	stats->resident_bytes = s->resident_bytes;
+	stats->budget_bytes = s->budget_bytes;
+	stats->resident_nodes = s->resident_nodes;
+	stats->node_count = s->node_count;
+	stats->drawn_nodes = s->drawn_nodes;
+	stats->drawn_vertices = s->drawn_vertices;
+	stats->streamed_mb_per_s = s->streamed_mb_per_s;
+	stats->hit_rate = s->hit_rate;
+	stats->pending_loads = work_queue_size (s->requests) +
+		work_queue_size (s->done);
+}
@@ -0,0 +1,296 @@
+//
+// Small threading helpers for the viewer's offline/CPU-side work
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "threads.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// one range of a parallel_for
+typedef struct parallel_job_t {
+	parallel_fn fn;
+	void* user;
+	int begin;
+	int end;
+	int thread_idx;
+} parallel_job_t;
+
+struct work_queue_t {
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	void** items;
+	int capacity;
+	int head;
+	int count;
+	bool closed;
+};
+
+// one long-running worker
+typedef struct worker_t {
+	worker_fn fn;
+	void* user;
+	int idx;
+	pthread_t thread;
+} worker_t;
+
+struct worker_group_t {
+	worker_t* workers;
+	int count;
+};
+
+static void* parallel_job_main (void* arg) {
+	parallel_job_t* job = (parallel_job_t*)arg;
+	job->fn (job->begin, job->end, job->thread_idx, job->user);
+	return NULL;
+}
+
+int get_cpu_count () {
+	int n = 1;
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	n = (int)si.dwNumberOfProcessors;
+#else
+	n = (int)sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	if (n < 1) {
+		n = 1;
+	}
+	return n;
+}
+
+int resolve_thread_count (int thread_count) {
+	if (thread_count <= 0) {
+		return get_cpu_count ();
+	}
+	return thread_count;
+}
+
+void parallel_for (int count, int thread_count, parallel_fn fn, void* user) {
+	parallel_job_t* jobs = NULL;
+	pthread_t* threads = NULL;
+	bool* started = NULL;
+	int i;
+
+	if (count <= 0) {
+		return;
+	}
+	thread_count = resolve_thread_count (thread_count);
+	if (thread_count > count) {
+		thread_count = count;
+	}
+	// nothing to gain from spawning
+	if (1 == thread_count) {
+		fn (0, count, 0, user);
+		return;
+	}
+
+	jobs = (parallel_job_t*)malloc (thread_count * sizeof (parallel_job_t));
+	threads = (pthread_t*)malloc (thread_count * sizeof (pthread_t));
+	started = (bool*)malloc (thread_count * sizeof (bool));
+	for (i = 0; i < thread_count; i++) {
+		jobs[i].fn = fn;
+		jobs[i].user = user;
+		jobs[i].begin = (int)(((long long)count * i) / thread_count);
+		jobs[i].end = (int)(((long long)count * (i + 1)) / thread_count);
+		jobs[i].thread_idx = i;
+		started[i] = false;
+	}
+	for (i = 1; i < thread_count; i++) {
+		started[i] = (0 == pthread_create (&threads[i], NULL, parallel_job_main,
+			&jobs[i]));
+		// if we ran out of threads just do the work here instead
+		if (!started[i]) {
+			parallel_job_main (&jobs[i]);
+		}
+	}
+	parallel_job_main (&jobs[0]);
+	for (i = 1; i < thread_count; i++) {
+		if (started[i]) {
+			pthread_join (threads[i], NULL);
+		}
+	}
+	free (jobs);
+	free (threads);
+	free (started);
+}
+
+double get_wall_time () {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+long long get_peak_memory_bytes () {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo (GetCurrentProcess (), &pmc, sizeof (pmc))) {
+		return -1;
+	}
+	return (long long)pmc.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (0 != getrusage (RUSAGE_SELF, &usage)) {
+		return -1;
+	}
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;
+#else
+	// kilobytes on Linux
+	return (long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+work_queue_t* create_work_queue (int capacity) {
+	work_queue_t* q = (work_queue_t*)calloc (1, sizeof (work_queue_t));
+	if (capacity < 1) {
+		capacity = 1;
+	}
+	pthread_mutex_init (&q->mutex, NULL);
+	pthread_cond_init (&q->not_empty, NULL);
+	pthread_cond_init (&q->not_full, NULL);
+	q->items = (void**)malloc (capacity * sizeof (void*));
+	q->capacity = capacity;
+	return q;
+}
+
+void destroy_work_queue (work_queue_t* q) {
+	if (!q) {
+		return;
+	}
+	pthread_mutex_destroy (&q->mutex);
+	pthread_cond_destroy (&q->not_empty);
+	pthread_cond_destroy (&q->not_full);
+	free (q->items);
+	free (q);
+}
+
+// caller holds the mutex and has checked there is room
+static void queue_insert (work_queue_t* q, void* item) {
+	q->items[(q->head + q->count) % q->capacity] = item;
+	q->count++;
+	pthread_cond_signal (&q->not_empty);
+}
+
+static void* queue_remove (work_queue_t* q) {
+	void* item = q->items[q->head];
+	q->head = (q->head + 1) % q->capacity;
+	q->count--;
+	pthread_cond_signal (&q->not_full);
+	return item;
+}
+
+bool work_queue_push (work_queue_t* q, void* item) {
+	bool ok;
+	pthread_mutex_lock (&q->mutex);
+	while (q->count == q->capacity && !q->closed) {
+		pthread_cond_wait (&q->not_full, &q->mutex);
+	}
+	ok = !q->closed;
+	if (ok) {
+		queue_insert (q, item);
+	}
+	pthread_mutex_unlock (&q->mutex);
+	return ok;
+}
+
+bool work_queue_try_push (work_queue_t* q, void* item) {
+	bool ok;
+	pthread_mutex_lock (&q->mutex);
+	ok = !q->closed && q->count < q->capacity;
+	if (ok) {
+		queue_insert (q, item);
+	}
+	pthread_mutex_unlock (&q->mutex);
+	return ok;
+}
+
+bool work_queue_pop (work_queue_t* q, void** item) {
+	bool ok;
+	pthread_mutex_lock (&q->mutex);
+	while (0 == q->count && !q->closed) {
+		pthread_cond_wait (&q->not_empty, &q->mutex);
+	}
+	ok = q->count > 0;
+	if (ok) {
+		*item = queue_remove (q);
+	}
+	pthread_mutex_unlock (&q->mutex);
+	return ok;
+}
+
+bool work_queue_try_pop (work_queue_t* q, void** item) {
+	bool ok;
+	pthread_mutex_lock (&q->mutex);
+	ok = q->count > 0;
+	if (ok) {
+		*item = queue_remove (q);
+	}
+	pthread_mutex_unlock (&q->mutex);
+	return ok;
+}
+
+void work_queue_close (work_queue_t* q) {
+	pthread_mutex_lock (&q->mutex);
+	q->closed = true;
+	pthread_cond_broadcast (&q->not_empty);
+	pthread_cond_broadcast (&q->not_full);
+	pthread_mutex_unlock (&q->mutex);
+}
+
+int work_queue_size (work_queue_t* q) {
+	int n;
+	pthread_mutex_lock (&q->mutex);
+	n = q->count;
+	pthread_mutex_unlock (&q->mutex);
+	return n;
+}
+
+static void* worker_main (void* arg) {
+	worker_t* w = (worker_t*)arg;
+	w->fn (w->idx, w->user);
+	return NULL;
+}
+
+worker_group_t* start_workers (int count, worker_fn fn, void* user) {
+	worker_group_t* group = (worker_group_t*)calloc (1, sizeof (worker_group_t));
+	int i;
+
+	group->workers = (worker_t*)calloc (count, sizeof (worker_t));
+	for (i = 0; i < count; i++) {
+		worker_t* w = &group->workers[group->count];
+		w->fn = fn;
+		w->user = user;
+		w->idx = group->count;
+		if (0 != pthread_create (&w->thread, NULL, worker_main, w)) {
+			fprintf (stderr, "ERROR: could not start worker thread %i\n", i);
+			break;
+		}
+		group->count++;
+	}
+	return group;
+}
+
+void join_workers (worker_group_t* group) {
+	int i;
+	if (!group) {
+		return;
+	}
+	for (i = 0; i < group->count; i++) {
+		pthread_join (group->workers[i].thread, NULL);
+	}
+	free (group->workers);
+	free (group);
+}
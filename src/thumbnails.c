@@ -0,0 +1,291 @@
+//
+// Thumbnail images for many mesh files, in a three-stage pipeline
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "thumbnails.h"
+#include "stb_image_write.h"
+#include "threads.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// a parsed mesh on its way to the GL thread
+typedef struct thumbnail_mesh_t {
+	loaded_mesh_t* mesh;
+	float centre[3];
+	float radius;
+} thumbnail_mesh_t;
+
+//
+// a drawn image on its way to an encoder
+typedef struct thumbnail_image_t {
+	char file_name[1024];
+	unsigned char* rgb;
+} thumbnail_image_t;
+
+typedef struct thumbnail_batch_t {
+	const char** file_names;
+	int file_count;
+	const char* out_dir;
+	int size;
+	mesh_process_fn process;
+	// file indices, parsed meshes and drawn images
+	work_queue_t* todo;
+	work_queue_t* parsed;
+	work_queue_t* images;
+	// per worker, so no locking
+	double* parse_busy;
+	double* encode_busy;
+	int* encode_written;
+} thumbnail_batch_t;
+
+static void mesh_bounds (const loaded_mesh_t* mesh, float* centre,
+	float* radius) {
+	float bb_min[3] = { 0.0f, 0.0f, 0.0f }, bb_max[3] = { 0.0f, 0.0f, 0.0f };
+	float r2 = 0.0f;
+	int i, k;
+
+	for (i = 0; i < mesh->point_count; i++) {
+		const float* p = &mesh->points[i * 3];
+		for (k = 0; k < 3; k++) {
+			if (0 == i || p[k] < bb_min[k]) {
+				bb_min[k] = p[k];
+			}
+			if (0 == i || p[k] > bb_max[k]) {
+				bb_max[k] = p[k];
+			}
+		}
+	}
+	for (k = 0; k < 3; k++) {
+		centre[k] = (bb_min[k] + bb_max[k]) * 0.5f;
+	}
+	for (i = 0; i < mesh->point_count; i++) {
+		const float* p = &mesh->points[i * 3];
+		float dx = p[0] - centre[0], dy = p[1] - centre[1], dz = p[2] - centre[2];
+		float d2 = dx * dx + dy * dy + dz * dz;
+		r2 = d2 > r2 ? d2 : r2;
+	}
+	*radius = r2 > 0.0f ? sqrtf (r2) : 1.0f;
+}
+
+static void parser_main (int worker_idx, void* user) {
+	thumbnail_batch_t* batch = (thumbnail_batch_t*)user;
+	void* item = NULL;
+
+	while (work_queue_pop (batch->todo, &item)) {
+		// indices are stored +1 so that file 0 isn't a NULL item
+		int index = (int)((size_t)item - 1);
+		thumbnail_mesh_t* out = (thumbnail_mesh_t*)calloc (1,
+			sizeof (thumbnail_mesh_t));
+		double t0 = get_wall_time ();
+		loaded_mesh_t* mesh = (loaded_mesh_t*)calloc (1, sizeof (loaded_mesh_t));
+
+		mesh->index = index;
+		strncpy (mesh->file_name, batch->file_names[index],
+			sizeof (mesh->file_name) - 1);
+		mesh->ok = load_mesh_file (mesh->file_name, 1, batch->process,
+			&mesh->points, &mesh->tex_coords, &mesh->normals, &mesh->point_count);
+		mesh->ok = mesh->ok && mesh->point_count > 0;
+		if (mesh->ok) {
+			mesh_bounds (mesh, out->centre, &out->radius);
+		}
+		mesh->parse_seconds = get_wall_time () - t0;
+		batch->parse_busy[worker_idx] += mesh->parse_seconds;
+		out->mesh = mesh;
+		// blocks while the GL thread is behind
+		work_queue_push (batch->parsed, out);
+	}
+}
+
+static void encoder_main (int worker_idx, void* user) {
+	thumbnail_batch_t* batch = (thumbnail_batch_t*)user;
+	void* item = NULL;
+	int size = batch->size;
+
+	while (work_queue_pop (batch->images, &item)) {
+		thumbnail_image_t* image = (thumbnail_image_t*)item;
+		double t0 = get_wall_time ();
+		// the last row first flips glReadPixels' bottom-up rows
+		unsigned char* last_row = image->rgb + size * 3 * (size - 1);
+
+		if (stbi_write_png (image->file_name, size, size, 3, last_row,
+			-3 * size)) {
+			batch->encode_written[worker_idx]++;
+		} else {
+			fprintf (stderr, "ERROR: could not write thumbnail %s\n",
+				image->file_name);
+		}
+		batch->encode_busy[worker_idx] += get_wall_time () - t0;
+		free (image->rgb);
+		free (image);
+	}
+}
+
+//
+// out_dir/name.png for mesh file dir/name.ext
+static void thumbnail_file_name (const char* out_dir, const char* mesh_file,
+	char* out, int out_size) {
+	const char* base = mesh_file;
+	const char* s;
+	const char* dot;
+	int base_len;
+
+	for (s = mesh_file; *s; s++) {
+		if ('/' == *s || '\\' == *s) {
+			base = s + 1;
+		}
+	}
+	dot = strrchr (base, '.');
+	base_len = dot ? (int)(dot - base) : (int)strlen (base);
+	snprintf (out, out_size, "%s/%.*s.png", out_dir, base_len, base);
+}
+
+static void finish_stage (thumbnail_stage_t* stage, const double* busy,
+	int threads, double seconds) {
+	int i;
+	stage->threads = threads;
+	stage->busy_seconds = 0.0;
+	for (i = 0; i < threads; i++) {
+		stage->busy_seconds += busy[i];
+	}
+	stage->utilisation = seconds > 0.0 ? stage->busy_seconds /
+		(threads * seconds) : 0.0;
+}
+
+bool make_thumbnails (
+	const char** file_names,
+	int file_count,
+	const char* out_dir,
+	int size,
+	int parse_threads,
+	int encode_threads,
+	mesh_process_fn process,
+	thumbnail_render_fn render,
+	void* user,
+	thumbnail_stats_t* stats
+) {
+	thumbnail_batch_t batch;
+	worker_group_t* parsers;
+	worker_group_t* encoders;
+	double t0 = get_wall_time (), render_busy = 0.0;
+	int i;
+
+	memset (stats, 0, sizeof (thumbnail_stats_t));
+	stats->assets = file_count;
+	if (!make_directory (out_dir)) {
+		return false;
+	}
+	parse_threads = resolve_thread_count (parse_threads);
+	parse_threads = parse_threads < file_count ? parse_threads : file_count;
+	parse_threads = parse_threads > 0 ? parse_threads : 1;
+	encode_threads = resolve_thread_count (encode_threads);
+	memset (&batch, 0, sizeof (thumbnail_batch_t));
+	batch.file_names = file_names;
+	batch.file_count = file_count;
+	batch.out_dir = out_dir;
+	batch.size = size;
+	batch.process = process;
+	batch.todo = create_work_queue (file_count + 1);
+	batch.parsed = create_work_queue (THUMBNAIL_QUEUE_DEPTH * parse_threads);
+	batch.images = create_work_queue (THUMBNAIL_QUEUE_DEPTH * encode_threads);
+	batch.parse_busy = (double*)calloc (parse_threads, sizeof (double));
+	batch.encode_busy = (double*)calloc (encode_threads, sizeof (double));
+	batch.encode_written = (int*)calloc (encode_threads, sizeof (int));
+	for (i = 0; i < file_count; i++) {
+		work_queue_push (batch.todo, (void*)(size_t)(i + 1));
+	}
+	work_queue_close (batch.todo);
+	parsers = start_workers (parse_threads, parser_main, &batch);
+	encoders = start_workers (encode_threads, encoder_main, &batch);
+
+	// every file comes back once, loaded or not
+	for (i = 0; i < file_count; i++) {
+		thumbnail_mesh_t* parsed = NULL;
+		thumbnail_image_t* image = NULL;
+		void* item = NULL;
+		double t1;
+		int waiting;
+
+		waiting = work_queue_size (batch.parsed);
+		if (!work_queue_pop (batch.parsed, &item)) {
+			break;
+		}
+		parsed = (thumbnail_mesh_t*)item;
+		stats->parsed_queue_peak = waiting > stats->parsed_queue_peak ? waiting :
+			stats->parsed_queue_peak;
+		if (!parsed->mesh->ok) {
+			fprintf (stderr, "ERROR: could not load %s\n",
+				parsed->mesh->file_name);
+			stats->failed++;
+			free_loaded_mesh (parsed->mesh);
+			free (parsed);
+			continue;
+		}
+		t1 = get_wall_time ();
+		image = (thumbnail_image_t*)calloc (1, sizeof (thumbnail_image_t));
+		image->rgb = (unsigned char*)malloc ((size_t)size * size * 3);
+		thumbnail_file_name (out_dir, parsed->mesh->file_name, image->file_name,
+			sizeof (image->file_name));
+		if (!render (parsed->mesh, parsed->centre, parsed->radius, image->rgb,
+			user)) {
+			stats->failed++;
+			free (image->rgb);
+			free (image);
+			image = NULL;
+		}
+		render_busy += get_wall_time () - t1;
+		free_loaded_mesh (parsed->mesh);
+		free (parsed);
+		if (image) {
+			// blocks while the encoders are behind
+			work_queue_push (batch.images, image);
+			waiting = work_queue_size (batch.images);
+			stats->image_queue_peak = waiting > stats->image_queue_peak ? waiting :
+				stats->image_queue_peak;
+		}
+	}
+	work_queue_close (batch.images);
+	join_workers (encoders);
+	join_workers (parsers);
+	stats->seconds = get_wall_time () - t0;
+	stats->assets_per_second = stats->seconds > 0.0 ? file_count /
+		stats->seconds : 0.0;
+	for (i = 0; i < encode_threads; i++) {
+		stats->written += batch.encode_written[i];
+	}
+	stats->failed = file_count - stats->written;
+	finish_stage (&stats->parse, batch.parse_busy, parse_threads,
+		stats->seconds);
+	finish_stage (&stats->render, &render_busy, 1, stats->seconds);
+	finish_stage (&stats->encode, batch.encode_busy, encode_threads,
+		stats->seconds);
+	destroy_work_queue (batch.todo);
+	destroy_work_queue (batch.parsed);
+	destroy_work_queue (batch.images);
+	free (batch.parse_busy);
+	free (batch.encode_busy);
+	free (batch.encode_written);
+	return true;
+}
+
+void print_thumbnail_stats (const thumbnail_stats_t* stats) {
+	const thumbnail_stage_t* stages[3] = {
+		&stats->parse, &stats->render, &stats->encode
+	};
+	const char* names[3] = { "parse", "render", "encode" };
+	int s;
+
+	printf ("thumbnails: %i of %i written, %i failed, in %.2fs: %.1f assets/s\n",
+		stats->written, stats->assets, stats->failed, stats->seconds,
+		stats->assets_per_second);
+	printf ("  stage   threads   busy s  utilisation\n");
+	for (s = 0; s < 3; s++) {
+		printf ("  %-7s %7i %8.2f %11.1f%%\n", names[s], stages[s]->threads,
+			stages[s]->busy_seconds, stages[s]->utilisation * 100.0);
+	}
+	printf ("  queue peaks: %i parsed meshes, %i images\n",
+		stats->parsed_queue_peak, stats->image_queue_peak);
+}
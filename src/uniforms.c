@@ -0,0 +1,158 @@
+//
+// Transform matrices for the shaders, derived on the CPU and sent only when
+// they change
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "uniforms.h"
+#include <math.h>
+#include <string.h>
+
+static void identity (float* m) {
+	memset (m, 0, 16 * sizeof (float));
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+//
+// out = a * b, all column-major. out must not alias a or b
+static void multiply (const float* a, const float* b, float* out) {
+	int col, row, k;
+	for (col = 0; col < 4; col++) {
+		for (row = 0; row < 4; row++) {
+			float sum = 0.0f;
+			for (k = 0; k < 4; k++) {
+				sum += a[k * 4 + row] * b[col * 4 + k];
+			}
+			out[col * 4 + row] = sum;
+		}
+	}
+}
+
+//
+// inverse transpose of the upper 3x3 of m, which is the cofactor matrix over
+// the determinant. a singular matrix gives the plain upper 3x3
+static void normal_matrix (const float* m, float* out) {
+	// a[col][row] of the 3x3
+	float a[3][3], c[3][3], det;
+	int col, row;
+
+	for (col = 0; col < 3; col++) {
+		for (row = 0; row < 3; row++) {
+			a[col][row] = m[col * 4 + row];
+		}
+	}
+	for (col = 0; col < 3; col++) {
+		for (row = 0; row < 3; row++) {
+			int c0 = (col + 1) % 3, c1 = (col + 2) % 3;
+			int r0 = (row + 1) % 3, r1 = (row + 2) % 3;
+			c[col][row] = a[c0][r0] * a[c1][r1] - a[c1][r0] * a[c0][r1];
+		}
+	}
+	det = a[0][0] * c[0][0] + a[0][1] * c[0][1] + a[0][2] * c[0][2];
+	for (col = 0; col < 3; col++) {
+		for (row = 0; row < 3; row++) {
+			out[col * 3 + row] = fabsf (det) > 1e-20f ? c[col][row] / det :
+				a[col][row];
+		}
+	}
+}
+
+static void set_input (transforms_t* t, int input, float* dst,
+	const float* m) {
+	if (0 == memcmp (dst, m, 16 * sizeof (float))) {
+		return;
+	}
+	memcpy (dst, m, 16 * sizeof (float));
+	t->versions[input]++;
+	t->derived_stale = true;
+}
+
+void init_transforms (transforms_t* t) {
+	int i;
+	memset (t, 0, sizeof (transforms_t));
+	identity (t->M);
+	identity (t->V);
+	identity (t->P);
+	for (i = 0; i < TRANSFORM_INPUTS; i++) {
+		t->versions[i] = 1;
+	}
+	t->derived_stale = true;
+}
+
+void set_model_matrix (transforms_t* t, const float* m) {
+	set_input (t, TRANSFORM_MODEL, t->M, m);
+}
+
+void set_view_matrix (transforms_t* t, const float* m) {
+	set_input (t, TRANSFORM_VIEW, t->V, m);
+}
+
+void set_projection_matrix (transforms_t* t, const float* m) {
+	set_input (t, TRANSFORM_PROJECTION, t->P, m);
+}
+
+void init_program_uniforms (program_uniforms_t* u, GLuint program) {
+	memset (u, 0, sizeof (program_uniforms_t));
+	u->program = program;
+	u->M_loc = glGetUniformLocation (program, "M");
+	u->V_loc = glGetUniformLocation (program, "V");
+	u->P_loc = glGetUniformLocation (program, "P");
+	u->MV_loc = glGetUniformLocation (program, "MV");
+	u->MVP_loc = glGetUniformLocation (program, "MVP");
+	u->normal_matrix_loc = glGetUniformLocation (program, "normal_matrix");
+}
+
+//
+// send a matrix if the program uses it and any input it depends on is newer
+// than what the program has
+static void upload (transforms_t* t, const program_uniforms_t* u, GLint loc,
+	const float* m, bool mat3, unsigned int depends) {
+	bool stale = false;
+	int i;
+
+	if (loc < 0) {
+		return;
+	}
+	for (i = 0; i < TRANSFORM_INPUTS; i++) {
+		if ((depends & (1u << i)) && u->sent[i] != t->versions[i]) {
+			stale = true;
+		}
+	}
+	if (!stale) {
+		t->uniform_skips++;
+		return;
+	}
+	if (mat3) {
+		glUniformMatrix3fv (loc, 1, GL_FALSE, m);
+	} else {
+		glUniformMatrix4fv (loc, 1, GL_FALSE, m);
+	}
+	t->uniform_uploads++;
+}
+
+void update_derived_transforms (transforms_t* t) {
+	if (t->derived_stale) {
+		float PV[16];
+		multiply (t->V, t->M, t->MV);
+		multiply (t->P, t->V, PV);
+		multiply (PV, t->M, t->MVP);
+		normal_matrix (t->MV, t->normal_matrix);
+		t->derived_stale = false;
+		t->derived_updates++;
+	}
+}
+
+void apply_transforms (transforms_t* t, program_uniforms_t* u) {
+	const unsigned int model = 1u << TRANSFORM_MODEL;
+	const unsigned int view = 1u << TRANSFORM_VIEW;
+	const unsigned int proj = 1u << TRANSFORM_PROJECTION;
+
+	update_derived_transforms (t);
+	upload (t, u, u->M_loc, t->M, false, model);
+	upload (t, u, u->V_loc, t->V, false, view);
+	upload (t, u, u->P_loc, t->P, false, proj);
+	upload (t, u, u->MV_loc, t->MV, false, model | view);
+	upload (t, u, u->MVP_loc, t->MVP, false, model | view | proj);
+	upload (t, u, u->normal_matrix_loc, t->normal_matrix, true, model | view);
+	memcpy (u->sent, t->versions, sizeof (u->sent));
+}
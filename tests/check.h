@@ -0,0 +1,33 @@
+//
+// Minimal checks for the GL-free tests run by make test
+// Anton Gerdelan
+// antongerdelan.net
+//
+// Each test is its own program. A failed CHECK prints where and carries on,
+// and the program returns non-zero from test_result () so make stops there.
+//
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+static int check_failures = 0;
+static int check_count = 0;
+
+#define CHECK(cond) do { \
+	check_count++; \
+	if (!(cond)) { \
+		fprintf (stderr, "FAILED %s:%i: %s\n", __FILE__, __LINE__, #cond); \
+		check_failures++; \
+	} \
+} while (0)
+
+//
+// print a summary for the program and give its exit code
+static int test_result (const char* name) {
+	printf ("%s: %i/%i checks passed\n", name, check_count - check_failures,
+		check_count);
+	return check_failures > 0 ? 1 : 0;
+}
+
+#endif
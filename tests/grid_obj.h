@@ -0,0 +1,79 @@
+//
+// Writes a generated height-field grid as an .obj for the mesh tests
+// Anton Gerdelan
+// antongerdelan.net
+//
+#ifndef _GRID_OBJ_H_
+#define _GRID_OBJ_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// what write_grid_obj () puts in the file besides positions
+#define GRID_TEX_COORDS 1
+#define GRID_NORMALS 2
+// end lines with \r\n
+#define GRID_CRLF 4
+
+//
+// columns x rows quads, each as two triangles, so 2 * columns * rows
+// triangles. values have 6 decimals, which every float parser should read
+// back the same
+static bool write_grid_obj (
+	const char* file_name,
+	int columns,
+	int rows,
+	int flags
+) {
+	const char* eol = (flags & GRID_CRLF) ? "\r\n" : "\n";
+	FILE* fp = fopen (file_name, "wb");
+	int x, y;
+
+	if (!fp) {
+		fprintf (stderr, "ERROR: could not open %s for writing\n", file_name);
+		return false;
+	}
+	fprintf (fp, "# %ix%i test grid%s", columns, rows, eol);
+	for (y = 0; y <= rows; y++) {
+		for (x = 0; x <= columns; x++) {
+			float h = sinf (x * 0.37f) * cosf (y * 0.21f);
+			fprintf (fp, "v %.6f %.6f %.6f%s", x * 0.125f, h, y * -0.125f, eol);
+			if (flags & GRID_TEX_COORDS) {
+				fprintf (fp, "vt %.6f %.6f%s", (float)x / columns, (float)y / rows,
+					eol);
+			}
+			if (flags & GRID_NORMALS) {
+				fprintf (fp, "vn %.6f %.6f %.6f%s", -h * 0.3f, 0.9f, h * 0.2f, eol);
+			}
+		}
+	}
+	for (y = 0; y < rows; y++) {
+		for (x = 0; x < columns; x++) {
+			// 1-based; every attribute has the same number as the position
+			int a = y * (columns + 1) + x + 1, b = a + 1;
+			int c = a + columns + 1, d = c + 1;
+			int tri[6] = { a, b, d, a, d, c };
+			int t, k;
+			for (t = 0; t < 2; t++) {
+				fprintf (fp, "f");
+				for (k = 0; k < 3; k++) {
+					int i = tri[t * 3 + k];
+					if ((flags & GRID_TEX_COORDS) && (flags & GRID_NORMALS)) {
+						fprintf (fp, " %i/%i/%i", i, i, i);
+					} else if (flags & GRID_TEX_COORDS) {
+						fprintf (fp, " %i/%i", i, i);
+					} else if (flags & GRID_NORMALS) {
+						fprintf (fp, " %i//%i", i, i);
+					} else {
+						fprintf (fp, " %i", i);
+					}
+				}
+				fprintf (fp, "%s", eol);
+			}
+		}
+	}
+	return 0 == fclose (fp);
+}
+
+#endif
@@ -0,0 +1,179 @@
+//
+// Round-trip tests for the .cmsh compressed mesh format
+// Anton Gerdelan
+// antongerdelan.net
+//
+// The codec is lossless, so a mesh written with write_cmsh_file () and read
+// back with load_cmsh_file () must expand to exactly what expand_obj_mesh ()
+// makes from the .obj, whatever the thread counts on either side.
+//
+#include "check.h"
+#include "grid_obj.h"
+#include "mesh_codec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_OBJ_FILE "_test_mesh_codec.obj"
+#define TEST_CMSH_FILE "_test_mesh_codec.cmsh"
+#define TEST_CMSH_FILE_2 "_test_mesh_codec_2.cmsh"
+
+static unsigned char* read_file (const char* file_name, long* size) {
+	FILE* fp = fopen (file_name, "rb");
+	unsigned char* data;
+	if (!fp) {
+		return NULL;
+	}
+	fseek (fp, 0, SEEK_END);
+	*size = ftell (fp);
+	rewind (fp);
+	data = (unsigned char*)malloc (*size + 1);
+	*size = (long)fread (data, 1, *size, fp);
+	fclose (fp);
+	return data;
+}
+
+static void test_round_trip (int columns, int rows, int flags) {
+	float *ref_vp = NULL, *ref_vt = NULL, *ref_vn = NULL;
+	float *vp = NULL, *vt = NULL, *vn = NULL;
+	unsigned char *one = NULL, *two = NULL;
+	long one_size = 0, two_size = 0;
+	int ref_count = 0, count = 0, threads;
+	unsigned int want_flags = 0;
+	cmsh_mesh_t cmsh;
+	obj_mesh_t mesh;
+
+	CHECK (write_grid_obj (TEST_OBJ_FILE, columns, rows, flags));
+	CHECK (load_obj_mesh (TEST_OBJ_FILE, &mesh, 1));
+	CHECK (expand_obj_mesh (&mesh, &ref_vp, &ref_vt, &ref_vn, &ref_count, 1));
+
+	// blocks are encoded in parallel but written in order
+	CHECK (write_cmsh_file (TEST_CMSH_FILE, &mesh, 1));
+	CHECK (write_cmsh_file (TEST_CMSH_FILE_2, &mesh, 4));
+	one = read_file (TEST_CMSH_FILE, &one_size);
+	two = read_file (TEST_CMSH_FILE_2, &two_size);
+	CHECK (one && two && one_size == two_size &&
+		0 == memcmp (one, two, one_size));
+	free (one);
+	free (two);
+
+	want_flags |= (flags & GRID_TEX_COORDS) ? CMSH_HAS_TEX_COORDS : 0;
+	want_flags |= (flags & GRID_NORMALS) ? CMSH_HAS_NORMALS : 0;
+	CHECK (load_cmsh_mesh (TEST_CMSH_FILE, &cmsh, 2, NULL));
+	CHECK (cmsh.index_count == mesh.tri_count * 3);
+	CHECK (cmsh.flags == want_flags);
+	// vertices are shared within a block, never more than once per corner
+	CHECK (cmsh.vertex_count > 0 && cmsh.vertex_count <= cmsh.index_count);
+	free_cmsh_mesh (&cmsh);
+
+	for (threads = 1; threads <= 4; threads += 3) {
+		CHECK (load_cmsh_file (TEST_CMSH_FILE, &vp, &vt, &vn, &count, threads));
+		CHECK (count == ref_count);
+		if (count == ref_count) {
+			CHECK (0 == memcmp (vp, ref_vp, count * 3 * sizeof (float)));
+			CHECK (0 == memcmp (vt, ref_vt, count * 2 * sizeof (float)));
+			CHECK (0 == memcmp (vn, ref_vn, count * 3 * sizeof (float)));
+		}
+		free (vp);
+		free (vt);
+		free (vn);
+	}
+	free_obj_mesh (&mesh);
+	free (ref_vp);
+	free (ref_vt);
+	free (ref_vn);
+}
+
+static void put_u32 (unsigned char* p, unsigned int v) {
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+//
+// write data of size bytes with the u32 at offset replaced by value, and
+// check that it fails to load
+static void check_rejected (const unsigned char* data, long size,
+	long offset, unsigned int value) {
+	float *vp = NULL, *vt = NULL, *vn = NULL;
+	unsigned char* copy = (unsigned char*)malloc (size);
+	int count = 0;
+	FILE* fp = fopen (TEST_CMSH_FILE_2, "wb");
+
+	memcpy (copy, data, size);
+	put_u32 (&copy[offset], value);
+	if (fp) {
+		fwrite (copy, 1, size, fp);
+		fclose (fp);
+	}
+	CHECK (!load_cmsh_file (TEST_CMSH_FILE_2, &vp, &vt, &vn, &count, 1));
+	free (copy);
+}
+
+static void test_bad_files () {
+	// header fields, then the first directory entry
+	const long vertex_count = 8, index_count = 12, block_count = 16;
+	const long entry = 24, entry_vertices = entry, entry_indices = entry + 4;
+	const long entry_offset = entry + 8, entry_size = entry + 16;
+	float *vp = NULL, *vt = NULL, *vn = NULL;
+	unsigned char* data;
+	long size = 0;
+	int count = 0;
+	obj_mesh_t mesh;
+	FILE* fp;
+
+	CHECK (!load_cmsh_file ("_test_mesh_codec_missing.cmsh", &vp, &vt, &vn,
+		&count, 1));
+	CHECK (write_grid_obj (TEST_OBJ_FILE, 150, 70, GRID_NORMALS));
+	CHECK (load_obj_mesh (TEST_OBJ_FILE, &mesh, 1));
+	CHECK (write_cmsh_file (TEST_CMSH_FILE, &mesh, 1));
+	free_obj_mesh (&mesh);
+	data = read_file (TEST_CMSH_FILE, &size);
+	CHECK (data && size > entry + 40);
+	if (!data || size <= entry + 40) {
+		free (data);
+		return;
+	}
+
+	// counts that are negative as ints, huge, or don't add up
+	check_rejected (data, size, vertex_count, 0xffffffffu);
+	check_rejected (data, size, vertex_count, 0x7fffffffu);
+	check_rejected (data, size, index_count, 0xffffffffu);
+	check_rejected (data, size, index_count, 0x7ffffffeu);
+	check_rejected (data, size, index_count, (unsigned int)size * 3);
+	check_rejected (data, size, block_count, 0xffffffffu);
+	check_rejected (data, size, block_count, 0x10000000u);
+	check_rejected (data, size, block_count, 0);
+	check_rejected (data, size, entry_vertices, 0xffffffffu);
+	check_rejected (data, size, entry_indices, 0xfffffffdu);
+	check_rejected (data, size, entry_indices, 1);
+	// blocks outside the file or over the directory
+	check_rejected (data, size, entry_offset, 0xfffffff0u);
+	check_rejected (data, size, entry_offset + 4, 1);
+	check_rejected (data, size, entry_offset, 0);
+	check_rejected (data, size, entry_size, 0xffffffffu);
+
+	// cut off part way through the blocks
+	fp = fopen (TEST_CMSH_FILE, "wb");
+	if (fp) {
+		fwrite (data, 1, size / 2, fp);
+		fclose (fp);
+	}
+	CHECK (!load_cmsh_file (TEST_CMSH_FILE, &vp, &vt, &vn, &count, 1));
+	free (data);
+}
+
+int main () {
+	test_round_trip (3, 2, GRID_TEX_COORDS | GRID_NORMALS);
+	// more than one block of CMSH_BLOCK_TRIANGLES
+	test_round_trip (150, 70, GRID_TEX_COORDS | GRID_NORMALS);
+	// missing attributes: tex coords become 0, normals the face normal
+	test_round_trip (150, 70, 0);
+	test_round_trip (40, 30, GRID_TEX_COORDS);
+	test_round_trip (40, 30, GRID_NORMALS);
+	test_bad_files ();
+	remove (TEST_OBJ_FILE);
+	remove (TEST_CMSH_FILE);
+	remove (TEST_CMSH_FILE_2);
+	return test_result ("mesh_codec");
+}
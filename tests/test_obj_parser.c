@@ -0,0 +1,116 @@
+//
+// Tests the chunked parallel .obj parser against the original load_obj_file
+// Anton Gerdelan
+// antongerdelan.net
+//
+// load_obj_file () reads one line at a time with sscanf and only takes
+// triangles with v/vt/vn on every corner. For files like that, load_obj_mesh
+// () expanded with expand_obj_mesh () must give exactly the same arrays, with
+// any thread count and so any split of the file into chunks.
+//
+#include "check.h"
+#include "grid_obj.h"
+#include "mesh_utils.h"
+#include "obj_parser.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_OBJ_FILE "_test_obj_parser.obj"
+#define TEST_REF_FILE "_test_obj_parser_ref.obj"
+
+//
+// parse file_name with load_obj_mesh () on thread_count threads and compare
+// it with the arrays load_obj_file () made from ref_name
+static void compare_with_reference (
+	const char* file_name,
+	const char* ref_name,
+	int thread_count
+) {
+	float *ref_vp = NULL, *ref_vt = NULL, *ref_vn = NULL;
+	float *vp = NULL, *vt = NULL, *vn = NULL;
+	int ref_count = 0, count = 0;
+	obj_mesh_t mesh;
+	bool ok;
+
+	ok = load_obj_file (ref_name, &ref_vp, &ref_vt, &ref_vn, &ref_count);
+	CHECK (ok);
+	CHECK (load_obj_mesh (file_name, &mesh, thread_count));
+	CHECK (mesh.tri_count * 3 == ref_count);
+	CHECK (expand_obj_mesh (&mesh, &vp, &vt, &vn, &count, thread_count));
+	CHECK (count == ref_count);
+	if (ok && count == ref_count) {
+		CHECK (0 == memcmp (vp, ref_vp, count * 3 * sizeof (float)));
+		CHECK (0 == memcmp (vt, ref_vt, count * 2 * sizeof (float)));
+		CHECK (0 == memcmp (vn, ref_vn, count * 3 * sizeof (float)));
+	}
+	free_obj_mesh (&mesh);
+	free (vp);
+	free (vt);
+	free (vn);
+	free (ref_vp);
+	free (ref_vt);
+	free (ref_vn);
+}
+
+static void test_grids () {
+	const int threads[3] = { 1, 3, 4 };
+	int t, crlf;
+
+	for (crlf = 0; crlf < 2; crlf++) {
+		int flags = GRID_TEX_COORDS | GRID_NORMALS | (crlf ? GRID_CRLF : 0);
+		// one chunk, then big enough for several chunks per thread
+		CHECK (write_grid_obj (TEST_OBJ_FILE, 3, 2, flags));
+		for (t = 0; t < 3; t++) {
+			compare_with_reference (TEST_OBJ_FILE, TEST_OBJ_FILE, threads[t]);
+		}
+		CHECK (write_grid_obj (TEST_OBJ_FILE, 200, 100, flags));
+		for (t = 0; t < 3; t++) {
+			compare_with_reference (TEST_OBJ_FILE, TEST_OBJ_FILE, threads[t]);
+		}
+	}
+}
+
+//
+// polygons, negative indices and blank or unknown lines are beyond
+// load_obj_file (), so compare with the same mesh written the way it reads
+static void test_polygons () {
+	const char* polygons =
+		"mtllib none.mtl\n"
+		"o quad\n"
+		"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 1.5 0\n"
+		"vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvt 0.5 1\n"
+		"vn 0 0 1\n"
+		"\n"
+		"s off\n"
+		"f 1/1/1 2/2/1 3/3/1 5/5/1 4/4/1\n"
+		"f -4/-4/-1 -2/-2/-1 -1/-1/-1";
+	const char* triangles =
+		"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 1.5 0\n"
+		"vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvt 0.5 1\n"
+		"vn 0 0 1\n"
+		"f 1/1/1 2/2/1 3/3/1\n"
+		"f 1/1/1 3/3/1 5/5/1\n"
+		"f 1/1/1 5/5/1 4/4/1\n"
+		"f 2/2/1 4/4/1 5/5/1\n";
+	FILE* fp = fopen (TEST_OBJ_FILE, "wb");
+	if (fp) {
+		fputs (polygons, fp);
+		fclose (fp);
+	}
+	fp = fopen (TEST_REF_FILE, "wb");
+	if (fp) {
+		fputs (triangles, fp);
+		fclose (fp);
+	}
+	compare_with_reference (TEST_OBJ_FILE, TEST_REF_FILE, 1);
+}
+
+int main () {
+	test_grids ();
+	test_polygons ();
+	// as exported from Blender, when run from the repository root
+	compare_with_reference ("cube.obj", "cube.obj", 2);
+	remove (TEST_OBJ_FILE);
+	remove (TEST_REF_FILE);
+	return test_result ("obj_parser");
+}
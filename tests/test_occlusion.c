@@ -0,0 +1,135 @@
+//
+// Tests for the software hierarchical-Z occlusion culling
+// Anton Gerdelan
+// antongerdelan.net
+//
+#include "check.h"
+#include "occlusion.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// column-major perspective projection looking down -z from the origin, so
+// with identity view and model matrices this is the whole clip matrix
+static void perspective (float fovy_deg, float aspect, float near, float far,
+	float* m) {
+	float f = 1.0f / tanf (fovy_deg * 0.5f * 3.14159265f / 180.0f);
+	memset (m, 0, 16 * sizeof (float));
+	m[0] = f / aspect;
+	m[5] = f;
+	m[10] = (far + near) / (near - far);
+	m[11] = -1.0f;
+	m[14] = 2.0f * far * near / (near - far);
+}
+
+//
+// two triangles making a square facing the camera at depth z
+static void square (float half, float z, float* points) {
+	const float corners[6][2] = {
+		{ -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, -1 }, { 1, 1 }, { -1, 1 }
+	};
+	int i;
+	for (i = 0; i < 6; i++) {
+		points[i * 3] = corners[i][0] * half;
+		points[i * 3 + 1] = corners[i][1] * half;
+		points[i * 3 + 2] = z;
+	}
+}
+
+static bool hidden (const occlusion_t* occ, float x0, float y0, float z0,
+	float x1, float y1, float z1) {
+	float bb_min[3] = { x0, y0, z0 };
+	float bb_max[3] = { x1, y1, z1 };
+	return test_occlusion_box (occ, bb_min, bb_max);
+}
+
+static void test_known_occluder () {
+	occlusion_t occ;
+	float clip[16], points[18];
+
+	perspective (67.0f, 1.0f, 0.1f, 100.0f, clip);
+	create_occlusion (&occ, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, 1);
+	// a wall at z = -5 wider than the view
+	square (10.0f, -5.0f, points);
+	select_occluders (&occ, points, 3, 6, OCCLUSION_OCCLUDER_TRIANGLES);
+	render_occluders (&occ, clip);
+	CHECK (2 == occ.triangles_drawn);
+
+	// behind the wall
+	CHECK (hidden (&occ, -1, -1, -12, 1, 1, -10));
+	CHECK (hidden (&occ, -2, -2, -6, 2, 2, -5.5f));
+	// in front of the wall, and straddling it
+	CHECK (!hidden (&occ, -1, -1, -4, 1, 1, -3));
+	CHECK (!hidden (&occ, -1, -1, -6, 1, 1, -4.5f));
+	// behind the wall but off screen, wholly or in part
+	CHECK (!hidden (&occ, 30, -1, -12, 32, 1, -10));
+	CHECK (!hidden (&occ, 2, -1, -12, 20, 1, -10));
+	CHECK (!hidden (&occ, -1, -40, -12, 1, -30, -10));
+	// crossing the near plane, around the eye, and behind it
+	CHECK (!hidden (&occ, -1, -1, -2, 1, 1, -0.05f));
+	CHECK (!hidden (&occ, -1, -1, -2, 1, 1, 0.5f));
+	CHECK (!hidden (&occ, -1, -1, 1, 1, 1, 2));
+	free_occlusion (&occ);
+
+	// a wall narrower than the box behind it
+	create_occlusion (&occ, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, 1);
+	square (1.0f, -5.0f, points);
+	select_occluders (&occ, points, 3, 6, OCCLUSION_OCCLUDER_TRIANGLES);
+	render_occluders (&occ, clip);
+	CHECK (hidden (&occ, -0.5f, -0.5f, -12, 0.5f, 0.5f, -10));
+	CHECK (!hidden (&occ, -3, -0.5f, -12, 3, 0.5f, -10));
+	free_occlusion (&occ);
+
+	// nothing drawn hides nothing
+	create_occlusion (&occ, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, 1);
+	render_occluders (&occ, clip);
+	CHECK (!hidden (&occ, -1, -1, -12, 1, 1, -10));
+	free_occlusion (&occ);
+}
+
+//
+// rows are split between threads, so the depth pyramid must come out the
+// same whatever the thread count
+static void test_thread_counts () {
+	const int tri_count = 500, thread_counts[3] = { 1, 3, 4 };
+	occlusion_t occ[3];
+	float clip[16];
+	float* points = (float*)malloc (tri_count * 9 * sizeof (float));
+	unsigned int seed = 12345;
+	int i, t, l;
+
+	perspective (67.0f, 16.0f / 9.0f, 0.1f, 100.0f, clip);
+	// random triangles, some of them crossing the near plane or off screen
+	for (i = 0; i < tri_count * 9; i++) {
+		float r;
+		seed = seed * 1664525u + 1013904223u;
+		r = (float)(seed >> 8) / (float)(1 << 24);
+		points[i] = i % 3 == 2 ? 1.0f - r * 30.0f : r * 20.0f - 10.0f;
+	}
+	for (t = 0; t < 3; t++) {
+		create_occlusion (&occ[t], 320, 180, thread_counts[t]);
+		select_occluders (&occ[t], points, 3, tri_count * 3, tri_count);
+		render_occluders (&occ[t], clip);
+	}
+	for (t = 1; t < 3; t++) {
+		CHECK (occ[t].level_count == occ[0].level_count);
+		CHECK (occ[t].triangles_drawn == occ[0].triangles_drawn);
+		for (l = 0; l < occ[0].level_count; l++) {
+			CHECK (0 == memcmp (occ[t].levels[l], occ[0].levels[l],
+				occ[0].level_width[l] * occ[0].level_height[l] * sizeof (float)));
+		}
+	}
+	// and the drawing isn't trivially empty
+	CHECK (occ[0].triangles_drawn > 0 && occ[0].levels[0][90 * 320 + 160] < 1.0f);
+	for (t = 0; t < 3; t++) {
+		free_occlusion (&occ[t]);
+	}
+	free (points);
+}
+
+int main () {
+	test_known_occluder ();
+	test_thread_counts ();
+	return test_result ("occlusion");
+}
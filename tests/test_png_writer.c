@@ -0,0 +1,220 @@
+//
+// Round-trip tests for the band-parallel PNG writer
+// Anton Gerdelan
+// antongerdelan.net
+//
+// Images are written with every filter and several levels, then read back
+// with stb_image, whose inflate shares no code with the deflate in
+// png_writer.c. stb_image skips the chunk CRCs and the Adler-32, so those
+// are checked here.
+//
+#include "check.h"
+#include "png_writer.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_PNG_FILE "_test_png_writer.png"
+
+static unsigned int crc32 (const unsigned char* data, size_t len) {
+	unsigned int crc = 0xffffffffu;
+	size_t i;
+	int k;
+	for (i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (k = 0; k < 8; k++) {
+			crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+		}
+	}
+	return crc ^ 0xffffffffu;
+}
+
+static unsigned int adler32 (const unsigned char* data, size_t len) {
+	unsigned int a = 1, b = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		a = (a + data[i]) % 65521u;
+		b = (b + a) % 65521u;
+	}
+	return (b << 16) | a;
+}
+
+static unsigned int read_u32 (const unsigned char* p) {
+	return (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 |
+		(unsigned int)p[2] << 8 | (unsigned int)p[3];
+}
+
+static unsigned char* read_file (const char* file_name, size_t* size) {
+	FILE* fp = fopen (file_name, "rb");
+	unsigned char* data;
+	long len;
+	if (!fp) {
+		return NULL;
+	}
+	fseek (fp, 0, SEEK_END);
+	len = ftell (fp);
+	rewind (fp);
+	data = (unsigned char*)malloc (len + 1);
+	*size = fread (data, 1, len, fp);
+	fclose (fp);
+	return data;
+}
+
+//
+// walk the chunks checking their CRCs, then inflate the joined IDAT data and
+// check its size and Adler-32
+static bool check_png_stream (const unsigned char* png, size_t size,
+	int width, int height, int channels) {
+	unsigned char* idat = (unsigned char*)malloc (size);
+	size_t pos = 8, idat_len = 0;
+	char* raw;
+	int raw_len = 0;
+	bool ok = size > 8 && 0 == memcmp (png, "\x89PNG\r\n\x1a\n", 8);
+
+	while (ok && pos + 12 <= size) {
+		unsigned int len = read_u32 (&png[pos]);
+		if (pos + 12 + len > size ||
+			crc32 (&png[pos + 4], len + 4) != read_u32 (&png[pos + 8 + len])) {
+			ok = false;
+			break;
+		}
+		if (0 == memcmp (&png[pos + 4], "IDAT", 4)) {
+			memcpy (&idat[idat_len], &png[pos + 8], len);
+			idat_len += len;
+		}
+		pos += 12 + len;
+	}
+	ok = ok && pos == size && idat_len > 6;
+	if (ok) {
+		raw = stbi_zlib_decode_malloc ((const char*)idat, (int)idat_len, &raw_len);
+		ok = raw && raw_len == height * (1 + width * channels) &&
+			adler32 ((const unsigned char*)raw, raw_len) ==
+			read_u32 (&idat[idat_len - 4]);
+		free (raw);
+	}
+	free (idat);
+	return ok;
+}
+
+//
+// gradients, noise and flat runs, so that matches, literals and stored
+// blocks all turn up
+static unsigned char* make_image (int width, int height, int channels,
+	unsigned int seed) {
+	unsigned char* pixels = (unsigned char*)malloc (width * height * channels);
+	int x, y, c;
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			for (c = 0; c < channels; c++) {
+				unsigned char v;
+				seed = seed * 1664525u + 1013904223u;
+				if (y < height / 3) {
+					v = (unsigned char)(x * 3 + y + c * 50);
+				} else if (y < 2 * height / 3) {
+					v = (unsigned char)(seed >> 24);
+				} else {
+					v = (unsigned char)((x / 16) * 40 + c);
+				}
+				pixels[(y * width + x) * channels + c] = v;
+			}
+		}
+	}
+	return pixels;
+}
+
+static void test_round_trip (int width, int height, int channels) {
+	const int levels[4] = { 0, 1, 6, 9 };
+	unsigned char* pixels = make_image (width, height, channels, width * 7 +
+		height);
+	png_settings_t settings;
+	int filter, l;
+
+	default_png_settings (&settings);
+	for (filter = 0; filter < PNG_FILTERS; filter++) {
+		for (l = 0; l < 4; l++) {
+			unsigned char* one = NULL;
+			unsigned char* decoded;
+			size_t one_size = 0, size = 0;
+			int w = 0, h = 0, n = 0, threads;
+
+			settings.filter = filter;
+			settings.level = levels[l];
+			for (threads = 1; threads <= 4; threads += 3) {
+				unsigned char* png;
+				settings.thread_count = threads;
+				CHECK (write_png (TEST_PNG_FILE, width, height, channels, pixels,
+					width * channels, &settings));
+				png = read_file (TEST_PNG_FILE, &size);
+				CHECK (png && check_png_stream (png, size, width, height,
+					channels));
+				// bands are cut by size, not by thread count
+				if (!one) {
+					one = png;
+					one_size = size;
+				} else {
+					CHECK (size == one_size && 0 == memcmp (png, one, size));
+					free (png);
+				}
+			}
+			decoded = stbi_load (TEST_PNG_FILE, &w, &h, &n, channels);
+			CHECK (decoded && w == width && h == height && n == channels);
+			CHECK (decoded && 0 == memcmp (decoded, pixels, width * height *
+				channels));
+			stbi_image_free (decoded);
+			free (one);
+		}
+	}
+	free (pixels);
+}
+
+//
+// rows given a few at a time, bottom-up with a negative stride, must make the
+// same file as the whole image at once
+static void test_strips () {
+	const int width = 211, height = 157, channels = 3, strip = 10;
+	unsigned char* pixels = make_image (width, height, channels, 99);
+	unsigned char* flipped = (unsigned char*)malloc (width * height * channels);
+	unsigned char* whole;
+	unsigned char* strips;
+	size_t whole_size = 0, strips_size = 0;
+	png_settings_t settings;
+	png_writer_t* pw;
+	int y;
+
+	default_png_settings (&settings);
+	CHECK (write_png (TEST_PNG_FILE, width, height, channels, pixels,
+		width * channels, &settings));
+	whole = read_file (TEST_PNG_FILE, &whole_size);
+	for (y = 0; y < height; y++) {
+		memcpy (&flipped[(height - 1 - y) * width * channels],
+			&pixels[y * width * channels], width * channels);
+	}
+	pw = open_png_writer (TEST_PNG_FILE, width, height, channels, &settings);
+	CHECK (pw != NULL);
+	for (y = 0; pw && y < height; y += strip) {
+		int rows = height - y < strip ? height - y : strip;
+		CHECK (write_png_rows (pw, &flipped[(height - 1 - y) * width * channels],
+			rows, -width * channels));
+	}
+	CHECK (pw && close_png_writer (pw));
+	strips = read_file (TEST_PNG_FILE, &strips_size);
+	CHECK (whole && strips && whole_size == strips_size &&
+		0 == memcmp (whole, strips, whole_size));
+	free (whole);
+	free (strips);
+	free (flipped);
+	free (pixels);
+}
+
+int main () {
+	test_round_trip (1, 1, 3);
+	test_round_trip (7, 5, 1);
+	test_round_trip (33, 20, 2);
+	test_round_trip (300, 200, 3);
+	// several bands
+	test_round_trip (640, 480, 4);
+	test_strips ();
+	remove (TEST_PNG_FILE);
+	return test_result ("png_writer");
+}